@@ -0,0 +1,78 @@
+
+#ifndef __REPO_BENCH_H__
+#define __REPO_BENCH_H__ 1
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/time.h>
+#include <repo.h>
+
+/**
+ * Helpers shared by the benchmarks run from `make bench`.
+ * Each benchmark prints one JSON object per line; `variant`
+ * is `cold` when the page cache was dropped for the workload
+ * first and `warm` otherwise.
+ */
+
+static double
+bench_now_ms () {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+
+static int
+bench_evict_file (const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+  int fd;
+
+  if (FTW_F != flag || -1 == (fd = open(path, O_RDONLY)))
+    return 0;
+
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+  return 0;
+}
+
+/**
+ * Drops cached pages for everything under `root`. Uses
+ * `drop_caches` when running as root, otherwise advises the
+ * kernel file by file, which leaves dentries and inodes cached.
+ * Returns the method used.
+ */
+
+static const char *
+bench_evict (const char *root) {
+  int fd;
+
+  sync();
+
+  if (-1 != (fd = open("/proc/sys/vm/drop_caches", O_WRONLY))) {
+    bool dropped = 2 == write(fd, "3\n", 2);
+    close(fd);
+    if (dropped) return "drop_caches";
+  }
+
+  nftw(root, bench_evict_file, 64, FTW_PHYS);
+  return "fadvise";
+}
+
+
+static int
+bench_rm_file (const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+  return remove(path);
+}
+
+
+static int
+bench_rmrf (const char *path) {
+  return nftw(path, bench_rm_file, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+
+static bool
+bench_is_cold (int argc, char *argv[], int n) {
+  return argc > n && 0 == strcmp(argv[n], "cold");
+}
+
+#endif
@@ -0,0 +1,139 @@
+
+#include <assert.h>
+#include "bench.h"
+
+/**
+ * Clones repositories of a generated root from `file://` remotes
+ * with each progress consumer, to isolate what progress reporting
+ * costs on top of the clone itself:
+ *
+ *   none       no progress callback
+ *   callback   a callback that only counts
+ *   throttled  `repo_clone_throttle()` feeding a JSON emitter
+ *   terminal   the `repo clone` progress bar
+ *
+ * usage: bench-clone <root> [cold|warm] [clones]
+ */
+
+typedef struct clone_counter {
+  repo_clone_throttle_t throttle;
+  repo_emitter_t *emitter;
+  size_t calls;
+  size_t emitted;
+} clone_counter_t;
+
+static const char *modes[] = { "none", "callback", "throttled", "terminal" };
+
+
+static void
+on_count (const repo_clone_progress_t *progress, void *data) {
+  ((clone_counter_t *) data)->calls++;
+}
+
+
+static void
+on_throttled (const repo_clone_progress_t *progress, void *data) {
+  clone_counter_t *counter = (clone_counter_t *) data;
+  counter->calls++;
+
+  if (!repo_clone_throttle(&counter->throttle, progress))
+    return;
+
+  counter->emitted++;
+  repo_emitter_begin(counter->emitter);
+  repo_emitter_int(counter->emitter, "received", progress->received);
+  repo_emitter_int(counter->emitter, "total", progress->total);
+  repo_emitter_int(counter->emitter, "checkoutCurrent", progress->checkout_current);
+  repo_emitter_end(counter->emitter);
+  repo_emitter_flush(counter->emitter);
+}
+
+
+int
+main (int argc, char *argv[]) {
+  bool cold = bench_is_cold(argc, argv, 2);
+  int limit = argc > 3 ? atoi(argv[3]) : 10;
+  char dest_root[] = "/tmp/repo-bench-clone-XXXXXX";
+  char url[REPO_PATH_MAX + 8], name[64];
+  double ms[4] = { 0, 0, 0, 0 };
+  const char *evict = NULL;
+  clone_counter_t counter;
+  repo_dir_t *dir;
+  repo_t dest;
+  int clones = 0, failed = 0, devnull, out;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: bench-clone <root> [cold|warm] [clones]\n");
+    return 1;
+  }
+
+  git_threads_init();
+  assert((dir = repo_dir_new(argv[1])));
+  assert(mkdtemp(dest_root));
+  dest.path = dest_root;
+
+  devnull = open("/dev/null", O_WRONLY);
+  out = dup(STDOUT_FILENO);
+  assert(-1 != devnull && -1 != out);
+
+  memset(&counter, 0, sizeof(counter));
+  counter.throttle.interval_ms = 100;
+  counter.emitter = repo_emitter_new(REPO_OUTPUT_NDJSON, devnull);
+  assert(counter.emitter);
+
+  for (int i = 0; i < dir->length && clones < limit; ++i) {
+    repo_dir_item_t *item = &dir->items[i];
+
+    // bare and unborn sources have nothing to check out
+    if (!repo_dir_item_is_git_repo(item)
+        || repo_dir_item_is_bare(item)
+        || repo_dir_item_is_orphan(item))
+      continue;
+
+    snprintf(url, sizeof(url), "file://%s", item->path);
+
+    for (int mode = 0; mode < 4; ++mode) {
+      repo_clone_opts_t opts = { mode == 1 ? on_count : on_throttled, &counter };
+      double start;
+      int error;
+
+      snprintf(name, sizeof(name), "%s-%d", item->name, mode);
+      if (cold) evict = bench_evict(item->path);
+
+      start = bench_now_ms();
+      if (3 == mode) {
+        // the bar draws on stdout
+        fflush(stdout);
+        dup2(devnull, STDOUT_FILENO);
+        error = repo_clone(&dest, url, name);
+        fflush(stdout);
+        dup2(out, STDOUT_FILENO);
+      } else {
+        error = repo_clone_with(&dest, url, name, 0 == mode ? NULL : &opts);
+      }
+      ms[mode] += bench_now_ms() - start;
+
+      if (0 != error) failed++;
+    }
+
+    clones++;
+  }
+
+  printf("{\"bench\":\"clone\",\"variant\":\"%s\",\"evict\":%s%s%s,\"clones\":%d,\"failed\":%d"
+    , cold ? "cold" : "warm"
+    , evict ? "\"" : "", evict ? evict : "null", evict ? "\"" : ""
+    , clones, failed);
+
+  for (int mode = 0; mode < 4; ++mode) {
+    printf(",\"%s_ms\":%.3f", modes[mode], clones ? ms[mode] / clones : 0);
+  }
+
+  printf(",\"progress_calls\":%zu,\"progress_emitted\":%zu}\n"
+    , counter.calls, counter.emitted);
+
+  repo_emitter_free(counter.emitter);
+  repo_dir_free(dir);
+  bench_rmrf(dest_root);
+  git_threads_shutdown();
+  return 0;
+}
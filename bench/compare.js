@@ -0,0 +1,84 @@
+
+/**
+ * Compares benchmark results against a stored baseline, both as
+ * newline delimited JSON with one record per benchmark run.
+ * Records are matched by `bench` and `variant`; numeric fields
+ * ending in `_ms` are lower-is-better and fields ending in `_mb_s`
+ * higher-is-better. Exits non-zero if any of them moved the wrong
+ * way by more than `BENCH_THRESHOLD` percent (10 by default).
+ *
+ * usage: node bench/compare.js <results> <baseline>
+ */
+
+var fs = require('fs');
+
+var threshold = parseFloat(process.env.BENCH_THRESHOLD || '10')
+  , resultsFile = process.argv[2]
+  , baselineFile = process.argv[3];
+
+if (!resultsFile || !baselineFile) {
+  console.error('usage: node bench/compare.js <results> <baseline>');
+  process.exit(1);
+}
+
+// nested objects flatten to dotted keys, `scanners.avx2.mb_s`
+function flatten (record, prefix, out) {
+  Object.keys(record).forEach(function (key) {
+    var value = record[key]
+      , name = prefix ? prefix + '.' + key : key;
+
+    if (value && 'object' === typeof value) flatten(value, name, out);
+    else if ('number' === typeof value) out[name] = value;
+  });
+  return out;
+}
+
+function load (file) {
+  var records = {};
+
+  fs.readFileSync(file, 'utf8').split('\n').forEach(function (line) {
+    if (!line.trim()) return;
+    var record = JSON.parse(line);
+    records[record.bench + (record.variant ? ':' + record.variant : '')] = flatten(record, '', {});
+  });
+
+  return records;
+}
+
+if (!fs.existsSync(baselineFile)) {
+  console.log('no baseline at ' + baselineFile + ', run `make bench-baseline` to store one');
+  process.exit(0);
+}
+
+var results = load(resultsFile)
+  , baseline = load(baselineFile)
+  , regressions = 0;
+
+Object.keys(results).forEach(function (key) {
+  var now = results[key]
+    , then = baseline[key];
+
+  if (!then) return console.log(key + ': no baseline');
+
+  Object.keys(now).forEach(function (field) {
+    var lower = /(^|[._])ms$/.test(field)
+      , higher = /(^|[._])mb_s$/.test(field)
+      , change;
+
+    if ((!lower && !higher) || !(field in then) || 0 === then[field]) return;
+
+    change = (now[field] - then[field]) / then[field] * 100;
+    if (higher) change = -change;
+
+    if (change > threshold) {
+      regressions++;
+      console.log('REGRESSION ' + key + ' ' + field + ': '
+        + then[field] + ' -> ' + now[field] + ' (' + change.toFixed(1) + '% worse)');
+    }
+  });
+});
+
+console.log(regressions
+  ? regressions + ' regression(s) over ' + threshold + '%'
+  : 'no regressions over ' + threshold + '%');
+process.exit(regressions ? 1 : 0);
@@ -0,0 +1,71 @@
+
+/**
+ * Runs 50 concurrent clones of a generated local repository
+ * while consuming every clone's progress iterator, like a
+ * dashboard would, and reports event loop delay and how many
+ * snapshots actually reached JavaScript.
+ *
+ * usage: node bench/dashboard.js [clones] [commits] [rate]
+ */
+
+var fs = require('fs')
+  , os = require('os')
+  , path = require('path')
+  , execFileSync = require('child_process').execFileSync
+  , perf = require('perf_hooks')
+  , repo = require('../');
+
+var clones = parseInt(process.argv[2], 10) || 50
+  , commits = parseInt(process.argv[3], 10) || 2000
+  , rate = parseInt(process.argv[4], 10) || 10
+  , root = fs.mkdtempSync(path.join(os.tmpdir(), 'repo-dashboard-'))
+  , source = path.join(root, 'source');
+
+function git (args) {
+  execFileSync('git', ['-C', source].concat(args), { stdio: 'ignore' });
+}
+
+fs.mkdirSync(source);
+git(['init', '--quiet']);
+for (var i = 0; i < commits; ++i) {
+  fs.writeFileSync(path.join(source, 'file-' + (i % 200)), 'revision ' + i + '\n');
+  if (0 === i % 50 || i === commits - 1) {
+    git(['add', '-A']);
+    git(['-c', 'user.name=bench', '-c', 'user.email=bench@example.com', 'commit', '--quiet', '-m', 'r' + i]);
+  }
+}
+
+var histogram = perf.monitorEventLoopDelay({ resolution: 1 })
+  , snapshots = 0
+  , start = process.hrtime.bigint();
+
+function consume (n) {
+  var clone = repo.cloneProgress(source, path.join(root, 'clone-' + n), { rate: rate });
+  return (async function () {
+    for await (var progress of clone) {
+      if (progress) snapshots++;
+    }
+    return clone.result;
+  })();
+}
+
+histogram.enable();
+
+var jobs = [];
+for (var n = 0; n < clones; ++n) jobs.push(consume(n));
+
+Promise.allSettled(jobs).then(function (results) {
+  histogram.disable();
+  console.log(JSON.stringify({
+    bench: 'dashboard',
+    clones: clones,
+    rate: rate,
+    ok: results.filter(function (r) { return 'fulfilled' === r.status; }).length,
+    ms: Number(process.hrtime.bigint() - start) / 1e6,
+    snapshots: snapshots,
+    lag_p50_ms: histogram.percentile(50) / 1e6,
+    lag_p99_ms: histogram.percentile(99) / 1e6,
+    lag_max_ms: histogram.max / 1e6
+  }));
+  fs.rmSync(root, { recursive: true, force: true });
+});
@@ -0,0 +1,71 @@
+
+#include <assert.h>
+#include "bench.h"
+
+/**
+ * Measures reading a repos root: `repo_dir_new()` plus the
+ * `.git` probe of every entry, and a full `repo_dir_ls()` with
+ * its output discarded.
+ *
+ * usage: bench-dir <root> [cold|warm] [rounds]
+ */
+
+int
+main (int argc, char *argv[]) {
+  bool cold = bench_is_cold(argc, argv, 2);
+  int rounds = argc > 3 ? atoi(argv[3]) : 5;
+  const char *evict = NULL;
+  double dir_ms = 0, ls_ms = 0, start;
+  int entries = 0, repos = 0, devnull, out;
+  repo_ls_opts_t opts;
+  repo_t repo;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: bench-dir <root> [cold|warm] [rounds]\n");
+    return 1;
+  }
+
+  git_threads_init();
+  repo.path = argv[1];
+  memset(&opts, 0, sizeof(opts));
+  opts.output = REPO_OUTPUT_TEXT;
+
+  devnull = open("/dev/null", O_WRONLY);
+  out = dup(STDOUT_FILENO);
+  assert(-1 != devnull && -1 != out);
+
+  for (int round = 0; round < rounds; ++round) {
+    repo_dir_t *dir;
+
+    if (cold) evict = bench_evict(repo.path);
+
+    start = bench_now_ms();
+    assert((dir = repo_dir_new(repo.path)));
+    repos = 0;
+    for (int i = 0; i < dir->length; ++i) {
+      if (repo_dir_item_is_git_repo(&dir->items[i])) repos++;
+    }
+    dir_ms += bench_now_ms() - start;
+    entries = dir->length;
+    repo_dir_free(dir);
+
+    if (cold) evict = bench_evict(repo.path);
+
+    fflush(stdout);
+    dup2(devnull, STDOUT_FILENO);
+    start = bench_now_ms();
+    repo_dir_ls(&repo, &opts);
+    fflush(stdout);
+    ls_ms += bench_now_ms() - start;
+    dup2(out, STDOUT_FILENO);
+  }
+
+  printf("{\"bench\":\"dir\",\"variant\":\"%s\",\"evict\":%s%s%s,\"entries\":%d,\"repos\":%d"
+    ",\"rounds\":%d,\"dir_new_ms\":%.3f,\"ls_ms\":%.3f}\n"
+    , cold ? "cold" : "warm"
+    , evict ? "\"" : "", evict ? evict : "null", evict ? "\"" : ""
+    , entries, repos, rounds, dir_ms / rounds, ls_ms / rounds);
+
+  git_threads_shutdown();
+  return 0;
+}
@@ -0,0 +1,75 @@
+
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <repo.h>
+
+/**
+ * Measures `repo ls --format` output throughput on synthetic
+ * items against writing the same bytes pre-rendered, which is
+ * the floor set by `cat` of the output.
+ *
+ * usage: bench-format [count] [template]
+ */
+
+static double
+now_ms () {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+
+int
+main (int argc, char *argv[]) {
+  int count = argc > 1 ? atoi(argv[1]) : 100000;
+  const char *template = argc > 2 ? argv[2] : "%(name)\\t%(branch)\\t%(path)";
+  repo_dir_item_t *items = calloc(count, sizeof(repo_dir_item_t));
+  repo_buf_t *rendered = repo_buf_new(-1), *out;
+  repo_format_t *format;
+  char error[256];
+  double start, format_ms, raw_ms;
+  int fd = open("/dev/null", O_WRONLY);
+
+  assert(items && rendered && -1 != fd);
+
+  if (!(format = repo_format_compile(template, error, sizeof(error)))) {
+    fprintf(stderr, "bench-format: %s\n", error);
+    return 1;
+  }
+
+  for (int i = 0; i < count; ++i) {
+    repo_dir_item_t *item = &items[i];
+    item->name = malloc(32);
+    item->path = malloc(64);
+    sprintf(item->name, "svc-%06d", i);
+    sprintf(item->path, "/home/user/repos/svc-%06d", i);
+    item->ino = i;
+    item->git_branch = i % 3 ? "main" : "feature/bench";
+    item->is_git_repo = true;
+    item->loaded = REPO_ITEM_GIT | REPO_ITEM_OPEN;
+    repo_format_write(format, item, rendered);
+  }
+
+  start = now_ms();
+  out = repo_buf_new(fd);
+  for (int i = 0; i < count; ++i) {
+    repo_format_write(format, &items[i], out);
+  }
+  repo_buf_free(out);
+  format_ms = now_ms() - start;
+
+  start = now_ms();
+  for (size_t off = 0; off < rendered->length; off += REPO_BUF_FLUSH_SIZE) {
+    size_t n = rendered->length - off;
+    write(fd, rendered->data + off, n < REPO_BUF_FLUSH_SIZE ? n : REPO_BUF_FLUSH_SIZE);
+  }
+  raw_ms = now_ms() - start;
+
+  printf("{\"bench\":\"format\",\"entries\":%d,\"bytes\":%zu,\"format_ms\":%.3f,\"raw_ms\":%.3f,\"format_mb_s\":%.1f}\n"
+    , count, rendered->length, format_ms, raw_ms
+    , rendered->length / 1048576.0 / (format_ms / 1000.0));
+
+  repo_format_free(format);
+  return 0;
+}
@@ -0,0 +1,102 @@
+#!/bin/sh
+
+##
+# Builds a synthetic repos root offline for `make bench`.
+#
+# usage: bench/generate.sh [-n repos] [-d depth] [-f files] [-l] <root>
+#
+#   -n  number of repositories (100)
+#   -d  commits of history per repository (20)
+#   -f  files per repository (50)
+#   -l  leave objects loose instead of packed
+#
+# Every 7th repository has a detached HEAD, every 11th an unborn
+# one and every 13th is bare. History is written with
+# `git fast-import`, so generation stays fast at large depths.
+# An existing root built with the same parameters is reused.
+##
+
+repos=100
+depth=20
+files=50
+loose=0
+
+while getopts "n:d:f:l" opt; do
+  case "$opt" in
+    n) repos="$OPTARG" ;;
+    d) depth="$OPTARG" ;;
+    f) files="$OPTARG" ;;
+    l) loose=1 ;;
+    *) echo "usage: $0 [-n repos] [-d depth] [-f files] [-l] <root>" >&2; exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+root="$1"
+stamp="repos=$repos depth=$depth files=$files loose=$loose"
+
+if [ -z "$root" ]; then
+  echo "usage: $0 [-n repos] [-d depth] [-f files] [-l] <root>" >&2
+  exit 1
+fi
+
+if [ -f "$root/.bench" ] && [ "$(cat "$root/.bench")" = "$stamp" ]; then
+  exit 0
+fi
+
+set -e
+rm -rf "$root"
+mkdir -p "$root"
+
+history () {
+  awk -v depth="$depth" -v files="$files" -v seed="$1" 'BEGIN {
+    srand(seed)
+    for (c = 1; c <= depth; c++) {
+      printf "commit refs/heads/master\n"
+      printf "committer Bench <bench@example.com> %d +0000\n", 1500000000 + c * 3600
+      printf "data <<EOT\nrevision %d\nEOT\n", c
+      n = (1 == c) ? files : (files < 5 ? files : 5)
+      for (j = 0; j < n; j++) {
+        f = (1 == c) ? j : int(rand() * files)
+        printf "M 100644 inline src/file-%04d.txt\n", f
+        printf "data <<EOT\nfile %d revision %d\n%s\nEOT\n", f, c, sprintf("%0*d", 64 + (c * f) % 512, c)
+      }
+      printf "\n"
+    }
+  }'
+}
+
+i=0
+while [ "$i" -lt "$repos" ]; do
+  dir="$root/svc-$(printf '%05d' "$i")"
+
+  if [ 0 -eq $((i % 13)) ] && [ 0 -ne "$i" ]; then
+    git init --quiet --bare "$dir/.git"
+    history "$i" | git -c fastimport.unpackLimit=0 --git-dir="$dir/.git" fast-import --quiet
+  elif [ 0 -eq $((i % 11)) ] && [ 0 -ne "$i" ]; then
+    git init --quiet "$dir"
+  else
+    git init --quiet "$dir"
+    history "$i" | git -c fastimport.unpackLimit=0 -C "$dir" fast-import --quiet
+    git -C "$dir" checkout --quiet --force master
+
+    if [ 0 -eq $((i % 7)) ] && [ 0 -ne "$i" ]; then
+      git -C "$dir" checkout --quiet --detach HEAD~1 2>/dev/null \
+        || git -C "$dir" checkout --quiet --detach HEAD
+    fi
+  fi
+
+  if [ 1 -eq "$loose" ] && [ -d "$dir/.git/objects/pack" ]; then
+    for pack in "$dir"/.git/objects/pack/*.pack; do
+      [ -f "$pack" ] || continue
+      mv "$pack" "$pack.tmp"
+      rm -f "${pack%.pack}.idx"
+      git --git-dir="$dir/.git" unpack-objects -q < "$pack.tmp"
+      rm -f "$pack.tmp"
+    done
+  fi
+
+  i=$((i + 1))
+done
+
+echo "$stamp" > "$root/.bench"
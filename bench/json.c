@@ -0,0 +1,182 @@
+
+#include <assert.h>
+#include <sys/time.h>
+#include <repo.h>
+
+/**
+ * Parses a synthetic manifest (50 MB by default) twice: into a
+ * `json_parser_dom` tree built with one system allocation per
+ * value and key, and into an arena backed `repo_json_doc_t`.
+ * Reports allocation counts and parse time for both.
+ *
+ * usage: bench-json [megabytes]
+ */
+
+typedef struct heap_node {
+  int type;
+  char *key;
+  char *value;
+  struct heap_node *child;
+  struct heap_node *next;
+} heap_node_t;
+
+static size_t mallocs = 0;
+
+
+static double
+now_ms () {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+
+static void *
+counted_calloc (size_t nmemb, size_t size) {
+  mallocs++;
+  return calloc(nmemb, size);
+}
+
+
+static void *
+counted_realloc (void *ptr, size_t size) {
+  mallocs++;
+  return realloc(ptr, size);
+}
+
+
+static void *
+heap_structure (int nesting, int is_object) {
+  heap_node_t *node = counted_calloc(1, sizeof(heap_node_t));
+  node->type = is_object ? JSON_OBJECT_BEGIN : JSON_ARRAY_BEGIN;
+  return node;
+}
+
+
+static void *
+heap_data (int type, const char *data, uint32_t length) {
+  heap_node_t *node = counted_calloc(1, sizeof(heap_node_t));
+  node->type = type;
+  node->value = counted_calloc(length + 1, 1);
+  memcpy(node->value, data, length);
+  return node;
+}
+
+
+static int
+heap_append (void *parent, char *key, uint32_t key_length, void *value) {
+  heap_node_t *p = parent, *v = value;
+  if (key) {
+    v->key = counted_calloc(key_length + 1, 1);
+    memcpy(v->key, key, key_length);
+  }
+  v->next = p->child;
+  p->child = v;
+  return 0;
+}
+
+
+static void
+heap_free (heap_node_t *node) {
+  while (node) {
+    heap_node_t *next = node->next;
+    heap_free(node->child);
+    free(node->key);
+    free(node->value);
+    free(node);
+    node = next;
+  }
+}
+
+
+static size_t
+count_borrowed (repo_json_node_t *node) {
+  size_t n = 0;
+  for (; node; node = node->next) {
+    if (node->key.length && !node->key.copy) n++;
+    if (JSON_STRING == node->type && !node->value.copy) n++;
+    n += count_borrowed(node->child);
+  }
+  return n;
+}
+
+
+int
+main (int argc, char *argv[]) {
+  size_t target = (size_t) (argc > 1 ? atoi(argv[1]) : 50) * 1024 * 1024;
+  repo_buf_t *input = repo_buf_new(-1);
+  repo_arena_t *arena = repo_arena_new(0);
+  repo_json_doc_t doc;
+  json_parser_dom dom;
+  json_parser parser;
+  json_config config;
+  double start, heap_ms, arena_ms, reparse_ms;
+  size_t heap_allocs, arena_allocs, arena_chunks, reparse_chunks, borrowed;
+  char line[512];
+  int entries = 0, rc;
+
+  assert(input && arena);
+
+  repo_buf_puts(input, "{\"version\":1,\"repos\":[");
+  while (input->length < target) {
+    sprintf(line, "%s{\"name\":\"svc-%07d\",\"url\":\"git@example.com:org/svc-%07d.git\","
+      "\"path\":\"/home/user/repos/svc-%07d\",\"branch\":\"%s\",\"size\":%d,"
+      "\"tags\":[\"service\",\"tier-%d\"],\"description\":\"%s\"}"
+      , entries ? "," : ""
+      , entries, entries, entries
+      , entries % 3 ? "main" : "feature/bench"
+      , entries * 37 % 100000
+      , entries % 4
+      , entries % 10 ? "plain description" : "quoted \\\"description\\\"\\n");
+    repo_buf_puts(input, line);
+    entries++;
+  }
+  repo_buf_puts(input, "]}");
+
+  // system allocator, one allocation per node, key and value
+  memset(&config, 0, sizeof(config));
+  config.user_calloc = counted_calloc;
+  config.user_realloc = counted_realloc;
+
+  start = now_ms();
+  json_parser_dom_init(&dom, heap_structure, heap_data, heap_append);
+  dom.user_calloc = counted_calloc;
+  dom.user_realloc = counted_realloc;
+  json_parser_init(&parser, &config, json_parser_dom_callback, &dom);
+  rc = json_parser_string(&parser, input->data, (uint32_t) input->length, NULL);
+  assert(0 == rc);
+  json_parser_free(&parser);
+  json_parser_dom_free(&dom);
+  heap_ms = now_ms() - start;
+  heap_allocs = mallocs;
+  heap_free(dom.root_structure);
+
+  // arena
+  start = now_ms();
+  rc = repo_json_parse(&doc, arena, input->data, input->length);
+  arena_ms = now_ms() - start;
+  arena_allocs = arena->allocations;
+  arena_chunks = arena->chunks;
+  borrowed = count_borrowed(doc.root);
+
+  // reset and parse again, the head chunk is reused
+  repo_arena_reset(arena);
+  start = now_ms();
+  rc |= repo_json_parse(&doc, arena, input->data, input->length);
+  reparse_ms = now_ms() - start;
+  reparse_chunks = arena->chunks - arena_chunks;
+  assert(0 == rc);
+
+  printf("{\"bench\":\"json\",\"bytes\":%zu,\"entries\":%d"
+    ",\"malloc_allocs\":%zu,\"malloc_ms\":%.3f"
+    ",\"arena_allocs\":%zu,\"arena_chunks\":%zu,\"arena_ms\":%.3f"
+    ",\"reparse_chunks\":%zu,\"reparse_ms\":%.3f,\"borrowed_strings\":%zu}\n"
+    , input->length, entries
+    , heap_allocs, heap_ms
+    , arena_allocs, arena_chunks, arena_ms
+    , reparse_chunks, reparse_ms, borrowed);
+
+  repo_arena_free(arena);
+  repo_buf_free(input);
+  return 0;
+}
@@ -0,0 +1,60 @@
+
+/**
+ * Measures event loop delay while `scan()` and `status()` run
+ * over a root of freshly initialised repositories. The loop
+ * should stay as responsive as when idle since all of the work
+ * is on the threadpool.
+ *
+ * usage: node bench/lag.js [count]
+ */
+
+var fs = require('fs')
+  , os = require('os')
+  , path = require('path')
+  , execFileSync = require('child_process').execFileSync
+  , perf = require('perf_hooks')
+  , repo = require('../');
+
+var count = parseInt(process.argv[2], 10) || 2000;
+var root = fs.mkdtempSync(path.join(os.tmpdir(), 'repo-lag-'));
+
+for (var i = 0; i < count; ++i) {
+  var dir = path.join(root, 'svc-' + i);
+  fs.mkdirSync(dir);
+  execFileSync('git', ['init', '--quiet', dir]);
+}
+
+function measure (fn) {
+  var histogram = perf.monitorEventLoopDelay({ resolution: 1 })
+    , start = process.hrtime.bigint();
+
+  histogram.enable();
+  return fn().then(function (result) {
+    histogram.disable();
+    return {
+      ms: Number(process.hrtime.bigint() - start) / 1e6,
+      entries: result ? result.length : 0,
+      lag_p50_ms: histogram.percentile(50) / 1e6,
+      lag_p99_ms: histogram.percentile(99) / 1e6,
+      lag_max_ms: histogram.max / 1e6
+    };
+  });
+}
+
+function idle () {
+  return new Promise(function (resolve) { setTimeout(resolve, 500); });
+}
+
+var out = { bench: 'lag', repos: count };
+
+measure(idle).then(function (r) {
+  out.idle = r;
+  return measure(function () { return repo.scan(root); });
+}).then(function (r) {
+  out.scan = r;
+  return measure(function () { return repo.status(root); });
+}).then(function (r) {
+  out.status = r;
+  console.log(JSON.stringify(out));
+  fs.rmSync(root, { recursive: true, force: true });
+});
@@ -0,0 +1,46 @@
+#!/bin/sh
+
+##
+# Runs the benchmark suite behind `make bench` and compares the
+# results against `bench/baseline.ndjson` when one exists.
+#
+# Environment:
+#
+#   BENCH_ROOT       generated repos root (/tmp/repo-bench)
+#   BENCH_REPOS      repositories to generate (100)
+#   BENCH_DEPTH      commits per repository (20)
+#   BENCH_FILES      files per repository (50)
+#   BENCH_CLONES     repositories cloned per variant (10)
+#   BENCH_RESULTS    where results are written (bench/results.ndjson)
+#   BENCH_THRESHOLD  allowed regression in percent (10)
+##
+
+root="${BENCH_ROOT:-/tmp/repo-bench}"
+results="${BENCH_RESULTS:-bench/results.ndjson}"
+clones="${BENCH_CLONES:-10}"
+
+set -e
+cd "$(dirname "$0")/.."
+
+bench/generate.sh \
+  -n "${BENCH_REPOS:-100}" \
+  -d "${BENCH_DEPTH:-20}" \
+  -f "${BENCH_FILES:-50}" \
+  "$root"
+
+: > "$results"
+
+for variant in cold warm; do
+  ./bench-dir "$root" "$variant" >> "$results"
+  ./bench-clone "$root" "$variant" "$clones" >> "$results"
+done
+
+./bench-where "$root" "git && !bare && branch == 'master'" >> "$results"
+./bench-format >> "$results"
+./bench-json >> "$results"
+./bench-scan >> "$results"
+./bench-sched >> "$results"
+./bench-sha1 >> "$results"
+
+cat "$results"
+node bench/compare.js "$results" bench/baseline.ndjson
@@ -0,0 +1,101 @@
+
+#include <assert.h>
+#include <sys/time.h>
+#include <repo.h>
+
+/**
+ * Measures `json_parser_string` throughput on an indented,
+ * manifest shaped document (32 MB by default) with each of
+ * the string/whitespace scanners the CPU supports.
+ *
+ * usage: bench-scan [megabytes] [rounds]
+ */
+
+static const char *names[] = {
+  "auto", "none", "scalar", "sse2", "avx2"
+};
+
+
+static double
+now_ms () {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+
+static int
+on_value (void *data, int type, const char *value, uint32_t length) {
+  (*(size_t *) data)++;
+  return 0;
+}
+
+
+int
+main (int argc, char *argv[]) {
+  size_t target = (size_t) (argc > 1 ? atoi(argv[1]) : 32) * 1024 * 1024;
+  int rounds = argc > 2 ? atoi(argv[2]) : 3;
+  repo_buf_t *input = repo_buf_new(-1);
+  char line[1024];
+  int entries = 0, first = 1;
+
+  assert(input);
+
+  repo_buf_puts(input, "{\n  \"version\": 1,\n  \"repos\": [\n");
+  while (input->length < target) {
+    sprintf(line, "%s    {\n"
+      "      \"name\": \"svc-%07d\",\n"
+      "      \"url\": \"https://git.example.com/platform/services/svc-%07d.git\",\n"
+      "      \"path\": \"/home/user/src/platform/services/svc-%07d\",\n"
+      "      \"branch\": \"%s\",\n"
+      "      \"size\": %d,\n"
+      "      \"description\": \"%s\"\n"
+      "    }"
+      , entries ? ",\n" : ""
+      , entries, entries, entries
+      , entries % 3 ? "main" : "feature/scanner-benchmark"
+      , entries * 37 % 100000
+      , entries % 10
+        ? "Service owning the repository metadata cache and its refresh schedule"
+        : "Escaped \\\"description\\\" with a newline\\n and caf\\u00e9");
+    repo_buf_puts(input, line);
+    entries++;
+  }
+  repo_buf_puts(input, "\n  ]\n}\n");
+
+  printf("{\"bench\":\"scan\",\"bytes\":%zu,\"entries\":%d,\"scanners\":{"
+    , input->length, entries);
+
+  for (int type = JSON_SCANNER_NONE; type <= JSON_SCANNER_AVX2; ++type) {
+    double best = 0;
+    size_t values = 0;
+
+    if (-1 == json_set_scanner(type))
+      continue;
+
+    for (int round = 0; round < rounds; ++round) {
+      json_parser parser;
+      double start, ms;
+      int rc;
+
+      values = 0;
+      start = now_ms();
+      json_parser_init(&parser, NULL, on_value, &values);
+      rc = json_parser_string(&parser, input->data, (uint32_t) input->length, NULL);
+      json_parser_free(&parser);
+      ms = now_ms() - start;
+      assert(0 == rc);
+
+      if (0 == round || ms < best) best = ms;
+    }
+
+    printf("%s\"%s\":{\"ms\":%.3f,\"mb_s\":%.1f,\"values\":%zu}"
+      , first ? "" : ","
+      , names[type], best, input->length / 1048576.0 / (best / 1000.0), values);
+    first = 0;
+  }
+
+  printf("}}\n");
+  repo_buf_free(input);
+  return 0;
+}
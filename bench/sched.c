@@ -0,0 +1,117 @@
+
+#include <assert.h>
+#include <math.h>
+#include "bench.h"
+
+/**
+ * Runs a skewed synthetic workload, a few long jobs among many
+ * short ones, on the scheduler in directory order and then
+ * longest first. Durations for the second run come from a job
+ * history recorded by the first, like `repo fetch` does, so the
+ * history round trip is part of what's measured.
+ *
+ * usage: bench-sched [jobs] [workers] [mean-ms]
+ */
+
+typedef struct sched_bench_job {
+  char key[32];
+  double ms;
+  double actual;
+} sched_bench_job_t;
+
+
+static void
+on_job (void *data) {
+  sched_bench_job_t *job = (sched_bench_job_t *) data;
+  double start = bench_now_ms();
+  usleep((useconds_t) (job->ms * 1000));
+  job->actual = bench_now_ms() - start;
+}
+
+
+static double
+run (sched_bench_job_t *jobs, int count, int workers, repo_history_t *history, double *predicted) {
+  repo_sched_t *sched = repo_sched_new(workers, 0);
+  double start;
+
+  assert(sched);
+
+  for (int i = 0; i < count; ++i) {
+    int rc = history
+      ? repo_sched_add(sched, "local", repo_history_predict(history, jobs[i].key), on_job, &jobs[i])
+      : repo_sched_push(sched, "local", on_job, &jobs[i]);
+    assert(0 == rc);
+  }
+
+  start = bench_now_ms();
+  if (history) *predicted = repo_sched_start(sched);
+  repo_sched_wait(sched);
+  repo_sched_free(sched);
+  return bench_now_ms() - start;
+}
+
+
+int
+main (int argc, char *argv[]) {
+  int count = argc > 1 ? atoi(argv[1]) : 200;
+  int workers = argc > 2 ? atoi(argv[2]) : 8;
+  double mean = argc > 3 ? atof(argv[3]) : 5;
+  char root[] = "/tmp/repo-bench-sched-XXXXXX";
+  sched_bench_job_t *jobs = calloc(count, sizeof(sched_bench_job_t));
+  double total = 0, longest = 0, fifo_ms, lpt_ms, predicted = 0, bound;
+  repo_history_t *history;
+  repo_t repo;
+  int rc;
+
+  assert(jobs);
+  assert(mkdtemp(root));
+  repo.path = root;
+  srand(42);
+
+  // pareto with alpha 1.5 has a mean of 3 * scale
+  for (int i = 0; i < count; ++i) {
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+    jobs[i].ms = (mean / 3) * pow(u, -1 / 1.5);
+    snprintf(jobs[i].key, sizeof(jobs[i].key), "bench:svc-%05d", i);
+    total += jobs[i].ms;
+    if (jobs[i].ms > longest) longest = jobs[i].ms;
+  }
+
+  // the huge repository happens to come last
+  for (int i = 0; i < count; ++i) {
+    if (jobs[i].ms == longest) {
+      sched_bench_job_t tmp = jobs[i];
+      jobs[i] = jobs[count - 1];
+      jobs[count - 1] = tmp;
+      break;
+    }
+  }
+
+  fifo_ms = run(jobs, count, workers, NULL, NULL);
+
+  assert((history = repo_history_load(&repo)));
+  for (int i = 0; i < count; ++i) {
+    rc = repo_history_record(history, jobs[i].key, jobs[i].actual, 0);
+    assert(0 == rc);
+  }
+  rc = repo_history_save(history);
+  assert(0 == rc);
+  repo_history_free(history);
+
+  assert((history = repo_history_load(&repo)));
+  lpt_ms = run(jobs, count, workers, history, &predicted);
+  repo_history_free(history);
+
+  bound = total / workers > longest ? total / workers : longest;
+
+  printf("{\"bench\":\"sched\",\"jobs\":%d,\"workers\":%d"
+    ",\"work_ms\":%.3f,\"longest_ms\":%.3f,\"lower_bound_ms\":%.3f"
+    ",\"fifo_ms\":%.3f,\"lpt_ms\":%.3f,\"predicted_ms\":%.3f}\n"
+    , count, workers
+    , total, longest, bound
+    , fifo_ms, lpt_ms, predicted);
+
+  bench_rmrf(root);
+  free(jobs);
+  return 0;
+}
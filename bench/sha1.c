@@ -0,0 +1,60 @@
+
+#include <assert.h>
+#include "bench.h"
+
+/**
+ * Hashes the same set of synthetic objects one at a time and
+ * batched across lanes, for a few object sizes typical of
+ * source trees. Prints one record per size.
+ *
+ * usage: bench-sha1 [megabytes]
+ */
+
+static const size_t sizes[] = { 64, 512, 4096, 65536 };
+
+
+int
+main (int argc, char *argv[]) {
+  size_t total = (size_t) (argc > 1 ? atoi(argv[1]) : 64) * 1024 * 1024;
+  unsigned char *data = malloc(total);
+  repo_sha1_msg_t *msgs, **batch;
+
+  assert(data);
+  for (size_t i = 0; i < total; ++i) data[i] = (unsigned char) (i * 2654435761u >> 13);
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    size_t size = sizes[s], count = total / size;
+    double start, scalar_ms, batch_ms;
+
+    assert((msgs = calloc(count, sizeof(repo_sha1_msg_t))));
+    assert((batch = calloc(count, sizeof(repo_sha1_msg_t *))));
+
+    for (size_t i = 0; i < count; ++i) {
+      repo_sha1_object(&msgs[i], "blob", data + i * size, size);
+      batch[i] = &msgs[i];
+    }
+
+    start = bench_now_ms();
+    for (size_t i = 0; i < count; ++i) repo_sha1(&msgs[i]);
+    scalar_ms = bench_now_ms() - start;
+
+    // fsck hands objects over in windows of this many
+    start = bench_now_ms();
+    for (size_t i = 0; i < count; i += 64) {
+      repo_sha1_batch(batch + i, count - i < 64 ? (int) (count - i) : 64);
+    }
+    batch_ms = bench_now_ms() - start;
+
+    printf("{\"bench\":\"sha1\",\"variant\":\"%zu\",\"lanes\":%d,\"objects\":%zu"
+      ",\"scalar_ms\":%.3f,\"batch_ms\":%.3f,\"scalar_mb_s\":%.1f,\"batch_mb_s\":%.1f}\n"
+      , size, repo_sha1_lanes(), count
+      , scalar_ms, batch_ms
+      , total / 1048576.0 / (scalar_ms / 1000), total / 1048576.0 / (batch_ms / 1000));
+
+    free(batch);
+    free(msgs);
+  }
+
+  free(data);
+  return 0;
+}
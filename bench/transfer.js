@@ -0,0 +1,71 @@
+
+/**
+ * Compares handing scan results to JavaScript as one object per
+ * repository against the packed `ScanResult` buffer, over a root
+ * of minimal repositories (50k by default). Reports the longest
+ * event loop stall, which is where the results are marshalled,
+ * and the cost of reading every field back.
+ *
+ * usage: node bench/transfer.js [count]
+ */
+
+var fs = require('fs')
+  , os = require('os')
+  , path = require('path')
+  , perf = require('perf_hooks')
+  , repo = require('../');
+
+var count = parseInt(process.argv[2], 10) || 50000;
+var root = fs.mkdtempSync(path.join(os.tmpdir(), 'repo-transfer-'));
+
+// just enough of a repository for libgit2 to open it
+for (var i = 0; i < count; ++i) {
+  var git = path.join(root, 'svc-' + i, '.git');
+  fs.mkdirSync(path.join(git, 'objects'), { recursive: true });
+  fs.mkdirSync(path.join(git, 'refs', 'heads'), { recursive: true });
+  fs.writeFileSync(path.join(git, 'HEAD'), 'ref: refs/heads/main\n');
+}
+
+function run (scan, read) {
+  var histogram = perf.monitorEventLoopDelay({ resolution: 1 })
+    , start = process.hrtime.bigint();
+
+  histogram.enable();
+  return scan(root).then(function (result) {
+    var resolved = process.hrtime.bigint()
+      , bytes = 0;
+
+    histogram.disable();
+    for (var i = 0; i < result.length; ++i) bytes += read(result, i);
+
+    return {
+      entries: result.length,
+      total_ms: Number(resolved - start) / 1e6,
+      stall_max_ms: histogram.max / 1e6,
+      read_ms: Number(process.hrtime.bigint() - resolved) / 1e6,
+      bytes: bytes
+    };
+  });
+}
+
+function readObject (rows, i) {
+  var row = rows[i];
+  return row.name.length + row.path.length + (row.branch || '').length
+    + (row.orphan ? 1 : 0);
+}
+
+function readPacked (result, i) {
+  return result.name(i).length + result.path(i).length + (result.branch(i) || '').length
+    + (result.orphan(i) ? 1 : 0);
+}
+
+var out = { bench: 'transfer', repos: count };
+
+run(repo.scanObjects, readObject).then(function (r) {
+  out.objects = r;
+  return run(repo.scan, readPacked);
+}).then(function (r) {
+  out.packed = r;
+  console.log(JSON.stringify(out));
+  fs.rmSync(root, { recursive: true, force: true });
+});
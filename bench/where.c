@@ -0,0 +1,72 @@
+
+#include <assert.h>
+#include <sys/time.h>
+#include <repo.h>
+
+/**
+ * Compares `repo ls --where` style filtering with every field
+ * computed up front against the lazily evaluated predicate.
+ *
+ * usage: bench-where <root> <expr>
+ */
+
+static double
+now_ms () {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+
+static int
+run (char *root, repo_where_t *where, bool eager, double *elapsed) {
+  double start = now_ms();
+  repo_dir_t *dir = repo_dir_new(root);
+  int matched = 0;
+
+  assert(dir);
+
+  for (int i = 0; i < dir->length; ++i) {
+    repo_dir_item_t *item = &dir->items[i];
+    if (eager) repo_dir_item_load(item);
+    if (repo_where_match(where, item)) matched++;
+  }
+
+  *elapsed = now_ms() - start;
+  repo_dir_free(dir);
+  return matched;
+}
+
+
+int
+main (int argc, char *argv[]) {
+  char error[256];
+  double eager_ms, lazy_ms;
+  repo_where_t *where;
+  int eager, lazy;
+
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <root> <expr>\n", argv[0]);
+    return 1;
+  }
+
+  if (!(where = repo_where_compile(argv[2], error, sizeof(error)))) {
+    fprintf(stderr, "bench-where: %s\n", error);
+    return 1;
+  }
+
+  git_threads_init();
+
+  // warm the page cache so both runs see the same state
+  run(argv[1], where, true, &eager_ms);
+
+  eager = run(argv[1], where, true, &eager_ms);
+  lazy = run(argv[1], where, false, &lazy_ms);
+
+  printf("{\"bench\":\"where\",\"expr\":\"%s\",\"matched\":%d,\"eager_ms\":%.3f,\"lazy_ms\":%.3f}\n"
+    , argv[2], lazy, eager_ms, lazy_ms);
+
+  repo_where_free(where);
+  git_threads_shutdown();
+  return eager == lazy ? 0 : 1;
+}
@@ -3,9 +3,24 @@
     {
       'target_name': 'repo',
       'include_dirs': [
-        './deps/', './include/'
+        './deps/', './include/', './libgit2/include/'
       ],
-      'sources': ['deps/*.c', 'src/*.c', 'bindings.cc' ]
+      'sources': [
+        'deps/commander.c', 'deps/json.c', 'deps/term.c',
+        'src/arena.c', 'src/buf.c', 'src/census.c', 'src/clean.c', 'src/clone.c',
+        'src/cmd.c', 'src/dom.c', 'src/du.c', 'src/dupes.c', 'src/emit.c',
+        'src/fetch.c', 'src/format.c', 'src/fsck.c', 'src/git.c', 'src/handles.c',
+        'src/history.c', 'src/log.c', 'src/ls.c', 'src/maintain.c', 'src/pool.c',
+        'src/pull.c', 'src/push.c', 'src/repo.c', 'src/sched.c', 'src/session.c',
+        'src/sha1.c', 'src/stats.c', 'src/status.c', 'src/trace.c', 'src/where.c',
+        'src/which.c',
+        'bindings.cc'
+      ],
+      'cflags_c': [ '-std=c99', '-D_GNU_SOURCE', '-pthread' ],
+      'libraries': [
+        '-L<(module_root_dir)/libgit2/build', '-lgit2',
+        '-Wl,-rpath,<(module_root_dir)/libgit2/build'
+      ]
     }
   ]
-}
\ No newline at end of file
+}
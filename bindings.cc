@@ -1,36 +1,656 @@
-
-#include <v8.h>
-#include <node.h>
+#include <node_api.h>
+#include <stdlib.h>
+#include <string.h>
 #include "repo.h"
 
-#define str(s) v8::String::New(s)
-
-class User {
-	// repo_user_t *ref_;
-	v8::Persistent<v8::Object> obj_;
-	public:
-		User () {
-			// ref_ = repo_user_new();
-			obj_->SetPointerInInternalField(0, this);
-		}
-
-		v8::Handle<v8::Object>
-		ToObject () {
-			return obj_;
-		}
+/**
+ * Node-API addon. Every export returns a Promise and runs its
+ * libgit2 work in a `napi_async_work` on the libuv threadpool,
+ * so the event loop never waits on the disk or the network.
+ */
+
+#define NAPI_CALL(env, call)                                    \
+	do {                                                          \
+		if (napi_ok != (call)) {                                    \
+			const napi_extended_error_info *info = NULL;              \
+			bool pending = false;                                     \
+			napi_get_last_error_info((env), &info);                   \
+			napi_is_exception_pending((env), &pending);               \
+			if (!pending) {                                           \
+				napi_throw_error((env), NULL, info && info->error_message \
+					? info->error_message : "repo: napi call failed");     \
+			}                                                         \
+			return NULL;                                              \
+		}                                                           \
+	} while (0)
+
+typedef struct async_op async_op_t;
+
+typedef napi_value (*async_resolve_cb) (napi_env env, async_op_t *op);
+
+struct async_op {
+	napi_async_work work;
+	napi_deferred deferred;
+	async_resolve_cb resolve;
+	repo_t repo;
+	char *root;
+	char *url;
+	char *name;
+	char *dest;
+	repo_status_list_t *list;
+	char *packed;
+	size_t packed_size;
+	napi_threadsafe_function tsfn;
+	repo_clone_throttle_t throttle;
+	int error;
+	char message[256];
 };
 
-v8::Handle<v8::Value>
-NewUser (const v8::Arguments &args) {
-	v8::HandleScope scope;
-	User *user = new User();
 
- return scope.Close(user->ToObject());
+static void
+op_free (async_op_t *op) {
+	repo_status_list_free(op->list);
+	free(op->packed);
+	free(op->root);
+	free(op->url);
+	free(op->name);
+	free(op->dest);
+	free(op);
+}
+
+// libgit2 errors are per thread, copy them in the worker
+static void
+op_fail (async_op_t *op, int error, const char *fallback) {
+	const git_error *err = giterr_last();
+	op->error = error ? error : -1;
+	snprintf(op->message, sizeof(op->message), "%s", err && err->message ? err->message : fallback);
+}
+
+
+static char *
+arg_string (napi_env env, napi_value value, const char *name) {
+	size_t length = 0;
+	napi_valuetype type;
+	char *str;
+
+	if (napi_ok != napi_typeof(env, value, &type) || napi_string != type) {
+		char message[64];
+		snprintf(message, sizeof(message), "%s must be a string", name);
+		napi_throw_type_error(env, NULL, message);
+		return NULL;
+	}
+
+	napi_get_value_string_utf8(env, value, NULL, 0, &length);
+	if (!(str = (char *) malloc(length + 1)))
+		return NULL;
+	napi_get_value_string_utf8(env, value, str, length + 1, &length);
+	return str;
+}
+
+
+static napi_value
+js_string (napi_env env, const char *str) {
+	napi_value value;
+	if (str) {
+		napi_create_string_utf8(env, str, NAPI_AUTO_LENGTH, &value);
+	} else {
+		napi_get_null(env, &value);
+	}
+	return value;
+}
+
+
+static void
+set_string (napi_env env, napi_value obj, const char *key, const char *str) {
+	napi_set_named_property(env, obj, key, js_string(env, str));
+}
+
+
+static void
+set_bool (napi_env env, napi_value obj, const char *key, bool b) {
+	napi_value value;
+	napi_get_boolean(env, b, &value);
+	napi_set_named_property(env, obj, key, value);
+}
+
+
+static void
+set_number (napi_env env, napi_value obj, const char *key, double n) {
+	napi_value value;
+	napi_create_double(env, n, &value);
+	napi_set_named_property(env, obj, key, value);
+}
+
+
+static void
+op_settle (napi_env env, async_op_t *op, bool ran) {
+	napi_value result, error, message;
+
+	if (ran && 0 == op->error) {
+		result = op->resolve(env, op);
+		napi_resolve_deferred(env, op->deferred, result);
+	} else {
+		napi_create_string_utf8(env, ran ? op->message : "cancelled"
+			, NAPI_AUTO_LENGTH, &message);
+		napi_create_error(env, NULL, message, &error);
+		set_number(env, error, "code", op->error);
+		napi_reject_deferred(env, op->deferred, error);
+	}
+}
+
+
+static void
+op_complete (napi_env env, napi_status status, void *data) {
+	async_op_t *op = (async_op_t *) data;
+	op_settle(env, op, napi_ok == status);
+	napi_delete_async_work(env, op->work);
+	op_free(op);
+}
+
+/**
+ * Queues `op` running `execute` on the threadpool and returns
+ * the Promise settled by `op_complete()`.
+ */
+
+static napi_value
+op_queue (napi_env env, async_op_t *op, const char *name, napi_async_execute_callback execute) {
+	napi_value promise, resource_name;
+
+	if (napi_ok != napi_create_promise(env, &op->deferred, &promise)) {
+		op_free(op);
+		return NULL;
+	}
+
+	napi_create_string_utf8(env, name, NAPI_AUTO_LENGTH, &resource_name);
+
+	if (napi_ok != napi_create_async_work(env, NULL, resource_name, execute, op_complete, op, &op->work)) {
+		op->work = NULL;
+	}
+
+	// `op_complete()` never runs, settle and free here
+	if (!op->work || napi_ok != napi_queue_async_work(env, op->work)) {
+		if (op->work) napi_delete_async_work(env, op->work);
+		op->error = -1;
+		snprintf(op->message, sizeof(op->message), "%s", "failed to queue work");
+		op_settle(env, op, true);
+		op_free(op);
+	}
+
+	return promise;
+}
+
+
+static async_op_t *
+op_new (napi_env env, napi_callback_info info, size_t argc_needed, napi_value *argv) {
+	size_t argc = argc_needed;
+	async_op_t *op;
+
+	if (napi_ok != napi_get_cb_info(env, info, &argc, argv, NULL, NULL))
+		return NULL;
+
+	if (argc < argc_needed) {
+		napi_throw_type_error(env, NULL, "repo: missing arguments");
+		return NULL;
+	}
+
+	if (!(op = (async_op_t *) calloc(1, sizeof(async_op_t)))) {
+		napi_throw_error(env, NULL, "repo: out of memory");
+		return NULL;
+	}
+
+	return op;
+}
+
+// scan(root)
+
+static void
+scan_execute (napi_env env, void *data) {
+	async_op_t *op = (async_op_t *) data;
+	if (!(op->list = repo_status_collect(&op->repo, 0, false))) {
+		op_fail(op, -1, "path does not exist");
+	}
+}
+
+
+static napi_value
+scan_resolve (napi_env env, async_op_t *op) {
+	napi_value array, obj;
+
+	napi_create_array_with_length(env, op->list->length, &array);
+
+	for (int i = 0; i < op->list->length; ++i) {
+		repo_status_t *r = &op->list->items[i];
+		napi_create_object(env, &obj);
+		set_string(env, obj, "name", r->item->name);
+		set_string(env, obj, "path", r->item->path);
+		set_string(env, obj, "branch", r->branch);
+		set_bool(env, obj, "bare", r->bare);
+		set_bool(env, obj, "orphan", r->orphan);
+		set_string(env, obj, "error", r->failed ? r->error : NULL);
+		napi_set_element(env, array, i, obj);
+	}
+
+	return array;
+}
+
+
+static napi_value
+scan_queue (napi_env env, napi_callback_info info, async_resolve_cb resolve, napi_async_execute_callback execute) {
+	napi_value argv[1];
+	async_op_t *op;
+
+	if (!(op = op_new(env, info, 1, argv)))
+		return NULL;
+
+	if (!(op->root = arg_string(env, argv[0], "root"))) {
+		op_free(op);
+		return NULL;
+	}
+
+	op->repo.path = op->root;
+	op->resolve = resolve;
+	return op_queue(env, op, "repo.scan", execute);
+}
+
+
+static napi_value
+ScanObjects (napi_env env, napi_callback_info info) {
+	return scan_queue(env, info, scan_resolve, scan_execute);
+}
+
+/**
+ * Packed scan results: one block holding a header, a table of
+ * fixed width records and a blob of the strings they point at,
+ * all native endian `uint32_t`. Built on the worker and handed
+ * to JavaScript as an external `ArrayBuffer`, decoded lazily by
+ * `ScanResult` in index.js.
+ *
+ *   header  magic 'RSCN', version, count, record size, blob offset
+ *   record  name off/len, path off/len, branch off/len,
+ *           error off/len, flags, inode lo/hi, reserved
+ *
+ * A missing string has offset `REPO_PACK_NONE`.
+ */
+
+#define REPO_PACK_MAGIC 0x4e435352 // "RSCN"
+#define REPO_PACK_VERSION 1
+#define REPO_PACK_HEADER 5
+#define REPO_PACK_FIELDS 12
+#define REPO_PACK_NONE 0xffffffff
+
+#define REPO_PACK_BARE (1 << 0)
+#define REPO_PACK_ORPHAN (1 << 1)
+#define REPO_PACK_FAILED (1 << 2)
+
+static uint32_t
+pack_string (char *blob, uint32_t *offset, uint32_t *field, const char *str) {
+	uint32_t length = str ? (uint32_t) strlen(str) : 0;
+
+	field[0] = str ? *offset : REPO_PACK_NONE;
+	field[1] = length;
+
+	if (blob && str) memcpy(blob + *offset, str, length);
+	*offset += length;
+	return length;
+}
+
+
+static void
+pack_record (repo_status_t *r, char *blob, uint32_t *offset, uint32_t *record) {
+	pack_string(blob, offset, &record[0], r->item->name);
+	pack_string(blob, offset, &record[2], r->item->path);
+	pack_string(blob, offset, &record[4], r->branch);
+	pack_string(blob, offset, &record[6], r->failed ? r->error : NULL);
+	record[8] = (r->bare ? REPO_PACK_BARE : 0)
+		| (r->orphan ? REPO_PACK_ORPHAN : 0)
+		| (r->failed ? REPO_PACK_FAILED : 0);
+	record[9] = (uint32_t) ((uint64_t) r->item->ino & 0xffffffff);
+	record[10] = (uint32_t) ((uint64_t) r->item->ino >> 32);
+	record[11] = 0;
+}
+
+
+static void
+scan_pack_execute (napi_env env, void *data) {
+	async_op_t *op = (async_op_t *) data;
+	uint32_t scratch[REPO_PACK_FIELDS], blob_length = 0, *header;
+	size_t table;
+	char *blob;
+
+	scan_execute(env, data);
+	if (op->error) return;
+
+	// size the string blob first so the block is allocated once
+	for (int i = 0; i < op->list->length; ++i) {
+		pack_record(&op->list->items[i], NULL, &blob_length, scratch);
+	}
+
+	table = (REPO_PACK_HEADER + (size_t) op->list->length * REPO_PACK_FIELDS) * sizeof(uint32_t);
+	op->packed_size = table + blob_length;
+
+	if (!(op->packed = (char *) malloc(op->packed_size ? op->packed_size : 1))) {
+		op_fail(op, -1, "out of memory");
+		return;
+	}
+
+	header = (uint32_t *) op->packed;
+	header[0] = REPO_PACK_MAGIC;
+	header[1] = REPO_PACK_VERSION;
+	header[2] = (uint32_t) op->list->length;
+	header[3] = REPO_PACK_FIELDS * sizeof(uint32_t);
+	header[4] = (uint32_t) table;
+
+	blob = op->packed + table;
+	blob_length = 0;
+
+	for (int i = 0; i < op->list->length; ++i) {
+		uint32_t *record = header + REPO_PACK_HEADER + i * REPO_PACK_FIELDS;
+		pack_record(&op->list->items[i], blob, &blob_length, record);
+	}
+
+	// the block is all that crosses over, release the rest here
+	repo_status_list_free(op->list);
+	op->list = NULL;
+}
+
+
+static void
+scan_pack_finalize (napi_env env, void *data, void *hint) {
+	free(data);
+}
+
+
+static napi_value
+scan_pack_resolve (napi_env env, async_op_t *op) {
+	napi_value buffer;
+	void *copy;
+
+	if (napi_ok == napi_create_external_arraybuffer(env, op->packed, op->packed_size
+			, scan_pack_finalize, NULL, &buffer)) {
+		op->packed = NULL;
+		return buffer;
+	}
+
+	// runtimes that forbid external buffers get a single copy
+	napi_create_arraybuffer(env, op->packed_size, &copy, &buffer);
+	memcpy(copy, op->packed, op->packed_size);
+	return buffer;
+}
+
+
+static napi_value
+Scan (napi_env env, napi_callback_info info) {
+	return scan_queue(env, info, scan_pack_resolve, scan_pack_execute);
+}
+
+// status(root)
+
+static void
+status_execute (napi_env env, void *data) {
+	async_op_t *op = (async_op_t *) data;
+	if (!(op->list = repo_status_collect(&op->repo, 0, true))) {
+		op_fail(op, -1, "path does not exist");
+	}
+}
+
+
+static napi_value
+status_resolve (napi_env env, async_op_t *op) {
+	napi_value array, obj;
+
+	napi_create_array_with_length(env, op->list->length, &array);
+
+	for (int i = 0; i < op->list->length; ++i) {
+		repo_status_t *r = &op->list->items[i];
+		bool clean = 0 == r->staged + r->modified + r->untracked;
+		napi_create_object(env, &obj);
+		set_string(env, obj, "name", r->item->name);
+		set_string(env, obj, "path", r->item->path);
+		set_string(env, obj, "branch", r->branch);
+		set_bool(env, obj, "bare", r->bare);
+		set_string(env, obj, "error", r->failed ? r->error : NULL);
+		set_bool(env, obj, "clean", clean && !r->failed);
+		set_number(env, obj, "staged", (double) r->staged);
+		set_number(env, obj, "modified", (double) r->modified);
+		set_number(env, obj, "untracked", (double) r->untracked);
+		napi_set_element(env, array, i, obj);
+	}
+
+	return array;
 }
 
-void
-Init (v8::Handle<v8::Object> exports) {
-	NODE_SET_METHOD(exports, "User", NewUser);
+
+static napi_value
+Status (napi_env env, napi_callback_info info) {
+	napi_value argv[1];
+	async_op_t *op;
+
+	if (!(op = op_new(env, info, 1, argv)))
+		return NULL;
+
+	if (!(op->root = arg_string(env, argv[0], "root"))) {
+		op_free(op);
+		return NULL;
+	}
+
+	op->repo.path = op->root;
+	op->resolve = status_resolve;
+	return op_queue(env, op, "repo.status", status_execute);
+}
+
+// clone(url, dest)
+
+static void
+clone_execute (napi_env env, void *data) {
+	async_op_t *op = (async_op_t *) data;
+	int error = repo_clone_with(&op->repo, op->url, op->name, NULL);
+	if (0 != error) {
+		op_fail(op, error, "clone failed");
+	}
+}
+
+
+static napi_value
+clone_resolve (napi_env env, async_op_t *op) {
+	return js_string(env, op->dest);
+}
+
+
+/**
+ * Reads `url` and `dest` into a new op. `repo_clone_with()`
+ * clones into `<repo->path>/<name>`, so `dest` is split there.
+ */
+
+static async_op_t *
+clone_op_new (napi_env env, napi_callback_info info, size_t argc, napi_value *argv) {
+	async_op_t *op;
+	char *slash;
+
+	if (!(op = op_new(env, info, argc, argv)))
+		return NULL;
+
+	if (!(op->url = arg_string(env, argv[0], "url"))
+			|| !(op->dest = arg_string(env, argv[1], "dest"))) {
+		op_free(op);
+		return NULL;
+	}
+
+	if ((slash = strrchr(op->dest, '/'))) {
+		op->root = strndup(op->dest, slash == op->dest ? 1 : slash - op->dest);
+		op->name = strdup(slash + 1);
+	} else {
+		op->root = strdup(".");
+		op->name = strdup(op->dest);
+	}
+
+	if (!op->root || !op->name || !*op->name) {
+		napi_throw_type_error(env, NULL, "dest must name a directory");
+		op_free(op);
+		return NULL;
+	}
+
+	op->repo.path = op->root;
+	op->resolve = clone_resolve;
+	return op;
+}
+
+
+static napi_value
+Clone (napi_env env, napi_callback_info info) {
+	napi_value argv[2];
+	async_op_t *op;
+
+	if (!(op = clone_op_new(env, info, 2, argv)))
+		return NULL;
+
+	return op_queue(env, op, "repo.clone", clone_execute);
+}
+
+/**
+ * cloneProgress(url, dest, rate, onProgress)
+ *
+ * Clones on a thread of its own rather than the threadpool, so
+ * dozens of long clones can't starve filesystem work, and posts
+ * progress snapshots through a `napi_threadsafe_function`. They
+ * are throttled to `rate` per second per clone and dropped when
+ * JavaScript falls behind, except for phase completions. The
+ * Promise settles once every queued snapshot has been delivered.
+ */
+
+#define CLONE_STREAM_RATE 10
+#define CLONE_STREAM_QUEUE 4
+
+static void
+stream_call_js (napi_env env, napi_value js_cb, void *context, void *data) {
+	repo_clone_progress_t *progress = (repo_clone_progress_t *) data;
+	napi_value obj, undefined;
+
+	if (env && js_cb) {
+		napi_create_object(env, &obj);
+		set_number(env, obj, "received", progress->received);
+		set_number(env, obj, "total", progress->total);
+		set_number(env, obj, "indexed", progress->indexed);
+		set_number(env, obj, "bytes", (double) progress->bytes);
+		set_number(env, obj, "checkoutCurrent", (double) progress->checkout_current);
+		set_number(env, obj, "checkoutTotal", (double) progress->checkout_total);
+		napi_get_undefined(env, &undefined);
+		napi_call_function(env, undefined, js_cb, 1, &obj, NULL);
+	}
+
+	free(progress);
+}
+
+
+static void
+stream_progress (const repo_clone_progress_t *progress, void *data) {
+	async_op_t *op = (async_op_t *) data;
+	repo_clone_progress_t *copy;
+	bool done = (progress->total && progress->indexed == progress->total)
+		|| (progress->checkout_total && progress->checkout_current == progress->checkout_total);
+
+	if (!repo_clone_throttle(&op->throttle, progress))
+		return;
+
+	if (!(copy = (repo_clone_progress_t *) malloc(sizeof(repo_clone_progress_t))))
+		return;
+
+	*copy = *progress;
+
+	// a full queue means JavaScript is behind, this snapshot is superseded
+	if (napi_ok != napi_call_threadsafe_function(op->tsfn, copy
+			, done ? napi_tsfn_blocking : napi_tsfn_nonblocking)) {
+		free(copy);
+	}
+}
+
+
+static void *
+stream_thread (void *data) {
+	async_op_t *op = (async_op_t *) data;
+	repo_clone_opts_t opts = { stream_progress, op };
+	int error = repo_clone_with(&op->repo, op->url, op->name, &opts);
+
+	if (0 != error) {
+		op_fail(op, error, "clone failed");
+	}
+
+	napi_release_threadsafe_function(op->tsfn, napi_tsfn_release);
+	return NULL;
+}
+
+
+static void
+stream_finalize (napi_env env, void *data, void *hint) {
+	async_op_t *op = (async_op_t *) data;
+	op_settle(env, op, true);
+	op_free(op);
+}
+
+
+static napi_value
+CloneProgress (napi_env env, napi_callback_info info) {
+	napi_value argv[4], promise, resource_name;
+	pthread_attr_t attr;
+	pthread_t thread;
+	napi_valuetype type;
+	double rate = 0;
+	async_op_t *op;
+
+	if (!(op = clone_op_new(env, info, 4, argv)))
+		return NULL;
+
+	if (napi_ok != napi_typeof(env, argv[3], &type) || napi_function != type) {
+		napi_throw_type_error(env, NULL, "onProgress must be a function");
+		op_free(op);
+		return NULL;
+	}
+
+	napi_get_value_double(env, argv[2], &rate);
+	op->throttle.interval_ms = 1000 / (rate > 0 ? rate : CLONE_STREAM_RATE);
+
+	if (napi_ok != napi_create_promise(env, &op->deferred, &promise)) {
+		op_free(op);
+		return NULL;
+	}
+
+	napi_create_string_utf8(env, "repo.cloneProgress", NAPI_AUTO_LENGTH, &resource_name);
+
+	// from here on `stream_finalize()` owns `op`
+	if (napi_ok != napi_create_threadsafe_function(env, argv[3], NULL, resource_name
+			, CLONE_STREAM_QUEUE, 1, op, stream_finalize, op, stream_call_js, &op->tsfn)) {
+		op->error = -1;
+		snprintf(op->message, sizeof(op->message), "%s", "failed to create progress callback");
+		op_settle(env, op, true);
+		op_free(op);
+		return promise;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	if (0 != pthread_create(&thread, &attr, stream_thread, op)) {
+		op_fail(op, -1, "failed to start clone thread");
+		napi_release_threadsafe_function(op->tsfn, napi_tsfn_release);
+	}
+
+	pthread_attr_destroy(&attr);
+	return promise;
+}
+
+
+static napi_value
+Init (napi_env env, napi_value exports) {
+	napi_property_descriptor props[] = {
+		{ "scan", NULL, Scan, NULL, NULL, NULL, napi_enumerable, NULL },
+		{ "scanObjects", NULL, ScanObjects, NULL, NULL, NULL, napi_enumerable, NULL },
+		{ "status", NULL, Status, NULL, NULL, NULL, napi_enumerable, NULL },
+		{ "clone", NULL, Clone, NULL, NULL, NULL, napi_enumerable, NULL },
+		{ "cloneProgress", NULL, CloneProgress, NULL, NULL, NULL, napi_enumerable, NULL },
+	};
+
+	git_threads_init();
+	NAPI_CALL(env, napi_define_properties(env, exports, sizeof(props) / sizeof(props[0]), props));
+	return exports;
 }
 
-NODE_MODULE(repo, Init);
\ No newline at end of file
+NAPI_MODULE(NODE_GYP_MODULE_NAME, Init)
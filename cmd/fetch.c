@@ -0,0 +1,12 @@
+
+#include <repo.h>
+#include <assert.h>
+
+int
+main (int argc, char *argv[]) {
+	// initialize session
+	repo_session_t *sess = repo_session_init(argc, argv);
+	repo_cmd_fetch(sess);
+	repo_session_free(sess);
+	return 0;
+}
@@ -178,6 +178,8 @@ enum actions {
 #define NR_CLASSES	(C_HASH + 1)
 
 #define IS_STATE_ACTION(s) ((s) & 0x80)
+#define IS_STRING_STATE(s) \
+	(((s) >= STATE__S && (s) <= STATE_U4) || (s) == STATE_D1 || (s) == STATE_D2)
 #define S(x) STATE_##x
 #define PT_(a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p,q,r,s,t,u,v,w,x,y,z,a1,b1,c1,d1,e1,f1,g1,h1)	\
 	{ S(a),S(b),S(c),S(d),S(e),S(f),S(g),S(h),S(i),S(j),S(k),S(l),S(m),S(n),		\
@@ -335,8 +337,17 @@ static inline void *memory_calloc(void *(*calloc_fct)(size_t, size_t), size_t nm
 	return (calloc_fct) ? calloc_fct(nmemb, size) : calloc(nmemb, size);
 }
 
+static inline void memory_free(void (*free_fct)(void *), void *ptr)
+{
+	if (free_fct)
+		free_fct(ptr);
+	else
+		free(ptr);
+}
+
 #define parser_calloc(parser, n, s) memory_calloc(parser->config.user_calloc, n, s)
 #define parser_realloc(parser, n, s) memory_realloc(parser->config.user_realloc, n, s)
+#define parser_free(parser, p) memory_free(parser->config.user_free, p)
 
 static int state_grow(json_parser *parser)
 {
@@ -408,6 +419,20 @@ static int buffer_push(json_parser *parser, unsigned char c)
 	return 0;
 }
 
+static int buffer_push_run(json_parser *parser, const char *s, uint32_t n)
+{
+	int ret;
+
+	while (parser->buffer_offset + n >= parser->buffer_size) {
+		ret = buffer_grow(parser);
+		if (ret)
+			return ret;
+	}
+	memcpy(parser->buffer + parser->buffer_offset, s, n);
+	parser->buffer_offset += n;
+	return 0;
+}
+
 static int do_callback_withbuf(json_parser *parser, int type)
 {
 	if (!parser->callback)
@@ -596,7 +621,11 @@ static int act_ae(json_parser *parser)
 static int act_se(json_parser *parser)
 {
 	int ret;
-	CHK(do_callback_withbuf(parser, (parser->expecting_key) ? JSON_KEY : JSON_STRING));
+	parser->raw = (parser->string_start && !parser->string_escaped) ? parser->string_start : NULL;
+	ret = do_callback_withbuf(parser, (parser->expecting_key) ? JSON_KEY : JSON_STRING);
+	parser->raw = NULL;
+	if (ret)
+		return ret;
 	parser->buffer_offset = 0;
 	parser->state = (parser->expecting_key) ? STATE_CO : STATE_OK;
 	parser->expecting_key = 0;
@@ -698,7 +727,7 @@ int json_parser_init(json_parser *parser, json_config *config,
 
 	parser->buffer = parser_calloc(parser, parser->buffer_size, sizeof(char));
 	if (!parser->buffer) {
-		free(parser->stack);
+		parser_free(parser, parser->stack);
 		return JSON_ERROR_NO_MEMORY;
 	}
 	return 0;
@@ -709,8 +738,8 @@ int json_parser_free(json_parser *parser)
 {
 	if (!parser)
 		return 0;
-	free(parser->stack);
-	free(parser->buffer);
+	parser_free(parser, parser->stack);
+	parser_free(parser, parser->buffer);
 	parser->stack = NULL;
 	parser->buffer = NULL;
 	return 0;
@@ -723,6 +752,173 @@ int json_parser_is_done(json_parser *parser)
 	return parser->stack_offset == 0 && parser->state != STATE_GO;
 }
 
+/*
+ * fast paths for json_parser_string. a scanner returns the length of the
+ * leading run of bytes that the state machine would consume without any
+ * action: plain string content (no quote, backslash, control character or
+ * non-ASCII byte, which stay on the slow path for escapes and UTF-8
+ * validation) and blanks between tokens.
+ */
+struct json_scanner
+{
+	json_scanner_type type;
+	uint32_t (*string)(const unsigned char *s, uint32_t length);
+	uint32_t (*blank)(const unsigned char *s, uint32_t length);
+};
+
+#define IS_PLAIN_CHAR(c) ((unsigned char) ((c) - 0x20) < 0x60 && (c) != '"' && (c) != '\\')
+#define IS_BLANK_CHAR(c) ((c) == ' ' || (c) == '\n' || (c) == '\t' || (c) == '\r')
+/* states in which blanks are skipped without changing state */
+#define IS_BLANK_STATE(s) ((s) <= STATE__A)
+
+static uint32_t scan_string_scalar(const unsigned char *s, uint32_t length)
+{
+	uint32_t i = 0;
+	while (i < length && IS_PLAIN_CHAR(s[i]))
+		i++;
+	return i;
+}
+
+static uint32_t scan_blank_scalar(const unsigned char *s, uint32_t length)
+{
+	uint32_t i = 0;
+	while (i < length && IS_BLANK_CHAR(s[i]))
+		i++;
+	return i;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JSON_X86_SIMD 1
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static uint32_t scan_string_sse2(const unsigned char *s, uint32_t length)
+{
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backs = _mm_set1_epi8('\\');
+	const __m128i space = _mm_set1_epi8(0x20);
+	uint32_t i;
+
+	for (i = 0; i + 16 <= length; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+		/* signed compare: catches controls and bytes >= 0x80 at once */
+		__m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+		                                      _mm_cmpeq_epi8(v, backs)),
+		                         _mm_cmplt_epi8(v, space));
+		unsigned mask = (unsigned) _mm_movemask_epi8(m);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+	return i + scan_string_scalar(s + i, length - i);
+}
+
+__attribute__((target("sse2")))
+static uint32_t scan_blank_sse2(const unsigned char *s, uint32_t length)
+{
+	const __m128i sp = _mm_set1_epi8(' ');
+	const __m128i nl = _mm_set1_epi8('\n');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i cr = _mm_set1_epi8('\r');
+	uint32_t i;
+
+	for (i = 0; i + 16 <= length; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+		__m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, nl)),
+		                         _mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, cr)));
+		unsigned mask = ~(unsigned) _mm_movemask_epi8(m) & 0xffff;
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+	return i + scan_blank_scalar(s + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static uint32_t scan_string_avx2(const unsigned char *s, uint32_t length)
+{
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backs = _mm256_set1_epi8('\\');
+	const __m256i space = _mm256_set1_epi8(0x20);
+	uint32_t i;
+
+	for (i = 0; i + 32 <= length; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+		__m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+		                                            _mm256_cmpeq_epi8(v, backs)),
+		                            _mm256_cmpgt_epi8(space, v));
+		unsigned mask = (unsigned) _mm256_movemask_epi8(m);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+	return i + scan_string_scalar(s + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static uint32_t scan_blank_avx2(const unsigned char *s, uint32_t length)
+{
+	const __m256i sp = _mm256_set1_epi8(' ');
+	const __m256i nl = _mm256_set1_epi8('\n');
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i cr = _mm256_set1_epi8('\r');
+	uint32_t i;
+
+	for (i = 0; i + 32 <= length; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+		__m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, nl)),
+		                            _mm256_or_si256(_mm256_cmpeq_epi8(v, tab), _mm256_cmpeq_epi8(v, cr)));
+		unsigned mask = ~(unsigned) _mm256_movemask_epi8(m);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+	return i + scan_blank_scalar(s + i, length - i);
+}
+#endif
+
+static const struct json_scanner scanners[] = {
+	{ JSON_SCANNER_NONE,   NULL,               NULL },
+	{ JSON_SCANNER_SCALAR, scan_string_scalar, scan_blank_scalar },
+#ifdef JSON_X86_SIMD
+	{ JSON_SCANNER_SSE2,   scan_string_sse2,   scan_blank_sse2 },
+	{ JSON_SCANNER_AVX2,   scan_string_avx2,   scan_blank_avx2 },
+#endif
+};
+
+/* resolved on first use; racing threads resolve to the same value */
+static const struct json_scanner *scanner = NULL;
+
+static int scanner_supported(json_scanner_type type)
+{
+#ifdef JSON_X86_SIMD
+	switch (type) {
+	case JSON_SCANNER_SSE2: return __builtin_cpu_supports("sse2");
+	case JSON_SCANNER_AVX2: return __builtin_cpu_supports("avx2");
+	default: break;
+	}
+#endif
+	return type == JSON_SCANNER_NONE || type == JSON_SCANNER_SCALAR;
+}
+
+int json_set_scanner(json_scanner_type type)
+{
+	uint32_t i;
+
+	if (type == JSON_SCANNER_AUTO) {
+		for (type = JSON_SCANNER_AVX2; type > JSON_SCANNER_SCALAR; type--)
+			if (scanner_supported(type))
+				break;
+	}
+
+	if (!scanner_supported(type))
+		return -1;
+
+	for (i = 0; i < sizeof(scanners) / sizeof(scanners[0]); i++) {
+		if (scanners[i].type == type) {
+			scanner = &scanners[i];
+			return type;
+		}
+	}
+	return -1;
+}
+
 /** json_parser_string append a string s with a specific length to the parser
  * return 0 if everything went ok, a JSON_ERROR_* otherwise.
  * the user can supplied a valid processed pointer that will
@@ -735,10 +931,39 @@ int json_parser_string(json_parser *parser, const char *s,
 	int buffer_policy;
 	uint32_t i;
 
+	const struct json_scanner *scan;
+
+	/* a string continued from a previous chunk can't be referenced in place */
+	if (IS_STRING_STATE(parser->state))
+		parser->string_start = NULL;
+
+	if (!scanner)
+		json_set_scanner(JSON_SCANNER_AUTO);
+	scan = scanner;
+
 	ret = 0;
 	for (i = 0; i < length; i++) {
-		unsigned char ch = s[i];
+		unsigned char ch;
+
+		/* fast path: runs of plain string content are copied in bulk and
+		 * blanks between tokens skipped, the rest goes through the tables */
+		if (scan->string && parser->utf8_multibyte_left == 0) {
+			uint32_t run = 0;
+
+			if (parser->state == STATE__S && IS_PLAIN_CHAR((unsigned char) s[i])) {
+				run = scan->string((const unsigned char *) s + i, length - i);
+				ret = buffer_push_run(parser, s + i, run);
+				if (ret)
+					break;
+			} else if (IS_BLANK_STATE(parser->state) && IS_BLANK_CHAR(s[i]))
+				run = scan->blank((const unsigned char *) s + i, length - i);
+
+			i += run;
+			if (i == length)
+				break;
+		}
 
+		ch = s[i];
 		ret = 0;
 		if (parser->utf8_multibyte_left > 0) {
 			if (utf8_continuation_table[ch] != 0) {
@@ -778,6 +1003,13 @@ int json_parser_string(json_parser *parser, const char *s,
 				break;
 		}
 
+		/* track where strings start and whether they need unescaping */
+		if (next_state == STATE__S && !IS_STRING_STATE(parser->state)) {
+			parser->string_start = s + i + 1;
+			parser->string_escaped = 0;
+		} else if (next_state == STATE_E0)
+			parser->string_escaped = 1;
+
 		/* move to the next level */
 		if (IS_STATE_ACTION(next_state))
 			ret = do_action(parser, next_state);
@@ -823,19 +1055,26 @@ int json_print_free(json_printer *printer)
  * XXX: it doesn't do unicode verification. yet?. */
 static int print_string(json_printer *printer, const char *data, uint32_t length)
 {
-	uint32_t i;
+	uint32_t i, run = 0;
 
 	printer->callback(printer->userdata, "\"", 1);
 	for (i = 0; i < length; i++) {
 		unsigned char c = data[i];
-		if (c < 36) {
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+		/* hand over the pending run of plain bytes in one call */
+		if (i > run)
+			printer->callback(printer->userdata, data + run, i - run);
+		if (c == '\\') {
+			printer->callback(printer->userdata, "\\\\", 2);
+		} else {
 			char *esc = character_escape[c];
 			printer->callback(printer->userdata, esc, strlen(esc));
-		} else if (c == '\\') {
-			printer->callback(printer->userdata, "\\\\", 2);
-		} else
-			printer->callback(printer->userdata, data + i, 1);
+		}
+		run = i + 1;
 	}
+	if (i > run)
+		printer->callback(printer->userdata, data + run, i - run);
 	printer->callback(printer->userdata, "\"", 1);
 	return 0;
 }
@@ -977,8 +1216,8 @@ static int dom_push(struct json_parser_dom *ctx, void *val)
 {
 	if (ctx->stack_offset == ctx->stack_size) {
 		void *ptr;
-		uint32_t newsize = ctx->stack_size * 2;
-		ptr = memory_realloc(ctx->user_realloc, ctx->stack, newsize);
+		uint32_t newsize = ctx->stack_size ? ctx->stack_size * 2 : 1024;
+		ptr = memory_realloc(ctx->user_realloc, ctx->stack, newsize * sizeof(*(ctx->stack)));
 		if (!ptr)
 			return JSON_ERROR_NO_MEMORY;
 		ctx->stack = ptr;
@@ -1003,12 +1242,12 @@ int json_parser_dom_init(json_parser_dom *dom,
                          json_parser_dom_create_data create_data,
                          json_parser_dom_append append)
 {
+	/* the stack is allocated on first push so that allocator hooks
+	 * set after init are honoured */
 	memset(dom, 0, sizeof(*dom));
-	dom->stack_size = 1024;
+	dom->stack_size = 0;
 	dom->stack_offset = 0;
-	dom->stack = memory_calloc(dom->user_calloc, dom->stack_size, sizeof(*(dom->stack)));
-	if (!dom->stack)
-		return JSON_ERROR_NO_MEMORY;
+	dom->stack = NULL;
 	dom->append = append;
 	dom->create_structure = create_structure;
 	dom->create_data = create_data;
@@ -1017,7 +1256,9 @@ int json_parser_dom_init(json_parser_dom *dom,
 
 int json_parser_dom_free(json_parser_dom *dom)
 {
-	free(dom->stack);
+	if (dom->stack)
+		memory_free(dom->user_free, dom->stack);
+	dom->stack = NULL;
 	return 0;
 }
 
@@ -1041,7 +1282,8 @@ int json_parser_dom_callback(void *userdata, int type, const char *data, uint32_
 		if (ctx->stack_offset > 0) {
 			stack = &(ctx->stack[ctx->stack_offset - 1]);
 			ctx->append(stack->val, stack->key, stack->key_length, v);
-			free(stack->key);
+			memory_free(ctx->user_free, stack->key);
+			stack->key = NULL;
 		} else
 			ctx->root_structure = v;
 		break;
@@ -1065,7 +1307,8 @@ int json_parser_dom_callback(void *userdata, int type, const char *data, uint32_
 			return JSON_ERROR_CALLBACK;
 		if (ctx->append(stack->val, stack->key, stack->key_length, v))
 			return JSON_ERROR_CALLBACK;
-		free(stack->key);
+		memory_free(ctx->user_free, stack->key);
+		stack->key = NULL;
 		break;
 	}
 	return 0;
@@ -95,6 +95,7 @@ typedef struct {
 	int allow_yaml_comments;
 	void * (*user_calloc)(size_t nmemb, size_t size);
 	void * (*user_realloc)(void *ptr, size_t size);
+	void (*user_free)(void *ptr);
 } json_config;
 
 typedef struct json_parser {
@@ -121,6 +122,15 @@ typedef struct json_parser {
 	char *buffer;
 	uint32_t buffer_size;
 	uint32_t buffer_offset;
+
+	/* start of the current string in the input chunk, NULL when it
+	 * began in a previous chunk, and whether it contained an escape */
+	const char *string_start;
+	uint8_t string_escaped;
+
+	/* during a JSON_KEY or JSON_STRING callback, points to the string
+	 * bytes in the input when they needed no unescaping, NULL otherwise */
+	const char *raw;
 } json_parser;
 
 typedef struct json_printer {
@@ -157,6 +167,20 @@ int json_parser_char(json_parser *parser, unsigned char next_char);
 /** json_parser_is_done return 0 is the parser isn't in a finish state. !0 if it is */
 int json_parser_is_done(json_parser *parser);
 
+/** string content and whitespace scanners used by json_parser_string */
+typedef enum
+{
+	JSON_SCANNER_AUTO = 0, /* best available on this CPU */
+	JSON_SCANNER_NONE,     /* no fast path, byte at a time */
+	JSON_SCANNER_SCALAR,
+	JSON_SCANNER_SSE2,
+	JSON_SCANNER_AVX2,
+} json_scanner_type;
+
+/** json_set_scanner force the scanner used by every parser.
+ * return the scanner selected or -1 if the CPU doesn't support it */
+int json_set_scanner(json_scanner_type type);
+
 /** json_print_init initialize a printer context. always succeed */
 int json_print_init(json_printer *printer, json_printer_callback callback, void *userdata);
 
@@ -199,6 +223,7 @@ typedef struct json_parser_dom
 	/* overridable memory allocator */
 	void * (*user_calloc)(size_t nmemb, size_t size);
 	void * (*user_realloc)(void *ptr, size_t size);
+	void (*user_free)(void *ptr);
 
 	/* returned root structure (object or array) */
 	void *root_structure;
@@ -15,6 +15,8 @@
 #include <dirent.h> // readdir(), opendir(), scandir()
 #include <errno.h>
 #include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <commander.h>
 #include <json.h>
@@ -25,7 +27,6 @@
 
 #define REPO_PATH_MAX 4096
 #define REPO_NAME_MAX 256
-#define REPO_MAX_DIR_SIZE 500
 
 
 #if __GNUC__ >= 4
@@ -98,8 +99,26 @@ typedef struct repo_user {
 
 
 
+/**
+ * Bits recording which `repo_dir_item_t` fields have been
+ * computed. Cheap fields are filled in when the item is
+ * created, the rest on first access.
+ */
+
+#define REPO_ITEM_GIT  (1 << 0) // `is_git_repo`, needs a stat
+#define REPO_ITEM_OPEN (1 << 1) // `git_branch`, `is_bare`, `is_git_orphan`, needs libgit2
+
+
+/**
+ * Type structure that represents an entry of a repos directory
+ *
+ * @typedef `repo_dir_item_t`
+ * @struct `repo_dir_item`
+ */
+
 typedef struct repo_dir_item {
-  int ino;
+  ino_t ino;
+  unsigned int loaded;
   bool is_git_repo;
   bool is_git_orphan;
   bool is_bare;
@@ -107,8 +126,6 @@ typedef struct repo_dir_item {
   char *path;
   const char *git_branch;
   struct dirent *fd_;
-  git_repository *git_repo;
-  git_reference *git_head;
 } repo_dir_item_t;
 
 
@@ -122,10 +139,46 @@ typedef struct repo_dir_item {
 typedef struct repo_dir {
   char *path;
   int length;
-  repo_dir_item_t items[REPO_MAX_DIR_SIZE];
+  int alloc;
+  repo_dir_item_t *items;
 } repo_dir_t;
 
 
+/**
+ * Fields of a `repo_dir_item_t` that can be referenced by
+ * `--where` expressions and `--format` templates
+ */
+
+typedef enum repo_field {
+  REPO_FIELD_NAME,
+  REPO_FIELD_PATH,
+  REPO_FIELD_INO,
+  REPO_FIELD_GIT,
+  REPO_FIELD_BRANCH,
+  REPO_FIELD_BARE,
+  REPO_FIELD_ORPHAN,
+  REPO_FIELD_COUNT
+} repo_field_t;
+
+
+/**
+ * Type structure that represents a growable output buffer
+ * flushed to `fd` with large writes
+ *
+ * @typedef `repo_buf_t`
+ * @struct `repo_buf`
+ */
+
+#define REPO_BUF_FLUSH_SIZE (64 * 1024)
+
+typedef struct repo_buf {
+  char *data;
+  size_t length;
+  size_t alloc;
+  int fd;
+} repo_buf_t;
+
+
 // git
 
 typedef struct git_progress_payload {
@@ -136,8 +189,591 @@ typedef struct git_progress_payload {
 } git_progress_payload_t;
 
 
+/**
+ * Type structure that represents a fixed size pool of
+ * worker threads consuming a queue of jobs
+ *
+ * @typedef `repo_pool_t`
+ * @struct `repo_pool`
+ */
+
+typedef void (*repo_pool_job_cb) (void *data);
+
+typedef struct repo_pool_job {
+  repo_pool_job_cb fn;
+  void *data;
+  struct repo_pool_job *next;
+} repo_pool_job_t;
+
+typedef struct repo_pool {
+  int size;
+  int pending;
+  bool closed;
+  pthread_t *threads;
+  pthread_mutex_t lock;
+  pthread_cond_t has_work;
+  pthread_cond_t done;
+  repo_pool_job_t *head;
+  repo_pool_job_t *tail;
+} repo_pool_t;
+
+
+/**
+ * Type structure that represents a bounded, least recently
+ * used pool of open repositories, see `src/handles.c`
+ *
+ * @typedef `repo_handles_t`
+ * @struct `repo_handles`
+ */
+
+typedef struct repo_handle {
+  char *path;
+  uint32_t hash;
+  bool pinned;
+  bool pooled;
+  git_repository *repo;
+  struct repo_handle *chain;
+  struct repo_handle *prev;
+  struct repo_handle *next;
+} repo_handle_t;
+
+typedef struct repo_handles {
+  int capacity;
+  int length;
+  size_t mask;
+  size_t hits;
+  size_t misses;
+  size_t evictions;
+  repo_handle_t **buckets;
+  repo_handle_t *lru_head;
+  repo_handle_t *lru_tail;
+  pthread_mutex_t lock;
+} repo_handles_t;
+
+
+/**
+ * Type structure that represents a worker pool that limits
+ * how many jobs of each group run at once, see `src/sched.c`
+ *
+ * @typedef `repo_sched_t`
+ * @struct `repo_sched`
+ */
+
+typedef struct repo_sched_job repo_sched_job_t;
+
+typedef struct repo_sched_group {
+  char *key;
+  int active;
+  repo_sched_job_t *head;
+  repo_sched_job_t *tail;
+  struct repo_sched_group *next;
+} repo_sched_group_t;
+
+typedef struct repo_sched {
+  repo_pool_t *pool;
+  int limit;
+  int length;
+  pthread_mutex_t lock;
+  repo_sched_group_t *groups;
+  repo_sched_job_t **pending;
+  int pending_length;
+  int pending_alloc;
+} repo_sched_t;
+
+
+/**
+ * Type structure that represents the durations of past jobs
+ * kept under the root, see `src/history.c`. `fingerprint` and
+ * `work_ms` describe the last run that wasn't skipped as a no-op.
+ *
+ * @typedef `repo_history_t`
+ * @struct `repo_history`
+ */
+
+typedef struct repo_history_entry {
+  char *key;
+  double ms;
+  size_t bytes;
+  uint64_t fingerprint;
+  double work_ms;
+} repo_history_entry_t;
+
+typedef struct repo_history {
+  repo_t *repo;
+  repo_history_entry_t *entries;
+  int length;
+  int alloc;
+  int *slots;
+  size_t mask;
+  double mean;
+} repo_history_t;
+
+
+/**
+ * Type structure that represents `repo fetch` options
+ *
+ * @typedef `repo_fetch_opts_t`
+ * @struct `repo_fetch_opts`
+ */
+
+typedef struct repo_fetch_opts {
+  int jobs;
+  int per_host;
+  bool force;
+} repo_fetch_opts_t;
+
+
+/**
+ * Type structure that represents the fetch of one remote of
+ * a repository, see `repo_fetch_run()`. `known` is the
+ * fingerprint of the remote's refs as of the last fetch.
+ *
+ * @typedef `repo_fetch_job_t`
+ * @struct `repo_fetch_job`
+ */
+
+typedef struct repo_fetch_job {
+  repo_dir_item_t *item;
+  char *remote;
+  char *key;
+  char host[256];
+  size_t updated;
+  size_t bytes;
+  unsigned int objects;
+  double ms;
+  uint64_t fingerprint;
+  uint64_t known;
+  double work_ms;
+  bool skipped;
+  bool failed;
+  bool needs_auth;
+  char error[128];
+} repo_fetch_job_t;
+
+
+/**
+ * Type structure that represents `repo pull` options
+ *
+ * @typedef `repo_pull_opts_t`
+ * @struct `repo_pull_opts`
+ */
+
+typedef struct repo_pull_opts {
+  int jobs;
+  int per_host;
+  int checkouts;
+  bool ff_only;
+} repo_pull_opts_t;
+
+
+/**
+ * Type structure that represents `repo push` options
+ *
+ * @typedef `repo_push_opts_t`
+ * @struct `repo_push_opts`
+ */
+
+typedef struct repo_push_opts {
+  int jobs;
+  int per_host;
+  bool dry_run;
+} repo_push_opts_t;
+
+
+/**
+ * Type structure that represents `repo maintain` options
+ *
+ * @typedef `repo_maintain_opts_t`
+ * @struct `repo_maintain_opts`
+ */
+
+typedef struct repo_maintain_opts {
+  int jobs;
+  bool io_idle;
+} repo_maintain_opts_t;
+
+
+/**
+ * Type structure that represents one git object being hashed,
+ * see `src/sha1.c`
+ *
+ * @typedef `repo_sha1_msg_t`
+ * @struct `repo_sha1_msg`
+ */
+
+typedef struct repo_sha1_msg {
+  unsigned char head[32];
+  size_t head_length;
+  const unsigned char *data;
+  size_t length;
+  unsigned char hash[20];
+} repo_sha1_msg_t;
+
+
+/**
+ * Type structure that represents `repo fsck` options
+ *
+ * @typedef `repo_fsck_opts_t`
+ * @struct `repo_fsck_opts`
+ */
+
+typedef struct repo_fsck_opts {
+  int jobs;
+} repo_fsck_opts_t;
+
+
+/**
+ * Type structure that represents `repo du` options
+ *
+ * @typedef `repo_du_opts_t`
+ * @struct `repo_du_opts`
+ */
+
+typedef struct repo_du_opts {
+  int jobs;
+  bool by_size;
+  bool force;
+} repo_du_opts_t;
+
+
+/**
+ * Type structure that represents `repo clean` options
+ *
+ * @typedef `repo_clean_opts_t`
+ * @struct `repo_clean_opts`
+ */
+
+typedef struct repo_clean_opts {
+  int jobs;
+  bool ignored;
+  bool dry_run;
+} repo_clean_opts_t;
+
+
+/**
+ * Type structure that represents `repo stats` options
+ *
+ * @typedef `repo_census_opts_t`
+ * @struct `repo_census_opts`
+ */
+
+typedef struct repo_census_opts {
+  int jobs;
+} repo_census_opts_t;
+
+
+/**
+ * Type structure that represents `repo dupes` options
+ *
+ * @typedef `repo_dupes_opts_t`
+ * @struct `repo_dupes_opts`
+ */
+
+typedef struct repo_dupes_opts {
+  int jobs;
+  uint64_t min_size;
+} repo_dupes_opts_t;
+
+
+/**
+ * Type structure that represents `repo log` options
+ *
+ * @typedef `repo_log_opts_t`
+ * @struct `repo_log_opts`
+ */
+
+typedef struct repo_log_opts {
+  time_t since;
+  int max_count;
+  int jobs;
+  bool all;
+} repo_log_opts_t;
+
+
+/**
+ * Output modes selected with `--json` / `--ndjson`
+ */
+
+typedef enum repo_output {
+  REPO_OUTPUT_TEXT,
+  REPO_OUTPUT_JSON,
+  REPO_OUTPUT_NDJSON
+} repo_output_t;
+
+
+/**
+ * Type structure that represents a stream of JSON records,
+ * see `src/emit.c`
+ *
+ * @typedef `repo_emitter_t`
+ * @struct `repo_emitter`
+ */
+
+typedef struct repo_emitter {
+  repo_output_t mode;
+  repo_buf_t *buf;
+  json_printer printer;
+  int records;
+} repo_emitter_t;
+
+
+/**
+ * Type structure that represents a bump allocator whose
+ * allocations are released together, see `src/arena.c`
+ *
+ * @typedef `repo_arena_t`
+ * @struct `repo_arena`
+ */
+
+#define REPO_ARENA_CHUNK_SIZE (1024 * 1024)
+
+typedef struct repo_arena_chunk {
+  struct repo_arena_chunk *next;
+  size_t size;
+  size_t used;
+  char data[];
+} repo_arena_chunk_t;
+
+typedef struct repo_arena {
+  repo_arena_chunk_t *head;
+  size_t chunk_size;
+  size_t allocations;
+  size_t bytes;
+  size_t chunks;
+} repo_arena_t;
+
+
+/**
+ * Type structure that represents a string of a parsed JSON
+ * document, `copy` is NULL when it is borrowed from the input
+ * at `offset`
+ *
+ * @typedef `repo_json_str_t`
+ * @struct `repo_json_str`
+ */
+
+typedef struct repo_json_str {
+  uint32_t offset;
+  uint32_t length;
+  char *copy;
+} repo_json_str_t;
+
+
+/**
+ * Type structure that represents a JSON value, objects and
+ * arrays link their `count` children through `next`
+ *
+ * @typedef `repo_json_node_t`
+ * @struct `repo_json_node`
+ */
+
+typedef struct repo_json_node {
+  json_type type;
+  uint32_t count;
+  repo_json_str_t key;
+  repo_json_str_t value;
+  struct repo_json_node *child;
+  struct repo_json_node *next;
+} repo_json_node_t;
+
+
+/**
+ * Type structure that represents a JSON document parsed
+ * into an arena, see `src/dom.c`
+ *
+ * @typedef `repo_json_doc_t`
+ * @struct `repo_json_doc`
+ */
+
+typedef struct repo_json_doc {
+  const char *input;
+  size_t length;
+  repo_arena_t *arena;
+  repo_json_node_t *root;
+} repo_json_doc_t;
+
+
+/**
+ * Type structure that represents the progress of a clone
+ *
+ * @typedef `repo_clone_progress_t`
+ * @struct `repo_clone_progress`
+ */
+
+typedef struct repo_clone_progress {
+  unsigned int received;
+  unsigned int total;
+  unsigned int indexed;
+  size_t bytes;
+  size_t checkout_current;
+  size_t checkout_total;
+} repo_clone_progress_t;
+
+typedef void (*repo_clone_progress_cb) (const repo_clone_progress_t *progress, void *data);
+
+
+/**
+ * Type structure that represents `repo_clone_with()` options
+ *
+ * @typedef `repo_clone_opts_t`
+ * @struct `repo_clone_opts`
+ */
+
+typedef struct repo_clone_opts {
+  repo_clone_progress_cb progress;
+  void *data;
+} repo_clone_opts_t;
+
+
+/**
+ * Type structure that represents the last progress reported
+ * by a consumer of `repo_clone_opts_t.progress` that wants at
+ * most one report per interval, see `repo_clone_throttle()`
+ *
+ * @typedef `repo_clone_throttle_t`
+ * @struct `repo_clone_throttle`
+ */
+
+typedef struct repo_clone_throttle {
+  long interval_ms;
+  struct timespec last;
+  unsigned int last_received;
+  size_t last_checkout;
+} repo_clone_throttle_t;
+
+
+/**
+ * Compiled `--where` predicate, see `src/where.c`
+ *
+ * @typedef `repo_where_t`
+ * @struct `repo_where`
+ */
+
+typedef struct repo_where repo_where_t;
+
+
+/**
+ * Compiled `--format` template, see `src/format.c`
+ *
+ * @typedef `repo_format_t`
+ * @struct `repo_format`
+ */
+
+typedef struct repo_format repo_format_t;
+
+
+/**
+ * Type structure that represents `repo ls` options
+ *
+ * @typedef `repo_ls_opts_t`
+ * @struct `repo_ls_opts`
+ */
+
+typedef struct repo_ls_opts {
+  repo_where_t *where;
+  repo_format_t *format;
+  repo_output_t output;
+} repo_ls_opts_t;
+
+
+/**
+ * Type structure that represents the state of one repository
+ * collected by `repo_status_collect()`. Working tree counts are
+ * only filled in when collected with `workdir`
+ *
+ * @typedef `repo_status_t`
+ * @struct `repo_status`
+ */
+
+typedef struct repo_status {
+  repo_dir_item_t *item;
+  const char *branch;
+  git_reference *head;
+  size_t staged;
+  size_t modified;
+  size_t untracked;
+  bool bare;
+  bool orphan;
+  bool failed;
+  char error[128];
+} repo_status_t;
+
+typedef struct repo_status_list {
+  repo_dir_t *dir;
+  repo_status_t *items;
+  int length;
+} repo_status_list_t;
+
+
+/**
+ * Type structure that represents the trace events recorded by
+ * one thread, see `src/trace.c`. Only the owning thread writes
+ * to a ring; `head` counts every event it ever recorded.
+ *
+ * @typedef `repo_trace_ring_t`
+ * @struct `repo_trace_ring`
+ */
+
+#define REPO_TRACE_RING_SIZE (16 * 1024)
+
+typedef struct repo_trace_event {
+  long long ns;
+  const char *name;
+  char phase;
+  char arg[47];
+} repo_trace_event_t;
+
+typedef struct repo_trace_ring {
+  struct repo_trace_ring *next;
+  size_t head;
+  int tid;
+  repo_trace_event_t events[REPO_TRACE_RING_SIZE];
+} repo_trace_ring_t;
+
+#define REPO_TRACE_BEGIN(name, arg)                        \
+  if (__builtin_expect(repo_trace_enabled, 0))             \
+    repo_trace_event('B', name, arg);
+
+#define REPO_TRACE_END(name)                               \
+  if (__builtin_expect(repo_trace_enabled, 0))             \
+    repo_trace_event('E', name, NULL);
+
+
+/**
+ * Kinds of operation `--stats` counts, see
+ * `src/stats.c`
+ */
+
+typedef enum repo_stats_op {
+  REPO_STATS_OTHER,
+  REPO_STATS_OPEN,
+  REPO_STATS_HEAD,
+  REPO_STATS_STATUS,
+  REPO_STATS_CLONE,
+  REPO_STATS_WALK,
+  REPO_STATS_FETCH,
+  REPO_STATS_CHECKOUT,
+  REPO_STATS_FSCK,
+  REPO_STATS_OP_COUNT
+} repo_stats_op_t;
+
+
+/**
+ * Type structure that represents how often one kind of
+ * operation ran
+ *
+ * @typedef `repo_stats_counter_t`
+ * @struct `repo_stats_counter`
+ */
+
+typedef struct repo_stats_counter {
+  size_t calls;
+} repo_stats_counter_t;
+
+
 typedef struct repo_session {
   repo_user_t *user;
+  repo_output_t output;
   command_t program;
   int argc;
   char *argv[];
@@ -175,19 +811,82 @@ repo_set (repo_user_t *user, char *path);
 
 // dir
 void
-repo_dir_ls (repo_t *repo);
+repo_dir_ls (repo_t *repo, repo_ls_opts_t *opts);
 
 repo_dir_t *
 repo_dir_new (char *path);
 
+void
+repo_dir_free (repo_dir_t *dir);
+
 repo_dir_item_t *
 repo_dir_item_new(char *root, struct dirent *fd, repo_dir_t *dir);
 
+bool
+repo_dir_item_is_git_repo (repo_dir_item_t *item);
+
+void
+repo_dir_item_load (repo_dir_item_t *item);
+
+const char *
+repo_dir_item_branch (repo_dir_item_t *item);
+
+bool
+repo_dir_item_is_bare (repo_dir_item_t *item);
+
+bool
+repo_dir_item_is_orphan (repo_dir_item_t *item);
+
+int
+repo_field_lookup (const char *name, size_t len);
+
+int
+repo_field_cost (repo_field_t field);
+
+// buf
+repo_buf_t *
+repo_buf_new (int fd);
+
+int
+repo_buf_write (repo_buf_t *buf, const char *data, size_t len);
+
+int
+repo_buf_puts (repo_buf_t *buf, const char *str);
+
+int
+repo_buf_flush (repo_buf_t *buf);
+
+void
+repo_buf_free (repo_buf_t *buf);
+
+// format
+repo_format_t *
+repo_format_compile (const char *source, char *error, size_t size);
+
+int
+repo_format_write (repo_format_t *format, repo_dir_item_t *item, repo_buf_t *out);
+
+void
+repo_format_free (repo_format_t *format);
+
+// where
+repo_where_t *
+repo_where_compile (const char *expr, char *error, size_t size);
+
+bool
+repo_where_match (repo_where_t *where, repo_dir_item_t *item);
+
+void
+repo_where_free (repo_where_t *where);
+
 // util
 
 bool
 repo_is_dir (char *path);
 
+int
+repo_cache_path (repo_t *repo, const char *name, char *out, size_t size);
+
 void
 repo_help_commands ();
 
@@ -207,6 +906,287 @@ repo_is_git_repo (repo_dir_item_t *item);
 int
 repo_clone (repo_t *repo, const char *url, const char *path);
 
+int
+repo_clone_with (repo_t *repo, const char *url, const char *path, repo_clone_opts_t *opts);
+
+bool
+repo_clone_throttle (repo_clone_throttle_t *throttle, const repo_clone_progress_t *progress);
+
+// status
+repo_status_list_t *
+repo_status_collect (repo_t *repo, int jobs, bool workdir);
+
+void
+repo_status_list_free (repo_status_list_t *list);
+
+int
+repo_status_print (repo_t *repo, repo_output_t output, int jobs);
+
+// emit
+repo_emitter_t *
+repo_emitter_new (repo_output_t mode, int fd);
+
+void
+repo_emitter_begin (repo_emitter_t *emitter);
+
+void
+repo_emitter_str (repo_emitter_t *emitter, const char *key, const char *value);
+
+void
+repo_emitter_int (repo_emitter_t *emitter, const char *key, long long value);
+
+void
+repo_emitter_float (repo_emitter_t *emitter, const char *key, double value);
+
+void
+repo_emitter_bool (repo_emitter_t *emitter, const char *key, bool value);
+
+void
+repo_emitter_object (repo_emitter_t *emitter, const char *key);
+
+void
+repo_emitter_object_end (repo_emitter_t *emitter);
+
+void
+repo_emitter_end (repo_emitter_t *emitter);
+
+int
+repo_emitter_flush (repo_emitter_t *emitter);
+
+void
+repo_emitter_free (repo_emitter_t *emitter);
+
+// arena
+repo_arena_t *
+repo_arena_new (size_t chunk_size);
+
+void *
+repo_arena_alloc (repo_arena_t *arena, size_t size);
+
+void *
+repo_arena_calloc (repo_arena_t *arena, size_t nmemb, size_t size);
+
+void *
+repo_arena_realloc (repo_arena_t *arena, void *ptr, size_t size);
+
+void
+repo_arena_reset (repo_arena_t *arena);
+
+void
+repo_arena_free (repo_arena_t *arena);
+
+repo_arena_t *
+repo_arena_use (repo_arena_t *arena);
+
+void
+repo_arena_json_config (json_config *config);
+
+void
+repo_arena_json_dom (json_parser_dom *dom);
+
+// dom
+int
+repo_json_parse (repo_json_doc_t *doc, repo_arena_t *arena, const char *input, size_t length);
+
+const char *
+repo_json_str (repo_json_doc_t *doc, const repo_json_str_t *str);
+
+bool
+repo_json_str_eq (repo_json_doc_t *doc, const repo_json_str_t *str, const char *value);
+
+char *
+repo_json_strdup (repo_json_doc_t *doc, const repo_json_str_t *str);
+
+repo_json_node_t *
+repo_json_get (repo_json_doc_t *doc, repo_json_node_t *object, const char *key);
+
+long long
+repo_json_int (repo_json_doc_t *doc, repo_json_node_t *node);
+
+// trace
+extern bool repo_trace_enabled;
+
+int
+repo_trace_start (const char *file);
+
+void
+repo_trace_event (char phase, const char *name, const char *arg);
+
+void
+repo_trace_flush ();
+
+// stats
+extern bool repo_stats_enabled;
+
+int
+repo_stats_install ();
+
+void
+repo_stats_count (repo_stats_op_t op);
+
+void
+repo_stats_read (repo_stats_op_t op, repo_stats_counter_t *out);
+
+void
+repo_stats_report ();
+
+// handles
+int
+repo_handles_budget ();
+
+repo_handles_t *
+repo_handles_new (int capacity);
+
+int
+repo_handles_get (repo_handles_t *handles, const char *path, repo_handle_t **out);
+
+void
+repo_handles_put (repo_handles_t *handles, repo_handle_t *h);
+
+void
+repo_handles_clear (repo_handles_t *handles);
+
+void
+repo_handles_free (repo_handles_t *handles);
+
+repo_handles_t *
+repo_handles_default ();
+
+void
+repo_handles_shutdown ();
+
+// pool
+int
+repo_pool_default_size ();
+
+repo_pool_t *
+repo_pool_new (int size);
+
+int
+repo_pool_push (repo_pool_t *pool, repo_pool_job_cb fn, void *data);
+
+void
+repo_pool_wait (repo_pool_t *pool);
+
+void
+repo_pool_free (repo_pool_t *pool);
+
+// sched
+repo_sched_t *
+repo_sched_new (int jobs, int limit);
+
+int
+repo_sched_push (repo_sched_t *sched, const char *key, repo_pool_job_cb fn, void *data);
+
+int
+repo_sched_add (repo_sched_t *sched, const char *key, double cost, repo_pool_job_cb fn, void *data);
+
+double
+repo_sched_start (repo_sched_t *sched);
+
+void
+repo_sched_wait (repo_sched_t *sched);
+
+void
+repo_sched_free (repo_sched_t *sched);
+
+// history
+repo_history_t *
+repo_history_load (repo_t *repo);
+
+double
+repo_history_predict (repo_history_t *history, const char *key);
+
+repo_history_entry_t *
+repo_history_find (repo_history_t *history, const char *key);
+
+int
+repo_history_record (repo_history_t *history, const char *key, double ms, size_t bytes);
+
+int
+repo_history_save (repo_history_t *history);
+
+void
+repo_history_free (repo_history_t *history);
+
+// fetch
+int
+repo_remote_host (const char *url, char *out, size_t size);
+
+repo_fetch_job_t *
+repo_fetch_job_new (repo_dir_item_t *item, git_repository *repo, const char *remote, repo_history_t *history);
+
+void
+repo_fetch_run (void *data);
+
+void
+repo_fetch_record (repo_history_t *history, repo_fetch_job_t *job);
+
+void
+repo_fetch_job_free (repo_fetch_job_t *job);
+
+int
+repo_fetch_all (repo_t *repo, repo_output_t output, repo_fetch_opts_t *opts);
+
+// pull
+int
+repo_pull_all (repo_t *repo, repo_output_t output, repo_pull_opts_t *opts);
+
+// push
+int
+repo_push_all (repo_t *repo, repo_output_t output, repo_push_opts_t *opts);
+
+// maintain
+int
+repo_maintain_all (repo_t *repo, repo_output_t output, repo_maintain_opts_t *opts);
+
+// sha1
+void
+repo_sha1_object (repo_sha1_msg_t *msg, const char *type, const void *data, size_t length);
+
+void
+repo_sha1 (repo_sha1_msg_t *msg);
+
+void
+repo_sha1_batch (repo_sha1_msg_t **msgs, int count);
+
+int
+repo_sha1_lanes ();
+
+// fsck
+int
+repo_fsck_all (repo_t *repo, repo_output_t output, repo_fsck_opts_t *opts);
+
+// du
+int
+repo_du_all (repo_t *repo, repo_output_t output, repo_du_opts_t *opts);
+
+// clean
+int
+repo_clean_all (repo_t *repo, repo_output_t output, repo_clean_opts_t *opts);
+
+// census
+int
+repo_census_all (repo_t *repo, repo_output_t output, repo_census_opts_t *opts);
+
+// dupes
+int
+repo_dupes_all (repo_t *repo, repo_output_t output, repo_dupes_opts_t *opts);
+
+// log
+int
+repo_log_parse_date (const char *str, time_t *out);
+
+int
+repo_log_print (repo_t *repo, repo_log_opts_t *opts);
+
+// which
+int
+repo_which_update (repo_t *repo, int jobs);
+
+int
+repo_which_lookup (repo_t *repo, const char *prefix);
+
 // commands
 bool
 repo_cmd_is (const char * cmd);
@@ -224,6 +1204,42 @@ repo_cmd_ls (repo_session_t *sess);
 void
 repo_cmd_clone (repo_session_t *sess);
 
+void
+repo_cmd_log (repo_session_t *sess);
+
+void
+repo_cmd_which (repo_session_t *sess);
+
+void
+repo_cmd_status (repo_session_t *sess);
+
+void
+repo_cmd_fetch (repo_session_t *sess);
+
+void
+repo_cmd_pull (repo_session_t *sess);
+
+void
+repo_cmd_push (repo_session_t *sess);
+
+void
+repo_cmd_maintain (repo_session_t *sess);
+
+void
+repo_cmd_fsck (repo_session_t *sess);
+
+void
+repo_cmd_du (repo_session_t *sess);
+
+void
+repo_cmd_clean (repo_session_t *sess);
+
+void
+repo_cmd_stats (repo_session_t *sess);
+
+void
+repo_cmd_dupes (repo_session_t *sess);
+
 
 
 
@@ -245,6 +1261,9 @@ repo_cmd_has (const char *cmd);
 void
 repo_cmd_parse (repo_session_t *sess);
 
+const char *
+repo_cmd_positional (repo_session_t *sess, const char *cmd, int n);
+
 int
 repo_args_index (const char *str);
 
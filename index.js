@@ -1,4 +1,154 @@
-var repo = require('bindings')('repo');
+var path = require('path')
+  , repo = require('bindings')('repo');
 
-user = new repo.User()
-console.log(repo)
\ No newline at end of file
+/**
+ * Promise returning wrappers around the native addon. All of
+ * the work happens on the libuv threadpool, see bindings.cc
+ */
+
+var PACK_MAGIC = 0x4e435352
+  , PACK_HEADER = 5
+  , PACK_FIELDS = 12
+  , PACK_NONE = 0xffffffff
+  , PACK_BARE = 1 << 0
+  , PACK_ORPHAN = 1 << 1
+  , PACK_FAILED = 1 << 2;
+
+/**
+ * Lazy view over the packed results of `scan()`. Nothing is
+ * decoded until a field is read, strings are decoded straight
+ * out of the shared buffer.
+ */
+
+function ScanResult (buffer) {
+  var header = new Uint32Array(buffer, 0, PACK_HEADER);
+
+  if (PACK_MAGIC !== header[0]) {
+    throw new Error('repo: bad scan result');
+  }
+
+  this.length = header[2];
+  this.table = new Uint32Array(buffer, 0, PACK_HEADER + this.length * PACK_FIELDS);
+  this.blob = Buffer.from(buffer, header[4]);
+}
+
+ScanResult.prototype.string = function (i, field) {
+  var base = PACK_HEADER + i * PACK_FIELDS + field
+    , offset = this.table[base];
+  if (PACK_NONE === offset) return null;
+  return this.blob.toString('utf8', offset, offset + this.table[base + 1]);
+};
+
+ScanResult.prototype.flags = function (i) {
+  return this.table[PACK_HEADER + i * PACK_FIELDS + 8];
+};
+
+ScanResult.prototype.name = function (i) { return this.string(i, 0); };
+ScanResult.prototype.path = function (i) { return this.string(i, 2); };
+ScanResult.prototype.branch = function (i) { return this.string(i, 4); };
+ScanResult.prototype.error = function (i) { return this.string(i, 6); };
+ScanResult.prototype.bare = function (i) { return 0 !== (this.flags(i) & PACK_BARE); };
+ScanResult.prototype.orphan = function (i) { return 0 !== (this.flags(i) & PACK_ORPHAN); };
+ScanResult.prototype.failed = function (i) { return 0 !== (this.flags(i) & PACK_FAILED); };
+
+ScanResult.prototype.inode = function (i) {
+  var base = PACK_HEADER + i * PACK_FIELDS;
+  return this.table[base + 9] + this.table[base + 10] * 0x100000000;
+};
+
+// materialises row `i` as a plain object
+ScanResult.prototype.get = function (i) {
+  return {
+    name: this.name(i),
+    path: this.path(i),
+    branch: this.branch(i),
+    bare: this.bare(i),
+    orphan: this.orphan(i),
+    error: this.error(i),
+    inode: this.inode(i)
+  };
+};
+
+ScanResult.prototype[Symbol.iterator] = function* () {
+  for (var i = 0; i < this.length; ++i) yield this.get(i);
+};
+
+exports.ScanResult = ScanResult;
+
+exports.scan = function (root) {
+  return repo.scan(path.resolve(root)).then(function (buffer) {
+    return new ScanResult(buffer);
+  });
+};
+
+// one object per repository, built natively
+exports.scanObjects = function (root) {
+  return repo.scanObjects(path.resolve(root));
+};
+
+exports.status = function (root) {
+  return repo.status(path.resolve(root));
+};
+
+exports.clone = function (url, dest) {
+  return repo.clone(url, path.resolve(dest));
+};
+
+/**
+ * Clones `url` into `dest` and returns an async iterator of
+ * progress snapshots `{received, total, indexed, bytes,
+ * checkoutCurrent, checkoutTotal}`, at most `options.rate` a
+ * second (default 10). Snapshots a slow consumer hasn't read
+ * are replaced by newer ones. `result` settles with the clone.
+ */
+
+exports.cloneProgress = function (url, dest, options) {
+  var rate = options && options.rate || 10
+    , pending = null
+    , waiting = []
+    , finished = false
+    , failure = null;
+
+  // settles waiting `next()` calls in the order they were made,
+  // the first one after a failure rejects and the rest are done
+  function settle () {
+    while (waiting.length) {
+      if (pending) {
+        waiting.shift().resolve({ value: pending, done: false });
+        pending = null;
+      } else if (failure) {
+        waiting.shift().reject(failure);
+        failure = null;
+        finished = true;
+      } else if (finished) {
+        waiting.shift().resolve({ value: undefined, done: true });
+      } else {
+        return;
+      }
+    }
+  }
+
+  var result = repo.cloneProgress(url, path.resolve(dest), rate, function (progress) {
+    pending = progress;
+    settle();
+  });
+
+  result.then(function () {
+    finished = true;
+    settle();
+  }, function (err) {
+    failure = err;
+    settle();
+  });
+
+  return {
+    result: result,
+    next: function () {
+      return new Promise(function (resolve, reject) {
+        waiting.push({ resolve: resolve, reject: reject });
+        settle();
+      });
+    },
+    [Symbol.asyncIterator]: function () { return this; }
+  };
+};
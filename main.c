@@ -16,6 +16,30 @@ main (int argc, char *argv[]) {
 			repo_cmd_ls(sess);
 		} else if (repo_cmd_has("clone")) {
 			repo_cmd_clone(sess);
+		} else if (repo_cmd_has("log")) {
+			repo_cmd_log(sess);
+		} else if (repo_cmd_has("which")) {
+			repo_cmd_which(sess);
+		} else if (repo_cmd_has("status")) {
+			repo_cmd_status(sess);
+		} else if (repo_cmd_has("fetch")) {
+			repo_cmd_fetch(sess);
+		} else if (repo_cmd_has("pull")) {
+			repo_cmd_pull(sess);
+		} else if (repo_cmd_has("push")) {
+			repo_cmd_push(sess);
+		} else if (repo_cmd_has("maintain")) {
+			repo_cmd_maintain(sess);
+		} else if (repo_cmd_has("fsck")) {
+			repo_cmd_fsck(sess);
+		} else if (repo_cmd_has("du")) {
+			repo_cmd_du(sess);
+		} else if (repo_cmd_has("clean")) {
+			repo_cmd_clean(sess);
+		} else if (repo_cmd_has("stats")) {
+			repo_cmd_stats(sess);
+		} else if (repo_cmd_has("dupes")) {
+			repo_cmd_dupes(sess);
 		} else if (repo_cmd_has("cmd")) {
 			repo_cmd_cmd(sess);
     } else if (repo_cmd_has("help")) {
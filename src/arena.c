@@ -0,0 +1,213 @@
+
+#include <repo.h>
+
+/**
+ * Bump allocator. Allocations are carved out of large chunks
+ * and are never freed individually; `repo_arena_reset()` drops
+ * everything at once. Each allocation is preceded by its size
+ * so that `repo_arena_realloc()` can copy or grow in place.
+ */
+
+#define ARENA_ALIGN sizeof(size_t)
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define ARENA_HEADER ARENA_ROUND(sizeof(size_t))
+
+// arena used by the `json_config` hooks on this thread
+static __thread repo_arena_t *current = NULL;
+
+
+static repo_arena_chunk_t *
+chunk_new (repo_arena_t *arena, size_t size) {
+  repo_arena_chunk_t *chunk;
+
+  if (!(chunk = malloc(sizeof(repo_arena_chunk_t) + size)))
+    return NULL;
+
+  chunk->next = NULL;
+  chunk->size = size;
+  chunk->used = 0;
+  arena->chunks++;
+  return chunk;
+}
+
+
+repo_arena_t *
+repo_arena_new (size_t chunk_size) {
+  repo_arena_t *arena;
+
+  if (!(arena = malloc(sizeof(repo_arena_t))))
+    return NULL;
+
+  arena->chunk_size = chunk_size > 0 ? ARENA_ROUND(chunk_size) : REPO_ARENA_CHUNK_SIZE;
+  arena->allocations = 0;
+  arena->bytes = 0;
+  arena->chunks = 0;
+
+  if (!(arena->head = chunk_new(arena, arena->chunk_size))) {
+    free(arena);
+    return NULL;
+  }
+
+  return arena;
+}
+
+
+void *
+repo_arena_alloc (repo_arena_t *arena, size_t size) {
+  repo_arena_chunk_t *chunk = arena->head;
+  size_t need = ARENA_HEADER + ARENA_ROUND(size);
+  char *ptr;
+
+  if (chunk->size - chunk->used < need) {
+    if (need > arena->chunk_size / 4) {
+      // oversized requests get a chunk of their own behind the
+      // head so the space left in the head is not wasted
+      if (!(chunk = chunk_new(arena, need)))
+        return NULL;
+      chunk->next = arena->head->next;
+      arena->head->next = chunk;
+    } else {
+      if (!(chunk = chunk_new(arena, arena->chunk_size)))
+        return NULL;
+      chunk->next = arena->head;
+      arena->head = chunk;
+    }
+  }
+
+  ptr = chunk->data + chunk->used;
+  chunk->used += need;
+  *(size_t *) ptr = size;
+
+  arena->allocations++;
+  arena->bytes += size;
+  return ptr + ARENA_HEADER;
+}
+
+
+void *
+repo_arena_calloc (repo_arena_t *arena, size_t nmemb, size_t size) {
+  void *ptr;
+
+  if (size && nmemb > SIZE_MAX / size)
+    return NULL;
+
+  if ((ptr = repo_arena_alloc(arena, nmemb * size)))
+    memset(ptr, 0, nmemb * size);
+
+  return ptr;
+}
+
+
+void *
+repo_arena_realloc (repo_arena_t *arena, void *ptr, size_t size) {
+  repo_arena_chunk_t *head = arena->head;
+  size_t *header, old;
+  void *tmp;
+
+  if (NULL == ptr)
+    return repo_arena_alloc(arena, size);
+
+  header = (size_t *) ((char *) ptr - ARENA_HEADER);
+  old = *header;
+
+  if (size <= old) {
+    *header = size;
+    return ptr;
+  }
+
+  // the last allocation of the head chunk can grow in place
+  if ((char *) ptr + ARENA_ROUND(old) == head->data + head->used
+      && head->size - head->used >= ARENA_ROUND(size) - ARENA_ROUND(old)) {
+    head->used += ARENA_ROUND(size) - ARENA_ROUND(old);
+    arena->bytes += size - old;
+    *header = size;
+    return ptr;
+  }
+
+  if ((tmp = repo_arena_alloc(arena, size)))
+    memcpy(tmp, ptr, old);
+
+  return tmp;
+}
+
+/**
+ * Releases every allocation at once. The head chunk is kept
+ * for reuse, any other chunk goes back to the system.
+ */
+
+void
+repo_arena_reset (repo_arena_t *arena) {
+  repo_arena_chunk_t *chunk = arena->head->next;
+
+  while (chunk) {
+    repo_arena_chunk_t *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+
+  arena->head->next = NULL;
+  arena->head->used = 0;
+  arena->allocations = 0;
+  arena->bytes = 0;
+}
+
+
+void
+repo_arena_free (repo_arena_t *arena) {
+  if (current == arena) current = NULL;
+  repo_arena_reset(arena);
+  free(arena->head);
+  free(arena);
+}
+
+/**
+ * `json_config` and `json_parser_dom` hooks. They take no
+ * userdata, so they allocate from the arena selected on the
+ * calling thread with `repo_arena_use()` and fall back to the
+ * system allocator when there is none.
+ */
+
+repo_arena_t *
+repo_arena_use (repo_arena_t *arena) {
+  repo_arena_t *previous = current;
+  current = arena;
+  return previous;
+}
+
+
+static void *
+json_calloc (size_t nmemb, size_t size) {
+  return current
+    ? repo_arena_calloc(current, nmemb, size)
+    : calloc(nmemb, size);
+}
+
+
+static void *
+json_realloc (void *ptr, size_t size) {
+  return current
+    ? repo_arena_realloc(current, ptr, size)
+    : realloc(ptr, size);
+}
+
+
+static void
+json_free (void *ptr) {
+  if (!current) free(ptr);
+}
+
+
+void
+repo_arena_json_config (json_config *config) {
+  config->user_calloc = json_calloc;
+  config->user_realloc = json_realloc;
+  config->user_free = json_free;
+}
+
+
+void
+repo_arena_json_dom (json_parser_dom *dom) {
+  dom->user_calloc = json_calloc;
+  dom->user_realloc = json_realloc;
+  dom->user_free = json_free;
+}
@@ -0,0 +1,89 @@
+
+#include <assert.h>
+#include <repo.h>
+
+/**
+ * Output buffer that grows geometrically and, when it has a
+ * file descriptor, drains itself with a single large write
+ * once `REPO_BUF_FLUSH_SIZE` bytes are pending.
+ */
+
+repo_buf_t *
+repo_buf_new (int fd) {
+  repo_buf_t *buf;
+
+  if (!(buf = malloc(sizeof(repo_buf_t))))
+    return NULL;
+
+  buf->alloc = REPO_BUF_FLUSH_SIZE;
+  buf->length = 0;
+  buf->fd = fd;
+
+  if (!(buf->data = malloc(buf->alloc))) {
+    free(buf);
+    return NULL;
+  }
+
+  return buf;
+}
+
+
+int
+repo_buf_flush (repo_buf_t *buf) {
+  size_t offset = 0;
+
+  if (-1 == buf->fd)
+    return 0;
+
+  while (offset < buf->length) {
+    ssize_t n = write(buf->fd, buf->data + offset, buf->length - offset);
+    if (-1 == n) {
+      if (EINTR == errno) continue;
+      return -1;
+    }
+    offset += (size_t) n;
+  }
+
+  buf->length = 0;
+  return 0;
+}
+
+
+int
+repo_buf_write (repo_buf_t *buf, const char *data, size_t len) {
+  if (buf->length + len > buf->alloc) {
+    size_t alloc = buf->alloc;
+    char *tmp;
+
+    while (alloc < buf->length + len) alloc *= 2;
+
+    if (!(tmp = realloc(buf->data, alloc)))
+      return -1;
+
+    buf->data = tmp;
+    buf->alloc = alloc;
+  }
+
+  memcpy(buf->data + buf->length, data, len);
+  buf->length += len;
+
+  if (-1 != buf->fd && buf->length >= REPO_BUF_FLUSH_SIZE)
+    return repo_buf_flush(buf);
+
+  return 0;
+}
+
+
+int
+repo_buf_puts (repo_buf_t *buf, const char *str) {
+  return repo_buf_write(buf, str, strlen(str));
+}
+
+
+void
+repo_buf_free (repo_buf_t *buf) {
+  if (!buf) return;
+  repo_buf_flush(buf);
+  free(buf->data);
+  free(buf);
+}
@@ -0,0 +1,847 @@
+
+#include <assert.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <repo.h>
+
+/**
+ * `repo stats` counts the files, bytes and languages in the
+ * HEAD tree of every repository under the root without checking
+ * anything out. Trees are read through libgit2 and blob sizes
+ * come from `git_odb_read_header()`, which doesn't inflate the
+ * content. Files are put in a language by their name.
+ *
+ * What a tree holds, all the way down, is remembered by the
+ * tree's oid. A tree seen before, in another repository, on an
+ * earlier commit or in an earlier run, is not read again, so an
+ * unchanged repository costs one lookup and a changed one only
+ * reads the trees on the paths that changed. The memo is kept
+ * in `<root>/.repo/census` with the subtrees of every tree, so
+ * whatever the current HEADs still reach survives the next save.
+ * (`src/stats.c` is the unrelated `--stats` accounting.)
+ *
+ *   header   magic, version and record count
+ *   records  `census_record_t`, then its `census_count_t`
+ *            languages and the raw oids of its subtrees
+ */
+
+#define CENSUS_JOBS 4
+#define CENSUS_MAGIC "RCEN"
+#define CENSUS_FILE "census"
+
+// bump when the languages below change, the memo counts by index
+#define CENSUS_VERSION 1
+
+// languages shown per repository, the summary shows two more
+#define CENSUS_TOP 3
+
+#define CENSUS_SYMLINK 0120000
+
+typedef enum {
+  CENSUS_OTHER,
+  CENSUS_C,
+  CENSUS_CPP,
+  CENSUS_CSHARP,
+  CENSUS_GO,
+  CENSUS_RUST,
+  CENSUS_JAVA,
+  CENSUS_KOTLIN,
+  CENSUS_SCALA,
+  CENSUS_JAVASCRIPT,
+  CENSUS_TYPESCRIPT,
+  CENSUS_PYTHON,
+  CENSUS_RUBY,
+  CENSUS_PHP,
+  CENSUS_PERL,
+  CENSUS_SHELL,
+  CENSUS_SWIFT,
+  CENSUS_OBJC,
+  CENSUS_LUA,
+  CENSUS_HASKELL,
+  CENSUS_ELIXIR,
+  CENSUS_ERLANG,
+  CENSUS_CLOJURE,
+  CENSUS_HTML,
+  CENSUS_CSS,
+  CENSUS_SQL,
+  CENSUS_MARKDOWN,
+  CENSUS_JSON,
+  CENSUS_YAML,
+  CENSUS_TOML,
+  CENSUS_XML,
+  CENSUS_CMAKE,
+  CENSUS_MAKEFILE,
+  CENSUS_DOCKERFILE,
+  CENSUS_PROTOBUF,
+  CENSUS_TEXT,
+  CENSUS_LANGS
+} census_lang_t;
+
+static const char *census_langs[CENSUS_LANGS] = {
+  "Other", "C", "C++", "C#", "Go", "Rust", "Java", "Kotlin", "Scala",
+  "JavaScript", "TypeScript", "Python", "Ruby", "PHP", "Perl", "Shell",
+  "Swift", "Objective-C", "Lua", "Haskell", "Elixir", "Erlang", "Clojure",
+  "HTML", "CSS", "SQL", "Markdown", "JSON", "YAML", "TOML", "XML", "CMake",
+  "Makefile", "Dockerfile", "Protobuf", "Text"
+};
+
+typedef struct census_ext {
+  const char *ext;
+  census_lang_t lang;
+} census_ext_t;
+
+// sorted for bsearch(), compared ignoring case
+static const census_ext_t census_exts[] = {
+  { "bash", CENSUS_SHELL }, { "c", CENSUS_C }, { "cc", CENSUS_CPP },
+  { "cjs", CENSUS_JAVASCRIPT }, { "clj", CENSUS_CLOJURE }, { "cmake", CENSUS_CMAKE },
+  { "cpp", CENSUS_CPP }, { "cs", CENSUS_CSHARP }, { "css", CENSUS_CSS },
+  { "cxx", CENSUS_CPP }, { "erl", CENSUS_ERLANG }, { "ex", CENSUS_ELIXIR },
+  { "exs", CENSUS_ELIXIR }, { "go", CENSUS_GO }, { "h", CENSUS_C },
+  { "hh", CENSUS_CPP }, { "hpp", CENSUS_CPP }, { "hs", CENSUS_HASKELL },
+  { "htm", CENSUS_HTML }, { "html", CENSUS_HTML }, { "java", CENSUS_JAVA },
+  { "js", CENSUS_JAVASCRIPT }, { "json", CENSUS_JSON }, { "jsx", CENSUS_JAVASCRIPT },
+  { "kt", CENSUS_KOTLIN }, { "kts", CENSUS_KOTLIN }, { "lua", CENSUS_LUA },
+  { "m", CENSUS_OBJC }, { "markdown", CENSUS_MARKDOWN }, { "md", CENSUS_MARKDOWN },
+  { "mjs", CENSUS_JAVASCRIPT }, { "mk", CENSUS_MAKEFILE }, { "mm", CENSUS_OBJC },
+  { "php", CENSUS_PHP }, { "pl", CENSUS_PERL }, { "pm", CENSUS_PERL },
+  { "proto", CENSUS_PROTOBUF }, { "py", CENSUS_PYTHON }, { "rb", CENSUS_RUBY },
+  { "rs", CENSUS_RUST }, { "scala", CENSUS_SCALA }, { "scss", CENSUS_CSS },
+  { "sh", CENSUS_SHELL }, { "sql", CENSUS_SQL }, { "swift", CENSUS_SWIFT },
+  { "toml", CENSUS_TOML }, { "ts", CENSUS_TYPESCRIPT }, { "tsx", CENSUS_TYPESCRIPT },
+  { "txt", CENSUS_TEXT }, { "xml", CENSUS_XML }, { "yaml", CENSUS_YAML },
+  { "yml", CENSUS_YAML }, { "zsh", CENSUS_SHELL }
+};
+
+typedef struct census_count {
+  uint32_t lang;
+  uint32_t files;
+  uint64_t bytes;
+} census_count_t;
+
+typedef struct census_header {
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+  uint32_t reserved;
+} census_header_t;
+
+typedef struct census_record {
+  unsigned char oid[GIT_OID_RAWSZ];
+  uint32_t counts_length;
+  uint32_t subtrees_length;
+  uint64_t files;
+  uint64_t bytes;
+} census_record_t;
+
+typedef struct census_tree {
+  census_record_t record;
+  census_count_t *counts;
+  git_oid *subtrees;
+  bool keep;
+} census_tree_t;
+
+/**
+ * Trees by oid, shared by the workers. The zero oid never names
+ * a tree, an empty slot is NULL.
+ */
+
+typedef struct census_memo {
+  pthread_mutex_t lock;
+  census_tree_t **slots;
+  size_t mask;
+  size_t length;
+} census_memo_t;
+
+typedef struct census_job {
+  repo_dir_item_t *item;
+  census_memo_t *memo;
+  git_repository *repo;
+  git_odb *odb;
+  git_oid root;
+  bool unborn;
+  uint64_t files;
+  uint64_t bytes;
+  census_count_t counts[CENSUS_LANGS];
+  size_t trees;
+  size_t reused;
+  double ms;
+  bool failed;
+  char error[160];
+} census_job_t;
+
+static repo_census_opts_t census_opts;
+
+
+static double
+census_now_ms () {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+
+static void
+census_format (uint64_t bytes, char *out, size_t size) {
+  if (bytes < 1024) snprintf(out, size, "%llu B", (unsigned long long) bytes);
+  else if (bytes < 1024 * 1024) snprintf(out, size, "%.1f KiB", bytes / 1024.0);
+  else if (bytes < 1024 * 1024 * 1024) snprintf(out, size, "%.1f MiB", bytes / (1024.0 * 1024));
+  else snprintf(out, size, "%.2f GiB", bytes / (1024.0 * 1024 * 1024));
+}
+
+
+static int
+ext_cmp (const void *key, const void *entry) {
+  return strcasecmp((const char *) key, ((const census_ext_t *) entry)->ext);
+}
+
+
+static census_lang_t
+census_lang (const char *name) {
+  const char *dot = strrchr(name, '.');
+  const census_ext_t *ext;
+
+  if (0 == strcmp(name, "Makefile") || 0 == strcmp(name, "GNUmakefile")) return CENSUS_MAKEFILE;
+  if (0 == strcmp(name, "Dockerfile")) return CENSUS_DOCKERFILE;
+  if (0 == strcmp(name, "CMakeLists.txt")) return CENSUS_CMAKE;
+
+  // dotfiles like .bashrc have no extension
+  if (!dot || dot == name)
+    return CENSUS_OTHER;
+
+  ext = bsearch(dot + 1, census_exts, sizeof(census_exts) / sizeof(census_exts[0])
+      , sizeof(census_ext_t), ext_cmp);
+  return ext ? ext->lang : CENSUS_OTHER;
+}
+
+
+static size_t
+census_slot (const census_memo_t *memo, const unsigned char *oid) {
+  uint64_t key;
+  size_t slot;
+
+  memcpy(&key, oid, sizeof(key));
+
+  for (slot = key & memo->mask; memo->slots[slot]; slot = (slot + 1) & memo->mask) {
+    if (0 == memcmp(memo->slots[slot]->record.oid, oid, GIT_OID_RAWSZ)) break;
+  }
+
+  return slot;
+}
+
+
+static census_tree_t *
+census_find (census_memo_t *memo, const git_oid *oid) {
+  census_tree_t *tree;
+
+  pthread_mutex_lock(&memo->lock);
+  tree = memo->slots ? memo->slots[census_slot(memo, oid->id)] : NULL;
+  pthread_mutex_unlock(&memo->lock);
+
+  return tree;
+}
+
+
+static void
+census_tree_free (census_tree_t *tree) {
+  if (!tree) return;
+  free(tree->counts);
+  free(tree->subtrees);
+  free(tree);
+}
+
+/**
+ * Adds `tree` to `memo` and returns it, or the one already
+ * there if another worker got to the same tree first. Called
+ * with the lock held.
+ */
+
+static census_tree_t *
+census_insert_locked (census_memo_t *memo, census_tree_t *tree) {
+  size_t slot;
+
+  // keep the table at most half full
+  if ((memo->length + 1) * 2 > memo->mask + 1 || !memo->slots) {
+    size_t size = memo->slots ? (memo->mask + 1) * 2 : 1024;
+    census_tree_t **old = memo->slots, **slots = calloc(size, sizeof(census_tree_t *));
+    size_t old_size = old ? memo->mask + 1 : 0;
+
+    if (!slots)
+      return NULL;
+
+    memo->slots = slots;
+    memo->mask = size - 1;
+
+    for (size_t i = 0; i < old_size; ++i) {
+      if (old[i]) memo->slots[census_slot(memo, old[i]->record.oid)] = old[i];
+    }
+
+    free(old);
+  }
+
+  slot = census_slot(memo, tree->record.oid);
+
+  if (memo->slots[slot]) {
+    census_tree_free(tree);
+    return memo->slots[slot];
+  }
+
+  memo->slots[slot] = tree;
+  memo->length++;
+  return tree;
+}
+
+
+static census_tree_t *
+census_insert (census_memo_t *memo, census_tree_t *tree) {
+  census_tree_t *result;
+
+  pthread_mutex_lock(&memo->lock);
+  result = census_insert_locked(memo, tree);
+  pthread_mutex_unlock(&memo->lock);
+
+  if (!result) census_tree_free(tree);
+  return result;
+}
+
+
+static void
+census_memo_free (census_memo_t *memo) {
+  for (size_t i = 0; memo->slots && i <= memo->mask; ++i) {
+    census_tree_free(memo->slots[i]);
+  }
+
+  free(memo->slots);
+  pthread_mutex_destroy(&memo->lock);
+}
+
+
+static bool
+census_read (const char *input, size_t size, size_t *offset, void *out, size_t length) {
+  if (*offset + length > size)
+    return false;
+
+  memcpy(out, input + *offset, length);
+  *offset += length;
+  return true;
+}
+
+/**
+ * Loads the trees remembered under `repo` into `memo`, if the
+ * file is there and readable
+ */
+
+static void
+census_load (repo_t *repo, census_memo_t *memo) {
+  char path[REPO_PATH_MAX], *input = NULL;
+  census_header_t header;
+  size_t offset = 0;
+  struct stat st;
+  int fd;
+
+  if (0 != repo_cache_path(repo, CENSUS_FILE, path, sizeof(path))
+      || -1 == (fd = open(path, O_RDONLY)))
+    return;
+
+  if (0 != fstat(fd, &st) || !(input = malloc(st.st_size + 1))
+      || st.st_size != read(fd, input, st.st_size)) {
+    free(input);
+    close(fd);
+    return;
+  }
+
+  close(fd);
+
+  if (!census_read(input, st.st_size, &offset, &header, sizeof(header))
+      || 0 != memcmp(header.magic, CENSUS_MAGIC, 4) || CENSUS_VERSION != header.version) {
+    free(input);
+    return;
+  }
+
+  pthread_mutex_lock(&memo->lock);
+
+  for (uint32_t i = 0; i < header.count; ++i) {
+    census_tree_t *tree = calloc(1, sizeof(census_tree_t));
+    size_t counts, subtrees;
+
+    if (!tree || !census_read(input, st.st_size, &offset, &tree->record, sizeof(census_record_t))) {
+      free(tree);
+      break;
+    }
+
+    counts = tree->record.counts_length * sizeof(census_count_t);
+    subtrees = tree->record.subtrees_length * sizeof(git_oid);
+
+    if (!(tree->counts = malloc(counts + 1)) || !(tree->subtrees = malloc(subtrees + 1))
+        || !census_read(input, st.st_size, &offset, tree->counts, counts)
+        || !census_read(input, st.st_size, &offset, tree->subtrees, subtrees)
+        || !census_insert_locked(memo, tree)) {
+      census_tree_free(tree);
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&memo->lock);
+  free(input);
+}
+
+/**
+ * Marks the trees reachable from `root` to be saved
+ */
+
+static size_t
+census_mark (census_memo_t *memo, const git_oid *root) {
+  census_tree_t **stack, *tree = census_find(memo, root);
+  size_t length = 0, alloc = 64, marked = 0;
+
+  if (!tree || tree->keep || !(stack = malloc(alloc * sizeof(census_tree_t *))))
+    return 0;
+
+  tree->keep = true;
+  stack[length++] = tree;
+
+  while (length > 0) {
+    tree = stack[--length];
+    marked++;
+
+    for (uint32_t i = 0; i < tree->record.subtrees_length; ++i) {
+      census_tree_t *sub = census_find(memo, &tree->subtrees[i]);
+
+      if (!sub || sub->keep) continue;
+
+      if (length == alloc) {
+        census_tree_t **grown = realloc(stack, alloc * 2 * sizeof(census_tree_t *));
+        if (!grown) break;
+        stack = grown;
+        alloc *= 2;
+      }
+
+      sub->keep = true;
+      stack[length++] = sub;
+    }
+  }
+
+  free(stack);
+  return marked;
+}
+
+
+static int
+census_save (repo_t *repo, census_memo_t *memo, census_job_t *jobs, int length) {
+  char path[REPO_PATH_MAX], tmp[REPO_PATH_MAX + 4];
+  census_header_t header = { { 0 }, CENSUS_VERSION, 0, 0 };
+  repo_buf_t *out;
+  int fd, rc = 0;
+
+  // what no HEAD reaches anymore is dropped
+  for (int i = 0; i < length; ++i) {
+    if (!jobs[i].failed && !jobs[i].unborn) header.count += census_mark(memo, &jobs[i].root);
+  }
+
+  if (0 != repo_cache_path(repo, CENSUS_FILE, path, sizeof(path)))
+    return -1;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+  if (-1 == (fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)))
+    return -1;
+
+  if (!(out = repo_buf_new(fd))) {
+    close(fd);
+    unlink(tmp);
+    return -1;
+  }
+
+  memcpy(header.magic, CENSUS_MAGIC, 4);
+  rc |= repo_buf_write(out, (const char *) &header, sizeof(header));
+
+  for (size_t i = 0; memo->slots && i <= memo->mask; ++i) {
+    census_tree_t *tree = memo->slots[i];
+
+    if (!tree || !tree->keep) continue;
+
+    rc |= repo_buf_write(out, (const char *) &tree->record, sizeof(census_record_t));
+    rc |= repo_buf_write(out, (const char *) tree->counts
+        , tree->record.counts_length * sizeof(census_count_t));
+    rc |= repo_buf_write(out, (const char *) tree->subtrees
+        , tree->record.subtrees_length * sizeof(git_oid));
+  }
+
+  rc |= repo_buf_flush(out);
+  repo_buf_free(out);
+  rc |= close(fd);
+
+  if (0 != rc || 0 != rename(tmp, path)) {
+    unlink(tmp);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Counts what the tree `oid` holds, reading only the trees that
+ * aren't in the memo yet. Returns NULL if a tree can't be read.
+ */
+
+static census_tree_t *
+census_tree (census_job_t *job, const git_oid *oid) {
+  census_count_t counts[CENSUS_LANGS] = { { 0 } };
+  census_tree_t *result;
+  git_oid *subtrees = NULL;
+  size_t length = 0, used = 0;
+  git_tree *tree = NULL;
+
+  if ((result = census_find(job->memo, oid))) {
+    job->reused++;
+    return result;
+  }
+
+  if (0 != git_tree_lookup(&tree, job->repo, oid))
+    return NULL;
+
+  job->trees++;
+  length = git_tree_entrycount(tree);
+
+  if (!(result = calloc(1, sizeof(census_tree_t))) || !(subtrees = malloc((length + 1) * sizeof(git_oid))))
+    goto fail;
+
+  git_oid_cpy((git_oid *) result->record.oid, oid);
+
+  for (size_t i = 0; i < length; ++i) {
+    const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+    const git_oid *id = git_tree_entry_id(entry);
+    census_tree_t *sub;
+    census_lang_t lang;
+    git_otype type;
+    size_t size;
+
+    switch (git_tree_entry_type(entry)) {
+      case GIT_OBJ_TREE:
+        if (!(sub = census_tree(job, id))) goto fail;
+        git_oid_cpy(&subtrees[result->record.subtrees_length++], id);
+        result->record.files += sub->record.files;
+        result->record.bytes += sub->record.bytes;
+        for (uint32_t c = 0; c < sub->record.counts_length; ++c) {
+          census_count_t *count = &counts[sub->counts[c].lang % CENSUS_LANGS];
+          count->files += sub->counts[c].files;
+          count->bytes += sub->counts[c].bytes;
+        }
+        break;
+
+      case GIT_OBJ_BLOB:
+        // the target path of a link isn't code
+        if (CENSUS_SYMLINK == git_tree_entry_filemode(entry)) break;
+        if (0 != git_odb_read_header(&size, &type, job->odb, id)) goto fail;
+        lang = census_lang(git_tree_entry_name(entry));
+        counts[lang].files++;
+        counts[lang].bytes += size;
+        result->record.files++;
+        result->record.bytes += size;
+        break;
+
+      // submodules are counted in their own repository
+      default:
+        break;
+    }
+  }
+
+  git_tree_free(tree);
+  tree = NULL;
+
+  for (int lang = 0; lang < CENSUS_LANGS; ++lang) {
+    if (counts[lang].files) used++;
+  }
+
+  if (!(result->counts = malloc((used + 1) * sizeof(census_count_t))))
+    goto fail;
+
+  for (int lang = 0; lang < CENSUS_LANGS; ++lang) {
+    if (!counts[lang].files) continue;
+    counts[lang].lang = lang;
+    result->counts[result->record.counts_length++] = counts[lang];
+  }
+
+  result->subtrees = subtrees;
+  return census_insert(job->memo, result);
+
+fail:
+  git_tree_free(tree);
+  free(subtrees);
+  census_tree_free(result);
+  return NULL;
+}
+
+
+static void
+census_run (void *data) {
+  census_job_t *job = (census_job_t *) data;
+  repo_handles_t *handles = repo_handles_default();
+  repo_handle_t *handle = NULL;
+  git_commit *commit = NULL;
+  census_tree_t *root;
+  double start = census_now_ms();
+  git_oid head;
+
+  REPO_TRACE_BEGIN("census", job->item->name);
+
+  if (0 != repo_handles_get(handles, job->item->path, &handle)
+      || 0 != git_repository_odb(&job->odb, handle->repo)) {
+    const git_error *err = giterr_last();
+    job->failed = true;
+    snprintf(job->error, sizeof(job->error), "open: %s", err ? err->message : "unknown error");
+    goto cleanup;
+  }
+
+  job->repo = handle->repo;
+
+  if (0 != git_reference_name_to_id(&head, job->repo, "HEAD")) {
+    giterr_clear();
+    job->unborn = true;
+    goto cleanup;
+  }
+
+  if (0 != git_commit_lookup(&commit, job->repo, &head)) {
+    const git_error *err = giterr_last();
+    job->failed = true;
+    snprintf(job->error, sizeof(job->error), "HEAD: %s", err ? err->message : "unknown error");
+    goto cleanup;
+  }
+
+  git_oid_cpy(&job->root, git_commit_tree_id(commit));
+
+  if (!(root = census_tree(job, &job->root))) {
+    const git_error *err = giterr_last();
+    job->failed = true;
+    snprintf(job->error, sizeof(job->error), "%s", err ? err->message : "out of memory");
+    goto cleanup;
+  }
+
+  job->files = root->record.files;
+  job->bytes = root->record.bytes;
+  for (uint32_t c = 0; c < root->record.counts_length; ++c) {
+    job->counts[root->counts[c].lang % CENSUS_LANGS] = root->counts[c];
+  }
+
+cleanup:
+  git_commit_free(commit);
+  git_odb_free(job->odb);
+  job->odb = NULL;
+  repo_handles_put(handles, handle);
+  job->repo = NULL;
+  REPO_TRACE_END("census");
+  job->ms = census_now_ms() - start;
+}
+
+
+static int
+count_cmp (const void *a, const void *b) {
+  uint64_t x = ((const census_count_t *) a)->bytes, y = ((const census_count_t *) b)->bytes;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/**
+ * Prints the `top` languages of `counts` taking the most bytes
+ */
+
+static void
+census_print_langs (FILE *out, const census_count_t *counts, uint64_t bytes, int top) {
+  census_count_t sorted[CENSUS_LANGS];
+  int length = 0;
+
+  for (int lang = 0; lang < CENSUS_LANGS; ++lang) {
+    if (counts[lang].files) {
+      sorted[length] = counts[lang];
+      sorted[length++].lang = lang;
+    }
+  }
+
+  qsort(sorted, length, sizeof(census_count_t), count_cmp);
+
+  for (int i = 0; i < length && i < top; ++i) {
+    fprintf(out, ", %s %.1f%%", census_langs[sorted[i].lang]
+        , bytes ? 100.0 * sorted[i].bytes / bytes : 0);
+  }
+}
+
+
+static void
+census_print (census_job_t *job) {
+  char size[32];
+
+  if (job->failed) {
+    printf(" %s failed: %s\n", job->item->name, job->error);
+    return;
+  }
+
+  if (job->unborn) {
+    printf(" %s: no commits\n", job->item->name);
+    return;
+  }
+
+  census_format(job->bytes, size, sizeof(size));
+  printf(" %s: %llu files, %s", job->item->name, (unsigned long long) job->files, size);
+  census_print_langs(stdout, job->counts, job->bytes, CENSUS_TOP);
+  printf("\n");
+}
+
+
+static void
+census_emit (repo_emitter_t *emitter, census_job_t *job) {
+  char tree[GIT_OID_HEXSZ + 1];
+
+  repo_emitter_begin(emitter);
+  repo_emitter_str(emitter, "name", job->item->name);
+  repo_emitter_str(emitter, "path", job->item->path);
+  repo_emitter_str(emitter, "error", job->failed ? job->error : NULL);
+  repo_emitter_str(emitter, "tree", job->failed || job->unborn
+      ? NULL : git_oid_tostr(tree, sizeof(tree), &job->root));
+  repo_emitter_int(emitter, "files", job->files);
+  repo_emitter_int(emitter, "bytes", job->bytes);
+
+  repo_emitter_object(emitter, "languages");
+  for (int lang = 0; lang < CENSUS_LANGS; ++lang) {
+    if (!job->counts[lang].files) continue;
+    repo_emitter_object(emitter, census_langs[lang]);
+    repo_emitter_int(emitter, "files", job->counts[lang].files);
+    repo_emitter_int(emitter, "bytes", job->counts[lang].bytes);
+    repo_emitter_object_end(emitter);
+  }
+  repo_emitter_object_end(emitter);
+
+  repo_emitter_int(emitter, "trees_read", job->trees);
+  repo_emitter_float(emitter, "ms", job->ms);
+  repo_emitter_end(emitter);
+}
+
+/**
+ * Counts the HEAD tree of every repository under `repo` and
+ * prints the results. Returns the number that failed, or -1 if
+ * none could be counted.
+ */
+
+int
+repo_census_all (repo_t *repo, repo_output_t output, repo_census_opts_t *opts) {
+  repo_dir_t *dir = repo_dir_new(repo->path);
+  repo_emitter_t *emitter = NULL;
+  census_count_t counts[CENSUS_LANGS] = { { 0 } };
+  census_memo_t memo = { .slots = NULL };
+  uint64_t files = 0, bytes = 0;
+  size_t trees = 0, reused = 0;
+  census_job_t *jobs;
+  repo_pool_t *pool;
+  int length = 0, failed = 0;
+  double start, elapsed;
+  char size[32];
+  FILE *summary;
+
+  if (!dir) {
+    repo_ferror("path does not exist '%s'", repo->path);
+  }
+
+  if (!(jobs = calloc(dir->length + 1, sizeof(census_job_t)))) {
+    repo_error("stats: out of memory");
+    repo_dir_free(dir);
+    return -1;
+  }
+
+  if (!(pool = repo_pool_new(opts->jobs > 0 ? opts->jobs : CENSUS_JOBS))) {
+    repo_error("stats: failed to start worker threads");
+    repo_dir_free(dir);
+    free(jobs);
+    return -1;
+  }
+
+  pthread_mutex_init(&memo.lock, NULL);
+  census_load(repo, &memo);
+
+  start = census_now_ms();
+
+  for (int i = 0; i < dir->length; ++i) {
+    repo_dir_item_t *item = &dir->items[i];
+    census_job_t *job = &jobs[length];
+
+    if (!repo_dir_item_is_git_repo(item)) continue;
+
+    job->item = item;
+    job->memo = &memo;
+    length++;
+    if (0 != repo_pool_push(pool, census_run, job)) census_run(job);
+  }
+
+  repo_pool_wait(pool);
+  repo_pool_free(pool);
+  elapsed = census_now_ms() - start;
+
+  if (0 != census_save(repo, &memo, jobs, length)) {
+    fprintf(stderr, "repo: stats: failed to save the tree memo: %s\n", strerror(errno));
+  }
+
+  if (REPO_OUTPUT_TEXT != output) {
+    emitter = repo_emitter_new(output, STDOUT_FILENO);
+    assert(emitter);
+  }
+
+  for (int i = 0; i < length; ++i) {
+    census_job_t *job = &jobs[i];
+
+    files += job->files;
+    bytes += job->bytes;
+    trees += job->trees;
+    reused += job->reused;
+    if (job->failed) failed++;
+
+    for (int lang = 0; lang < CENSUS_LANGS; ++lang) {
+      counts[lang].files += job->counts[lang].files;
+      counts[lang].bytes += job->counts[lang].bytes;
+    }
+
+    if (emitter) census_emit(emitter, job);
+    else census_print(job);
+  }
+
+  repo_emitter_free(emitter);
+
+  summary = emitter ? stderr : stdout;
+  census_format(bytes, size, sizeof(size));
+  fprintf(summary, "repo: stats: %d repositories, %llu files, %s"
+      , length, (unsigned long long) files, size);
+  census_print_langs(summary, counts, bytes, CENSUS_TOP + 2);
+  fprintf(summary, "; %zu trees read, %zu remembered, in %.1fs", trees, reused, elapsed / 1000.0);
+  if (failed) fprintf(summary, ", %d failed", failed);
+  fprintf(summary, "\n");
+
+  census_memo_free(&memo);
+  free(jobs);
+  repo_dir_free(dir);
+  return failed;
+}
+
+
+static void
+on_jobs (command_t *self) {
+  census_opts.jobs = atoi(self->arg);
+}
+
+
+void
+repo_cmd_stats (repo_session_t *sess) {
+  int failed;
+
+  census_opts.jobs = CENSUS_JOBS;
+
+  command_option(&sess->program, "-j", "--jobs <n>", "Number of repositories counted in parallel", on_jobs);
+
+  if (sess->argc > 1) {
+    if (repo_cmd_needs_help(sess)) {
+      repo_help(sess, false);
+      exit(0);
+    }
+
+    repo_session_start(sess);
+  }
+
+  failed = repo_census_all(sess->user->repo, sess->output, &census_opts);
+
+  repo_session_free(sess);
+  exit(0 == failed ? 0 : 1);
+}
@@ -0,0 +1,655 @@
+
+#include <assert.h>
+#include <fcntl.h>
+#include <repo.h>
+
+/**
+ * `repo clean --ignored` removes the files the ignore rules of
+ * every repository under the root match, like `git clean -fdX`
+ * run in each of them, but in parallel. Every repository's
+ * worktree is scanned on a worker: files that are tracked are
+ * kept, an ignored file is unlinked on the spot and an ignored
+ * directory with nothing tracked in it is handed to the pool to
+ * be removed whole. Removal works relative to the open directory
+ * with `unlinkat()`, and the first levels of a large ignored
+ * tree are split across workers again, so one `node_modules`
+ * doesn't keep a single thread busy while the others idle. A
+ * directory is removed once the last of its parts is done.
+ *
+ * Directories holding another repository are left alone, as
+ * `git clean` does. `--dry-run` walks the same paths and counts
+ * what would go without removing anything.
+ */
+
+#define CLEAN_JOBS 4
+
+// ignored trees are handed out to other workers this many levels down
+#define CLEAN_SPLIT_DEPTH 2
+
+typedef struct clean_job {
+  repo_dir_item_t *item;
+  repo_pool_t *pool;
+  git_repository *repo;
+  const char **tracked;
+  size_t tracked_length;
+  size_t root_length;
+  char **targets;
+  size_t targets_length;
+  size_t targets_alloc;
+  size_t files;
+  size_t dirs;
+  size_t bytes;
+  size_t errors;
+  size_t kept;
+  bool dry_run;
+  bool failed;
+  char error[160];
+} clean_job_t;
+
+/**
+ * An ignored directory being removed. `pending` counts the walk
+ * of the directory itself and the subdirectories handed off.
+ */
+
+typedef struct clean_node {
+  clean_job_t *job;
+  struct clean_node *parent;
+  char *path;
+  int depth;
+  int pending;
+  bool kept;
+} clean_node_t;
+
+typedef struct clean_counts {
+  size_t files;
+  size_t dirs;
+  size_t bytes;
+} clean_counts_t;
+
+static repo_clean_opts_t clean_opts;
+
+
+static double
+clean_now_ms () {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+
+static void
+clean_format (size_t bytes, char *out, size_t size) {
+  if (bytes < 1024) snprintf(out, size, "%zu B", bytes);
+  else if (bytes < 1024 * 1024) snprintf(out, size, "%.1f KiB", bytes / 1024.0);
+  else if (bytes < 1024 * 1024 * 1024) snprintf(out, size, "%.1f MiB", bytes / (1024.0 * 1024));
+  else snprintf(out, size, "%.2f GiB", bytes / (1024.0 * 1024 * 1024));
+}
+
+/**
+ * Counts an error removing `path`, the first one is kept
+ */
+
+static void
+clean_error (clean_job_t *job, const char *path, int error) {
+  if (0 == __atomic_fetch_add(&job->errors, 1, __ATOMIC_RELAXED)) {
+    snprintf(job->error, sizeof(job->error), "%s: %s", path, strerror(error));
+  }
+}
+
+
+static void
+clean_add (clean_job_t *job, const clean_counts_t *counts) {
+  __atomic_add_fetch(&job->files, counts->files, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&job->dirs, counts->dirs, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&job->bytes, counts->bytes, __ATOMIC_RELAXED);
+}
+
+
+static bool
+clean_is_repo (int fd) {
+  return 0 == faccessat(fd, ".git", F_OK, AT_SYMLINK_NOFOLLOW);
+}
+
+static void
+clean_node_run (void *data);
+
+/**
+ * Removes what is in the directory open as `fd`, at `path`.
+ * Subdirectories less than CLEAN_SPLIT_DEPTH levels below the
+ * ignored one are handed to the pool as nodes of `node`.
+ */
+
+static void
+clean_tree (clean_node_t *node, int fd, const char *path, int depth, clean_counts_t *counts) {
+  clean_job_t *job = node->job;
+  struct dirent *entry;
+  struct stat st;
+  DIR *dir;
+  int copy;
+
+  // fdopendir() takes over the descriptor it is given
+  if (-1 == (copy = dup(fd)) || !(dir = fdopendir(copy))) {
+    if (-1 != copy) close(copy);
+    clean_error(job, path, errno);
+    return;
+  }
+
+  while ((entry = readdir(dir))) {
+    const char *name = entry->d_name;
+    bool is_dir = DT_DIR == entry->d_type;
+    char sub[REPO_PATH_MAX];
+    int fds;
+
+    if ('.' == name[0] && ('\0' == name[1] || ('.' == name[1] && '\0' == name[2]))) continue;
+
+    if (!is_dir) {
+      if (0 != fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW)) continue;
+      is_dir = DT_UNKNOWN == entry->d_type && S_ISDIR(st.st_mode);
+    }
+
+    snprintf(sub, sizeof(sub), "%s/%s", path, name);
+
+    if (!is_dir) {
+      if (!job->dry_run && 0 != unlinkat(fd, name, 0)) {
+        clean_error(job, sub, errno);
+        continue;
+      }
+      counts->files++;
+      counts->bytes += (size_t) st.st_blocks * 512;
+      continue;
+    }
+
+    if (depth < CLEAN_SPLIT_DEPTH) {
+      clean_node_t *child = calloc(1, sizeof(clean_node_t));
+
+      if (child && (child->path = strdup(sub))) {
+        child->job = job;
+        child->parent = node;
+        child->depth = depth + 1;
+        child->pending = 1;
+        __atomic_add_fetch(&node->pending, 1, __ATOMIC_RELAXED);
+        if (0 != repo_pool_push(job->pool, clean_node_run, child)) clean_node_run(child);
+        continue;
+      }
+
+      free(child);
+    }
+
+    if (-1 == (fds = openat(fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC))) {
+      clean_error(job, sub, errno);
+      continue;
+    }
+
+    if (clean_is_repo(fds)) {
+      __atomic_add_fetch(&job->kept, 1, __ATOMIC_RELAXED);
+      close(fds);
+      continue;
+    }
+
+    clean_tree(node, fds, sub, depth + 1, counts);
+    close(fds);
+
+    if (!job->dry_run && 0 != unlinkat(fd, name, AT_REMOVEDIR)) {
+      // something in it was kept
+      if (ENOTEMPTY != errno && EEXIST != errno) clean_error(job, sub, errno);
+      continue;
+    }
+
+    counts->dirs++;
+  }
+
+  closedir(dir);
+}
+
+/**
+ * Called when a part of `node` is done, removes the directory
+ * once all of them are and passes it on to the parent
+ */
+
+static void
+clean_node_done (clean_node_t *node) {
+  while (node && 0 == __atomic_sub_fetch(&node->pending, 1, __ATOMIC_ACQ_REL)) {
+    clean_node_t *parent = node->parent;
+    clean_counts_t counts = { 0, 1, 0 };
+
+    if (node->kept) {
+      counts.dirs = 0;
+    } else if (!node->job->dry_run && 0 != rmdir(node->path)) {
+      if (ENOTEMPTY != errno && EEXIST != errno) clean_error(node->job, node->path, errno);
+      counts.dirs = 0;
+    }
+
+    clean_add(node->job, &counts);
+    free(node->path);
+    free(node);
+    node = parent;
+  }
+}
+
+
+static void
+clean_node_run (void *data) {
+  clean_node_t *node = (clean_node_t *) data;
+  clean_counts_t counts = { 0 };
+  int fd;
+
+  REPO_TRACE_BEGIN("clean-tree", node->path);
+
+  if (-1 == (fd = open(node->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC))) {
+    clean_error(node->job, node->path, errno);
+  } else if (clean_is_repo(fd)) {
+    __atomic_add_fetch(&node->job->kept, 1, __ATOMIC_RELAXED);
+    node->kept = true;
+    close(fd);
+  } else {
+    clean_tree(node, fd, node->path, node->depth, &counts);
+    close(fd);
+  }
+
+  clean_add(node->job, &counts);
+  REPO_TRACE_END("clean-tree");
+  clean_node_done(node);
+}
+
+
+static void
+clean_target (clean_job_t *job, const char *rel, bool is_dir) {
+  // only listed by --dry-run
+  if (!job->dry_run)
+    return;
+
+  if (job->targets_length == job->targets_alloc) {
+    size_t alloc = job->targets_alloc ? job->targets_alloc * 2 : 16;
+    char **targets = realloc(job->targets, alloc * sizeof(char *));
+    if (!targets) return;
+    job->targets = targets;
+    job->targets_alloc = alloc;
+  }
+
+  if (-1 != asprintf(&job->targets[job->targets_length], "%s%s", rel, is_dir ? "/" : "")) {
+    job->targets_length++;
+  }
+}
+
+
+static int
+path_cmp (const void *a, const void *b) {
+  return strcmp(*(const char * const *) a, *(const char * const *) b);
+}
+
+/**
+ * Index of the first tracked path not sorting before `path`
+ */
+
+static size_t
+clean_lower_bound (clean_job_t *job, const char *path) {
+  size_t lo = 0, hi = job->tracked_length;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (strcmp(job->tracked[mid], path) < 0) lo = mid + 1;
+    else hi = mid;
+  }
+
+  return lo;
+}
+
+
+static bool
+clean_is_tracked (clean_job_t *job, const char *rel) {
+  size_t i = clean_lower_bound(job, rel);
+  return i < job->tracked_length && 0 == strcmp(job->tracked[i], rel);
+}
+
+
+static bool
+clean_has_tracked (clean_job_t *job, const char *rel) {
+  size_t length = strlen(rel), i;
+  char prefix[REPO_PATH_MAX];
+
+  snprintf(prefix, sizeof(prefix), "%s/", rel);
+  i = clean_lower_bound(job, prefix);
+  return i < job->tracked_length && 0 == strncmp(job->tracked[i], prefix, length + 1);
+}
+
+
+static bool
+clean_is_ignored (clean_job_t *job, const char *rel) {
+  int ignored = 0;
+
+  if (0 != git_ignore_path_is_ignored(&ignored, job->repo, rel)) {
+    giterr_clear();
+    return false;
+  }
+
+  return ignored;
+}
+
+/**
+ * Looks for ignored paths in the worktree directory open as
+ * `fd`, at `path`, `length` bytes long
+ */
+
+static void
+clean_scan (clean_job_t *job, int fd, char *path, size_t length) {
+  clean_counts_t counts = { 0 };
+  struct dirent *entry;
+  struct stat st;
+  DIR *dir;
+  int copy;
+
+  if (-1 == (copy = dup(fd)) || !(dir = fdopendir(copy))) {
+    if (-1 != copy) close(copy);
+    clean_error(job, path, errno);
+    return;
+  }
+
+  while ((entry = readdir(dir))) {
+    const char *name = entry->d_name, *rel;
+    size_t child = length + 1 + strlen(name);
+    bool is_dir = DT_DIR == entry->d_type;
+    int sub;
+
+    if ('.' == name[0] && ('\0' == name[1] || ('.' == name[1] && '\0' == name[2]))) continue;
+    if (length == job->root_length && 0 == strcmp(name, ".git")) continue;
+    if (child >= REPO_PATH_MAX) continue;
+
+    if (!is_dir && DT_UNKNOWN == entry->d_type && 0 == fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW)) {
+      is_dir = S_ISDIR(st.st_mode);
+    }
+
+    path[length] = '/';
+    strcpy(path + length + 1, name);
+    rel = path + job->root_length + 1;
+
+    if (!is_dir) {
+      if (!clean_is_tracked(job, rel) && clean_is_ignored(job, rel)
+          && 0 == fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW)) {
+        clean_target(job, rel, false);
+        if (!job->dry_run && 0 != unlinkat(fd, name, 0)) {
+          clean_error(job, path, errno);
+        } else {
+          counts.files++;
+          counts.bytes += (size_t) st.st_blocks * 512;
+        }
+      }
+    } else if (-1 != (sub = openat(fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC))) {
+      if (clean_is_repo(sub)) {
+        // submodules and nested repositories clean themselves
+      } else if (!clean_has_tracked(job, rel) && clean_is_ignored(job, rel)) {
+        clean_node_t *node = calloc(1, sizeof(clean_node_t));
+
+        clean_target(job, rel, true);
+        if (node && (node->path = strdup(path))) {
+          node->job = job;
+          node->pending = 1;
+          if (0 != repo_pool_push(job->pool, clean_node_run, node)) clean_node_run(node);
+        } else {
+          free(node);
+          clean_error(job, path, ENOMEM);
+        }
+      } else {
+        clean_scan(job, sub, path, child);
+      }
+      close(sub);
+    }
+
+    path[length] = '\0';
+  }
+
+  closedir(dir);
+  clean_add(job, &counts);
+}
+
+
+static void
+clean_run (void *data) {
+  clean_job_t *job = (clean_job_t *) data;
+  repo_handles_t *handles = repo_handles_default();
+  repo_handle_t *handle = NULL;
+  git_index *index = NULL;
+  char path[REPO_PATH_MAX];
+  int fd;
+
+  REPO_TRACE_BEGIN("clean", job->item->name);
+
+  snprintf(path, sizeof(path), "%s", job->item->path);
+  job->root_length = strlen(path);
+  while (job->root_length > 1 && '/' == path[job->root_length - 1]) path[--job->root_length] = '\0';
+
+  if (0 != repo_handles_get(handles, job->item->path, &handle)) {
+    const git_error *err = giterr_last();
+    job->failed = true;
+    snprintf(job->error, sizeof(job->error), "open: %s", err ? err->message : "unknown error");
+    goto cleanup;
+  }
+
+  job->repo = handle->repo;
+
+  // nothing in a bare repository is ignored
+  if (git_repository_is_bare(job->repo))
+    goto cleanup;
+
+  if (0 != git_repository_index(&index, job->repo)) {
+    const git_error *err = giterr_last();
+    job->failed = true;
+    snprintf(job->error, sizeof(job->error), "index: %s", err ? err->message : "unknown error");
+    goto cleanup;
+  }
+
+  // the index is sorted already, but not always the way strcmp() sorts
+  job->tracked_length = git_index_entrycount(index);
+  if (!(job->tracked = calloc(job->tracked_length + 1, sizeof(char *)))) {
+    job->failed = true;
+    snprintf(job->error, sizeof(job->error), "out of memory");
+    goto cleanup;
+  }
+
+  for (size_t i = 0; i < job->tracked_length; ++i) {
+    job->tracked[i] = git_index_get_byindex(index, i)->path;
+  }
+  qsort(job->tracked, job->tracked_length, sizeof(char *), path_cmp);
+
+  if (-1 == (fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC))) {
+    job->failed = true;
+    snprintf(job->error, sizeof(job->error), "open: %s", strerror(errno));
+    goto cleanup;
+  }
+
+  clean_scan(job, fd, path, job->root_length);
+  close(fd);
+
+cleanup:
+  free(job->tracked);
+  job->tracked = NULL;
+  git_index_free(index);
+  repo_handles_put(handles, handle);
+  job->repo = NULL;
+  REPO_TRACE_END("clean");
+}
+
+
+static void
+clean_print (clean_job_t *job) {
+  char size[32];
+
+  if (job->failed) {
+    printf(" %s failed: %s\n", job->item->name, job->error);
+    return;
+  }
+
+  if (0 == job->files && 0 == job->dirs && 0 == job->errors) {
+    printf(" %s: nothing to clean\n", job->item->name);
+    return;
+  }
+
+  clean_format(job->bytes, size, sizeof(size));
+  printf(" %s: %s %zu files in %zu directories, %s"
+      , job->item->name, job->dry_run ? "would remove" : "removed", job->files, job->dirs, size);
+  if (job->kept) printf(", %zu nested repositories kept", job->kept);
+  if (job->errors) printf(", %zu errors, first %s", job->errors, job->error);
+  printf("\n");
+
+  if (job->dry_run) {
+    for (size_t i = 0; i < job->targets_length; ++i) printf("   %s\n", job->targets[i]);
+  }
+}
+
+
+static void
+clean_emit (repo_emitter_t *emitter, clean_job_t *job) {
+  repo_emitter_begin(emitter);
+  repo_emitter_str(emitter, "name", job->item->name);
+  repo_emitter_str(emitter, "path", job->item->path);
+  repo_emitter_str(emitter, "error", job->failed || job->errors ? job->error : NULL);
+  repo_emitter_bool(emitter, "dry_run", job->dry_run);
+  repo_emitter_int(emitter, "files", job->files);
+  repo_emitter_int(emitter, "dirs", job->dirs);
+  repo_emitter_int(emitter, "bytes", job->bytes);
+  repo_emitter_int(emitter, "errors", job->errors);
+  repo_emitter_int(emitter, "kept", job->kept);
+  repo_emitter_end(emitter);
+}
+
+/**
+ * Removes the ignored files of every repository under `repo`
+ * and prints the results. Returns the number of repositories
+ * that failed or had errors, or -1 if none could be cleaned.
+ */
+
+int
+repo_clean_all (repo_t *repo, repo_output_t output, repo_clean_opts_t *opts) {
+  repo_dir_t *dir = repo_dir_new(repo->path);
+  repo_emitter_t *emitter = NULL;
+  clean_job_t *jobs;
+  repo_pool_t *pool;
+  size_t files = 0, bytes = 0, errors = 0;
+  int length = 0, failed = 0;
+  double start, elapsed;
+  char size[32];
+  FILE *summary;
+
+  if (!dir) {
+    repo_ferror("path does not exist '%s'", repo->path);
+  }
+
+  if (!(jobs = calloc(dir->length + 1, sizeof(clean_job_t)))) {
+    repo_error("clean: out of memory");
+    repo_dir_free(dir);
+    return -1;
+  }
+
+  if (!(pool = repo_pool_new(opts->jobs > 0 ? opts->jobs : CLEAN_JOBS))) {
+    repo_error("clean: failed to start worker threads");
+    repo_dir_free(dir);
+    free(jobs);
+    return -1;
+  }
+
+  start = clean_now_ms();
+
+  for (int i = 0; i < dir->length; ++i) {
+    repo_dir_item_t *item = &dir->items[i];
+    clean_job_t *job = &jobs[length];
+
+    if (!repo_dir_item_is_git_repo(item)) continue;
+
+    job->item = item;
+    job->pool = pool;
+    job->dry_run = opts->dry_run;
+    length++;
+    if (0 != repo_pool_push(pool, clean_run, job)) clean_run(job);
+  }
+
+  // scans queue the ignored trees they find, this waits for those too
+  repo_pool_wait(pool);
+  repo_pool_free(pool);
+  elapsed = clean_now_ms() - start;
+
+  if (REPO_OUTPUT_TEXT != output) {
+    emitter = repo_emitter_new(output, STDOUT_FILENO);
+    assert(emitter);
+  }
+
+  for (int i = 0; i < length; ++i) {
+    clean_job_t *job = &jobs[i];
+
+    files += job->files;
+    bytes += job->bytes;
+    errors += job->errors;
+    if (job->failed || job->errors) failed++;
+
+    if (emitter) clean_emit(emitter, job);
+    else clean_print(job);
+  }
+
+  repo_emitter_free(emitter);
+
+  summary = emitter ? stderr : stdout;
+  clean_format(bytes, size, sizeof(size));
+  fprintf(summary, "repo: clean: %d repositories, %s %zu files (%s) in %.1fs, %.0f files/s"
+      , length, opts->dry_run ? "would remove" : "removed", files, size, elapsed / 1000.0
+      , elapsed > 0 ? files / (elapsed / 1000.0) : 0);
+  if (errors) fprintf(summary, ", %zu errors in %d repositories", errors, failed);
+  fprintf(summary, "\n");
+
+  for (int i = 0; i < length; ++i) {
+    for (size_t j = 0; j < jobs[i].targets_length; ++j) free(jobs[i].targets[j]);
+    free(jobs[i].targets);
+  }
+
+  free(jobs);
+  repo_dir_free(dir);
+  return failed;
+}
+
+
+static void
+on_jobs (command_t *self) {
+  clean_opts.jobs = atoi(self->arg);
+}
+
+
+static void
+on_ignored (command_t *self) {
+  clean_opts.ignored = true;
+}
+
+
+static void
+on_dry_run (command_t *self) {
+  clean_opts.dry_run = true;
+}
+
+
+void
+repo_cmd_clean (repo_session_t *sess) {
+  int failed;
+
+  clean_opts.jobs = CLEAN_JOBS;
+  clean_opts.ignored = false;
+  clean_opts.dry_run = false;
+
+  command_option(&sess->program, "-j", "--jobs <n>", "Number of workers scanning and removing", on_jobs);
+  command_option(&sess->program, "-X", "--ignored", "Remove files the ignore rules match", on_ignored);
+  command_option(&sess->program, "-n", "--dry-run", "Only show what would be removed", on_dry_run);
+
+  if (sess->argc > 1) {
+    if (repo_cmd_needs_help(sess)) {
+      repo_help(sess, false);
+      exit(0);
+    }
+
+    repo_session_start(sess);
+  }
+
+  // untracked files may be someone's work, only ignored ones go
+  if (!clean_opts.ignored) {
+    repo_ferror("clean: only ignored files are removed, pass --ignored");
+  }
+
+  failed = repo_clean_all(sess->user->repo, sess->output, &clean_opts);
+
+  repo_session_free(sess);
+  exit(0 == failed ? 0 : 1);
+}
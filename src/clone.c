@@ -6,6 +6,31 @@
 
 progress_t *fetch_progress, *checkout_progress;
 
+/**
+ * State threaded through the libgit2 callbacks of one clone,
+ * so concurrent clones never share progress.
+ */
+
+typedef struct clone_state {
+  repo_clone_opts_t *opts;
+  repo_clone_progress_t progress;
+  bool needs_auth;
+} clone_state_t;
+
+/**
+ * State of a `--json` / `--ndjson` clone, progress is
+ * coalesced to at most one event every `CLONE_EVENT_INTERVAL_MS`
+ */
+
+#define CLONE_EVENT_INTERVAL_MS 100
+
+typedef struct clone_events {
+  repo_emitter_t *emitter;
+  repo_clone_throttle_t throttle;
+} clone_events_t;
+
+static unsigned int terminal_received = 0;
+
 static void
 on_progress_start (progress_data_t *data) {
   repo_log("clone: fetching..");
@@ -21,31 +46,35 @@ on_progress_end (progress_data_t *data) {
   // add new line from progress bar
   puts("");
   repo_log("clone: complete");
+  fetch_progress = NULL;
 }
 
 static int
 on_fetch_progress (const git_transfer_progress *stats, void *data) {
-  git_progress_payload_t *payload = (git_progress_payload_t*)data;
-  payload->fetch_progress = *stats;
+  clone_state_t *state = (clone_state_t *) data;
 
-  if (0 == fetch_progress->total) {
-    fetch_progress->total = (int) stats->total_objects;
-  }
-
-  progress_tick(fetch_progress, (int)stats->received_objects);
+  state->progress.received = stats->received_objects;
+  state->progress.total = stats->total_objects;
+  state->progress.indexed = stats->indexed_objects;
+  state->progress.bytes = stats->received_bytes;
 
-  if (fetch_progress->value != fetch_progress->total) {
-    usleep(20000);
+  if (state->opts && state->opts->progress) {
+    state->opts->progress(&state->progress, state->opts->data);
   }
 
   return 0;
 }
 
 static void
-on_checkout_progress (const char *path, size_t current, size_t toal, void *data) {
+on_checkout_progress (const char *path, size_t current, size_t total, void *data) {
+  clone_state_t *state = (clone_state_t *) data;
 
-  // do nothing here..
+  state->progress.checkout_current = current;
+  state->progress.checkout_total = total;
 
+  if (state->opts && state->opts->progress) {
+    state->opts->progress(&state->progress, state->opts->data);
+  }
 }
 
 
@@ -53,47 +82,140 @@ static int
 on_cred_acquire (git_cred **out, const char * url, const char * username_from_url,
                  unsigned int allowed_types, void * payload) {
 
-  repo_ferror("%s\n", "expecting authentication");
-  exit(1);
-  return 1;
+  clone_state_t *state = (clone_state_t *) payload;
+  state->needs_auth = true;
+  return -1;
 
 }
 
+static void
+on_terminal_progress (const repo_clone_progress_t *progress, void *data) {
+  // the bar only follows the fetch
+  if (!fetch_progress || progress->checkout_total) return;
 
-int
-repo_clone (repo_t *repo, const char *url, const char *path) {
-  int error;
-  char dest_path[256];
-  sprintf(dest_path, "%s/%s", repo->path, path);
+  if (0 == fetch_progress->total) {
+    fetch_progress->total = (int) progress->total;
+  }
 
-  progress_t *fprogress = progress_new(0, 50);
-  fetch_progress = fprogress;
-  checkout_progress = progress_new(0, 20);
+  progress_tick(fetch_progress, (int) (progress->received - terminal_received));
+  terminal_received = progress->received;
 
-  progress_on(fetch_progress, PROGRESS_EVENT_START, on_progress_start);
-  progress_on(fetch_progress, PROGRESS_EVENT_PROGRESS, on_progress);
-  progress_on(fetch_progress, PROGRESS_EVENT_END, on_progress_end);
+  if (fetch_progress && fetch_progress->value != fetch_progress->total) {
+    usleep(20000);
+  }
+}
 
-  fetch_progress->fmt = "repo: clone: :percent {:bar} (:elapsed)";
-  fetch_progress->bar_char = "#";
-  fetch_progress->bg_bar_char = ".";
+static void
+on_event_progress (const repo_clone_progress_t *progress, void *data) {
+  clone_events_t *events = (clone_events_t *) data;
+  repo_emitter_t *emitter = events->emitter;
+
+  if (!repo_clone_throttle(&events->throttle, progress))
+    return;
+
+  repo_emitter_begin(emitter);
+  repo_emitter_str(emitter, "event", progress->checkout_total ? "checkout" : "fetch");
+  repo_emitter_int(emitter, "received", progress->received);
+  repo_emitter_int(emitter, "total", progress->total);
+  repo_emitter_int(emitter, "indexed", progress->indexed);
+  repo_emitter_int(emitter, "bytes", progress->bytes);
+  repo_emitter_int(emitter, "checkoutCurrent", progress->checkout_current);
+  repo_emitter_int(emitter, "checkoutTotal", progress->checkout_total);
+  repo_emitter_end(emitter);
+
+  // events are only useful to a consumer when they are timely
+  repo_emitter_flush(emitter);
+}
+
+
+/**
+ * Returns `true` when `progress` should be reported: something
+ * moved and either `interval_ms` has passed since the last
+ * report or a phase just completed, which always goes out.
+ */
+
+bool
+repo_clone_throttle (repo_clone_throttle_t *throttle, const repo_clone_progress_t *progress) {
+  struct timespec now;
+  bool fetch_done = progress->received == progress->total && progress->indexed == progress->total;
+  bool checkout_done = progress->checkout_total && progress->checkout_current == progress->checkout_total;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  long elapsed = (now.tv_sec - throttle->last.tv_sec) * 1000
+               + (now.tv_nsec - throttle->last.tv_nsec) / 1000000;
+
+  if (elapsed < throttle->interval_ms && !fetch_done && !checkout_done)
+    return false;
+
+  if (progress->received == throttle->last_received
+      && progress->checkout_current == throttle->last_checkout)
+    return false;
+
+  throttle->last = now;
+  throttle->last_received = progress->received;
+  throttle->last_checkout = progress->checkout_current;
+  return true;
+}
+
+
+int
+repo_clone_with (repo_t *repo, const char *url, const char *path, repo_clone_opts_t *opts) {
+  int error;
+  char dest_path[REPO_PATH_MAX];
+  snprintf(dest_path, sizeof(dest_path), "%s/%s", repo->path, path);
 
-  git_progress_payload_t payload = {{ 0 }};
+  clone_state_t state;
   git_repository *cloned_repo = NULL;
   git_clone_options clone_opts = GIT_CLONE_OPTIONS_INIT;
   git_checkout_opts checkout_opts = GIT_CHECKOUT_OPTS_INIT;
 
+  memset(&state, 0, sizeof(state));
+  state.opts = opts;
+
   checkout_opts.checkout_strategy = GIT_CHECKOUT_SAFE_CREATE;
   checkout_opts.progress_cb = on_checkout_progress;
-  checkout_opts.progress_payload = &payload;
+  checkout_opts.progress_payload = &state;
 
   clone_opts.checkout_opts = checkout_opts;
   clone_opts.fetch_progress_cb = &on_fetch_progress;
-  clone_opts.fetch_progress_payload = &payload;
+  clone_opts.fetch_progress_payload = &state;
   clone_opts.cred_acquire_cb = on_cred_acquire;
+  clone_opts.cred_acquire_payload = &state;
 
+  repo_stats_count(REPO_STATS_CLONE);
   error = git_clone(&cloned_repo, url, dest_path, &clone_opts);
 
+  if (0 != error && state.needs_auth) {
+    giterr_set_str(GITERR_NET, "expecting authentication");
+  } else if (cloned_repo) {
+    git_repository_free(cloned_repo);
+  }
+
+  return error;
+}
+
+
+int
+repo_clone (repo_t *repo, const char *url, const char *path) {
+  int error;
+  repo_clone_opts_t opts = { on_terminal_progress, NULL };
+
+  progress_t *fprogress = progress_new(0, 50);
+  fetch_progress = fprogress;
+  checkout_progress = progress_new(0, 20);
+  terminal_received = 0;
+
+  progress_on(fetch_progress, PROGRESS_EVENT_START, on_progress_start);
+  progress_on(fetch_progress, PROGRESS_EVENT_PROGRESS, on_progress);
+  progress_on(fetch_progress, PROGRESS_EVENT_END, on_progress_end);
+
+  fetch_progress->fmt = "repo: clone: :percent {:bar} (:elapsed)";
+  fetch_progress->bar_char = "#";
+  fetch_progress->bg_bar_char = ".";
+
+  error = repo_clone_with(repo, url, path, &opts);
+
   if (0 != error) {
     const git_error *err = giterr_last();
     if (err){
@@ -101,25 +223,59 @@ repo_clone (repo_t *repo, const char *url, const char *path) {
     } else {
       repo_ferror("clone: (%d) unknown error\n", error);
     }
-  } else if (cloned_repo) {
-    git_repository_free(cloned_repo);
   }
 
   return error;
 }
 
+/**
+ * Clone emitting `start`, `fetch`, `checkout` and `end` records
+ * instead of drawing a progress bar
+ */
 
-void
-repo_cmd_clone (repo_session_t *sess) {
-  int n = repo_args_index("clone");
+static int
+repo_clone_events (repo_t *repo, const char *url, const char *path, repo_output_t output) {
+  clone_events_t events;
+  repo_clone_opts_t opts = { on_event_progress, &events };
+  const git_error *err;
+  int error;
 
-  if (-1 == n)
-    n = 0;
+  memset(&events, 0, sizeof(events));
+  events.throttle.interval_ms = CLONE_EVENT_INTERVAL_MS;
+  events.emitter = repo_emitter_new(output, STDOUT_FILENO);
+  assert(events.emitter);
+
+  repo_emitter_begin(events.emitter);
+  repo_emitter_str(events.emitter, "event", "start");
+  repo_emitter_str(events.emitter, "url", url);
+  repo_emitter_str(events.emitter, "path", path);
+  repo_emitter_end(events.emitter);
+  repo_emitter_flush(events.emitter);
+
+  error = repo_clone_with(repo, url, path, &opts);
+  err = 0 != error ? giterr_last() : NULL;
+
+  repo_emitter_begin(events.emitter);
+  repo_emitter_str(events.emitter, "event", "end");
+  repo_emitter_str(events.emitter, "path", path);
+  repo_emitter_int(events.emitter, "code", error);
+  repo_emitter_str(events.emitter, "error", 0 != error
+    ? (err ? err->message : "unknown error")
+    : NULL);
+  repo_emitter_end(events.emitter);
+  repo_emitter_free(events.emitter);
 
-  char *remote, *tmp_dest, dest[256], abspath[256];
+  return error;
+}
+
+
+void
+repo_cmd_clone (repo_session_t *sess) {
+  char *remote, *tmp_dest, dest[256], abspath[REPO_PATH_MAX];
   repo_t *repo = sess->user->repo;
+  int error;
 
-  if (NULL != (remote = sess->argv[n + 1])) {
+  if (sess->argc > 1) {
     if (repo_cmd_needs_help(sess)) {
       repo_help(sess, false);
       exit(0);
@@ -128,24 +284,33 @@ repo_cmd_clone (repo_session_t *sess) {
     repo_session_start(sess);
   }
 
+  if (NULL == (remote = (char *) repo_cmd_positional(sess, "clone", 0))) {
+    repo_help(sess, false);
+    exit(1);
+  }
 
-
-  if (NULL != (tmp_dest = sess->argv[n + 2])) {
-    sprintf(dest, "%s", tmp_dest);
+  if (NULL != (tmp_dest = (char *) repo_cmd_positional(sess, "clone", 1))) {
+    snprintf(dest, sizeof(dest), "%s", tmp_dest);
   } else {
-    char *base = basename(remote);
-    sprintf(dest, "%s", repo_str_replace(base, ".git", "", 4));
+    char base[256];
+    snprintf(base, sizeof(base), "%s", basename(remote));
+    if (strstr(base, ".git")) repo_str_replace(base, ".git", "", 4);
+    snprintf(dest, sizeof(dest), "%s", base);
   }
 
-  sprintf(abspath, "%s/%s", repo->path, dest);
+  snprintf(abspath, sizeof(abspath), "%s/%s", repo->path, dest);
 
   if (repo_is_dir(abspath)) {
     repo_ferror("clone: Destination '%s' already exists", dest);
   }
 
-  repo_printf("clone: cloning into: %s => %s\n", remote, dest);
-  repo_clone(repo, remote, dest);
+  if (REPO_OUTPUT_TEXT != sess->output) {
+    error = repo_clone_events(repo, remote, dest, sess->output);
+  } else {
+    repo_printf("clone: cloning into: %s => %s\n", remote, dest);
+    error = repo_clone(repo, remote, dest);
+  }
 
   repo_session_free(sess);
-  exit(0);
+  exit(0 == error ? 0 : 1);
 }
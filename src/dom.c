@@ -0,0 +1,222 @@
+
+#include <repo.h>
+
+/**
+ * Arena backed JSON document. Nodes, the parser's own state
+ * and any string that needed unescaping live in the arena;
+ * every other string is stored as an (offset, length) pair
+ * into the input, which must outlive the document.
+ */
+
+typedef struct dom_frame {
+  repo_json_node_t *node;
+  repo_json_node_t *last;
+} dom_frame_t;
+
+typedef struct dom_builder {
+  repo_json_doc_t *doc;
+  json_parser *parser;
+  dom_frame_t *stack;
+  uint32_t depth;
+  uint32_t alloc;
+  repo_json_str_t key;
+} dom_builder_t;
+
+
+static int
+dom_str (dom_builder_t *b, repo_json_str_t *str, const char *data, uint32_t length) {
+  str->length = length;
+
+  if (b->parser->raw) {
+    str->offset = (uint32_t) (b->parser->raw - b->doc->input);
+    str->copy = NULL;
+    return 0;
+  }
+
+  if (!(str->copy = repo_arena_alloc(b->doc->arena, length + 1)))
+    return JSON_ERROR_NO_MEMORY;
+
+  memcpy(str->copy, data, length);
+  str->copy[length] = '\0';
+  str->offset = 0;
+  return 0;
+}
+
+
+static repo_json_node_t *
+dom_node (dom_builder_t *b, json_type type) {
+  repo_json_node_t *node;
+
+  if (!(node = repo_arena_alloc(b->doc->arena, sizeof(repo_json_node_t))))
+    return NULL;
+
+  node->type = type;
+  node->count = 0;
+  node->key = b->key;
+  node->value.offset = 0;
+  node->value.length = 0;
+  node->value.copy = NULL;
+  node->child = NULL;
+  node->next = NULL;
+
+  memset(&b->key, 0, sizeof(b->key));
+
+  if (0 == b->depth) {
+    b->doc->root = node;
+  } else {
+    dom_frame_t *frame = &b->stack[b->depth - 1];
+    if (frame->last) {
+      frame->last->next = node;
+    } else {
+      frame->node->child = node;
+    }
+    frame->last = node;
+    frame->node->count++;
+  }
+
+  return node;
+}
+
+
+static int
+dom_callback (void *data, int type, const char *value, uint32_t length) {
+  dom_builder_t *b = (dom_builder_t *) data;
+  repo_json_node_t *node;
+
+  switch (type) {
+    case JSON_OBJECT_BEGIN:
+    case JSON_ARRAY_BEGIN:
+      if (!(node = dom_node(b, type)))
+        return JSON_ERROR_NO_MEMORY;
+
+      if (b->depth == b->alloc) {
+        uint32_t alloc = b->alloc ? b->alloc * 2 : 32;
+        dom_frame_t *tmp = repo_arena_realloc(b->doc->arena, b->stack, alloc * sizeof(dom_frame_t));
+        if (!tmp) return JSON_ERROR_NO_MEMORY;
+        b->stack = tmp;
+        b->alloc = alloc;
+      }
+
+      b->stack[b->depth].node = node;
+      b->stack[b->depth].last = NULL;
+      b->depth++;
+      return 0;
+
+    case JSON_OBJECT_END:
+    case JSON_ARRAY_END:
+      b->depth--;
+      return 0;
+
+    case JSON_KEY:
+      return dom_str(b, &b->key, value, length);
+
+    case JSON_STRING:
+    case JSON_INT:
+    case JSON_FLOAT:
+      if (!(node = dom_node(b, type)))
+        return JSON_ERROR_NO_MEMORY;
+      // numbers are never tracked in the input, `raw` is NULL
+      return dom_str(b, &node->value, value, length);
+
+    case JSON_NULL:
+    case JSON_TRUE:
+    case JSON_FALSE:
+      return dom_node(b, type) ? 0 : JSON_ERROR_NO_MEMORY;
+  }
+
+  return 0;
+}
+
+/**
+ * Parses `length` bytes of `input` into `doc`. Returns 0 or
+ * a `JSON_ERROR_*` code. Everything allocated is released by
+ * resetting or freeing `arena`.
+ */
+
+int
+repo_json_parse (repo_json_doc_t *doc, repo_arena_t *arena, const char *input, size_t length) {
+  repo_arena_t *previous;
+  json_config config;
+  json_parser parser;
+  dom_builder_t b;
+  int rc;
+
+  if (length > UINT32_MAX)
+    return JSON_ERROR_NO_MEMORY;
+
+  doc->input = input;
+  doc->length = length;
+  doc->arena = arena;
+  doc->root = NULL;
+
+  memset(&b, 0, sizeof(b));
+  b.doc = doc;
+  b.parser = &parser;
+
+  memset(&config, 0, sizeof(config));
+  repo_arena_json_config(&config);
+  previous = repo_arena_use(arena);
+
+  if (0 == (rc = json_parser_init(&parser, &config, dom_callback, &b))) {
+    rc = json_parser_string(&parser, input, (uint32_t) length, NULL);
+    if (0 == rc && !json_parser_is_done(&parser)) {
+      rc = JSON_ERROR_UNEXPECTED_CHAR;
+    }
+    json_parser_free(&parser);
+  }
+
+  repo_arena_use(previous);
+  return rc;
+}
+
+
+const char *
+repo_json_str (repo_json_doc_t *doc, const repo_json_str_t *str) {
+  return str->copy ? str->copy : doc->input + str->offset;
+}
+
+
+bool
+repo_json_str_eq (repo_json_doc_t *doc, const repo_json_str_t *str, const char *value) {
+  size_t length = strlen(value);
+  return length == str->length
+    && 0 == memcmp(repo_json_str(doc, str), value, length);
+}
+
+
+char *
+repo_json_strdup (repo_json_doc_t *doc, const repo_json_str_t *str) {
+  char *copy;
+
+  if (str->copy)
+    return str->copy;
+
+  if ((copy = repo_arena_alloc(doc->arena, str->length + 1))) {
+    memcpy(copy, doc->input + str->offset, str->length);
+    copy[str->length] = '\0';
+  }
+
+  return copy;
+}
+
+
+repo_json_node_t *
+repo_json_get (repo_json_doc_t *doc, repo_json_node_t *object, const char *key) {
+  if (!object || JSON_OBJECT_BEGIN != object->type)
+    return NULL;
+
+  for (repo_json_node_t *node = object->child; node; node = node->next) {
+    if (repo_json_str_eq(doc, &node->key, key))
+      return node;
+  }
+
+  return NULL;
+}
+
+
+long long
+repo_json_int (repo_json_doc_t *doc, repo_json_node_t *node) {
+  if (!node || (JSON_INT != node->type && JSON_FLOAT != node->type))
+    return 0;
+  return strtoll(repo_json_str(doc, &node->value), NULL, 10);
+}
@@ -0,0 +1,840 @@
+
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <repo.h>
+
+/**
+ * `repo du` measures the disk space every repository under the
+ * root takes, split into the object database, the rest of the
+ * git directory, and the worktree's tracked, untracked and
+ * ignored files. Repositories are measured in parallel, each
+ * walked with `openat()` and `fstatat()` relative to the open
+ * directory so no path is resolved twice, and `d_type` tells
+ * subdirectories apart without a stat.
+ *
+ * What each directory holds directly is kept in
+ * `<root>/.repo/du`, with the directory's mtime and the names of
+ * its subdirectories. A directory whose mtime hasn't moved since
+ * is not read again, only its subdirectories are visited. Files
+ * rewritten in place don't move the mtime of their directory,
+ * `--force` measures everything again. The cache of worktree
+ * directories is also dropped when the index or `info/exclude`
+ * change, and below any `.gitignore` that changes, since those
+ * decide which files count as tracked or ignored.
+ *
+ *   header   magic, version and record count
+ *   records  `du_record_t`, then the directory's path and the
+ *            names of its subdirectories, each NUL terminated
+ */
+
+#define DU_JOBS 4
+#define DU_MAGIC "RDUC"
+#define DU_VERSION 1
+#define DU_FILE "du"
+
+typedef enum {
+  DU_OBJECTS,
+  DU_GIT,
+  DU_TRACKED,
+  DU_UNTRACKED,
+  DU_IGNORED,
+  DU_KINDS
+} du_kind_t;
+
+static const char *du_kinds[] = {
+  "objects", "git", "tracked", "untracked", "ignored"
+};
+
+typedef struct du_header {
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+  uint32_t reserved;
+} du_header_t;
+
+typedef struct du_record {
+  uint32_t path_length;
+  uint32_t names_length;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t stamp;
+  uint64_t bytes[DU_KINDS];
+} du_record_t;
+
+typedef struct du_dir {
+  du_record_t record;
+  const char *path;
+  const char *names;
+} du_dir_t;
+
+typedef struct du_cache {
+  void *map;
+  size_t size;
+  du_dir_t *dirs;
+  int length;
+  int *slots;
+  size_t mask;
+} du_cache_t;
+
+typedef struct du_job {
+  repo_dir_item_t *item;
+  const du_cache_t *cache;
+  git_repository *repo;
+  const char **tracked;
+  size_t tracked_length;
+  size_t root_length;
+  size_t gitdir_length;
+  uint64_t stamp;
+  uint64_t bytes[DU_KINDS];
+  uint64_t total;
+  size_t dirs;
+  size_t cached;
+  du_dir_t *out;
+  size_t out_length;
+  size_t out_alloc;
+  double ms;
+  bool failed;
+  char error[160];
+} du_job_t;
+
+static repo_du_opts_t du_opts;
+
+
+static double
+du_now_ms () {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+
+static void
+du_format (uint64_t bytes, char *out, size_t size) {
+  if (bytes < 1024) snprintf(out, size, "%llu B", (unsigned long long) bytes);
+  else if (bytes < 1024 * 1024) snprintf(out, size, "%.1f KiB", bytes / 1024.0);
+  else if (bytes < 1024 * 1024 * 1024) snprintf(out, size, "%.1f MiB", bytes / (1024.0 * 1024));
+  else snprintf(out, size, "%.2f GiB", bytes / (1024.0 * 1024 * 1024));
+}
+
+
+static uint32_t
+du_hash (const char *key) {
+  uint32_t hash = 2166136261u;
+  while (*key) hash = (hash ^ (unsigned char) *key++) * 16777619u;
+  return hash;
+}
+
+
+static void
+du_cache_close (du_cache_t *cache) {
+  if (cache->map) munmap(cache->map, cache->size);
+  free(cache->dirs);
+  free(cache->slots);
+  memset(cache, 0, sizeof(du_cache_t));
+}
+
+/**
+ * Maps the cache kept under `repo`, leaving `cache` empty if
+ * there is none or it can't be read
+ */
+
+static void
+du_cache_open (repo_t *repo, du_cache_t *cache) {
+  char path[REPO_PATH_MAX];
+  du_header_t header;
+  size_t offset = sizeof(du_header_t), size = 64;
+  struct stat st;
+  int fd;
+
+  memset(cache, 0, sizeof(du_cache_t));
+
+  if (0 != repo_cache_path(repo, DU_FILE, path, sizeof(path))
+      || -1 == (fd = open(path, O_RDONLY)))
+    return;
+
+  if (0 != fstat(fd, &st) || (size_t) st.st_size < sizeof(du_header_t)) {
+    close(fd);
+    return;
+  }
+
+  cache->size = (size_t) st.st_size;
+  cache->map = mmap(NULL, cache->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (MAP_FAILED == cache->map) {
+    cache->map = NULL;
+    return;
+  }
+
+  memcpy(&header, cache->map, sizeof(header));
+
+  if (0 != memcmp(header.magic, DU_MAGIC, 4) || DU_VERSION != header.version)
+    goto corrupt;
+
+  while (size < (size_t) header.count * 2) size <<= 1;
+
+  if (!(cache->dirs = calloc(header.count + 1, sizeof(du_dir_t)))
+      || !(cache->slots = malloc(size * sizeof(int))))
+    goto corrupt;
+
+  memset(cache->slots, -1, size * sizeof(int));
+  cache->mask = size - 1;
+
+  for (uint32_t i = 0; i < header.count; ++i) {
+    const char *base = (const char *) cache->map;
+    du_dir_t *dir = &cache->dirs[i];
+    size_t slot;
+
+    // records are packed, so copied out rather than read in place
+    if (offset + sizeof(du_record_t) > cache->size) goto corrupt;
+    memcpy(&dir->record, base + offset, sizeof(du_record_t));
+    offset += sizeof(du_record_t);
+
+    if (offset + dir->record.path_length + 1 + dir->record.names_length > cache->size
+        || '\0' != base[offset + dir->record.path_length])
+      goto corrupt;
+
+    dir->path = base + offset;
+    offset += dir->record.path_length + 1;
+    dir->names = base + offset;
+    offset += dir->record.names_length;
+
+    slot = du_hash(dir->path) & cache->mask;
+    while (-1 != cache->slots[slot]) slot = (slot + 1) & cache->mask;
+    cache->slots[slot] = (int) i;
+    cache->length++;
+  }
+
+  return;
+
+corrupt:
+  du_cache_close(cache);
+}
+
+
+static const du_dir_t *
+du_cache_find (const du_cache_t *cache, const char *path) {
+  size_t slot;
+
+  if (!cache || !cache->slots)
+    return NULL;
+
+  slot = du_hash(path) & cache->mask;
+
+  for (; -1 != cache->slots[slot]; slot = (slot + 1) & cache->mask) {
+    const du_dir_t *dir = &cache->dirs[cache->slots[slot]];
+    if (0 == strcmp(dir->path, path)) return dir;
+  }
+
+  return NULL;
+}
+
+
+static int
+du_cache_save (repo_t *repo, du_job_t *jobs, int length) {
+  char path[REPO_PATH_MAX], tmp[REPO_PATH_MAX + 4];
+  du_header_t header = { { 0 }, DU_VERSION, 0, 0 };
+  repo_buf_t *out;
+  int fd, rc = 0;
+
+  if (0 != repo_cache_path(repo, DU_FILE, path, sizeof(path)))
+    return -1;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+  if (-1 == (fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)))
+    return -1;
+
+  if (!(out = repo_buf_new(fd))) {
+    close(fd);
+    unlink(tmp);
+    return -1;
+  }
+
+  memcpy(header.magic, DU_MAGIC, 4);
+  for (int i = 0; i < length; ++i) header.count += (uint32_t) jobs[i].out_length;
+  rc |= repo_buf_write(out, (const char *) &header, sizeof(header));
+
+  for (int i = 0; i < length; ++i) {
+    for (size_t j = 0; j < jobs[i].out_length; ++j) {
+      du_dir_t *dir = &jobs[i].out[j];
+      rc |= repo_buf_write(out, (const char *) &dir->record, sizeof(du_record_t));
+      rc |= repo_buf_write(out, dir->path, dir->record.path_length + 1);
+      rc |= repo_buf_write(out, dir->names, dir->record.names_length);
+    }
+  }
+
+  rc |= repo_buf_flush(out);
+  repo_buf_free(out);
+  rc |= close(fd);
+
+  if (0 != rc || 0 != rename(tmp, path)) {
+    unlink(tmp);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Keeps what `path` holds directly for the next run
+ */
+
+static void
+du_keep (du_job_t *job, const char *path, const du_record_t *record, const char *names) {
+  du_dir_t *dir;
+  char *copy;
+
+  if (job->out_length == job->out_alloc) {
+    size_t alloc = job->out_alloc ? job->out_alloc * 2 : 256;
+    du_dir_t *out = realloc(job->out, alloc * sizeof(du_dir_t));
+    if (!out) return;
+    job->out = out;
+    job->out_alloc = alloc;
+  }
+
+  if (!(copy = malloc(record->path_length + 1 + record->names_length)))
+    return;
+
+  memcpy(copy, path, record->path_length + 1);
+  memcpy(copy + record->path_length + 1, names, record->names_length);
+
+  dir = &job->out[job->out_length++];
+  dir->record = *record;
+  dir->path = copy;
+  dir->names = copy + record->path_length + 1;
+}
+
+
+static int
+path_cmp (const void *a, const void *b) {
+  return strcmp(*(const char * const *) a, *(const char * const *) b);
+}
+
+/**
+ * Index of the first tracked path not sorting before `path`
+ */
+
+static size_t
+du_lower_bound (du_job_t *job, const char *path) {
+  size_t lo = 0, hi = job->tracked_length;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (strcmp(job->tracked[mid], path) < 0) lo = mid + 1;
+    else hi = mid;
+  }
+
+  return lo;
+}
+
+
+static bool
+du_is_tracked (du_job_t *job, const char *rel) {
+  size_t i = du_lower_bound(job, rel);
+  return i < job->tracked_length && 0 == strcmp(job->tracked[i], rel);
+}
+
+
+static bool
+du_has_tracked (du_job_t *job, const char *rel) {
+  size_t length = strlen(rel), i;
+  char prefix[REPO_PATH_MAX];
+
+  snprintf(prefix, sizeof(prefix), "%s/", rel);
+  i = du_lower_bound(job, prefix);
+  return i < job->tracked_length && 0 == strncmp(job->tracked[i], prefix, length + 1);
+}
+
+
+static bool
+du_is_ignored (du_job_t *job, const char *rel) {
+  int ignored = 0;
+
+  if (0 != git_ignore_path_is_ignored(&ignored, job->repo, rel)) {
+    giterr_clear();
+    return false;
+  }
+
+  return ignored;
+}
+
+
+static du_kind_t
+du_classify (du_job_t *job, const char *rel, bool ignored) {
+  if (du_is_tracked(job, rel)) return DU_TRACKED;
+  if (ignored || du_is_ignored(job, rel)) return DU_IGNORED;
+  return DU_UNTRACKED;
+}
+
+static void
+du_walk (du_job_t *job, int fd, char *path, size_t length, du_kind_t kind, bool ignored, uint64_t stamp);
+
+/**
+ * The mtime in `st`, which macOS keeps under another name
+ */
+
+static struct timespec
+du_mtime (const struct stat *st) {
+#if defined(__APPLE__)
+  return st->st_mtimespec;
+#else
+  return st->st_mtim;
+#endif
+}
+
+/**
+ * Folds the mtime in `st` into `stamp`
+ */
+
+static uint64_t
+du_mix (uint64_t stamp, const struct stat *st) {
+  struct timespec mtime = du_mtime(st);
+  return stamp * 31 + mtime.tv_sec * 1000000000ull + mtime.tv_nsec;
+}
+
+/**
+ * Descends into `name` in `fd`, a directory of `kind` whose
+ * ignore rules have `stamp`
+ */
+
+static void
+du_enter (du_job_t *job, int fd, char *path, size_t length, du_kind_t kind, bool ignored, uint64_t stamp, const char *name) {
+  size_t child = length + 1 + strlen(name);
+  const char *rel;
+  int sub;
+
+  if (child >= REPO_PATH_MAX)
+    return;
+
+  path[length] = '/';
+  strcpy(path + length + 1, name);
+  rel = path + job->root_length + 1;
+
+  if (length == job->root_length && 0 == strcmp(name, ".git")) {
+    kind = DU_GIT;
+  } else if (DU_GIT == kind && length == job->gitdir_length && 0 == strcmp(name, "objects")) {
+    kind = DU_OBJECTS;
+  } else if (DU_TRACKED == kind && !ignored && !du_has_tracked(job, rel)) {
+    // an ignored directory with nothing tracked in it is ignored whole
+    ignored = du_is_ignored(job, rel);
+  }
+
+  if (-1 != (sub = openat(fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC))) {
+    du_walk(job, sub, path, child, kind, ignored, stamp);
+    close(sub);
+  }
+
+  path[length] = '\0';
+}
+
+/**
+ * Measures the directory open as `fd` at `path`, `length` bytes
+ * long. In the worktree `kind` is DU_TRACKED and files are told
+ * apart one by one, `stamp` covers the ignore rules of the
+ * directories above and the directory's own `.gitignore` is
+ * folded in, so editing one re-reads everything below it.
+ */
+
+static void
+du_walk (du_job_t *job, int fd, char *path, size_t length, du_kind_t kind, bool ignored, uint64_t stamp) {
+  const du_dir_t *cached;
+  du_record_t record = { 0 };
+  char *names = NULL;
+  size_t names_length = 0, names_alloc = 0;
+  struct dirent *entry;
+  struct stat st;
+  DIR *dir;
+  int copy;
+
+  if (0 != fstat(fd, &st))
+    return;
+
+  job->dirs++;
+  record.path_length = (uint32_t) length;
+  record.mtime_sec = du_mtime(&st).tv_sec;
+  record.mtime_nsec = du_mtime(&st).tv_nsec;
+  record.stamp = 0;
+
+  if (DU_TRACKED == kind) {
+    struct stat rules;
+    record.stamp = 0 == fstatat(fd, ".gitignore", &rules, 0) ? du_mix(stamp, &rules) : stamp;
+  }
+
+  cached = du_opts.force ? NULL : du_cache_find(job->cache, path);
+
+  if (cached
+      && cached->record.mtime_sec == record.mtime_sec
+      && cached->record.mtime_nsec == record.mtime_nsec
+      && cached->record.stamp == record.stamp) {
+    job->cached++;
+    du_keep(job, path, &cached->record, cached->names);
+
+    for (int k = 0; k < DU_KINDS; ++k) job->bytes[k] += cached->record.bytes[k];
+
+    for (size_t i = 0; i < cached->record.names_length; i += strlen(cached->names + i) + 1) {
+      du_enter(job, fd, path, length, kind, ignored, record.stamp, cached->names + i);
+    }
+
+    return;
+  }
+
+  // fdopendir() takes over the descriptor it is given
+  if (-1 == (copy = dup(fd)) || !(dir = fdopendir(copy))) {
+    if (-1 != copy) close(copy);
+    return;
+  }
+
+  while ((entry = readdir(dir))) {
+    const char *name = entry->d_name;
+    bool is_dir = DT_DIR == entry->d_type;
+    du_kind_t file = kind;
+
+    if ('.' == name[0] && ('\0' == name[1] || ('.' == name[1] && '\0' == name[2]))) continue;
+
+    if (!is_dir) {
+      if (0 != fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW)) continue;
+      is_dir = DT_UNKNOWN == entry->d_type && S_ISDIR(st.st_mode);
+    }
+
+    if (is_dir) {
+      size_t size = strlen(name) + 1;
+
+      if (names_length + size > names_alloc) {
+        size_t alloc = names_alloc ? names_alloc * 2 : 256;
+        char *grown;
+        while (alloc < names_length + size) alloc *= 2;
+        if (!(grown = realloc(names, alloc))) continue;
+        names = grown;
+        names_alloc = alloc;
+      }
+
+      memcpy(names + names_length, name, size);
+      names_length += size;
+      continue;
+    }
+
+    if (length == job->root_length && 0 == strcmp(name, ".git")) {
+      file = DU_GIT;
+    } else if (DU_TRACKED == kind) {
+      char rel[REPO_PATH_MAX];
+      snprintf(rel, sizeof(rel), "%s%s%s", path + job->root_length + (length > job->root_length)
+          , length > job->root_length ? "/" : "", name);
+      file = du_classify(job, rel, ignored);
+    }
+
+    // blocks rather than length, sparse and compressed files count what they use
+    record.bytes[file] += (uint64_t) st.st_blocks * 512;
+  }
+
+  closedir(dir);
+
+  record.names_length = (uint32_t) names_length;
+  du_keep(job, path, &record, names ? names : "");
+
+  for (int k = 0; k < DU_KINDS; ++k) job->bytes[k] += record.bytes[k];
+
+  for (size_t i = 0; i < names_length; i += strlen(names + i) + 1) {
+    du_enter(job, fd, path, length, kind, ignored, record.stamp, names + i);
+  }
+
+  free(names);
+}
+
+/**
+ * What decides tracked and ignored across the whole worktree:
+ * the index and `info/exclude`
+ */
+
+static uint64_t
+du_stamp (const char *gitdir) {
+  const char *files[] = { "index", "info/exclude" };
+  char path[REPO_PATH_MAX + 16];
+  uint64_t stamp = 0;
+  struct stat st;
+
+  for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+    snprintf(path, sizeof(path), "%s%s", gitdir, files[i]);
+    if (0 == stat(path, &st)) stamp = du_mix(stamp, &st);
+  }
+
+  return stamp;
+}
+
+
+static void
+du_run (void *data) {
+  du_job_t *job = (du_job_t *) data;
+  repo_handles_t *handles = repo_handles_default();
+  repo_handle_t *handle = NULL;
+  git_index *index = NULL;
+  char path[REPO_PATH_MAX];
+  double start = du_now_ms();
+  int fd;
+
+  REPO_TRACE_BEGIN("du", job->item->name);
+
+  snprintf(path, sizeof(path), "%s", job->item->path);
+  job->root_length = strlen(path);
+  while (job->root_length > 1 && '/' == path[job->root_length - 1]) path[--job->root_length] = '\0';
+
+  if (0 != repo_handles_get(handles, job->item->path, &handle)) {
+    const git_error *err = giterr_last();
+    job->failed = true;
+    snprintf(job->error, sizeof(job->error), "open: %s", err ? err->message : "unknown error");
+    goto cleanup;
+  }
+
+  job->repo = handle->repo;
+
+  if (git_repository_is_bare(job->repo)) {
+    job->gitdir_length = job->root_length;
+  } else {
+    job->gitdir_length = job->root_length + strlen("/.git");
+    job->stamp = du_stamp(git_repository_path(job->repo));
+
+    // the index is sorted already, but not always the way strcmp() sorts
+    if (0 == git_repository_index(&index, job->repo)) {
+      job->tracked_length = git_index_entrycount(index);
+      if ((job->tracked = calloc(job->tracked_length + 1, sizeof(char *)))) {
+        for (size_t i = 0; i < job->tracked_length; ++i) {
+          job->tracked[i] = git_index_get_byindex(index, i)->path;
+        }
+        qsort(job->tracked, job->tracked_length, sizeof(char *), path_cmp);
+      } else {
+        job->tracked_length = 0;
+      }
+    } else {
+      giterr_clear();
+    }
+  }
+
+  if (-1 == (fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC))) {
+    job->failed = true;
+    snprintf(job->error, sizeof(job->error), "open: %s", strerror(errno));
+    goto cleanup;
+  }
+
+  du_walk(job, fd, path, job->root_length
+      , git_repository_is_bare(job->repo) ? DU_GIT : DU_TRACKED, false, job->stamp);
+  close(fd);
+
+  for (int k = 0; k < DU_KINDS; ++k) job->total += job->bytes[k];
+
+cleanup:
+  free(job->tracked);
+  job->tracked = NULL;
+  git_index_free(index);
+  repo_handles_put(handles, handle);
+  job->repo = NULL;
+  REPO_TRACE_END("du");
+  job->ms = du_now_ms() - start;
+}
+
+
+static void
+du_print (du_job_t *job) {
+  char size[32];
+
+  if (job->failed) {
+    printf(" %s failed: %s\n", job->item->name, job->error);
+    return;
+  }
+
+  du_format(job->total, size, sizeof(size));
+  printf(" %s: %s", job->item->name, size);
+
+  for (int k = 0; k < DU_KINDS; ++k) {
+    if (0 == job->bytes[k]) continue;
+    du_format(job->bytes[k], size, sizeof(size));
+    printf("%s%s %s", 0 == k ? " (" : ", ", du_kinds[k], size);
+  }
+
+  printf("%s\n", job->total ? ")" : "");
+}
+
+
+static void
+du_emit (repo_emitter_t *emitter, du_job_t *job) {
+  repo_emitter_begin(emitter);
+  repo_emitter_str(emitter, "name", job->item->name);
+  repo_emitter_str(emitter, "path", job->item->path);
+  repo_emitter_str(emitter, "error", job->failed ? job->error : NULL);
+  repo_emitter_int(emitter, "total", job->total);
+  for (int k = 0; k < DU_KINDS; ++k) repo_emitter_int(emitter, du_kinds[k], job->bytes[k]);
+  repo_emitter_int(emitter, "dirs", job->dirs);
+  repo_emitter_int(emitter, "cached", job->cached);
+  repo_emitter_float(emitter, "ms", job->ms);
+  repo_emitter_end(emitter);
+}
+
+
+static int
+size_cmp (const void *a, const void *b) {
+  const du_job_t *x = *(du_job_t * const *) a, *y = *(du_job_t * const *) b;
+  return x->total < y->total ? 1 : x->total > y->total ? -1 : 0;
+}
+
+/**
+ * Measures every repository under `repo` and prints the
+ * results. Returns the number that failed, or -1 if none could
+ * be measured.
+ */
+
+int
+repo_du_all (repo_t *repo, repo_output_t output, repo_du_opts_t *opts) {
+  repo_dir_t *dir = repo_dir_new(repo->path);
+  repo_emitter_t *emitter = NULL;
+  uint64_t bytes[DU_KINDS] = { 0 }, total = 0;
+  size_t dirs = 0, cached = 0;
+  du_job_t *jobs, **order;
+  du_cache_t cache;
+  repo_pool_t *pool;
+  int length = 0, failed = 0;
+  double start, elapsed;
+  char size[32];
+  FILE *summary;
+
+  if (!dir) {
+    repo_ferror("path does not exist '%s'", repo->path);
+  }
+
+  if (!(jobs = calloc(dir->length + 1, sizeof(du_job_t)))
+      || !(order = calloc(dir->length + 1, sizeof(du_job_t *)))) {
+    repo_error("du: out of memory");
+    repo_dir_free(dir);
+    free(jobs);
+    return -1;
+  }
+
+  if (!(pool = repo_pool_new(opts->jobs > 0 ? opts->jobs : DU_JOBS))) {
+    repo_error("du: failed to start worker threads");
+    repo_dir_free(dir);
+    free(order);
+    free(jobs);
+    return -1;
+  }
+
+  du_cache_open(repo, &cache);
+  start = du_now_ms();
+
+  for (int i = 0; i < dir->length; ++i) {
+    repo_dir_item_t *item = &dir->items[i];
+    du_job_t *job = &jobs[length];
+
+    if (!repo_dir_item_is_git_repo(item)) continue;
+
+    job->item = item;
+    job->cache = &cache;
+    order[length++] = job;
+    if (0 != repo_pool_push(pool, du_run, job)) du_run(job);
+  }
+
+  repo_pool_wait(pool);
+  repo_pool_free(pool);
+  elapsed = du_now_ms() - start;
+
+  // the old cache is mapped, it has to go before it is replaced
+  du_cache_close(&cache);
+  if (0 != du_cache_save(repo, jobs, length)) {
+    fprintf(stderr, "repo: du: failed to save the cache: %s\n", strerror(errno));
+  }
+
+  if (opts->by_size) {
+    qsort(order, length, sizeof(du_job_t *), size_cmp);
+  }
+
+  if (REPO_OUTPUT_TEXT != output) {
+    emitter = repo_emitter_new(output, STDOUT_FILENO);
+    assert(emitter);
+  }
+
+  for (int i = 0; i < length; ++i) {
+    du_job_t *job = order[i];
+
+    for (int k = 0; k < DU_KINDS; ++k) bytes[k] += job->bytes[k];
+    total += job->total;
+    dirs += job->dirs;
+    cached += job->cached;
+    if (job->failed) failed++;
+
+    if (emitter) du_emit(emitter, job);
+    else du_print(job);
+  }
+
+  repo_emitter_free(emitter);
+
+  summary = emitter ? stderr : stdout;
+  du_format(total, size, sizeof(size));
+  fprintf(summary, "repo: du: %d repositories, %s", length, size);
+  du_format(bytes[DU_OBJECTS], size, sizeof(size));
+  fprintf(summary, ", objects %s", size);
+  du_format(bytes[DU_IGNORED], size, sizeof(size));
+  fprintf(summary, ", ignored %s, %zu directories (%zu unchanged) in %.1fs"
+      , size, dirs, cached, elapsed / 1000.0);
+  if (failed) fprintf(summary, ", %d failed", failed);
+  fprintf(summary, "\n");
+
+  for (int i = 0; i < length; ++i) {
+    for (size_t j = 0; j < jobs[i].out_length; ++j) free((char *) jobs[i].out[j].path);
+    free(jobs[i].out);
+  }
+
+  free(order);
+  free(jobs);
+  repo_dir_free(dir);
+  return failed;
+}
+
+
+static void
+on_jobs (command_t *self) {
+  du_opts.jobs = atoi(self->arg);
+}
+
+
+static void
+on_sort (command_t *self) {
+  if (0 == strcmp(self->arg, "size")) {
+    du_opts.by_size = true;
+  } else if (0 == strcmp(self->arg, "name")) {
+    du_opts.by_size = false;
+  } else {
+    repo_ferror("du: --sort: unknown key '%s', use size or name", self->arg);
+  }
+}
+
+
+static void
+on_force (command_t *self) {
+  du_opts.force = true;
+}
+
+
+void
+repo_cmd_du (repo_session_t *sess) {
+  int failed;
+
+  du_opts.jobs = DU_JOBS;
+  du_opts.by_size = false;
+  du_opts.force = false;
+
+  command_option(&sess->program, "-j", "--jobs <n>", "Number of repositories measured in parallel", on_jobs);
+  command_option(&sess->program, "-s", "--sort <key>", "Order repositories by size or name", on_sort);
+  command_option(&sess->program, "-f", "--force", "Measure everything again, ignoring the cache", on_force);
+
+  if (sess->argc > 1) {
+    if (repo_cmd_needs_help(sess)) {
+      repo_help(sess, false);
+      exit(0);
+    }
+
+    repo_session_start(sess);
+  }
+
+  failed = repo_du_all(sess->user->repo, sess->output, &du_opts);
+
+  repo_session_free(sess);
+  exit(0 == failed ? 0 : 1);
+}
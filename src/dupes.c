@@ -0,0 +1,635 @@
+
+#include <assert.h>
+#include <repo.h>
+
+/**
+ * `repo dupes` finds files with the same content across the
+ * HEAD trees of every repository under the root. Blob oids are
+ * hashes of the content, so two files are the same exactly when
+ * their oids are, and nothing but trees and blob headers is
+ * read. Repositories are walked in parallel. Every blob of at
+ * least `--min-size` bytes becomes one fixed size entry in a
+ * shared array, and paths are kept as a tree of names per
+ * repository rather than as strings per file.
+ *
+ * Entries are grouped with an open addressing table of entry
+ * indexes keyed on the oid, each slot heading a chain threaded
+ * through one array of next indexes, so grouping tens of
+ * millions of entries takes three flat allocations. Groups are
+ * reported by the space their extra copies take, largest first.
+ */
+
+#define DUPES_JOBS 4
+
+// blobs smaller than this are licenses and empty `__init__.py`s
+#define DUPES_MIN_SIZE 1024
+
+// entries a worker collects before adding them to the shared array
+#define DUPES_BATCH 4096
+
+#define DUPES_NONE UINT32_MAX
+#define DUPES_SYMLINK 0120000
+
+/**
+ * One blob at one path. Sizes over 4 GiB are counted as 4 GiB,
+ * hosts refuse blobs that big anyway.
+ */
+
+typedef struct dupes_entry {
+  unsigned char oid[GIT_OID_RAWSZ];
+  uint32_t repo;
+  uint32_t path;
+  uint32_t size;
+} dupes_entry_t;
+
+// a file or directory, `name` is an offset into the job's names
+typedef struct dupes_node {
+  uint32_t parent;
+  uint32_t name;
+} dupes_node_t;
+
+typedef struct dupes_group {
+  uint32_t head;
+  uint32_t copies;
+  uint32_t repos;
+  uint64_t wasted;
+} dupes_group_t;
+
+typedef struct dupes_shared {
+  pthread_mutex_t lock;
+  dupes_entry_t *entries;
+  size_t length;
+  size_t alloc;
+} dupes_shared_t;
+
+typedef struct dupes_job {
+  repo_dir_item_t *item;
+  uint32_t index;
+  dupes_shared_t *shared;
+  git_repository *repo;
+  git_odb *odb;
+  uint64_t min_size;
+  dupes_node_t *nodes;
+  uint32_t nodes_length;
+  uint32_t nodes_alloc;
+  char *names;
+  size_t names_length;
+  size_t names_alloc;
+  dupes_entry_t *batch;
+  int batch_length;
+  size_t blobs;
+  size_t trees;
+  bool unborn;
+  bool failed;
+  char error[160];
+} dupes_job_t;
+
+static repo_dupes_opts_t dupes_opts;
+
+
+static double
+dupes_now_ms () {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+
+static void
+dupes_format (uint64_t bytes, char *out, size_t size) {
+  if (bytes < 1024) snprintf(out, size, "%llu B", (unsigned long long) bytes);
+  else if (bytes < 1024 * 1024) snprintf(out, size, "%.1f KiB", bytes / 1024.0);
+  else if (bytes < 1024 * 1024 * 1024) snprintf(out, size, "%.1f MiB", bytes / (1024.0 * 1024));
+  else snprintf(out, size, "%.2f GiB", bytes / (1024.0 * 1024 * 1024));
+}
+
+/**
+ * Adds a path component named `name` under `parent`. Returns
+ * its index, or DUPES_NONE when out of memory.
+ */
+
+static uint32_t
+dupes_node (dupes_job_t *job, uint32_t parent, const char *name) {
+  size_t size = strlen(name) + 1;
+
+  if (job->nodes_length == job->nodes_alloc) {
+    uint32_t alloc = job->nodes_alloc ? job->nodes_alloc * 2 : 1024;
+    dupes_node_t *nodes = realloc(job->nodes, alloc * sizeof(dupes_node_t));
+    if (!nodes) return DUPES_NONE;
+    job->nodes = nodes;
+    job->nodes_alloc = alloc;
+  }
+
+  if (job->names_length + size > job->names_alloc) {
+    size_t alloc = job->names_alloc ? job->names_alloc * 2 : 16384;
+    char *names;
+    while (alloc < job->names_length + size) alloc *= 2;
+    if (!(names = realloc(job->names, alloc))) return DUPES_NONE;
+    job->names = names;
+    job->names_alloc = alloc;
+  }
+
+  memcpy(job->names + job->names_length, name, size);
+  job->nodes[job->nodes_length].parent = parent;
+  job->nodes[job->nodes_length].name = (uint32_t) job->names_length;
+  job->names_length += size;
+  return job->nodes_length++;
+}
+
+
+static int
+dupes_flush (dupes_job_t *job) {
+  dupes_shared_t *shared = job->shared;
+  int rc = 0;
+
+  pthread_mutex_lock(&shared->lock);
+
+  if (shared->length + job->batch_length > shared->alloc) {
+    size_t alloc = shared->alloc ? shared->alloc * 2 : 65536;
+    dupes_entry_t *entries = realloc(shared->entries, alloc * sizeof(dupes_entry_t));
+    if (entries) {
+      shared->entries = entries;
+      shared->alloc = alloc;
+    } else {
+      rc = -1;
+    }
+  }
+
+  if (0 == rc) {
+    memcpy(shared->entries + shared->length, job->batch, job->batch_length * sizeof(dupes_entry_t));
+    shared->length += job->batch_length;
+  }
+
+  pthread_mutex_unlock(&shared->lock);
+
+  job->batch_length = 0;
+  return rc;
+}
+
+/**
+ * Collects the blobs in tree `oid`, the directory `dir`
+ */
+
+static int
+dupes_tree (dupes_job_t *job, const git_oid *oid, uint32_t dir) {
+  git_tree *tree = NULL;
+  size_t count;
+  int rc = 0;
+
+  if (0 != git_tree_lookup(&tree, job->repo, oid))
+    return -1;
+
+  job->trees++;
+  count = git_tree_entrycount(tree);
+
+  for (size_t i = 0; i < count && 0 == rc; ++i) {
+    const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+    const git_oid *id = git_tree_entry_id(entry);
+    dupes_entry_t *out;
+    uint32_t node;
+    git_otype type;
+    size_t size;
+
+    switch (git_tree_entry_type(entry)) {
+      case GIT_OBJ_TREE:
+        if (DUPES_NONE == (node = dupes_node(job, dir, git_tree_entry_name(entry)))) rc = -1;
+        else rc = dupes_tree(job, id, node);
+        break;
+
+      case GIT_OBJ_BLOB:
+        if (DUPES_SYMLINK == git_tree_entry_filemode(entry)) break;
+        if (0 != git_odb_read_header(&size, &type, job->odb, id)) {
+          rc = -1;
+          break;
+        }
+
+        job->blobs++;
+        if (size < job->min_size) break;
+
+        if (DUPES_NONE == (node = dupes_node(job, dir, git_tree_entry_name(entry)))) {
+          rc = -1;
+          break;
+        }
+
+        out = &job->batch[job->batch_length++];
+        memcpy(out->oid, id->id, GIT_OID_RAWSZ);
+        out->repo = job->index;
+        out->path = node;
+        out->size = size > UINT32_MAX ? UINT32_MAX : (uint32_t) size;
+
+        if (DUPES_BATCH == job->batch_length) rc = dupes_flush(job);
+        break;
+
+      // submodules are looked at in their own repository
+      default:
+        break;
+    }
+  }
+
+  git_tree_free(tree);
+  return rc;
+}
+
+
+static void
+dupes_run (void *data) {
+  dupes_job_t *job = (dupes_job_t *) data;
+  repo_handles_t *handles = repo_handles_default();
+  repo_handle_t *handle = NULL;
+  git_commit *commit = NULL;
+  uint32_t root;
+  git_oid head;
+
+  REPO_TRACE_BEGIN("dupes", job->item->name);
+
+  if (0 != repo_handles_get(handles, job->item->path, &handle)
+      || 0 != git_repository_odb(&job->odb, handle->repo)) {
+    const git_error *err = giterr_last();
+    job->failed = true;
+    snprintf(job->error, sizeof(job->error), "open: %s", err ? err->message : "unknown error");
+    goto cleanup;
+  }
+
+  job->repo = handle->repo;
+
+  // only while the repository is walked, jobs outlive their batches
+  if (!(job->batch = malloc(DUPES_BATCH * sizeof(dupes_entry_t)))) {
+    job->failed = true;
+    snprintf(job->error, sizeof(job->error), "out of memory");
+    goto cleanup;
+  }
+
+  if (0 != git_reference_name_to_id(&head, job->repo, "HEAD")) {
+    giterr_clear();
+    job->unborn = true;
+    goto cleanup;
+  }
+
+  if (DUPES_NONE == (root = dupes_node(job, DUPES_NONE, ""))
+      || 0 != git_commit_lookup(&commit, job->repo, &head)
+      || 0 != dupes_tree(job, git_commit_tree_id(commit), root)
+      || (job->batch_length > 0 && 0 != dupes_flush(job))) {
+    const git_error *err = giterr_last();
+    job->failed = true;
+    snprintf(job->error, sizeof(job->error), "%s", err ? err->message : "out of memory");
+  }
+
+cleanup:
+  free(job->batch);
+  job->batch = NULL;
+  git_commit_free(commit);
+  git_odb_free(job->odb);
+  job->odb = NULL;
+  repo_handles_put(handles, handle);
+  job->repo = NULL;
+  REPO_TRACE_END("dupes");
+}
+
+/**
+ * Writes the path of `node` in `job` to `out`
+ */
+
+static void
+dupes_path (dupes_job_t *job, uint32_t node, char *out, size_t size) {
+  uint32_t parts[256];
+  size_t depth = 0, length = 0;
+
+  // the root has no name and no parent
+  for (; DUPES_NONE != job->nodes[node].parent && depth < 256; node = job->nodes[node].parent) {
+    parts[depth++] = node;
+  }
+
+  out[0] = '\0';
+
+  while (depth-- > 0) {
+    const char *name = job->names + job->nodes[parts[depth]].name;
+    int n = snprintf(out + length, size - length, "%s%s", length ? "/" : "", name);
+    if (n < 0 || (size_t) n >= size - length) break;
+    length += n;
+  }
+}
+
+
+static size_t
+dupes_slot (const uint32_t *slots, size_t mask, const dupes_entry_t *entries, const unsigned char *oid) {
+  uint64_t key;
+  size_t slot;
+
+  memcpy(&key, oid, sizeof(key));
+
+  for (slot = key & mask; DUPES_NONE != slots[slot]; slot = (slot + 1) & mask) {
+    if (0 == memcmp(entries[slots[slot]].oid, oid, GIT_OID_RAWSZ)) break;
+  }
+
+  return slot;
+}
+
+/**
+ * Chains the entries of `shared` by oid and returns the groups
+ * with more than one entry in `out`. `next` links each entry to
+ * the next one with the same oid.
+ */
+
+static int
+dupes_group (dupes_shared_t *shared, int repos, uint32_t **next, dupes_group_t **out, size_t *length) {
+  dupes_entry_t *entries = shared->entries;
+  size_t size = 1024, count = 0, alloc = 0;
+  uint32_t *slots, *seen = NULL;
+  dupes_group_t *groups = NULL;
+
+  while (size < shared->length * 2) size <<= 1;
+
+  if (!(slots = malloc(size * sizeof(uint32_t)))
+      || !(*next = malloc((shared->length + 1) * sizeof(uint32_t)))
+      || !(seen = malloc((repos + 1) * sizeof(uint32_t)))) {
+    free(slots);
+    free(seen);
+    return -1;
+  }
+
+  memset(slots, 0xff, size * sizeof(uint32_t));
+  memset(seen, 0xff, (repos + 1) * sizeof(uint32_t));
+
+  for (size_t i = 0; i < shared->length; ++i) {
+    size_t slot = dupes_slot(slots, size - 1, entries, entries[i].oid);
+    (*next)[i] = slots[slot];
+    slots[slot] = (uint32_t) i;
+  }
+
+  for (size_t slot = 0; slot < size; ++slot) {
+    uint32_t head = slots[slot];
+    dupes_group_t group = { head, 0, 0, 0 };
+
+    if (DUPES_NONE == head || DUPES_NONE == (*next)[head]) continue;
+
+    for (uint32_t i = head; DUPES_NONE != i; i = (*next)[i]) {
+      group.copies++;
+      if (seen[entries[i].repo] != (uint32_t) count) {
+        seen[entries[i].repo] = (uint32_t) count;
+        group.repos++;
+      }
+    }
+
+    group.wasted = (uint64_t) entries[head].size * (group.copies - 1);
+
+    if (count == alloc) {
+      size_t grow = alloc ? alloc * 2 : 256;
+      dupes_group_t *grown = realloc(groups, grow * sizeof(dupes_group_t));
+      if (!grown) {
+        free(groups);
+        free(slots);
+        free(seen);
+        return -1;
+      }
+      groups = grown;
+      alloc = grow;
+    }
+
+    groups[count++] = group;
+  }
+
+  free(slots);
+  free(seen);
+  *out = groups;
+  *length = count;
+  return 0;
+}
+
+
+static int
+group_cmp (const void *a, const void *b) {
+  const dupes_group_t *x = a, *y = b;
+  if (x->wasted != y->wasted) return x->wasted < y->wasted ? 1 : -1;
+  return x->copies < y->copies ? 1 : x->copies > y->copies ? -1 : 0;
+}
+
+
+static const dupes_entry_t *entry_base;
+
+static int
+entry_cmp (const void *a, const void *b) {
+  const dupes_entry_t *x = &entry_base[*(const uint32_t *) a], *y = &entry_base[*(const uint32_t *) b];
+  if (x->repo != y->repo) return x->repo < y->repo ? -1 : 1;
+  return x->path < y->path ? -1 : x->path > y->path;
+}
+
+
+static void
+dupes_report (repo_emitter_t *emitter, dupes_job_t *jobs, dupes_shared_t *shared
+    , dupes_group_t *group, const uint32_t *next) {
+  const dupes_entry_t *entries = shared->entries;
+  char hex[GIT_OID_HEXSZ + 1], size[32], wasted[32], path[REPO_PATH_MAX];
+  uint32_t *copies = malloc(group->copies * sizeof(uint32_t));
+  git_oid oid;
+  uint32_t n = 0;
+
+  if (!copies)
+    return;
+
+  for (uint32_t i = group->head; DUPES_NONE != i; i = next[i]) copies[n++] = i;
+
+  // copies in directory order, the chain has them newest first
+  entry_base = entries;
+  qsort(copies, n, sizeof(uint32_t), entry_cmp);
+
+  git_oid_fromraw(&oid, entries[group->head].oid);
+  git_oid_tostr(hex, sizeof(hex), &oid);
+
+  if (!emitter) {
+    dupes_format(entries[group->head].size, size, sizeof(size));
+    dupes_format(group->wasted, wasted, sizeof(wasted));
+    printf(" %.*s: %s x %u copies in %u repositories, %s duplicated\n"
+        , 12, hex, size, group->copies, group->repos, wasted);
+  }
+
+  for (uint32_t i = 0; i < n; ++i) {
+    const dupes_entry_t *entry = &entries[copies[i]];
+    dupes_job_t *job = &jobs[entry->repo];
+
+    dupes_path(job, entry->path, path, sizeof(path));
+
+    if (!emitter) {
+      printf("   %s: %s\n", job->item->name, path);
+      continue;
+    }
+
+    // one record per copy, grouped by oid
+    repo_emitter_begin(emitter);
+    repo_emitter_str(emitter, "oid", hex);
+    repo_emitter_int(emitter, "size", entry->size);
+    repo_emitter_int(emitter, "copies", group->copies);
+    repo_emitter_int(emitter, "repositories", group->repos);
+    repo_emitter_int(emitter, "wasted", group->wasted);
+    repo_emitter_str(emitter, "name", job->item->name);
+    repo_emitter_str(emitter, "path", path);
+    repo_emitter_end(emitter);
+  }
+
+  free(copies);
+}
+
+/**
+ * Finds duplicated blobs across the repositories under `repo`
+ * and prints them. Returns the number of repositories that
+ * failed, or -1 if nothing could be compared.
+ */
+
+int
+repo_dupes_all (repo_t *repo, repo_output_t output, repo_dupes_opts_t *opts) {
+  repo_dir_t *dir = repo_dir_new(repo->path);
+  repo_emitter_t *emitter = NULL;
+  dupes_shared_t shared = { .entries = NULL };
+  dupes_group_t *groups = NULL;
+  uint32_t *next = NULL;
+  size_t groups_length = 0, blobs = 0, trees = 0, copies = 0;
+  uint64_t wasted = 0;
+  dupes_job_t *jobs;
+  repo_pool_t *pool;
+  int length = 0, failed = 0;
+  double start, elapsed;
+  char size[32];
+  FILE *summary;
+
+  if (!dir) {
+    repo_ferror("path does not exist '%s'", repo->path);
+  }
+
+  if (!(jobs = calloc(dir->length + 1, sizeof(dupes_job_t)))) {
+    repo_error("dupes: out of memory");
+    repo_dir_free(dir);
+    return -1;
+  }
+
+  if (!(pool = repo_pool_new(opts->jobs > 0 ? opts->jobs : DUPES_JOBS))) {
+    repo_error("dupes: failed to start worker threads");
+    repo_dir_free(dir);
+    free(jobs);
+    return -1;
+  }
+
+  pthread_mutex_init(&shared.lock, NULL);
+  start = dupes_now_ms();
+
+  for (int i = 0; i < dir->length; ++i) {
+    repo_dir_item_t *item = &dir->items[i];
+    dupes_job_t *job = &jobs[length];
+
+    if (!repo_dir_item_is_git_repo(item)) continue;
+
+    job->item = item;
+    job->index = (uint32_t) length;
+    job->shared = &shared;
+    job->min_size = opts->min_size;
+    length++;
+    if (0 != repo_pool_push(pool, dupes_run, job)) dupes_run(job);
+  }
+
+  repo_pool_wait(pool);
+  repo_pool_free(pool);
+
+  if (0 != dupes_group(&shared, length, &next, &groups, &groups_length)) {
+    repo_error("dupes: out of memory");
+    failed = -1;
+    goto cleanup;
+  }
+
+  qsort(groups, groups_length, sizeof(dupes_group_t), group_cmp);
+  elapsed = dupes_now_ms() - start;
+
+  for (int i = 0; i < length; ++i) {
+    dupes_job_t *job = &jobs[i];
+
+    blobs += job->blobs;
+    trees += job->trees;
+    if (!job->failed) continue;
+
+    failed++;
+    fprintf(stderr, " %s failed: %s\n", job->item->name, job->error);
+  }
+
+  if (REPO_OUTPUT_TEXT != output) {
+    emitter = repo_emitter_new(output, STDOUT_FILENO);
+    assert(emitter);
+  }
+
+  for (size_t i = 0; i < groups_length; ++i) {
+    copies += groups[i].copies;
+    wasted += groups[i].wasted;
+    dupes_report(emitter, jobs, &shared, &groups[i], next);
+  }
+
+  repo_emitter_free(emitter);
+
+  summary = emitter ? stderr : stdout;
+  dupes_format(wasted, size, sizeof(size));
+  fprintf(summary, "repo: dupes: %d repositories, %zu trees, %zu blobs, %zu at least %llu bytes"
+      ", %zu duplicated in %zu copies taking %s more than needed, in %.1fs"
+      , length, trees, blobs, shared.length, (unsigned long long) opts->min_size
+      , groups_length, copies, size, elapsed / 1000.0);
+  if (failed) fprintf(summary, ", %d failed", failed);
+  fprintf(summary, "\n");
+
+cleanup:
+  for (int i = 0; i < length; ++i) {
+    free(jobs[i].nodes);
+    free(jobs[i].names);
+  }
+
+  pthread_mutex_destroy(&shared.lock);
+  free(shared.entries);
+  free(groups);
+  free(next);
+  free(jobs);
+  repo_dir_free(dir);
+  return failed;
+}
+
+
+static void
+on_jobs (command_t *self) {
+  dupes_opts.jobs = atoi(self->arg);
+}
+
+
+static void
+on_min_size (command_t *self) {
+  char *end;
+  unsigned long long size = strtoull(self->arg, &end, 10);
+
+  switch (*end) {
+    case 'g': case 'G': size *= 1024; // fallthrough
+    case 'm': case 'M': size *= 1024; // fallthrough
+    case 'k': case 'K': size *= 1024; // fallthrough
+    case '\0': break;
+    default:
+      repo_ferror("dupes: --min-size: invalid size '%s'", self->arg);
+  }
+
+  dupes_opts.min_size = size;
+}
+
+
+void
+repo_cmd_dupes (repo_session_t *sess) {
+  int failed;
+
+  dupes_opts.jobs = DUPES_JOBS;
+  dupes_opts.min_size = DUPES_MIN_SIZE;
+
+  command_option(&sess->program, "-j", "--jobs <n>", "Number of repositories read in parallel", on_jobs);
+  command_option(&sess->program, "-m", "--min-size <n>", "Ignore files smaller than n bytes, k, M or G suffixed", on_min_size);
+
+  if (sess->argc > 1) {
+    if (repo_cmd_needs_help(sess)) {
+      repo_help(sess, false);
+      exit(0);
+    }
+
+    repo_session_start(sess);
+  }
+
+  failed = repo_dupes_all(sess->user->repo, sess->output, &dupes_opts);
+
+  repo_session_free(sess);
+  exit(0 == failed ? 0 : 1);
+}
@@ -0,0 +1,140 @@
+
+#include <assert.h>
+#include <repo.h>
+
+/**
+ * Record emitter shared by commands that support `--json`
+ * and `--ndjson`. Records go through deps/json's printer into
+ * a `repo_buf_t`, so output is streamed in large writes and
+ * memory stays flat no matter how many records are emitted.
+ *
+ *   --json    one array holding every record
+ *   --ndjson  one object per line
+ */
+
+static int
+on_print (void *userdata, const char *s, uint32_t length) {
+  return repo_buf_write((repo_buf_t *) userdata, s, length);
+}
+
+
+repo_emitter_t *
+repo_emitter_new (repo_output_t mode, int fd) {
+  repo_emitter_t *emitter;
+
+  if (!(emitter = malloc(sizeof(repo_emitter_t))))
+    return NULL;
+
+  if (!(emitter->buf = repo_buf_new(fd))) {
+    free(emitter);
+    return NULL;
+  }
+
+  emitter->mode = mode;
+  emitter->records = 0;
+  json_print_init(&emitter->printer, on_print, emitter->buf);
+
+  if (REPO_OUTPUT_JSON == mode) {
+    json_print_raw(&emitter->printer, JSON_ARRAY_BEGIN, NULL, 0);
+  }
+
+  return emitter;
+}
+
+
+void
+repo_emitter_begin (repo_emitter_t *emitter) {
+  // every ndjson line is a document of its own
+  if (REPO_OUTPUT_NDJSON == emitter->mode) {
+    json_print_init(&emitter->printer, on_print, emitter->buf);
+  }
+
+  json_print_raw(&emitter->printer, JSON_OBJECT_BEGIN, NULL, 0);
+}
+
+
+void
+repo_emitter_str (repo_emitter_t *emitter, const char *key, const char *value) {
+  json_print_raw(&emitter->printer, JSON_KEY, key, strlen(key));
+
+  if (value) {
+    json_print_raw(&emitter->printer, JSON_STRING, value, strlen(value));
+  } else {
+    json_print_raw(&emitter->printer, JSON_NULL, NULL, 0);
+  }
+}
+
+
+void
+repo_emitter_int (repo_emitter_t *emitter, const char *key, long long value) {
+  char num[32];
+  int len = snprintf(num, sizeof(num), "%lld", value);
+  json_print_raw(&emitter->printer, JSON_KEY, key, strlen(key));
+  json_print_raw(&emitter->printer, JSON_INT, num, len);
+}
+
+
+void
+repo_emitter_float (repo_emitter_t *emitter, const char *key, double value) {
+  char num[64];
+  int len = snprintf(num, sizeof(num), "%.3f", value);
+  json_print_raw(&emitter->printer, JSON_KEY, key, strlen(key));
+  json_print_raw(&emitter->printer, JSON_FLOAT, num, len);
+}
+
+
+void
+repo_emitter_bool (repo_emitter_t *emitter, const char *key, bool value) {
+  json_print_raw(&emitter->printer, JSON_KEY, key, strlen(key));
+  json_print_raw(&emitter->printer, value ? JSON_TRUE : JSON_FALSE, NULL, 0);
+}
+
+
+/**
+ * Starts an object nested in the current record under `key`,
+ * closed by `repo_emitter_object_end()`
+ */
+
+void
+repo_emitter_object (repo_emitter_t *emitter, const char *key) {
+  json_print_raw(&emitter->printer, JSON_KEY, key, strlen(key));
+  json_print_raw(&emitter->printer, JSON_OBJECT_BEGIN, NULL, 0);
+}
+
+
+void
+repo_emitter_object_end (repo_emitter_t *emitter) {
+  json_print_raw(&emitter->printer, JSON_OBJECT_END, NULL, 0);
+}
+
+
+void
+repo_emitter_end (repo_emitter_t *emitter) {
+  json_print_raw(&emitter->printer, JSON_OBJECT_END, NULL, 0);
+  emitter->records++;
+
+  if (REPO_OUTPUT_NDJSON == emitter->mode) {
+    repo_buf_write(emitter->buf, "\n", 1);
+  }
+}
+
+
+int
+repo_emitter_flush (repo_emitter_t *emitter) {
+  return repo_buf_flush(emitter->buf);
+}
+
+
+void
+repo_emitter_free (repo_emitter_t *emitter) {
+  if (!emitter) return;
+
+  if (REPO_OUTPUT_JSON == emitter->mode) {
+    json_print_raw(&emitter->printer, JSON_ARRAY_END, NULL, 0);
+    repo_buf_write(emitter->buf, "\n", 1);
+  }
+
+  json_print_free(&emitter->printer);
+  repo_buf_free(emitter->buf);
+  free(emitter);
+}
@@ -0,0 +1,562 @@
+
+#include <assert.h>
+#include <repo.h>
+
+/**
+ * `repo fetch` fetches every remote of every repository under
+ * the root. Remotes are listed on the calling thread, then
+ * handed to the scheduler longest first going by how long they
+ * took in earlier runs, grouped by host so no server sees more
+ * than `--per-host` connections from us at a time. Results are
+ * printed in directory order once every fetch is done, followed
+ * by a summary comparing the predicted and actual run time.
+ *
+ * Every fetch starts by reading the refs the remote advertises.
+ * A fingerprint of that advertisement is kept in the job history
+ * after each successful fetch, and when the next advertisement
+ * hashes the same the remote has nothing new for us: the fetch
+ * disconnects there, skipping negotiation and the pack transfer.
+ * The fingerprint also covers the remote's fetch refspecs and the
+ * tips of the refs they write to, so a changed refspec or deleted
+ * or pruned tracking refs fetch again. `--force` fetches
+ * regardless.
+ */
+
+#define FETCH_PER_HOST 4
+#define FETCH_FNV_OFFSET 14695981039346656037ull
+#define FETCH_FNV_PRIME 1099511628211ull
+
+static repo_fetch_opts_t fetch_opts;
+
+
+static double
+fetch_now_ms () {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+
+static void
+fetch_fail (repo_fetch_job_t *job) {
+  const git_error *err = giterr_last();
+
+  job->failed = true;
+  snprintf(job->error, sizeof(job->error), "%s", job->needs_auth
+      ? "authentication required"
+      : err ? err->message : "unknown error");
+}
+
+
+static uint64_t
+fetch_hash (uint64_t hash, const void *data, size_t length) {
+  const unsigned char *bytes = (const unsigned char *) data;
+  for (size_t i = 0; i < length; ++i) hash = (hash ^ bytes[i]) * FETCH_FNV_PRIME;
+  return hash;
+}
+
+
+static int
+on_head (git_remote_head *head, void *data) {
+  repo_fetch_job_t *job = (repo_fetch_job_t *) data;
+  uint64_t hash = fetch_hash(FETCH_FNV_OFFSET, head->name, strlen(head->name) + 1);
+
+  // summed so the order refs are advertised in doesn't matter
+  job->fingerprint += fetch_hash(hash, head->oid.id, GIT_OID_RAWSZ);
+  return 0;
+}
+
+
+typedef struct fetch_local {
+  git_repository *repo;
+  uint64_t hash;
+} fetch_local_t;
+
+
+static int
+on_tracking_ref (const char *name, void *data) {
+  fetch_local_t *local = (fetch_local_t *) data;
+  uint64_t hash = fetch_hash(FETCH_FNV_OFFSET, name, strlen(name) + 1);
+  git_oid oid;
+
+  // a symbolic ref that doesn't resolve hashes as its name alone
+  if (0 == git_reference_name_to_id(&oid, local->repo, name)) {
+    hash = fetch_hash(hash, oid.id, GIT_OID_RAWSZ);
+  } else {
+    giterr_clear();
+  }
+
+  local->hash += hash;
+  return 0;
+}
+
+/**
+ * Hashes the fetch refspecs of `remote` and the refs they write
+ * to in `repo`, what a fetch would find on our side
+ */
+
+static uint64_t
+fetch_local_hash (git_repository *repo, git_remote *remote) {
+  fetch_local_t local = { repo, FETCH_FNV_OFFSET };
+  git_strarray refspecs = { NULL, 0 };
+
+  if (0 != git_remote_get_fetch_refspecs(&refspecs, remote)) {
+    giterr_clear();
+    return 0;
+  }
+
+  for (size_t i = 0; i < refspecs.count; ++i) {
+    const char *spec = refspecs.strings[i], *dst = strchr(spec, ':');
+
+    local.hash = fetch_hash(local.hash, spec, strlen(spec) + 1);
+    if (!dst || !*++dst) continue;
+
+    if (strchr(dst, '*')) {
+      if (0 != git_reference_foreach_glob(repo, dst, on_tracking_ref, &local)) giterr_clear();
+    } else {
+      on_tracking_ref(dst, &local);
+    }
+  }
+
+  git_strarray_free(&refspecs);
+  return local.hash;
+}
+
+
+static int
+on_update_tips (const char *refname, const git_oid *a, const git_oid *b, void *data) {
+  ((repo_fetch_job_t *) data)->updated++;
+  return 0;
+}
+
+
+static int
+on_cred_acquire (git_cred **out, const char *url, const char *username_from_url,
+                 unsigned int allowed_types, void *payload) {
+  // nobody is there to answer a prompt
+  ((repo_fetch_job_t *) payload)->needs_auth = true;
+  return -1;
+}
+
+
+/**
+ * Fetches `job`'s remote, a `repo_pool_job_cb`. Safe to run on
+ * any thread; the outcome is left in `job`.
+ */
+
+void
+repo_fetch_run (void *data) {
+  repo_fetch_job_t *job = (repo_fetch_job_t *) data;
+  git_remote_callbacks callbacks = GIT_REMOTE_CALLBACKS_INIT;
+  repo_handles_t *handles = repo_handles_default();
+  repo_handle_t *handle = NULL;
+  git_remote *remote = NULL;
+  const git_transfer_progress *stats;
+  uint64_t advertised;
+  const char *url;
+  double start = fetch_now_ms();
+
+  REPO_TRACE_BEGIN("fetch", job->item->name);
+  repo_stats_count(REPO_STATS_FETCH);
+
+  if (0 != repo_handles_get(handles, job->item->path, &handle)
+      || 0 != git_remote_load(&remote, handle->repo, job->remote)) {
+    fetch_fail(job);
+    goto cleanup;
+  }
+
+  callbacks.update_tips = on_update_tips;
+  callbacks.payload = job;
+  git_remote_set_callbacks(remote, &callbacks);
+  git_remote_set_cred_acquire_cb(remote, on_cred_acquire, job);
+
+  if (0 != git_remote_connect(remote, GIT_DIRECTION_FETCH)
+      || 0 != git_remote_ls(remote, on_head, job)) {
+    fetch_fail(job);
+    goto cleanup;
+  }
+
+  // a new url is a new remote even if it advertises the same refs
+  if ((url = git_remote_url(remote))) {
+    job->fingerprint ^= fetch_hash(FETCH_FNV_OFFSET, url, strlen(url));
+  }
+
+  advertised = job->fingerprint;
+  job->fingerprint = advertised ^ fetch_local_hash(handle->repo, remote);
+  if (0 == job->fingerprint) job->fingerprint = 1;
+
+  if (job->known == job->fingerprint) {
+    job->skipped = true;
+    goto cleanup;
+  }
+
+  if (0 != git_remote_download(remote, NULL, NULL)
+      || 0 != git_remote_update_tips(remote)) {
+    fetch_fail(job);
+    goto cleanup;
+  }
+
+  // what the next run will find if nothing changes meanwhile
+  job->fingerprint = advertised ^ fetch_local_hash(handle->repo, remote);
+  if (0 == job->fingerprint) job->fingerprint = 1;
+
+  stats = git_remote_stats(remote);
+  job->bytes = stats->received_bytes;
+  job->objects = stats->received_objects;
+
+cleanup:
+  if (remote) {
+    git_remote_disconnect(remote);
+    git_remote_free(remote);
+  }
+
+  repo_handles_put(handles, handle);
+  REPO_TRACE_END("fetch");
+  job->ms = fetch_now_ms() - start;
+}
+
+/**
+ * Writes the host `url` points at into `out`: `github.com` for
+ * both `https://user@github.com:443/a/b` and `git@github.com:a/b`.
+ * Local paths and `file://` URLs are all host `local`.
+ */
+
+int
+repo_remote_host (const char *url, char *out, size_t size) {
+  const char *start = url, *end, *at, *scheme = strstr(url, "://");
+  size_t len;
+
+  if (scheme) {
+    if (0 == strncmp(url, "file://", 7)) {
+      snprintf(out, size, "local");
+      return 0;
+    }
+    start = scheme + 3;
+    end = start + strcspn(start, "/");
+  } else {
+    end = start + strcspn(start, ":/");
+
+    // no `host:` prefix, a path on this machine
+    if (':' != *end) {
+      snprintf(out, size, "local");
+      return 0;
+    }
+  }
+
+  if ((at = memchr(start, '@', end - start))) start = at + 1;
+
+  // `[::1]:9418`, keep the brackets and drop the port
+  if ('[' == *start && (at = memchr(start, ']', end - start))) {
+    len = at + 1 - start;
+  } else {
+    len = strcspn(start, ":/");
+    if (start + len > end) len = end - start;
+  }
+
+  if (0 == len || len >= size)
+    return -1;
+
+  memcpy(out, start, len);
+  out[len] = '\0';
+  return 0;
+}
+
+
+static void
+format_bytes (size_t bytes, char *out, size_t size) {
+  if (bytes < 1024) snprintf(out, size, "%zu B", bytes);
+  else if (bytes < 1024 * 1024) snprintf(out, size, "%.1f KiB", bytes / 1024.0);
+  else if (bytes < 1024 * 1024 * 1024) snprintf(out, size, "%.1f MiB", bytes / (1024.0 * 1024));
+  else snprintf(out, size, "%.2f GiB", bytes / (1024.0 * 1024 * 1024));
+}
+
+/**
+ * Creates the fetch of `remote` of the repository `item`,
+ * open as `repo`. Given a `history` the fetch is skipped if the
+ * remote still advertises what it did the last time.
+ */
+
+repo_fetch_job_t *
+repo_fetch_job_new (repo_dir_item_t *item, git_repository *repo, const char *remote, repo_history_t *history) {
+  repo_history_entry_t *entry;
+  git_remote *loaded = NULL;
+  repo_fetch_job_t *job;
+
+  if (!(job = calloc(1, sizeof(repo_fetch_job_t))))
+    return NULL;
+
+  if (!(job->remote = strdup(remote))
+      || !(job->key = malloc(strlen(item->name) + strlen(remote) + 8))) {
+    repo_fetch_job_free(job);
+    return NULL;
+  }
+
+  job->item = item;
+  sprintf(job->key, "fetch:%s/%s", item->name, remote);
+
+  if (0 == git_remote_load(&loaded, repo, remote)) {
+    if (!git_remote_url(loaded)
+        || 0 != repo_remote_host(git_remote_url(loaded), job->host, sizeof(job->host))) {
+      snprintf(job->host, sizeof(job->host), "%s", "unknown");
+    }
+    git_remote_free(loaded);
+  } else {
+    // let the job report why it can't be loaded
+    snprintf(job->host, sizeof(job->host), "%s", "unknown");
+  }
+
+  if (history && (entry = repo_history_find(history, job->key))) {
+    job->known = entry->fingerprint;
+    job->work_ms = entry->work_ms;
+  }
+
+  return job;
+}
+
+/**
+ * Records how long `job` took in `history` along with what its
+ * remote advertised, unless it failed
+ */
+
+void
+repo_fetch_record (repo_history_t *history, repo_fetch_job_t *job) {
+  repo_history_entry_t *entry;
+
+  // a failure says nothing about how long the fetch takes
+  if (job->failed || 0 != repo_history_record(history, job->key, job->ms, job->bytes))
+    return;
+
+  if (!job->skipped && (entry = repo_history_find(history, job->key))) {
+    entry->fingerprint = job->fingerprint;
+    entry->work_ms = job->ms;
+  }
+}
+
+
+void
+repo_fetch_job_free (repo_fetch_job_t *job) {
+  if (!job) return;
+  free(job->remote);
+  free(job->key);
+  free(job);
+}
+
+/**
+ * Adds one job per remote of `item` to `sched`, costed from
+ * `history`, and appends them to `jobs`. Unless `force` is set
+ * jobs skip remotes whose advertisement matches the one in
+ * `history`. Returns the number added or -1.
+ */
+
+static int
+fetch_queue (repo_sched_t *sched, repo_history_t *history, repo_dir_item_t *item, bool force,
+             repo_fetch_job_t ***jobs, int *length, int *alloc) {
+  repo_handles_t *handles = repo_handles_default();
+  repo_handle_t *handle = NULL;
+  git_strarray names = { NULL, 0 };
+  int queued = 0, first = *length;
+
+  if (0 != repo_handles_get(handles, item->path, &handle))
+    return -1;
+
+  if (0 != git_remote_list(&names, handle->repo)) {
+    repo_handles_put(handles, handle);
+    return -1;
+  }
+
+  for (size_t i = 0; i < names.count; ++i) {
+    repo_fetch_job_t *job;
+
+    if (*length == *alloc) {
+      int size = *alloc ? *alloc * 2 : 64;
+      repo_fetch_job_t **tmp = realloc(*jobs, size * sizeof(repo_fetch_job_t *));
+      if (!tmp) break;
+      *jobs = tmp;
+      *alloc = size;
+    }
+
+    if (!(job = repo_fetch_job_new(item, handle->repo, names.strings[i], force ? NULL : history)))
+      break;
+
+    (*jobs)[(*length)++] = job;
+  }
+
+  git_strarray_free(&names);
+  repo_handles_put(handles, handle);
+
+  for (int i = first; i < *length; ++i) {
+    repo_fetch_job_t *job = (*jobs)[i];
+    double cost = repo_history_predict(history, job->key);
+
+    if (0 != repo_sched_add(sched, job->host, cost, repo_fetch_run, job)) {
+      repo_fetch_run(job);
+    }
+    queued++;
+  }
+
+  return queued;
+}
+
+/**
+ * Fetches every remote of every repository under `repo` and
+ * prints the results. Returns the number of failed fetches, or
+ * -1 if the fetches couldn't be started.
+ */
+
+int
+repo_fetch_all (repo_t *repo, repo_output_t output, repo_fetch_opts_t *opts) {
+  repo_dir_t *dir = repo_dir_new(repo->path);
+  repo_emitter_t *emitter = NULL;
+  repo_history_t *history;
+  repo_sched_t *sched;
+  repo_fetch_job_t **jobs = NULL;
+  int length = 0, alloc = 0, repos = 0, failed = 0, skipped = 0;
+  size_t updated = 0, bytes = 0;
+  double start, elapsed, predicted, saved = 0;
+  char size[32];
+  FILE *summary;
+
+  if (!dir) {
+    repo_ferror("path does not exist '%s'", repo->path);
+  }
+
+  if (!(history = repo_history_load(repo))) {
+    repo_error("fetch: out of memory");
+    repo_dir_free(dir);
+    return -1;
+  }
+
+  if (!(sched = repo_sched_new(opts->jobs, opts->per_host > 0 ? opts->per_host : FETCH_PER_HOST))) {
+    repo_error("fetch: failed to start worker threads");
+    repo_history_free(history);
+    repo_dir_free(dir);
+    return -1;
+  }
+
+  for (int i = 0; i < dir->length; ++i) {
+    repo_dir_item_t *item = &dir->items[i];
+    if (!repo_dir_item_is_git_repo(item)) continue;
+    if (fetch_queue(sched, history, item, opts->force, &jobs, &length, &alloc) > 0) repos++;
+  }
+
+  start = fetch_now_ms();
+  predicted = repo_sched_start(sched);
+  repo_sched_wait(sched);
+  repo_sched_free(sched);
+  elapsed = fetch_now_ms() - start;
+
+  if (REPO_OUTPUT_TEXT != output) {
+    emitter = repo_emitter_new(output, STDOUT_FILENO);
+    assert(emitter);
+  }
+
+  for (int i = 0; i < length; ++i) {
+    repo_fetch_job_t *job = jobs[i];
+
+    updated += job->updated;
+    bytes += job->bytes;
+
+    repo_fetch_record(history, job);
+    if (job->failed) failed++;
+
+    if (job->skipped) {
+      skipped++;
+      if (job->work_ms > job->ms) saved += job->work_ms - job->ms;
+    }
+
+    if (emitter) {
+      repo_emitter_begin(emitter);
+      repo_emitter_str(emitter, "name", job->item->name);
+      repo_emitter_str(emitter, "path", job->item->path);
+      repo_emitter_str(emitter, "remote", job->remote);
+      repo_emitter_str(emitter, "host", job->host);
+      repo_emitter_str(emitter, "error", job->failed ? job->error : NULL);
+      repo_emitter_bool(emitter, "skipped", job->skipped);
+      repo_emitter_int(emitter, "updated", job->updated);
+      repo_emitter_int(emitter, "objects", job->objects);
+      repo_emitter_int(emitter, "bytes", job->bytes);
+      repo_emitter_float(emitter, "ms", job->ms);
+      repo_emitter_end(emitter);
+    } else if (job->failed) {
+      printf(" (%s) %s failed: %s\n", job->remote, job->item->name, job->error);
+    } else if (job->updated) {
+      format_bytes(job->bytes, size, sizeof(size));
+      printf(" (%s) %s: %zu refs updated, %s\n", job->remote, job->item->name, job->updated, size);
+    } else if (job->skipped) {
+      printf(" (%s) %s: unchanged, skipped\n", job->remote, job->item->name);
+    } else {
+      printf(" (%s) %s: up to date\n", job->remote, job->item->name);
+    }
+  }
+
+  repo_emitter_free(emitter);
+
+  // keep --json / --ndjson output on stdout parseable
+  summary = emitter ? stderr : stdout;
+  format_bytes(bytes, size, sizeof(size));
+  fprintf(summary, "repo: fetch: %d remotes of %d repositories in %.1fs", length, repos, elapsed / 1000.0);
+  if (predicted > 0) fprintf(summary, " (predicted %.1fs)", predicted / 1000.0);
+  fprintf(summary, ", %zu refs updated, %s received", updated, size);
+  if (skipped) fprintf(summary, ", %d unchanged skipped saving ~%.1fs", skipped, saved / 1000.0);
+  if (failed) fprintf(summary, ", %d failed", failed);
+  fprintf(summary, "\n");
+
+  if (0 != repo_history_save(history)) {
+    fprintf(stderr, "repo: fetch: failed to save job history: %s\n", strerror(errno));
+  }
+
+  for (int i = 0; i < length; ++i) {
+    repo_fetch_job_free(jobs[i]);
+  }
+
+  free(jobs);
+  repo_history_free(history);
+  repo_dir_free(dir);
+  return failed;
+}
+
+
+static void
+on_jobs (command_t *self) {
+  fetch_opts.jobs = atoi(self->arg);
+}
+
+
+static void
+on_per_host (command_t *self) {
+  fetch_opts.per_host = atoi(self->arg);
+}
+
+
+static void
+on_force (command_t *self) {
+  fetch_opts.force = true;
+}
+
+
+void
+repo_cmd_fetch (repo_session_t *sess) {
+  int failed;
+
+  fetch_opts.jobs = 0;
+  fetch_opts.per_host = FETCH_PER_HOST;
+  fetch_opts.force = false;
+
+  command_option(&sess->program, "-j", "--jobs <n>", "Number of fetches run in parallel", on_jobs);
+  command_option(&sess->program, "-p", "--per-host <n>", "Most fetches run against one host at once", on_per_host);
+  command_option(&sess->program, "-f", "--force", "Fetch even if a remote's refs didn't change", on_force);
+
+  if (sess->argc > 1) {
+    if (repo_cmd_needs_help(sess)) {
+      repo_help(sess, false);
+      exit(0);
+    }
+
+    repo_session_start(sess);
+  }
+
+  failed = repo_fetch_all(sess->user->repo, sess->output, &fetch_opts);
+
+  repo_session_free(sess);
+  exit(0 == failed ? 0 : 1);
+}
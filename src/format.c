@@ -0,0 +1,142 @@
+
+#include <assert.h>
+#include <repo.h>
+
+/**
+ * `--format` templates are parsed once into a list of ops:
+ * literal runs (already unescaped) and field references.
+ * Writing an item walks the list into a `repo_buf_t`, so only
+ * the fields the template mentions are ever computed.
+ *
+ *   %(field)  a `repo_field_t` by name, e.g. `%(branch)`
+ *   %%        a literal `%`
+ *   \t \n \\  tab, newline and backslash
+ *
+ * Every record is terminated with a newline.
+ */
+
+enum format_opcode { OP_LITERAL, OP_FIELD };
+
+typedef struct format_op {
+  enum format_opcode code;
+  int field;
+  size_t offset;
+  size_t length;
+} format_op_t;
+
+struct repo_format {
+  format_op_t *ops;
+  int length;
+  char *literals;
+  size_t literals_len;
+};
+
+
+static void
+push_literal (repo_format_t *format, char c) {
+  format_op_t *last = format->length ? &format->ops[format->length - 1] : NULL;
+
+  if (!last || OP_LITERAL != last->code) {
+    last = &format->ops[format->length++];
+    last->code = OP_LITERAL;
+    last->offset = format->literals_len;
+    last->length = 0;
+  }
+
+  format->literals[format->literals_len++] = c;
+  last->length++;
+}
+
+
+repo_format_t *
+repo_format_compile (const char *source, char *error, size_t size) {
+  size_t len = strlen(source);
+  const char *cur = source;
+  repo_format_t *format;
+
+  if (!(format = calloc(1, sizeof(repo_format_t))))
+    return NULL;
+
+  // at worst one op per source byte plus the trailing newline
+  format->ops = malloc((len + 1) * sizeof(format_op_t));
+  format->literals = malloc(len + 1);
+  assert(format->ops && format->literals);
+
+  while (*cur) {
+    if ('\\' == cur[0] && cur[1]) {
+      switch (cur[1]) {
+        case 't': push_literal(format, '\t'); break;
+        case 'n': push_literal(format, '\n'); break;
+        case 'r': push_literal(format, '\r'); break;
+        default: push_literal(format, cur[1]); break;
+      }
+      cur += 2;
+    } else if ('%' == cur[0] && '%' == cur[1]) {
+      push_literal(format, '%');
+      cur += 2;
+    } else if ('%' == cur[0] && '(' == cur[1]) {
+      const char *end = strchr(cur + 2, ')');
+      int field = end ? repo_field_lookup(cur + 2, end - cur - 2) : -1;
+
+      if (-1 == field) {
+        snprintf(error, size, "unknown field at offset %d", (int) (cur - source));
+        repo_format_free(format);
+        return NULL;
+      }
+
+      format_op_t *op = &format->ops[format->length++];
+      op->code = OP_FIELD;
+      op->field = field;
+      cur = end + 1;
+    } else {
+      push_literal(format, *cur++);
+    }
+  }
+
+  push_literal(format, '\n');
+  return format;
+}
+
+
+int
+repo_format_write (repo_format_t *format, repo_dir_item_t *item, repo_buf_t *out) {
+  char num[32];
+  const char *str;
+  int rc = 0;
+
+  for (int i = 0; i < format->length && 0 == rc; ++i) {
+    format_op_t *op = &format->ops[i];
+
+    if (OP_LITERAL == op->code) {
+      rc = repo_buf_write(out, format->literals + op->offset, op->length);
+      continue;
+    }
+
+    switch (op->field) {
+      case REPO_FIELD_NAME: str = item->name; break;
+      case REPO_FIELD_PATH: str = item->path; break;
+      case REPO_FIELD_BRANCH: str = repo_dir_item_branch(item); break;
+      case REPO_FIELD_GIT: str = repo_dir_item_is_git_repo(item) ? "true" : "false"; break;
+      case REPO_FIELD_BARE: str = repo_dir_item_is_bare(item) ? "true" : "false"; break;
+      case REPO_FIELD_ORPHAN: str = repo_dir_item_is_orphan(item) ? "true" : "false"; break;
+      case REPO_FIELD_INO:
+        snprintf(num, sizeof(num), "%llu", (unsigned long long) item->ino);
+        str = num;
+        break;
+      default: str = NULL;
+    }
+
+    if (str) rc = repo_buf_puts(out, str);
+  }
+
+  return rc;
+}
+
+
+void
+repo_format_free (repo_format_t *format) {
+  if (!format) return;
+  free(format->ops);
+  free(format->literals);
+  free(format);
+}
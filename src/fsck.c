@@ -0,0 +1,626 @@
+
+#include <assert.h>
+#include <repo.h>
+
+/**
+ * `repo fsck` checks every object in every repository under the
+ * root: each one is read back, inflated, and hashed again, and
+ * the hash has to match the name it is stored under. Objects
+ * are hashed in windows so `repo_sha1_batch()` can run several
+ * through the compression function at once. A window is bounded
+ * by its inflated size as well as its count, and large objects
+ * are hashed alone, so a worker holds one window plus at most one
+ * large object however big the repository's blobs are.
+ *
+ * Connectivity is checked without walking history: every object
+ * a commit, tree or tag points at has to be in the object
+ * database, and so does the target of every ref and of HEAD.
+ * If all links hold, everything reachable from the refs is
+ * there. Parents of the commits listed in `shallow` are allowed
+ * to be missing.
+ */
+
+#define FSCK_JOBS 4
+
+// objects read and hashed together, up to this many bytes
+#define FSCK_WINDOW 64
+#define FSCK_WINDOW_BYTES (8 * 1024 * 1024)
+
+// objects this large are hashed alone as soon as they're read
+#define FSCK_LARGE (1024 * 1024)
+
+// error messages kept per repository, the rest are only counted
+#define FSCK_MAX_ERRORS 20
+
+/**
+ * Open addressing set of oids, keyed by their first eight bytes.
+ * The zero oid marks an empty slot.
+ */
+
+typedef struct fsck_set {
+  git_oid *slots;
+  size_t mask;
+} fsck_set_t;
+
+typedef struct fsck_job {
+  repo_dir_item_t *item;
+  git_oid *oids;
+  size_t length;
+  size_t capacity;
+  fsck_set_t present;
+  fsck_set_t shallow;
+  size_t objects;
+  size_t bytes;
+  size_t errors;
+  char messages[FSCK_MAX_ERRORS][120];
+  double ms;
+  bool failed;
+  char error[160];
+} fsck_job_t;
+
+static repo_fsck_opts_t fsck_opts;
+
+
+static double
+fsck_now_ms () {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+
+static void
+fsck_report (fsck_job_t *job, const char *fmt, ...) {
+  va_list args;
+
+  if (job->errors < FSCK_MAX_ERRORS) {
+    va_start(args, fmt);
+    vsnprintf(job->messages[job->errors], sizeof(job->messages[0]), fmt, args);
+    va_end(args);
+  }
+
+  job->errors++;
+}
+
+
+static bool
+fsck_set_init (fsck_set_t *set, size_t count) {
+  size_t size = 16;
+
+  // at most half full
+  while (size < count * 2) size <<= 1;
+
+  set->mask = size - 1;
+  return NULL != (set->slots = calloc(size, sizeof(git_oid)));
+}
+
+/**
+ * Adds `oid` to `set`, returns false if it was already there
+ */
+
+static bool
+fsck_set_add (fsck_set_t *set, const git_oid *oid) {
+  uint64_t key;
+  size_t i;
+
+  memcpy(&key, oid->id, sizeof(key));
+
+  for (i = key & set->mask; !git_oid_iszero(&set->slots[i]); i = (i + 1) & set->mask) {
+    if (0 == git_oid_cmp(&set->slots[i], oid)) return false;
+  }
+
+  git_oid_cpy(&set->slots[i], oid);
+  return true;
+}
+
+
+static bool
+fsck_set_has (const fsck_set_t *set, const git_oid *oid) {
+  uint64_t key;
+
+  if (!set->slots)
+    return false;
+
+  memcpy(&key, oid->id, sizeof(key));
+
+  for (size_t i = key & set->mask; !git_oid_iszero(&set->slots[i]); i = (i + 1) & set->mask) {
+    if (0 == git_oid_cmp(&set->slots[i], oid)) return true;
+  }
+
+  return false;
+}
+
+
+static int
+on_object (const git_oid *oid, void *payload) {
+  fsck_job_t *job = (fsck_job_t *) payload;
+
+  if (job->length == job->capacity) {
+    size_t capacity = job->capacity ? job->capacity * 2 : 1024;
+    git_oid *oids = realloc(job->oids, capacity * sizeof(git_oid));
+    if (!oids) return -1;
+    job->oids = oids;
+    job->capacity = capacity;
+  }
+
+  git_oid_cpy(&job->oids[job->length++], oid);
+  return 0;
+}
+
+/**
+ * Lists the objects of `odb` into `job->oids` once each, an
+ * object can be both loose and packed, and builds the set they
+ * are looked up in
+ */
+
+static int
+fsck_list (fsck_job_t *job, git_odb *odb) {
+  size_t unique = 0;
+
+  if (0 != git_odb_foreach(odb, on_object, job))
+    return -1;
+
+  if (!fsck_set_init(&job->present, job->length))
+    return -1;
+
+  for (size_t i = 0; i < job->length; ++i) {
+    if (fsck_set_add(&job->present, &job->oids[i])) job->oids[unique++] = job->oids[i];
+  }
+
+  job->length = unique;
+  return 0;
+}
+
+/**
+ * Reads the commits listed in `<gitdir>/shallow`, whose parents
+ * were never fetched
+ */
+
+static void
+fsck_shallow (fsck_job_t *job, const char *gitdir) {
+  char path[REPO_PATH_MAX + 16], line[GIT_OID_HEXSZ + 8];
+  git_oid oid;
+  FILE *file;
+
+  snprintf(path, sizeof(path), "%sshallow", gitdir);
+  if (!(file = fopen(path, "r")))
+    return;
+
+  if (fsck_set_init(&job->shallow, 64)) {
+    size_t count = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+      if (0 != git_oid_fromstrn(&oid, line, GIT_OID_HEXSZ)) continue;
+
+      // keep the set at most half full
+      if (++count * 2 > job->shallow.mask) {
+        fsck_set_t bigger;
+        if (!fsck_set_init(&bigger, count)) break;
+        for (size_t i = 0; i <= job->shallow.mask; ++i) {
+          if (!git_oid_iszero(&job->shallow.slots[i])) fsck_set_add(&bigger, &job->shallow.slots[i]);
+        }
+        free(job->shallow.slots);
+        job->shallow = bigger;
+      }
+
+      fsck_set_add(&job->shallow, &oid);
+    }
+  }
+
+  fclose(file);
+}
+
+
+static void
+fsck_link (fsck_job_t *job, const git_oid *from, const char *type, const git_oid *to) {
+  char a[GIT_OID_HEXSZ + 1], b[GIT_OID_HEXSZ + 1];
+
+  if (fsck_set_has(&job->present, to))
+    return;
+
+  git_oid_tostr(a, sizeof(a), from);
+  git_oid_tostr(b, sizeof(b), to);
+  fsck_report(job, "broken link from %s %s to %s", type, a, b);
+}
+
+/**
+ * Checks the header lines of a commit or tag starting with
+ * `field ` name an object that is present
+ */
+
+static void
+fsck_headers (fsck_job_t *job, const git_oid *oid, const char *type, const char *data, size_t size) {
+  const char *end = data + size, *line = data;
+  bool shallow = fsck_set_has(&job->shallow, oid);
+
+  // headers end at the first empty line
+  while (line < end && '\n' != *line) {
+    const char *next = memchr(line, '\n', end - line);
+    size_t length = next ? (size_t) (next - line) : (size_t) (end - line);
+    const char *hex = NULL;
+    git_oid to;
+
+    if (length >= 5 + GIT_OID_HEXSZ && 0 == memcmp(line, "tree ", 5)) hex = line + 5;
+    else if (length >= 7 + GIT_OID_HEXSZ && 0 == memcmp(line, "parent ", 7) && !shallow) hex = line + 7;
+    else if (length >= 7 + GIT_OID_HEXSZ && 0 == memcmp(line, "object ", 7)) hex = line + 7;
+
+    if (hex) {
+      if (0 == git_oid_fromstrn(&to, hex, GIT_OID_HEXSZ)) fsck_link(job, oid, type, &to);
+      else fsck_report(job, "bad header in %s %.*s", type, (int) length, line);
+    }
+
+    if (!next) break;
+    line = next + 1;
+  }
+}
+
+/**
+ * Tree entries are `<mode> <name>\0` and a raw 20 byte oid.
+ * Submodules, mode 160000, point into another repository.
+ */
+
+static void
+fsck_tree (fsck_job_t *job, const git_oid *oid, const unsigned char *data, size_t size) {
+  const unsigned char *p = data, *end = data + size;
+  char hex[GIT_OID_HEXSZ + 1];
+  git_oid to;
+
+  while (p < end) {
+    const unsigned char *nul = memchr(p, '\0', end - p);
+
+    if (!nul || (size_t) (end - nul - 1) < GIT_OID_RAWSZ) {
+      git_oid_tostr(hex, sizeof(hex), oid);
+      fsck_report(job, "truncated tree %s", hex);
+      return;
+    }
+
+    git_oid_fromraw(&to, nul + 1);
+    if (0 != memcmp(p, "160000 ", 7)) fsck_link(job, oid, "tree", &to);
+
+    p = nul + 1 + GIT_OID_RAWSZ;
+  }
+}
+
+
+static void
+fsck_links (fsck_job_t *job, const git_oid *oid, git_odb_object *object) {
+  const char *data = (const char *) git_odb_object_data(object);
+  size_t size = git_odb_object_size(object);
+
+  switch (git_odb_object_type(object)) {
+    case GIT_OBJ_COMMIT: fsck_headers(job, oid, "commit", data, size); break;
+    case GIT_OBJ_TAG: fsck_headers(job, oid, "tag", data, size); break;
+    case GIT_OBJ_TREE: fsck_tree(job, oid, (const unsigned char *) data, size); break;
+    default: break;
+  }
+}
+
+/**
+ * Objects read and waiting to be hashed together
+ */
+
+typedef struct fsck_window {
+  git_odb_object *objects[FSCK_WINDOW];
+  const git_oid *oids[FSCK_WINDOW];
+  repo_sha1_msg_t msgs[FSCK_WINDOW];
+  int length;
+  size_t bytes;
+} fsck_window_t;
+
+/**
+ * Checks that `object` hashed to `oid` and that its links hold,
+ * then frees it
+ */
+
+static void
+fsck_verify (fsck_job_t *job, const git_oid *oid, git_odb_object *object, repo_sha1_msg_t *msg) {
+  char hex[GIT_OID_HEXSZ + 1];
+
+  if (0 != memcmp(msg->hash, oid->id, GIT_OID_RAWSZ)) {
+    git_oid actual;
+    char other[GIT_OID_HEXSZ + 1];
+    git_oid_fromraw(&actual, msg->hash);
+    git_oid_tostr(hex, sizeof(hex), oid);
+    git_oid_tostr(other, sizeof(other), &actual);
+    fsck_report(job, "hash mismatch %s, contents hash to %s", hex, other);
+  } else {
+    fsck_links(job, oid, object);
+  }
+
+  git_odb_object_free(object);
+  job->objects++;
+}
+
+
+static void
+fsck_flush (fsck_job_t *job, fsck_window_t *window) {
+  repo_sha1_msg_t *batch[FSCK_WINDOW];
+
+  for (int i = 0; i < window->length; ++i) batch[i] = &window->msgs[i];
+  repo_sha1_batch(batch, window->length);
+
+  for (int i = 0; i < window->length; ++i) {
+    fsck_verify(job, window->oids[i], window->objects[i], &window->msgs[i]);
+  }
+
+  window->length = 0;
+  window->bytes = 0;
+}
+
+/**
+ * Reads `oid` into `window`, hashing the window once it is full
+ */
+
+static void
+fsck_read (fsck_job_t *job, git_odb *odb, fsck_window_t *window, const git_oid *oid) {
+  char hex[GIT_OID_HEXSZ + 1];
+  git_odb_object *object = NULL;
+  repo_sha1_msg_t *msg, alone;
+  const git_error *err;
+  size_t size;
+
+  if (0 != git_odb_read(&object, odb, oid)) {
+    err = giterr_last();
+    git_oid_tostr(hex, sizeof(hex), oid);
+    fsck_report(job, "corrupt object %s: %s", hex, err ? err->message : "unreadable");
+    giterr_clear();
+    return;
+  }
+
+  size = git_odb_object_size(object);
+  job->bytes += size;
+
+  msg = size >= FSCK_LARGE ? &alone : &window->msgs[window->length];
+  repo_sha1_object(msg, git_object_type2string(git_odb_object_type(object))
+      , git_odb_object_data(object), size);
+
+  if (&alone == msg) {
+    repo_sha1_batch(&msg, 1);
+    fsck_verify(job, oid, object, msg);
+    return;
+  }
+
+  window->objects[window->length] = object;
+  window->oids[window->length] = oid;
+  window->length++;
+  window->bytes += size;
+
+  if (FSCK_WINDOW == window->length || window->bytes >= FSCK_WINDOW_BYTES) {
+    fsck_flush(job, window);
+  }
+}
+
+
+static int
+on_ref (const char *name, void *payload) {
+  fsck_job_t *job = (fsck_job_t *) ((void **) payload)[0];
+  git_repository *repo = (git_repository *) ((void **) payload)[1];
+  char hex[GIT_OID_HEXSZ + 1];
+  git_oid oid;
+
+  if (0 != git_reference_name_to_id(&oid, repo, name)) {
+    fsck_report(job, "unreadable ref %s", name);
+    giterr_clear();
+    return 0;
+  }
+
+  if (!fsck_set_has(&job->present, &oid)) {
+    git_oid_tostr(hex, sizeof(hex), &oid);
+    fsck_report(job, "%s points to missing object %s", name, hex);
+  }
+
+  return 0;
+}
+
+
+static void
+fsck_refs (fsck_job_t *job, git_repository *repo) {
+  void *payload[] = { job, repo };
+  git_oid head;
+
+  git_reference_foreach(repo, GIT_REF_OID, on_ref, payload);
+
+  // an unborn HEAD has nothing to point at
+  if (0 == git_reference_name_to_id(&head, repo, "HEAD")) on_ref("HEAD", payload);
+  else giterr_clear();
+}
+
+
+static void
+fsck_run (void *data) {
+  fsck_job_t *job = (fsck_job_t *) data;
+  repo_handles_t *handles = repo_handles_default();
+  repo_handle_t *handle = NULL;
+  git_odb *odb = NULL;
+  fsck_window_t window;
+  double start = fsck_now_ms();
+
+  REPO_TRACE_BEGIN("fsck", job->item->name);
+  repo_stats_count(REPO_STATS_FSCK);
+
+  if (0 != repo_handles_get(handles, job->item->path, &handle)
+      || 0 != git_repository_odb(&odb, handle->repo)
+      || 0 != fsck_list(job, odb)) {
+    const git_error *err = giterr_last();
+    job->failed = true;
+    snprintf(job->error, sizeof(job->error), "%s", err ? err->message : "out of memory");
+    goto cleanup;
+  }
+
+  fsck_shallow(job, git_repository_path(handle->repo));
+
+  window.length = 0;
+  window.bytes = 0;
+
+  for (size_t i = 0; i < job->length; ++i) {
+    fsck_read(job, odb, &window, &job->oids[i]);
+  }
+
+  fsck_flush(job, &window);
+
+  fsck_refs(job, handle->repo);
+
+cleanup:
+  git_odb_free(odb);
+  repo_handles_put(handles, handle);
+
+  free(job->oids);
+  free(job->present.slots);
+  free(job->shallow.slots);
+  job->oids = NULL;
+  job->present.slots = job->shallow.slots = NULL;
+
+  REPO_TRACE_END("fsck");
+  job->ms = fsck_now_ms() - start;
+}
+
+
+static void
+fsck_print (fsck_job_t *job) {
+  if (job->failed) {
+    printf(" %s failed: %s\n", job->item->name, job->error);
+    return;
+  }
+
+  if (0 == job->errors) {
+    printf(" %s: %zu objects ok\n", job->item->name, job->objects);
+    return;
+  }
+
+  printf(" %s: %zu errors in %zu objects\n", job->item->name, job->errors, job->objects);
+  for (size_t i = 0; i < job->errors && i < FSCK_MAX_ERRORS; ++i) {
+    printf("   %s\n", job->messages[i]);
+  }
+  if (job->errors > FSCK_MAX_ERRORS) {
+    printf("   and %zu more\n", job->errors - FSCK_MAX_ERRORS);
+  }
+}
+
+
+static void
+fsck_emit (repo_emitter_t *emitter, fsck_job_t *job) {
+  repo_emitter_begin(emitter);
+  repo_emitter_str(emitter, "name", job->item->name);
+  repo_emitter_str(emitter, "path", job->item->path);
+  repo_emitter_str(emitter, "error", job->failed ? job->error : (job->errors ? job->messages[0] : NULL));
+  repo_emitter_int(emitter, "objects", job->objects);
+  repo_emitter_int(emitter, "bytes", job->bytes);
+  repo_emitter_int(emitter, "errors", job->errors);
+  repo_emitter_float(emitter, "ms", job->ms);
+  repo_emitter_end(emitter);
+}
+
+/**
+ * Checks every repository under `repo` and prints the results.
+ * Returns the number of repositories with errors, or -1 if none
+ * could be checked.
+ */
+
+int
+repo_fsck_all (repo_t *repo, repo_output_t output, repo_fsck_opts_t *opts) {
+  repo_dir_t *dir = repo_dir_new(repo->path);
+  repo_emitter_t *emitter = NULL;
+  fsck_job_t *jobs;
+  repo_pool_t *pool;
+  size_t objects = 0, bytes = 0, errors = 0;
+  int length = 0, failed = 0;
+  double start, elapsed;
+  FILE *summary;
+
+  if (!dir) {
+    repo_ferror("path does not exist '%s'", repo->path);
+  }
+
+  if (!(jobs = calloc(dir->length + 1, sizeof(fsck_job_t)))) {
+    repo_error("fsck: out of memory");
+    repo_dir_free(dir);
+    return -1;
+  }
+
+  if (!(pool = repo_pool_new(opts->jobs > 0 ? opts->jobs : FSCK_JOBS))) {
+    repo_error("fsck: failed to start worker threads");
+    repo_dir_free(dir);
+    free(jobs);
+    return -1;
+  }
+
+  start = fsck_now_ms();
+
+  for (int i = 0; i < dir->length; ++i) {
+    repo_dir_item_t *item = &dir->items[i];
+    fsck_job_t *job = &jobs[length];
+
+    if (!repo_dir_item_is_git_repo(item)) continue;
+
+    job->item = item;
+    length++;
+    if (0 != repo_pool_push(pool, fsck_run, job)) fsck_run(job);
+  }
+
+  repo_pool_wait(pool);
+  repo_pool_free(pool);
+  elapsed = fsck_now_ms() - start;
+
+  if (REPO_OUTPUT_TEXT != output) {
+    emitter = repo_emitter_new(output, STDOUT_FILENO);
+    assert(emitter);
+  }
+
+  for (int i = 0; i < length; ++i) {
+    fsck_job_t *job = &jobs[i];
+
+    objects += job->objects;
+    bytes += job->bytes;
+    errors += job->errors;
+    if (job->failed || job->errors) failed++;
+
+    if (emitter) fsck_emit(emitter, job);
+    else fsck_print(job);
+  }
+
+  repo_emitter_free(emitter);
+
+  summary = emitter ? stderr : stdout;
+  fprintf(summary, "repo: fsck: %d repositories, %zu objects (%.1f MiB) in %.1fs"
+      ", %.0f objects/s, %.1f MiB/s, sha1 %d lanes"
+      , length, objects, bytes / 1048576.0, elapsed / 1000.0
+      , elapsed > 0 ? objects / (elapsed / 1000.0) : 0
+      , elapsed > 0 ? bytes / 1048576.0 / (elapsed / 1000.0) : 0
+      , repo_sha1_lanes());
+  if (failed) fprintf(summary, ", %zu errors in %d repositories", errors, failed);
+  fprintf(summary, "\n");
+
+  free(jobs);
+  repo_dir_free(dir);
+  return failed;
+}
+
+
+static void
+on_jobs (command_t *self) {
+  fsck_opts.jobs = atoi(self->arg);
+}
+
+
+void
+repo_cmd_fsck (repo_session_t *sess) {
+  int failed;
+
+  fsck_opts.jobs = FSCK_JOBS;
+
+  command_option(&sess->program, "-j", "--jobs <n>", "Number of repositories checked in parallel", on_jobs);
+
+  if (sess->argc > 1) {
+    if (repo_cmd_needs_help(sess)) {
+      repo_help(sess, false);
+      exit(0);
+    }
+
+    repo_session_start(sess);
+  }
+
+  failed = repo_fsck_all(sess->user->repo, sess->output, &fsck_opts);
+
+  repo_session_free(sess);
+  exit(0 == failed ? 0 : 1);
+}
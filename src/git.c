@@ -26,55 +26,59 @@ repo_git_check (int error, const char *message, const char *extra) {
 }
 
 
+/**
+ * Opens the repository of `item` to fill in `is_bare`,
+ * `is_git_orphan` and `git_branch`. The branch name is copied
+ * so the head can be released and the repository handed back
+ * to the handle pool right away.
+ */
+
 void
 repo_git_init (repo_dir_item_t *item) {
 	int error = 0;
-	const char *branch = item->git_branch;
-	// const git_status_entry *entry;
-
-	git_repository *git_repo = item->git_repo;
-	git_reference *head = item->git_head;
-	git_status_options opt = GIT_STATUS_OPTIONS_INIT;
-	git_status_list *status;
-	
-	// size_t entrycount = git_status_list_entrycount(status);
-
-
-	opt.show  = GIT_STATUS_SHOW_INDEX_AND_WORKDIR;
-	opt.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED
-		        | GIT_STATUS_OPT_RENAMES_HEAD_TO_INDEX
-		        | GIT_STATUS_OPT_SORT_CASE_SENSITIVELY;
-
+	const char *branch = NULL;
+	repo_handles_t *handles = repo_handles_default();
+	repo_handle_t *handle = NULL;
+	git_repository *git_repo;
+	git_reference *head = NULL;
 
 	// open repo and check for integrity
-	repo_git_check(
-		git_repository_open_ext(&git_repo, item->path, 0, NULL),
-		"Failed to open git repository", item->path
-	);
+	REPO_TRACE_BEGIN("open", item->name);
+	repo_stats_count(REPO_STATS_OPEN);
+	error = repo_handles_get(handles, item->path, &handle);
+	REPO_TRACE_END("open");
+
+	repo_git_check(error, "Failed to open git repository", item->path);
+	git_repo = handle->repo;
 
 	item->is_bare = git_repository_is_bare(git_repo)? true : false;
 
 	item->is_git_repo = true;
 
 	// retrieve head
+	REPO_TRACE_BEGIN("head", item->name);
+	repo_stats_count(REPO_STATS_HEAD);
 	error = git_repository_head(&head, git_repo);
+	REPO_TRACE_END("head");
 
 	if (error == GIT_EORPHANEDHEAD) {
 		item->is_git_orphan = true;
-		branch = NULL;
 	} else if (error == GIT_ENOTFOUND) {
 		item->is_git_repo = false;
-		branch = NULL;
 	} else if (!error) {
 		branch = git_reference_name(head);
 		if (!strncmp(branch, "refs/heads/", strlen("refs/heads/"))) {
 			branch += strlen("refs/heads/");
 		}
 
-		item->git_branch = branch;
+		item->git_branch = strdup(branch);
 	} else {
+		repo_handles_put(handles, handle);
 		repo_git_check(error, "failed to get current branch", NULL);
 	}
+
+	if (head) git_reference_free(head);
+	repo_handles_put(handles, handle);
 }
 
 bool
@@ -82,7 +86,9 @@ repo_is_git_repo (repo_dir_item_t *item) {
 	struct stat s;
 	char path[REPO_PATH_MAX + 5];
 	sprintf(path, "%s/.git", item->path);
+	REPO_TRACE_BEGIN("stat", item->name);
 	int err = stat(path, &s);
+	REPO_TRACE_END("stat");
 
 	if (-1 == err && errno != ENOENT) return false;
 	else if (S_ISDIR(s.st_mode)) return true;
@@ -0,0 +1,293 @@
+
+#include <assert.h>
+#include <sys/resource.h>
+#include <repo.h>
+
+/**
+ * Bounded pool of open `git_repository` handles, keyed on
+ * path. A handle is pinned by whoever got it until it is put
+ * back, and is never shared while pinned as libgit2 handles
+ * aren't safe to use from two threads at once. Idle handles
+ * stay open on a least recently used list so the next lookup
+ * of the same repository skips the open.
+ *
+ * The pool holds at most `capacity` handles. Once it is full,
+ * getting a new one closes the least recently used idle one;
+ * if every handle is pinned the new one is handed out anyway
+ * and closed as soon as it is put back, so the pool never
+ * blocks. That keeps within the budget only as long as callers
+ * pin a bounded number of handles at once, one per worker
+ * thread; `repo log` reopens repositories rather than keep one
+ * pinned per walk. The default pool sizes itself from
+ * RLIMIT_NOFILE, see `repo_handles_budget()`.
+ */
+
+#define HANDLES_FDS_PER_REPO 4
+#define HANDLES_FDS_RESERVED 64
+#define HANDLES_MAX 4096
+#define HANDLES_MAPPED_PER_REPO (32 * 1024 * 1024)
+
+static repo_handles_t *handles_default = NULL;
+static pthread_once_t handles_once = PTHREAD_ONCE_INIT;
+
+
+static uint32_t
+handles_hash (const char *path) {
+  uint32_t hash = 2166136261u;
+  while (*path) hash = (hash ^ (unsigned char) *path++) * 16777619u;
+  return hash;
+}
+
+
+static void
+lru_unlink (repo_handles_t *handles, repo_handle_t *h) {
+  if (h->prev) h->prev->next = h->next;
+  else handles->lru_head = h->next;
+
+  if (h->next) h->next->prev = h->prev;
+  else handles->lru_tail = h->prev;
+
+  h->prev = h->next = NULL;
+}
+
+
+static void
+lru_push (repo_handles_t *handles, repo_handle_t *h) {
+  h->prev = NULL;
+  h->next = handles->lru_head;
+
+  if (handles->lru_head) handles->lru_head->prev = h;
+  else handles->lru_tail = h;
+
+  handles->lru_head = h;
+}
+
+
+static void
+bucket_unlink (repo_handles_t *handles, repo_handle_t *h) {
+  repo_handle_t **link = &handles->buckets[h->hash & handles->mask];
+
+  while (*link && *link != h) link = &(*link)->chain;
+  if (*link) *link = h->chain;
+}
+
+
+static void
+handle_close (repo_handle_t *h) {
+  git_repository_free(h->repo);
+  free(h->path);
+  free(h);
+}
+
+/**
+ * Removes the least recently used idle handle from the pool
+ * and returns it for the caller to close outside the lock
+ */
+
+static repo_handle_t *
+handles_evict (repo_handles_t *handles) {
+  repo_handle_t *h = handles->lru_tail;
+
+  if (!h)
+    return NULL;
+
+  lru_unlink(handles, h);
+  bucket_unlink(handles, h);
+  handles->length--;
+  handles->evictions++;
+  return h;
+}
+
+/**
+ * Handles the pool can keep open within the process's file
+ * descriptor limit, leaving room for everything else
+ */
+
+int
+repo_handles_budget () {
+  struct rlimit limit;
+  long fds = 1024, budget;
+
+  if (0 == getrlimit(RLIMIT_NOFILE, &limit))
+    fds = RLIM_INFINITY == limit.rlim_cur ? 65536 : (long) limit.rlim_cur;
+
+  budget = (fds - HANDLES_FDS_RESERVED) / HANDLES_FDS_PER_REPO;
+  if (budget < 8) budget = 8;
+  if (budget > HANDLES_MAX) budget = HANDLES_MAX;
+  return (int) budget;
+}
+
+
+repo_handles_t *
+repo_handles_new (int capacity) {
+  repo_handles_t *handles;
+  size_t buckets = 16;
+
+  if (capacity < 1)
+    capacity = repo_handles_budget();
+
+  while (buckets < (size_t) capacity * 2) buckets <<= 1;
+
+  if (!(handles = calloc(1, sizeof(repo_handles_t))))
+    return NULL;
+
+  if (!(handles->buckets = calloc(buckets, sizeof(repo_handle_t *)))) {
+    free(handles);
+    return NULL;
+  }
+
+  handles->capacity = capacity;
+  handles->mask = buckets - 1;
+  pthread_mutex_init(&handles->lock, NULL);
+  return handles;
+}
+
+/**
+ * Pins an open handle on the repository at `path` into `out`,
+ * opening it if no idle one is pooled. Returns 0 or the libgit2
+ * error of the open, which is left in `giterr_last()`.
+ */
+
+int
+repo_handles_get (repo_handles_t *handles, const char *path, repo_handle_t **out) {
+  uint32_t hash = handles_hash(path);
+  repo_handle_t *h, *evicted = NULL;
+  git_repository *repo = NULL;
+  int error;
+
+  pthread_mutex_lock(&handles->lock);
+
+  for (h = handles->buckets[hash & handles->mask]; h; h = h->chain) {
+    if (!h->pinned && h->hash == hash && 0 == strcmp(h->path, path)) {
+      lru_unlink(handles, h);
+      h->pinned = true;
+      handles->hits++;
+      pthread_mutex_unlock(&handles->lock);
+      *out = h;
+      return 0;
+    }
+  }
+
+  handles->misses++;
+  pthread_mutex_unlock(&handles->lock);
+
+  // opening touches the disk, so it happens outside the lock
+  if (0 != (error = git_repository_open(&repo, path)))
+    return error;
+
+  if (!(h = calloc(1, sizeof(repo_handle_t))) || !(h->path = strdup(path))) {
+    free(h);
+    git_repository_free(repo);
+    giterr_set_oom();
+    return -1;
+  }
+
+  h->repo = repo;
+  h->hash = hash;
+  h->pinned = true;
+
+  pthread_mutex_lock(&handles->lock);
+
+  if (handles->length >= handles->capacity)
+    evicted = handles_evict(handles);
+
+  if (handles->length < handles->capacity) {
+    h->chain = handles->buckets[hash & handles->mask];
+    handles->buckets[hash & handles->mask] = h;
+    h->pooled = true;
+    handles->length++;
+  }
+
+  pthread_mutex_unlock(&handles->lock);
+
+  if (evicted) handle_close(evicted);
+
+  *out = h;
+  return 0;
+}
+
+/**
+ * Unpins `h`, keeping it open for the next lookup of its
+ * repository unless it was handed out over capacity
+ */
+
+void
+repo_handles_put (repo_handles_t *handles, repo_handle_t *h) {
+  if (!h)
+    return;
+
+  if (!h->pooled) {
+    handle_close(h);
+    return;
+  }
+
+  pthread_mutex_lock(&handles->lock);
+  h->pinned = false;
+  lru_push(handles, h);
+  pthread_mutex_unlock(&handles->lock);
+}
+
+/**
+ * Closes every idle handle. Pinned handles are closed when
+ * they're put back.
+ */
+
+void
+repo_handles_clear (repo_handles_t *handles) {
+  repo_handle_t *h;
+
+  pthread_mutex_lock(&handles->lock);
+  while ((h = handles_evict(handles))) {
+    handle_close(h);
+  }
+  pthread_mutex_unlock(&handles->lock);
+}
+
+
+void
+repo_handles_free (repo_handles_t *handles) {
+  if (!handles) return;
+  repo_handles_clear(handles);
+  pthread_mutex_destroy(&handles->lock);
+  free(handles->buckets);
+  free(handles);
+}
+
+
+static void
+handles_default_init () {
+  size_t mapped = 0;
+
+  handles_default = repo_handles_new(0);
+  assert(handles_default);
+
+  // pack windows of every pooled handle share libgit2's mapped
+  // limit, size it to the pool rather than the address space
+  if (0 == git_libgit2_opts(GIT_OPT_GET_MWINDOW_MAPPED_LIMIT, &mapped)) {
+    size_t limit = (size_t) handles_default->capacity * HANDLES_MAPPED_PER_REPO;
+    if (0 == mapped || limit < mapped) {
+      git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, limit);
+    }
+  }
+}
+
+/**
+ * Returns the process wide pool used by commands and the
+ * Node binding
+ */
+
+repo_handles_t *
+repo_handles_default () {
+  pthread_once(&handles_once, handles_default_init);
+  return handles_default;
+}
+
+/**
+ * Closes the idle handles of the default pool, call before
+ * libgit2 is shut down
+ */
+
+void
+repo_handles_shutdown () {
+  if (handles_default) repo_handles_clear(handles_default);
+}
@@ -0,0 +1,332 @@
+
+#include <assert.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <repo.h>
+
+/**
+ * Durations and byte counts of past jobs, kept under the root
+ * in `.repo/history.json` so bulk commands can schedule the
+ * longest jobs first. Keys name the job, `fetch:<repo>/<remote>`
+ * for instance. Durations are smoothed across runs so a single
+ * slow run doesn't reorder everything.
+ *
+ * Jobs that can tell up front they have nothing to do, like a
+ * fetch from a remote whose refs didn't move, keep a fingerprint
+ * of their input and how long the last real run took.
+ *
+ *   {"version":1,"jobs":{"fetch:svc/origin":{"ms":812,"bytes":40960,
+ *     "fingerprint":"8c3f0b7e5d2a9146","work_ms":1530}}}
+ */
+
+#define HISTORY_FILE "history.json"
+#define HISTORY_VERSION 1
+
+// weight of the newest run in a job's smoothed duration
+#define HISTORY_WEIGHT 0.5
+
+
+static uint32_t
+history_hash (const char *key) {
+  uint32_t hash = 2166136261u;
+  while (*key) hash = (hash ^ (unsigned char) *key++) * 16777619u;
+  return hash;
+}
+
+
+static int
+history_index (repo_history_t *history) {
+  size_t size = 64;
+  int *slots;
+
+  while (size < (size_t) history->length * 2) size <<= 1;
+
+  if (!(slots = malloc(size * sizeof(int))))
+    return -1;
+
+  memset(slots, -1, size * sizeof(int));
+
+  for (int i = 0; i < history->length; ++i) {
+    size_t slot = history_hash(history->entries[i].key) & (size - 1);
+    while (-1 != slots[slot]) slot = (slot + 1) & (size - 1);
+    slots[slot] = i;
+  }
+
+  free(history->slots);
+  history->slots = slots;
+  history->mask = size - 1;
+  return 0;
+}
+
+
+static repo_history_entry_t *
+history_find (repo_history_t *history, const char *key) {
+  size_t slot;
+
+  if (!history->slots)
+    return NULL;
+
+  slot = history_hash(key) & history->mask;
+
+  for (; -1 != history->slots[slot]; slot = (slot + 1) & history->mask) {
+    repo_history_entry_t *entry = &history->entries[history->slots[slot]];
+    if (0 == strcmp(entry->key, key)) return entry;
+  }
+
+  return NULL;
+}
+
+
+static repo_history_entry_t *
+history_add (repo_history_t *history, const char *key) {
+  repo_history_entry_t *entry;
+
+  if (history->length == history->alloc) {
+    int alloc = history->alloc ? history->alloc * 2 : 64;
+    repo_history_entry_t *entries = realloc(history->entries, alloc * sizeof(repo_history_entry_t));
+    if (!entries) return NULL;
+    history->entries = entries;
+    history->alloc = alloc;
+  }
+
+  entry = &history->entries[history->length];
+  memset(entry, 0, sizeof(repo_history_entry_t));
+
+  if (!(entry->key = strdup(key)))
+    return NULL;
+
+  history->length++;
+
+  // keep the table at most half full
+  if ((size_t) history->length * 2 > history->mask + 1 || !history->slots) {
+    if (0 != history_index(history)) {
+      free(entry->key);
+      history->length--;
+      return NULL;
+    }
+  } else {
+    size_t slot = history_hash(key) & history->mask;
+    while (-1 != history->slots[slot]) slot = (slot + 1) & history->mask;
+    history->slots[slot] = history->length - 1;
+  }
+
+  return entry;
+}
+
+
+static void
+history_read (repo_history_t *history, const char *input, size_t length) {
+  repo_arena_t *arena = repo_arena_new(0);
+  repo_json_doc_t doc;
+  repo_json_node_t *jobs;
+
+  if (!arena)
+    return;
+
+  if (0 == repo_json_parse(&doc, arena, input, length)
+      && HISTORY_VERSION == repo_json_int(&doc, repo_json_get(&doc, doc.root, "version"))
+      && (jobs = repo_json_get(&doc, doc.root, "jobs"))
+      && JSON_OBJECT_BEGIN == jobs->type) {
+    for (repo_json_node_t *node = jobs->child; node; node = node->next) {
+      repo_history_entry_t *entry;
+      repo_json_node_t *value;
+      char *key = repo_json_strdup(&doc, &node->key);
+
+      if (!key || !(entry = history_add(history, key)))
+        break;
+
+      entry->ms = (double) repo_json_int(&doc, repo_json_get(&doc, node, "ms"));
+      entry->bytes = (size_t) repo_json_int(&doc, repo_json_get(&doc, node, "bytes"));
+      entry->work_ms = (double) repo_json_int(&doc, repo_json_get(&doc, node, "work_ms"));
+
+      // 64 bits don't survive a JSON number, it's kept as hex
+      if ((value = repo_json_get(&doc, node, "fingerprint")) && JSON_STRING == value->type) {
+        entry->fingerprint = strtoull(repo_json_str(&doc, &value->value), NULL, 16);
+      }
+    }
+  }
+
+  repo_arena_free(arena);
+}
+
+/**
+ * Loads the job history kept under `repo`. A missing or
+ * unreadable file gives an empty history.
+ */
+
+repo_history_t *
+repo_history_load (repo_t *repo) {
+  repo_history_t *history;
+  char path[REPO_PATH_MAX];
+  struct stat st;
+  char *input;
+  int fd;
+
+  if (!(history = calloc(1, sizeof(repo_history_t))))
+    return NULL;
+
+  history->repo = repo;
+  history->mean = -1;
+
+  if (0 != repo_cache_path(repo, HISTORY_FILE, path, sizeof(path))
+      || -1 == (fd = open(path, O_RDONLY)))
+    return history;
+
+  if (0 == fstat(fd, &st) && st.st_size > 0 && (input = malloc(st.st_size))) {
+    if (st.st_size == read(fd, input, st.st_size)) {
+      history_read(history, input, st.st_size);
+    }
+    free(input);
+  }
+
+  close(fd);
+  return history;
+}
+
+/**
+ * Predicted duration of job `key` in milliseconds. Jobs that
+ * never ran are predicted to take as long as the average job
+ * that did, or 0 when nothing ran before.
+ */
+
+double
+repo_history_predict (repo_history_t *history, const char *key) {
+  repo_history_entry_t *entry = history_find(history, key);
+  double total = 0;
+
+  if (entry)
+    return entry->ms;
+
+  if (history->length > 0 && history->mean < 0) {
+    for (int i = 0; i < history->length; ++i) total += history->entries[i].ms;
+    history->mean = total / history->length;
+  }
+
+  return history->length > 0 ? history->mean : 0;
+}
+
+/**
+ * Returns what is known about job `key`, or NULL
+ */
+
+repo_history_entry_t *
+repo_history_find (repo_history_t *history, const char *key) {
+  return history_find(history, key);
+}
+
+/**
+ * Records that job `key` took `ms` and moved `bytes`
+ */
+
+int
+repo_history_record (repo_history_t *history, const char *key, double ms, size_t bytes) {
+  repo_history_entry_t *entry = history_find(history, key);
+
+  if (entry) {
+    entry->ms = HISTORY_WEIGHT * ms + (1 - HISTORY_WEIGHT) * entry->ms;
+  } else if ((entry = history_add(history, key))) {
+    entry->ms = ms;
+  } else {
+    return -1;
+  }
+
+  entry->bytes = bytes;
+  history->mean = -1;
+  return 0;
+}
+
+
+static int
+on_print (void *userdata, const char *s, uint32_t length) {
+  return repo_buf_write((repo_buf_t *) userdata, s, length);
+}
+
+
+static void
+print_num (json_printer *printer, const char *key, long long value) {
+  char num[32];
+  int len = snprintf(num, sizeof(num), "%lld", value);
+
+  json_print_raw(printer, JSON_KEY, key, strlen(key));
+  json_print_raw(printer, JSON_INT, num, len);
+}
+
+/**
+ * Writes the history back, replacing the file atomically
+ */
+
+int
+repo_history_save (repo_history_t *history) {
+  char path[REPO_PATH_MAX], tmp[REPO_PATH_MAX + 4];
+  json_printer printer;
+  repo_buf_t *out;
+  int fd, rc;
+
+  if (0 != repo_cache_path(history->repo, HISTORY_FILE, path, sizeof(path)))
+    return -1;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+  if (-1 == (fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)))
+    return -1;
+
+  if (!(out = repo_buf_new(fd))) {
+    close(fd);
+    unlink(tmp);
+    return -1;
+  }
+
+  json_print_init(&printer, on_print, out);
+  json_print_raw(&printer, JSON_OBJECT_BEGIN, NULL, 0);
+  print_num(&printer, "version", HISTORY_VERSION);
+  json_print_raw(&printer, JSON_KEY, "jobs", strlen("jobs"));
+  json_print_raw(&printer, JSON_OBJECT_BEGIN, NULL, 0);
+
+  for (int i = 0; i < history->length; ++i) {
+    repo_history_entry_t *entry = &history->entries[i];
+
+    json_print_raw(&printer, JSON_KEY, entry->key, strlen(entry->key));
+    json_print_raw(&printer, JSON_OBJECT_BEGIN, NULL, 0);
+    print_num(&printer, "ms", (long long) (entry->ms + 0.5));
+    print_num(&printer, "bytes", (long long) entry->bytes);
+
+    if (entry->fingerprint) {
+      char hex[17];
+      snprintf(hex, sizeof(hex), "%016" PRIx64, entry->fingerprint);
+      json_print_raw(&printer, JSON_KEY, "fingerprint", strlen("fingerprint"));
+      json_print_raw(&printer, JSON_STRING, hex, 16);
+      print_num(&printer, "work_ms", (long long) (entry->work_ms + 0.5));
+    }
+
+    json_print_raw(&printer, JSON_OBJECT_END, NULL, 0);
+  }
+
+  json_print_raw(&printer, JSON_OBJECT_END, NULL, 0);
+  json_print_raw(&printer, JSON_OBJECT_END, NULL, 0);
+  json_print_free(&printer);
+
+  rc = repo_buf_flush(out);
+  repo_buf_free(out);
+  rc |= close(fd);
+
+  if (0 != rc || 0 != rename(tmp, path)) {
+    unlink(tmp);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+void
+repo_history_free (repo_history_t *history) {
+  if (!history) return;
+
+  for (int i = 0; i < history->length; ++i) {
+    free(history->entries[i].key);
+  }
+
+  free(history->entries);
+  free(history->slots);
+  free(history);
+}
@@ -0,0 +1,464 @@
+
+#include <assert.h>
+#include <ctype.h>
+#include <repo.h>
+
+/**
+ * One revision walk per repository, merged newest first through
+ * a heap keyed on the commit time at the head of each walk.
+ *
+ * Walkers don't keep their repository open between commits, as
+ * a root can hold far more repositories than there are file
+ * descriptors. Each walk reads a chunk of commits ahead, just
+ * their oid, time and summary, and lets go of its handle. When
+ * a walker has shown its chunk it reopens the repository, walks
+ * past what it already read and reads the next, twice as large.
+ * First chunks are read in parallel, later ones by whichever
+ * walker reaches the top of the heap, so at most `--jobs`
+ * handles are pinned at once.
+ */
+
+#define LOG_CHUNK 16
+#define LOG_CHUNK_MAX 4096
+
+typedef struct log_commit {
+  git_oid oid;
+  git_time_t time;
+  size_t summary;
+} log_commit_t;
+
+typedef struct log_walker {
+  repo_dir_item_t *item;
+  repo_log_opts_t *opts;
+  log_commit_t *commits;
+  size_t length;
+  size_t pos;
+  size_t chunk;
+  size_t walked;
+  char *text;
+  size_t text_length;
+  size_t text_alloc;
+  git_time_t time;
+  bool exhausted;
+  bool live;
+  bool failed;
+  char error[160];
+} log_walker_t;
+
+static repo_log_opts_t log_opts;
+
+static const char *weekdays[] = {
+  "sunday", "monday", "tuesday", "wednesday", "thursday", "friday", "saturday"
+};
+
+
+static void
+walker_free (log_walker_t *w) {
+  free(w->commits);
+  free(w->text);
+  w->commits = NULL;
+  w->text = NULL;
+  w->length = w->pos = 0;
+  w->live = false;
+}
+
+
+static void
+walker_fail (log_walker_t *w) {
+  const git_error *err = giterr_last();
+
+  w->failed = true;
+  snprintf(w->error, sizeof(w->error), "%s", err ? err->message : "out of memory");
+  walker_free(w);
+}
+
+/**
+ * Appends the first line of `message` to `w`'s summaries and
+ * returns its offset, or -1 when out of memory
+ */
+
+static long
+walker_summary (log_walker_t *w, const char *message) {
+  size_t length = strcspn(message, "\n"), offset = w->text_length;
+
+  if (w->text_length + length + 1 > w->text_alloc) {
+    size_t alloc = w->text_alloc ? w->text_alloc * 2 : 1024;
+    char *text;
+    while (alloc < w->text_length + length + 1) alloc *= 2;
+    if (!(text = realloc(w->text, alloc))) return -1;
+    w->text = text;
+    w->text_alloc = alloc;
+  }
+
+  memcpy(w->text + offset, message, length);
+  w->text[offset + length] = '\0';
+  w->text_length += length + 1;
+  return (long) offset;
+}
+
+/**
+ * Reads the next chunk of `w`'s walk. The walk is started over
+ * and the commits read by earlier chunks are skipped, so no
+ * handle is kept between chunks. Returns 0 or -1 on failure.
+ */
+
+static int
+walker_fill (log_walker_t *w) {
+  repo_handles_t *handles = repo_handles_default();
+  repo_handle_t *handle = NULL;
+  git_revwalk *walk = NULL;
+  git_commit *commit = NULL;
+  log_commit_t *commits;
+  size_t skipped = 0;
+  int error, rc = -1;
+  git_oid oid;
+
+  repo_stats_count(REPO_STATS_WALK);
+
+  w->length = w->pos = 0;
+  w->text_length = 0;
+
+  if (!(commits = realloc(w->commits, w->chunk * sizeof(log_commit_t))))
+    goto cleanup;
+
+  w->commits = commits;
+
+  if (0 != repo_handles_get(handles, w->item->path, &handle)
+      || 0 != git_revwalk_new(&walk, handle->repo))
+    goto cleanup;
+
+  git_revwalk_sorting(walk, GIT_SORT_TIME);
+
+  error = w->opts->all
+    ? git_revwalk_push_glob(walk, "refs/heads")
+    : git_revwalk_push_head(walk);
+
+  // nothing to walk in an unborn repository
+  if (0 != error) {
+    giterr_clear();
+    w->exhausted = true;
+    rc = 0;
+    goto cleanup;
+  }
+
+  while (w->length < w->chunk) {
+    git_time_t time;
+    long summary;
+
+    if (0 != (error = git_revwalk_next(&oid, walk))) {
+      if (GIT_ITEROVER != error) goto cleanup;
+      w->exhausted = true;
+      break;
+    }
+
+    if (skipped < w->walked) {
+      skipped++;
+      continue;
+    }
+
+    if (0 != git_commit_lookup(&commit, handle->repo, &oid))
+      goto cleanup;
+
+    time = git_commit_time(commit);
+
+    if (w->opts->since && time < w->opts->since) {
+      w->exhausted = true;
+      break;
+    }
+
+    if (-1 == (summary = walker_summary(w, git_commit_message(commit))))
+      goto cleanup;
+
+    git_oid_cpy(&w->commits[w->length].oid, &oid);
+    w->commits[w->length].time = time;
+    w->commits[w->length].summary = (size_t) summary;
+    w->length++;
+
+    git_commit_free(commit);
+    commit = NULL;
+  }
+
+  w->walked += w->length;
+  if (w->chunk < LOG_CHUNK_MAX) w->chunk *= 2;
+  rc = 0;
+
+cleanup:
+  git_commit_free(commit);
+  if (walk) git_revwalk_free(walk);
+  repo_handles_put(handles, handle);
+
+  if (0 != rc) {
+    walker_fail(w);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Advances `w` to its next commit, reading another chunk once
+ * the current one is used up. Returns `false` and releases `w`
+ * once its walk is exhausted or has gone past `--since`.
+ */
+
+static bool
+walker_next (log_walker_t *w) {
+  if (++w->pos >= w->length) {
+    if (w->exhausted || 0 != walker_fill(w) || 0 == w->length) {
+      walker_free(w);
+      return false;
+    }
+  }
+
+  w->time = w->commits[w->pos].time;
+  return true;
+}
+
+
+static void
+walker_prime (void *data) {
+  log_walker_t *w = (log_walker_t *) data;
+
+  if (0 != walker_fill(w) || 0 == w->length) {
+    walker_free(w);
+    return;
+  }
+
+  w->time = w->commits[0].time;
+  w->live = true;
+}
+
+// max heap on commit time, newest on top
+
+static void
+heap_swap (log_walker_t **heap, int a, int b) {
+  log_walker_t *tmp = heap[a];
+  heap[a] = heap[b];
+  heap[b] = tmp;
+}
+
+
+static void
+heap_push (log_walker_t **heap, int *length, log_walker_t *w) {
+  int i = (*length)++;
+  heap[i] = w;
+
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (heap[parent]->time >= heap[i]->time) break;
+    heap_swap(heap, parent, i);
+    i = parent;
+  }
+}
+
+
+static log_walker_t *
+heap_pop (log_walker_t **heap, int *length) {
+  log_walker_t *top = heap[0];
+  int i = 0, n = --(*length);
+
+  heap[0] = heap[n];
+
+  while (true) {
+    int l = 2 * i + 1, r = l + 1, max = i;
+    if (l < n && heap[l]->time > heap[max]->time) max = l;
+    if (r < n && heap[r]->time > heap[max]->time) max = r;
+    if (max == i) break;
+    heap_swap(heap, max, i);
+    i = max;
+  }
+
+  return top;
+}
+
+
+static void
+print_commit (log_walker_t *w) {
+  const log_commit_t *commit = &w->commits[w->pos];
+  char oid[GIT_OID_HEXSZ + 1], date[32];
+  time_t t = (time_t) commit->time;
+  struct tm tm;
+
+  git_oid_tostr(oid, 8, &commit->oid);
+  localtime_r(&t, &tm);
+  strftime(date, sizeof(date), "%Y-%m-%d %H:%M", &tm);
+
+  printf("%s %s %-20s %s\n"
+    , oid
+    , date
+    , w->item->name
+    , w->text + commit->summary
+  );
+}
+
+/**
+ * Accepts `YYYY-MM-DD[ HH:MM[:SS]]`, `@<epoch>`, a relative
+ * `<n>(m|h|d|w)` offset or a weekday name meaning the most
+ * recent one before today.
+ */
+
+int
+repo_log_parse_date (const char *str, time_t *out) {
+  time_t now = time(NULL);
+  struct tm tm;
+  char unit = 0;
+  long n = 0;
+  int consumed = 0;
+
+  memset(&tm, 0, sizeof(tm));
+
+  if ('@' == str[0]) {
+    *out = (time_t) strtol(str + 1, NULL, 10);
+    return 0;
+  }
+
+  if (sscanf(str, "%d-%d-%d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &consumed) >= 3
+      && consumed >= 8) {
+    sscanf(str + consumed, " %d:%d:%d", &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    *out = mktime(&tm);
+    return -1 == *out ? -1 : 0;
+  }
+
+  if (2 == sscanf(str, "%ld%c", &n, &unit)) {
+    switch (tolower(unit)) {
+      case 'm': *out = now - n * 60; return 0;
+      case 'h': *out = now - n * 3600; return 0;
+      case 'd': *out = now - n * 86400; return 0;
+      case 'w': *out = now - n * 7 * 86400; return 0;
+      default: return -1;
+    }
+  }
+
+  for (int day = 0; day < 7; ++day) {
+    if (0 == strcasecmp(str, weekdays[day])) {
+      localtime_r(&now, &tm);
+      int delta = (tm.tm_wday - day + 7) % 7;
+      tm.tm_mday -= 0 == delta ? 7 : delta;
+      tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+      tm.tm_isdst = -1;
+      *out = mktime(&tm);
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+
+int
+repo_log_print (repo_t *repo, repo_log_opts_t *opts) {
+  repo_dir_t *dir = repo_dir_new(repo->path);
+  log_walker_t *walkers, **heap;
+  repo_pool_t *pool;
+  int length = 0, printed = 0;
+
+  if (!dir) {
+    repo_ferror("path does not exist '%s'", repo->path);
+  }
+
+  walkers = calloc(dir->length, sizeof(log_walker_t));
+  heap = calloc(dir->length, sizeof(log_walker_t *));
+  assert(walkers);
+  assert(heap);
+
+  if (!(pool = repo_pool_new(opts->jobs))) {
+    repo_error("log: failed to start worker threads");
+    free(heap);
+    free(walkers);
+    repo_dir_free(dir);
+    return -1;
+  }
+
+  for (int i = 0; i < dir->length; ++i) {
+    repo_dir_item_t *item = &dir->items[i];
+    log_walker_t *w = &walkers[i];
+    w->item = item;
+    w->opts = opts;
+    w->chunk = opts->max_count > 0 && opts->max_count < LOG_CHUNK ? opts->max_count : LOG_CHUNK;
+    if (repo_dir_item_is_git_repo(item)) {
+      if (0 != repo_pool_push(pool, walker_prime, w)) walker_prime(w);
+    }
+  }
+
+  repo_pool_wait(pool);
+  repo_pool_free(pool);
+
+  for (int i = 0; i < dir->length; ++i) {
+    if (walkers[i].live) heap_push(heap, &length, &walkers[i]);
+  }
+
+  // lazily pull from whichever walk holds the newest commit
+  while (length > 0 && (opts->max_count < 0 || printed < opts->max_count)) {
+    log_walker_t *w = heap_pop(heap, &length);
+    print_commit(w);
+    printed++;
+    if (walker_next(w)) heap_push(heap, &length, w);
+  }
+
+  for (int i = 0; i < dir->length; ++i) {
+    if (walkers[i].failed) fprintf(stderr, " %s failed: %s\n", walkers[i].item->name, walkers[i].error);
+    walker_free(&walkers[i]);
+  }
+
+  free(heap);
+  free(walkers);
+  repo_dir_free(dir);
+  return printed;
+}
+
+
+static void
+on_since (command_t *self) {
+  if (0 != repo_log_parse_date(self->arg, &log_opts.since)) {
+    repo_ferror("log: invalid date '%s'", self->arg);
+  }
+}
+
+
+static void
+on_max_count (command_t *self) {
+  log_opts.max_count = atoi(self->arg);
+}
+
+
+static void
+on_jobs (command_t *self) {
+  log_opts.jobs = atoi(self->arg);
+}
+
+
+static void
+on_all (command_t *self) {
+  log_opts.all = true;
+}
+
+
+void
+repo_cmd_log (repo_session_t *sess) {
+  log_opts.since = 0;
+  log_opts.max_count = -1;
+  log_opts.jobs = 0;
+  log_opts.all = false;
+
+  command_option(&sess->program, "-s", "--since <date>", "Only show commits newer than date", on_since);
+  command_option(&sess->program, "-n", "--max-count <n>", "Limit the number of commits shown", on_max_count);
+  command_option(&sess->program, "-j", "--jobs <n>", "Number of repositories opened in parallel", on_jobs);
+  command_option(&sess->program, "-a", "--all", "Walk all local branches instead of HEAD", on_all);
+
+  if (sess->argc > 1) {
+    if (repo_cmd_needs_help(sess)) {
+      repo_help(sess, false);
+      exit(0);
+    }
+
+    repo_session_start(sess);
+  }
+
+  repo_log_print(sess->user->repo, &log_opts);
+
+  repo_session_free(sess);
+  exit(0);
+}
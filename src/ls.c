@@ -2,8 +2,38 @@
 #include <assert.h>
 #include <repo.h>
 
+static repo_ls_opts_t ls_opts;
+
+static const char *default_format = " (%(branch)) %(name)";
+
+static void
+on_where (command_t *self) {
+  char error[256];
+
+  if (!(ls_opts.where = repo_where_compile(self->arg, error, sizeof(error)))) {
+    repo_ferror("ls: --where: %s", error);
+  }
+}
+
+
+static void
+on_format (command_t *self) {
+  char error[256];
+
+  if (!(ls_opts.format = repo_format_compile(self->arg, error, sizeof(error)))) {
+    repo_ferror("ls: --format: %s", error);
+  }
+}
+
+
 void
 repo_cmd_ls (repo_session_t *sess) {
+  ls_opts.where = NULL;
+  ls_opts.format = NULL;
+
+  command_option(&sess->program, "-w", "--where <expr>", "Only list repositories matching expr", on_where);
+  command_option(&sess->program, "-f", "--format <template>", "Print each repository with a %(field) template", on_format);
+
   if (sess->argc > 1) {
     if (repo_cmd_needs_help(sess)) {
       repo_help(sess, false);
@@ -13,15 +43,20 @@ repo_cmd_ls (repo_session_t *sess) {
     repo_session_start(sess);
   }
 
-  repo_dir_ls(sess->user->repo);
+  ls_opts.output = sess->output;
+  repo_dir_ls(sess->user->repo, &ls_opts);
 
   repo_session_free(sess);
   exit(0);
 }
 
 void
-repo_dir_ls (repo_t *repo) {
+repo_dir_ls (repo_t *repo, repo_ls_opts_t *opts) {
   repo_dir_t *dir = repo_dir_new(repo->path);
+  repo_format_t *format = opts->format;
+  repo_emitter_t *emitter = NULL;
+  repo_buf_t *out = NULL;
+  char error[256];
   
   if (!dir) {
     repo_ferror("path does not exist '%s'", repo->path);
@@ -31,16 +66,51 @@ repo_dir_ls (repo_t *repo) {
   assert(dir->items);
   assert(dir->length);
 
+  if (REPO_OUTPUT_TEXT != opts->output) {
+    emitter = repo_emitter_new(opts->output, STDOUT_FILENO);
+    assert(emitter);
+  } else {
+    if (!format) {
+      format = repo_format_compile(default_format, error, sizeof(error));
+      assert(format);
+    }
+
+    out = repo_buf_new(STDOUT_FILENO);
+    assert(out);
+  }
+
   for (int i = 0; i < dir->length; ++i) {
     repo_dir_item_t *item = &dir->items[i];
-    if (item->is_git_repo && !item->is_git_orphan) {
-      printf(" (%s) %s\n"
-        , item->git_branch
-        , item->name
-      );
+
+    if (!repo_dir_item_is_git_repo(item)) continue;
+
+    // `--where` and `--format` decide on orphans themselves, which
+    // keeps repositories closed unless a field needs them open
+    if (opts->where) {
+      if (!repo_where_match(opts->where, item)) continue;
+    } else if (!opts->format) {
+      if (repo_dir_item_is_orphan(item) || !item->is_git_repo) continue;
+    }
+
+    REPO_TRACE_BEGIN("write", item->name);
+
+    if (emitter) {
+      repo_emitter_begin(emitter);
+      repo_emitter_str(emitter, "name", item->name);
+      repo_emitter_str(emitter, "path", item->path);
+      repo_emitter_str(emitter, "branch", repo_dir_item_branch(item));
+      repo_emitter_bool(emitter, "bare", repo_dir_item_is_bare(item));
+      repo_emitter_bool(emitter, "orphan", repo_dir_item_is_orphan(item));
+      repo_emitter_end(emitter);
+    } else if (0 != repo_format_write(format, item, out)) {
+      repo_ferror("ls: failed to write output: %s", strerror(errno));
     }
+
+    REPO_TRACE_END("write");
   }
 
-  free(dir);
-  exit(0);
+  if (format != opts->format) repo_format_free(format);
+  repo_emitter_free(emitter);
+  repo_buf_free(out);
+  repo_dir_free(dir);
 }
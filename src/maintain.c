@@ -0,0 +1,538 @@
+
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <repo.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+/**
+ * `repo maintain` tidies every repository under the root the
+ * way `git maintenance` would: loose refs are packed into
+ * `packed-refs`, loose objects and small packs are folded into
+ * fewer packs, and a commit-graph is written. libgit2 has no
+ * repack or commit-graph writer, so each step runs the git
+ * command line tool.
+ *
+ * With `--io-idle` the workers, and the git processes they
+ * start, only get the disk when nothing else wants it. That
+ * takes Linux I/O priorities, elsewhere it is ignored with a
+ * warning. Object, pack and ref counts are taken before and
+ * after from the object directory itself, and `repo ls` is timed
+ * over the root on both sides so the effect on scans shows up in
+ * the summary.
+ */
+
+#define MAINTAIN_JOBS 2
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+// git exits with 129 on options it doesn't know
+#define GIT_USAGE_ERROR 129
+
+typedef struct maintain_counts {
+  size_t loose;
+  size_t packed;
+  size_t packs;
+  size_t refs;
+  bool graph;
+} maintain_counts_t;
+
+typedef struct maintain_job {
+  repo_dir_item_t *item;
+  char gitdir[REPO_PATH_MAX];
+  maintain_counts_t before;
+  maintain_counts_t after;
+  double ms;
+  bool failed;
+  char error[160];
+} maintain_job_t;
+
+static repo_maintain_opts_t maintain_opts;
+static __thread size_t maintain_refs;
+
+
+static double
+maintain_now_ms () {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+
+static size_t
+count_entries (const char *path, const char *suffix) {
+  size_t count = 0, len = suffix ? strlen(suffix) : 0;
+  struct dirent *entry;
+  DIR *dir;
+
+  if (!(dir = opendir(path)))
+    return 0;
+
+  while ((entry = readdir(dir))) {
+    size_t name = strlen(entry->d_name);
+    if ('.' == entry->d_name[0]) continue;
+    if (suffix && (name < len || 0 != strcmp(entry->d_name + name - len, suffix))) continue;
+    count++;
+  }
+
+  closedir(dir);
+  return count;
+}
+
+/**
+ * Number of objects in the pack index at `path`, read from the
+ * last fanout entry
+ */
+
+static size_t
+idx_objects (const char *path) {
+  unsigned char header[8], last[4];
+  off_t fanout = 0;
+  int fd;
+
+  if (-1 == (fd = open(path, O_RDONLY)))
+    return 0;
+
+  // version 2 and later start with "\377tOc" and a version
+  if (sizeof(header) == pread(fd, header, sizeof(header), 0)
+      && 0 == memcmp(header, "\377tOc", 4)) {
+    fanout = sizeof(header);
+  }
+
+  if (sizeof(last) != pread(fd, last, sizeof(last), fanout + 255 * 4)) {
+    close(fd);
+    return 0;
+  }
+
+  close(fd);
+  return (size_t) last[0] << 24 | (size_t) last[1] << 16 | (size_t) last[2] << 8 | last[3];
+}
+
+
+static int
+on_ref_file (const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+  if (FTW_F == flag) maintain_refs++;
+  return 0;
+}
+
+
+static void
+maintain_count (const char *gitdir, maintain_counts_t *counts) {
+  char path[REPO_PATH_MAX + 64];
+  struct dirent *entry;
+  DIR *dir;
+
+  memset(counts, 0, sizeof(maintain_counts_t));
+
+  for (int i = 0; i < 256; ++i) {
+    snprintf(path, sizeof(path), "%sobjects/%02x", gitdir, i);
+    counts->loose += count_entries(path, NULL);
+  }
+
+  snprintf(path, sizeof(path), "%sobjects/pack", gitdir);
+  counts->packs = count_entries(path, ".pack");
+
+  if ((dir = opendir(path))) {
+    while ((entry = readdir(dir))) {
+      size_t len = strlen(entry->d_name);
+      if (len < 4 || 0 != strcmp(entry->d_name + len - 4, ".idx")) continue;
+      snprintf(path, sizeof(path), "%sobjects/pack/%s", gitdir, entry->d_name);
+      counts->packed += idx_objects(path);
+    }
+    closedir(dir);
+  }
+
+  maintain_refs = 0;
+  snprintf(path, sizeof(path), "%srefs", gitdir);
+  nftw(path, on_ref_file, 16, FTW_PHYS);
+  counts->refs = maintain_refs;
+
+  snprintf(path, sizeof(path), "%sobjects/info/commit-graph", gitdir);
+  counts->graph = 0 == access(path, F_OK);
+  snprintf(path, sizeof(path), "%sobjects/info/commit-graphs/commit-graph-chain", gitdir);
+  counts->graph = counts->graph || 0 == access(path, F_OK);
+}
+
+/**
+ * Runs `git -C <path> <args>`, keeping the tail of what it
+ * writes to stderr in `error`. Returns its exit status, or -1
+ * if it couldn't be run.
+ */
+
+static int
+maintain_git (const char *path, const char **args, char *error, size_t size) {
+  const char *argv[16] = { "git", "-C", path };
+  posix_spawn_file_actions_t actions;
+  char buf[256];
+  size_t length = 0;
+  int fds[2], status, argc = 3;
+  ssize_t n;
+  pid_t pid;
+
+  while (*args && argc < 15) argv[argc++] = *args++;
+  argv[argc] = NULL;
+
+  if (0 != pipe(fds))
+    return -1;
+
+  // git only gets the write end, as its stderr
+  if (-1 == fcntl(fds[0], F_SETFD, FD_CLOEXEC) || -1 == fcntl(fds[1], F_SETFD, FD_CLOEXEC)) {
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+
+  status = posix_spawnp(&pid, "git", &actions, NULL, (char * const *) argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[1]);
+
+  if (0 != status) {
+    close(fds[0]);
+    errno = status;
+    snprintf(error, size, "git: %s", strerror(status));
+    return -1;
+  }
+
+  // drain stderr so git never blocks on a full pipe
+  while ((n = read(fds[0], buf, sizeof(buf))) > 0 || (-1 == n && EINTR == errno)) {
+    if (n <= 0) continue;
+
+    // keep the last `size - 1` bytes, git ends with the reason
+    if ((size_t) n >= size - 1) {
+      memcpy(error, buf + n - (size - 1), size - 1);
+      length = size - 1;
+      continue;
+    }
+
+    if (length + n > size - 1) {
+      size_t drop = length + n - (size - 1);
+      memmove(error, error + drop, length - drop);
+      length -= drop;
+    }
+
+    memcpy(error + length, buf, n);
+    length += n;
+  }
+
+  close(fds[0]);
+  error[length] = '\0';
+  while (length > 0 && '\n' == error[length - 1]) error[--length] = '\0';
+
+  while (-1 == waitpid(pid, &status, 0)) {
+    if (EINTR != errno) return -1;
+  }
+
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+
+static bool
+maintain_step (maintain_job_t *job, const char *name, const char **args) {
+  char output[sizeof(job->error)];
+  int status = maintain_git(job->item->path, args, output, sizeof(output));
+
+  if (0 == status)
+    return true;
+
+  job->failed = true;
+  snprintf(job->error, sizeof(job->error), "%s: %s", name, output[0] ? output : "failed");
+  return false;
+}
+
+
+static void
+maintain_run (void *data) {
+  maintain_job_t *job = (maintain_job_t *) data;
+  const char *pack_refs[] = { "pack-refs", "--all", "--prune", NULL };
+  const char *geometric[] = { "repack", "-d", "-l", "-q", "--geometric=2", NULL };
+  const char *repack[] = { "repack", "-d", "-l", "-q", NULL };
+  const char *graph[] = { "commit-graph", "write", "--reachable", "--split", NULL };
+  char output[sizeof(job->error)];
+  double start = maintain_now_ms();
+  int status;
+
+  REPO_TRACE_BEGIN("maintain", job->item->name);
+  maintain_count(job->gitdir, &job->before);
+
+  if (!maintain_step(job, "pack-refs", pack_refs))
+    goto done;
+
+  // geometric repacking folds small packs into bigger ones without
+  // rewriting the big ones, git before 2.33 only packs loose objects
+  if (GIT_USAGE_ERROR == (status = maintain_git(job->item->path, geometric, output, sizeof(output)))) {
+    if (!maintain_step(job, "repack", repack)) goto done;
+  } else if (0 != status) {
+    job->failed = true;
+    snprintf(job->error, sizeof(job->error), "repack: %s", output[0] ? output : "failed");
+    goto done;
+  }
+
+  maintain_step(job, "commit-graph", graph);
+
+done:
+  maintain_count(job->gitdir, &job->after);
+  REPO_TRACE_END("maintain");
+  job->ms = maintain_now_ms() - start;
+}
+
+/**
+ * Time it takes to list `repo` the way `repo ls` does, without
+ * the writes, best of two so the first run warms the cache
+ */
+
+static double
+maintain_time_ls (repo_t *repo) {
+  double best = -1;
+
+  for (int round = 0; round < 2; ++round) {
+    double start;
+    repo_dir_t *dir;
+
+    // pooled handles would skip the opens being measured
+    repo_handles_clear(repo_handles_default());
+
+    start = maintain_now_ms();
+    if (!(dir = repo_dir_new(repo->path))) return 0;
+    for (int i = 0; i < dir->length; ++i) {
+      repo_dir_item_t *item = &dir->items[i];
+      if (repo_dir_item_is_git_repo(item)) repo_dir_item_branch(item);
+    }
+    repo_dir_free(dir);
+
+    if (best < 0 || maintain_now_ms() - start < best) best = maintain_now_ms() - start;
+  }
+
+  return best;
+}
+
+
+static void
+maintain_print (maintain_job_t *job) {
+  maintain_counts_t *a = &job->before, *b = &job->after;
+
+  if (job->failed) {
+    printf(" %s failed: %s\n", job->item->name, job->error);
+    return;
+  }
+
+  printf(" %s: loose objects %zu -> %zu, packs %zu -> %zu, loose refs %zu -> %zu%s, %.1fs\n"
+      , job->item->name, a->loose, b->loose, a->packs, b->packs, a->refs, b->refs
+      , b->graph ? ", commit-graph" : "", job->ms / 1000.0);
+}
+
+
+static void
+maintain_emit (repo_emitter_t *emitter, maintain_job_t *job) {
+  repo_emitter_begin(emitter);
+  repo_emitter_str(emitter, "name", job->item->name);
+  repo_emitter_str(emitter, "path", job->item->path);
+  repo_emitter_str(emitter, "error", job->failed ? job->error : NULL);
+  repo_emitter_int(emitter, "loose_before", job->before.loose);
+  repo_emitter_int(emitter, "loose_after", job->after.loose);
+  repo_emitter_int(emitter, "packed_before", job->before.packed);
+  repo_emitter_int(emitter, "packed_after", job->after.packed);
+  repo_emitter_int(emitter, "packs_before", job->before.packs);
+  repo_emitter_int(emitter, "packs_after", job->after.packs);
+  repo_emitter_int(emitter, "refs_before", job->before.refs);
+  repo_emitter_int(emitter, "refs_after", job->after.refs);
+  repo_emitter_bool(emitter, "commit_graph", job->after.graph);
+  repo_emitter_float(emitter, "ms", job->ms);
+  repo_emitter_end(emitter);
+}
+
+/**
+ * Creates the worker pool, at idle I/O priority if `idle` is
+ * set. Threads inherit the priority of the thread creating them
+ * and processes that of their parent, so the calling thread
+ * takes it on just long enough to start the workers.
+ */
+
+static repo_pool_t *
+maintain_pool (int jobs, bool idle) {
+  repo_pool_t *pool;
+#if defined(__linux__)
+  long prio = -1;
+
+  if (idle) {
+    prio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+    if (-1 == syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT)) {
+      fprintf(stderr, "repo: maintain: can't lower I/O priority: %s\n", strerror(errno));
+    }
+  }
+#else
+  if (idle) {
+    fprintf(stderr, "repo: maintain: --io-idle is only supported on Linux, ignoring it\n");
+  }
+#endif
+
+  pool = repo_pool_new(jobs > 0 ? jobs : MAINTAIN_JOBS);
+
+#if defined(__linux__)
+  if (prio >= 0) {
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, prio);
+  }
+#endif
+
+  return pool;
+}
+
+/**
+ * Maintains every repository under `repo` and prints the
+ * results. Returns the number that failed, or -1 if none could
+ * be started.
+ */
+
+int
+repo_maintain_all (repo_t *repo, repo_output_t output, repo_maintain_opts_t *opts) {
+  repo_dir_t *dir = repo_dir_new(repo->path);
+  repo_handles_t *handles = repo_handles_default();
+  repo_emitter_t *emitter = NULL;
+  maintain_counts_t before = { 0 }, after = { 0 };
+  maintain_job_t *jobs;
+  repo_pool_t *pool;
+  int length = 0, failed = 0;
+  double start, elapsed, ls_before, ls_after;
+  FILE *summary;
+
+  if (!dir) {
+    repo_ferror("path does not exist '%s'", repo->path);
+  }
+
+  if (!(jobs = calloc(dir->length + 1, sizeof(maintain_job_t)))) {
+    repo_error("maintain: out of memory");
+    repo_dir_free(dir);
+    return -1;
+  }
+
+  if (!(pool = maintain_pool(opts->jobs, opts->io_idle))) {
+    repo_error("maintain: failed to start worker threads");
+    repo_dir_free(dir);
+    free(jobs);
+    return -1;
+  }
+
+  ls_before = maintain_time_ls(repo);
+
+  for (int i = 0; i < dir->length; ++i) {
+    repo_dir_item_t *item = &dir->items[i];
+    maintain_job_t *job = &jobs[length];
+    repo_handle_t *handle = NULL;
+
+    if (!repo_dir_item_is_git_repo(item)) continue;
+
+    job->item = item;
+    length++;
+
+    if (0 != repo_handles_get(handles, item->path, &handle)) {
+      const git_error *err = giterr_last();
+      job->failed = true;
+      snprintf(job->error, sizeof(job->error), "open: %s", err ? err->message : "unknown error");
+      continue;
+    }
+
+    // `.git` may be a file pointing elsewhere, libgit2 knows where
+    snprintf(job->gitdir, sizeof(job->gitdir), "%s", git_repository_path(handle->repo));
+    repo_handles_put(handles, handle);
+  }
+
+  // repacking replaces the packs the pooled handles have open
+  repo_handles_clear(handles);
+
+  start = maintain_now_ms();
+
+  for (int i = 0; i < length; ++i) {
+    if (jobs[i].failed) continue;
+    if (0 != repo_pool_push(pool, maintain_run, &jobs[i])) maintain_run(&jobs[i]);
+  }
+
+  repo_pool_wait(pool);
+  repo_pool_free(pool);
+  elapsed = maintain_now_ms() - start;
+
+  ls_after = maintain_time_ls(repo);
+
+  if (REPO_OUTPUT_TEXT != output) {
+    emitter = repo_emitter_new(output, STDOUT_FILENO);
+    assert(emitter);
+  }
+
+  for (int i = 0; i < length; ++i) {
+    maintain_job_t *job = &jobs[i];
+
+    before.loose += job->before.loose;
+    before.packs += job->before.packs;
+    before.refs += job->before.refs;
+    after.loose += job->after.loose;
+    after.packs += job->after.packs;
+    after.refs += job->after.refs;
+    if (job->failed) failed++;
+
+    if (emitter) maintain_emit(emitter, job);
+    else maintain_print(job);
+  }
+
+  repo_emitter_free(emitter);
+
+  summary = emitter ? stderr : stdout;
+  fprintf(summary, "repo: maintain: %d repositories in %.1fs, loose objects %zu -> %zu"
+      ", packs %zu -> %zu, loose refs %zu -> %zu, repo ls %.0fms -> %.0fms"
+      , length, elapsed / 1000.0, before.loose, after.loose, before.packs, after.packs
+      , before.refs, after.refs, ls_before, ls_after);
+  if (failed) fprintf(summary, ", %d failed", failed);
+  fprintf(summary, "\n");
+
+  free(jobs);
+  repo_dir_free(dir);
+  return failed;
+}
+
+
+static void
+on_jobs (command_t *self) {
+  maintain_opts.jobs = atoi(self->arg);
+}
+
+
+static void
+on_io_idle (command_t *self) {
+  maintain_opts.io_idle = true;
+}
+
+
+void
+repo_cmd_maintain (repo_session_t *sess) {
+  int failed;
+
+  maintain_opts.jobs = MAINTAIN_JOBS;
+  maintain_opts.io_idle = false;
+
+  command_option(&sess->program, "-j", "--jobs <n>", "Number of repositories maintained in parallel", on_jobs);
+  command_option(&sess->program, "-i", "--io-idle", "Only use the disk when nothing else does", on_io_idle);
+
+  if (sess->argc > 1) {
+    if (repo_cmd_needs_help(sess)) {
+      repo_help(sess, false);
+      exit(0);
+    }
+
+    repo_session_start(sess);
+  }
+
+  failed = repo_maintain_all(sess->user->repo, sess->output, &maintain_opts);
+
+  repo_session_free(sess);
+  exit(0 == failed ? 0 : 1);
+}
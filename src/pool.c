@@ -0,0 +1,145 @@
+
+#include <assert.h>
+#include <pthread.h>
+#include <repo.h>
+
+static void *
+pool_worker (void *data) {
+  repo_pool_t *pool = (repo_pool_t *) data;
+  repo_pool_job_t *job;
+
+  while (true) {
+    pthread_mutex_lock(&pool->lock);
+
+    while (NULL == pool->head && !pool->closed) {
+      pthread_cond_wait(&pool->has_work, &pool->lock);
+    }
+
+    if (NULL == (job = pool->head)) {
+      // closed and drained
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+
+    if (NULL == (pool->head = job->next)) {
+      pool->tail = NULL;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    REPO_TRACE_BEGIN("job", NULL);
+    job->fn(job->data);
+    REPO_TRACE_END("job");
+    free(job);
+
+    pthread_mutex_lock(&pool->lock);
+    if (0 == --pool->pending) {
+      pthread_cond_broadcast(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  return NULL;
+}
+
+
+int
+repo_pool_default_size () {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int) n : 1;
+}
+
+
+repo_pool_t *
+repo_pool_new (int size) {
+  repo_pool_t *pool;
+
+  if (size < 1)
+    size = repo_pool_default_size();
+
+  if (!(pool = malloc(sizeof(repo_pool_t))))
+    return NULL;
+
+  if (!(pool->threads = malloc(size * sizeof(pthread_t)))) {
+    free(pool);
+    return NULL;
+  }
+
+  pool->size = 0;
+  pool->pending = 0;
+  pool->closed = false;
+  pool->head = pool->tail = NULL;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->has_work, NULL);
+  pthread_cond_init(&pool->done, NULL);
+
+  for (int i = 0; i < size; ++i) {
+    if (0 != pthread_create(&pool->threads[i], NULL, pool_worker, pool))
+      break;
+    pool->size++;
+  }
+
+  if (0 == pool->size) {
+    repo_pool_free(pool);
+    return NULL;
+  }
+
+  return pool;
+}
+
+
+int
+repo_pool_push (repo_pool_t *pool, repo_pool_job_cb fn, void *data) {
+  repo_pool_job_t *job;
+
+  if (!(job = malloc(sizeof(repo_pool_job_t))))
+    return -1;
+
+  job->fn = fn;
+  job->data = data;
+  job->next = NULL;
+
+  pthread_mutex_lock(&pool->lock);
+
+  if (pool->tail) {
+    pool->tail->next = job;
+  } else {
+    pool->head = job;
+  }
+
+  pool->tail = job;
+  pool->pending++;
+  pthread_cond_signal(&pool->has_work);
+  pthread_mutex_unlock(&pool->lock);
+
+  return 0;
+}
+
+
+void
+repo_pool_wait (repo_pool_t *pool) {
+  pthread_mutex_lock(&pool->lock);
+  while (pool->pending > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+
+void
+repo_pool_free (repo_pool_t *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->closed = true;
+  pthread_cond_broadcast(&pool->has_work);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->size; ++i) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->has_work);
+  pthread_cond_destroy(&pool->done);
+  free(pool->threads);
+  free(pool);
+}
@@ -0,0 +1,518 @@
+
+#include <assert.h>
+#include <repo.h>
+
+/**
+ * `repo pull --ff-only` fast-forwards the checked out branch of
+ * every repository to its upstream in two stages. Fetches go
+ * through the scheduler as with `repo fetch`, and each repository
+ * whose fetch is done moves on to a small pool of checkout
+ * workers, so the disk-bound checkouts overlap the fetches still
+ * waiting on the network. Repositories with local changes, with
+ * a merge or rebase in progress, or whose branch has diverged
+ * from upstream are left alone and reported.
+ */
+
+#define PULL_PER_HOST 4
+#define PULL_CHECKOUTS 2
+
+typedef enum {
+  PULL_PENDING,
+  PULL_UPDATED,
+  PULL_CURRENT,
+  PULL_AHEAD,
+  PULL_DIRTY,
+  PULL_BUSY,
+  PULL_DIVERGED,
+  PULL_NO_UPSTREAM,
+  PULL_DETACHED,
+  PULL_FAILED
+} pull_state_t;
+
+static const char *pull_states[] = {
+  "pending", "updated", "current", "ahead", "dirty", "busy", "diverged",
+  "no-upstream", "detached", "failed"
+};
+
+typedef struct pull_job {
+  repo_dir_item_t *item;
+  repo_pool_t *checkouts;
+  repo_fetch_job_t *fetch;
+  char branch[256];
+  char upstream[256];
+  pull_state_t state;
+  git_oid from;
+  git_oid to;
+  size_t ahead;
+  size_t behind;
+  size_t files;
+  double checkout_ms;
+  char error[160];
+} pull_job_t;
+
+static repo_pull_opts_t pull_opts;
+
+
+static double
+pull_now_ms () {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+
+static void
+pull_fail (pull_job_t *job, const char *stage) {
+  const git_error *err = giterr_last();
+
+  job->state = PULL_FAILED;
+  snprintf(job->error, sizeof(job->error), "%s: %s", stage, err ? err->message : "unknown error");
+}
+
+
+static void
+on_checkout_progress (const char *path, size_t completed, size_t total, void *payload) {
+  ((pull_job_t *) payload)->files = total;
+}
+
+/**
+ * Sets `dirty` if tracked files differ from HEAD, in the index
+ * or the working tree. Untracked files don't count; checkout
+ * refuses to overwrite them itself.
+ */
+
+static int
+pull_is_dirty (git_repository *repo, bool *dirty) {
+  git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+  git_status_list *list = NULL;
+  int error;
+
+  opts.show = GIT_STATUS_SHOW_INDEX_AND_WORKDIR;
+  opts.flags = 0;
+
+  if (0 != (error = git_status_list_new(&list, repo, &opts)))
+    return error;
+
+  *dirty = git_status_list_entrycount(list) > 0;
+  git_status_list_free(list);
+  return 0;
+}
+
+/**
+ * Checkout stage, fast-forwards the branch to what the fetch
+ * brought in if that is all it takes
+ */
+
+static void
+pull_checkout (void *data) {
+  pull_job_t *job = (pull_job_t *) data;
+  git_checkout_opts opts = GIT_CHECKOUT_OPTS_INIT;
+  repo_handles_t *handles = repo_handles_default();
+  repo_handle_t *handle = NULL;
+  git_reference *head = NULL, *moved = NULL;
+  git_object *target = NULL;
+  double start = pull_now_ms();
+  bool dirty = false;
+
+  REPO_TRACE_BEGIN("checkout", job->item->name);
+  repo_stats_count(REPO_STATS_CHECKOUT);
+
+  if (0 != repo_handles_get(handles, job->item->path, &handle)
+      || 0 != git_repository_head(&head, handle->repo)
+      || 0 != git_reference_name_to_id(&job->to, handle->repo, job->upstream)) {
+    pull_fail(job, "checkout");
+    goto cleanup;
+  }
+
+  // someone switched branches while we were fetching
+  if (0 != strcmp(git_reference_name(head), job->branch)) {
+    job->state = PULL_FAILED;
+    snprintf(job->error, sizeof(job->error), "checkout: HEAD moved off %s", job->branch);
+    goto cleanup;
+  }
+
+  git_oid_cpy(&job->from, git_reference_target(head));
+
+  if (git_oid_equal(&job->from, &job->to)) {
+    job->state = PULL_CURRENT;
+    goto cleanup;
+  }
+
+  if (0 != git_graph_ahead_behind(&job->ahead, &job->behind, handle->repo, &job->from, &job->to)) {
+    pull_fail(job, "checkout");
+    goto cleanup;
+  }
+
+  if (0 == job->behind) {
+    job->state = PULL_AHEAD;
+    goto cleanup;
+  }
+
+  if (job->ahead > 0) {
+    job->state = PULL_DIVERGED;
+    goto cleanup;
+  }
+
+  if (GIT_REPOSITORY_STATE_NONE != git_repository_state(handle->repo)) {
+    job->state = PULL_BUSY;
+    goto cleanup;
+  }
+
+  if (0 != pull_is_dirty(handle->repo, &dirty)) {
+    pull_fail(job, "status");
+    goto cleanup;
+  }
+
+  if (dirty) {
+    job->state = PULL_DIRTY;
+    goto cleanup;
+  }
+
+  // safe checkout only touches files that match HEAD, which the
+  // status check above says all of them do
+  opts.checkout_strategy = GIT_CHECKOUT_SAFE;
+  opts.progress_cb = on_checkout_progress;
+  opts.progress_payload = job;
+
+  if (0 != git_object_lookup(&target, handle->repo, &job->to, GIT_OBJ_COMMIT)
+      || 0 != git_checkout_tree(handle->repo, target, &opts)
+      || 0 != git_reference_set_target(&moved, head, &job->to)) {
+    pull_fail(job, "checkout");
+    goto cleanup;
+  }
+
+  job->state = PULL_UPDATED;
+
+cleanup:
+  git_reference_free(moved);
+  git_object_free(target);
+  git_reference_free(head);
+  repo_handles_put(handles, handle);
+  REPO_TRACE_END("checkout");
+  job->checkout_ms = pull_now_ms() - start;
+}
+
+/**
+ * Fetch stage, hands the repository to the checkout stage as
+ * soon as its fetch is done
+ */
+
+static void
+pull_fetch (void *data) {
+  pull_job_t *job = (pull_job_t *) data;
+
+  repo_fetch_run(job->fetch);
+
+  if (job->fetch->failed) {
+    job->state = PULL_FAILED;
+    snprintf(job->error, sizeof(job->error), "fetch: %s", job->fetch->error);
+    return;
+  }
+
+  if (0 != repo_pool_push(job->checkouts, pull_checkout, job)) {
+    pull_checkout(job);
+  }
+}
+
+/**
+ * Works out the branch, upstream and remote to fetch for `item`.
+ * Returns NULL for repositories there's nothing to pull into.
+ */
+
+static pull_job_t *
+pull_job_new (repo_dir_item_t *item, repo_pool_t *checkouts, repo_history_t *history) {
+  repo_handles_t *handles = repo_handles_default();
+  repo_handle_t *handle = NULL;
+  git_reference *head = NULL;
+  char remote[256];
+  pull_job_t *job;
+
+  if (!repo_dir_item_is_git_repo(item) || repo_dir_item_is_bare(item) || repo_dir_item_is_orphan(item))
+    return NULL;
+
+  if (!(job = calloc(1, sizeof(pull_job_t))))
+    return NULL;
+
+  job->item = item;
+  job->checkouts = checkouts;
+
+  if (0 != repo_handles_get(handles, item->path, &handle)) {
+    pull_fail(job, "open");
+    return job;
+  }
+
+  if (0 != git_repository_head(&head, handle->repo)) {
+    pull_fail(job, "head");
+  } else if (!git_reference_is_branch(head)) {
+    job->state = PULL_DETACHED;
+  } else {
+    snprintf(job->branch, sizeof(job->branch), "%s", git_reference_name(head));
+
+    if (0 > git_branch_upstream_name(job->upstream, sizeof(job->upstream), handle->repo, job->branch)) {
+      job->state = PULL_NO_UPSTREAM;
+    } else if (0 > git_branch_remote_name(remote, sizeof(remote), handle->repo, job->upstream)) {
+      // tracks a local branch, there's nothing to fetch
+      giterr_clear();
+    } else if (!(job->fetch = repo_fetch_job_new(item, handle->repo, remote, history))) {
+      job->state = PULL_FAILED;
+      snprintf(job->error, sizeof(job->error), "out of memory");
+    }
+  }
+
+  git_reference_free(head);
+  repo_handles_put(handles, handle);
+  return job;
+}
+
+
+static const char *
+short_name (const char *ref) {
+  if (0 == strncmp(ref, "refs/remotes/", 13)) return ref + 13;
+  if (0 == strncmp(ref, "refs/heads/", 11)) return ref + 11;
+  return ref;
+}
+
+
+static void
+pull_print (pull_job_t *job) {
+  const char *name = job->item->name;
+  char from[8], to[8];
+
+  switch (job->state) {
+    case PULL_UPDATED:
+      git_oid_tostr(from, sizeof(from), &job->from);
+      git_oid_tostr(to, sizeof(to), &job->to);
+      printf(" %s: %s..%s, %zu commits, %zu files\n", name, from, to, job->behind, job->files);
+      break;
+    case PULL_CURRENT:
+      printf(" %s: up to date\n", name);
+      break;
+    case PULL_AHEAD:
+      printf(" %s: %zu ahead of %s, nothing to pull\n", name, job->ahead, short_name(job->upstream));
+      break;
+    case PULL_DIRTY:
+      printf(" %s: skipped, local changes\n", name);
+      break;
+    case PULL_BUSY:
+      printf(" %s: skipped, merge or rebase in progress\n", name);
+      break;
+    case PULL_DIVERGED:
+      printf(" %s: skipped, diverged from %s (%zu ahead, %zu behind)\n"
+          , name, short_name(job->upstream), job->ahead, job->behind);
+      break;
+    case PULL_NO_UPSTREAM:
+      printf(" %s: skipped, %s has no upstream\n", name, short_name(job->branch));
+      break;
+    case PULL_DETACHED:
+      printf(" %s: skipped, detached HEAD\n", name);
+      break;
+    case PULL_PENDING:
+    case PULL_FAILED:
+      printf(" %s failed: %s\n", name, job->error[0] ? job->error : "not run");
+      break;
+  }
+}
+
+
+static void
+pull_emit (repo_emitter_t *emitter, pull_job_t *job) {
+  char from[GIT_OID_HEXSZ + 1], to[GIT_OID_HEXSZ + 1];
+  bool moved = PULL_UPDATED == job->state;
+
+  git_oid_tostr(from, sizeof(from), &job->from);
+  git_oid_tostr(to, sizeof(to), &job->to);
+
+  repo_emitter_begin(emitter);
+  repo_emitter_str(emitter, "name", job->item->name);
+  repo_emitter_str(emitter, "path", job->item->path);
+  repo_emitter_str(emitter, "branch", job->branch[0] ? short_name(job->branch) : NULL);
+  repo_emitter_str(emitter, "upstream", job->upstream[0] ? short_name(job->upstream) : NULL);
+  repo_emitter_str(emitter, "status", pull_states[job->state]);
+  repo_emitter_str(emitter, "error", PULL_FAILED == job->state ? job->error : NULL);
+  repo_emitter_str(emitter, "from", moved ? from : NULL);
+  repo_emitter_str(emitter, "to", moved ? to : NULL);
+  repo_emitter_int(emitter, "ahead", job->ahead);
+  repo_emitter_int(emitter, "behind", job->behind);
+  repo_emitter_int(emitter, "files", job->files);
+  repo_emitter_bool(emitter, "fetch_skipped", job->fetch && job->fetch->skipped);
+  repo_emitter_float(emitter, "fetch_ms", job->fetch ? job->fetch->ms : 0);
+  repo_emitter_float(emitter, "checkout_ms", job->checkout_ms);
+  repo_emitter_end(emitter);
+}
+
+/**
+ * Fast-forwards every repository under `repo` and prints the
+ * results. Returns the number of repositories that failed, or
+ * -1 if the pull couldn't be started.
+ */
+
+int
+repo_pull_all (repo_t *repo, repo_output_t output, repo_pull_opts_t *opts) {
+  repo_dir_t *dir = repo_dir_new(repo->path);
+  int counts[PULL_FAILED + 1] = { 0 };
+  repo_emitter_t *emitter = NULL;
+  repo_pool_t *checkouts = NULL;
+  repo_history_t *history;
+  repo_sched_t *sched;
+  pull_job_t **jobs;
+  int length = 0, skipped;
+  double start, elapsed;
+  FILE *summary;
+
+  if (!dir) {
+    repo_ferror("path does not exist '%s'", repo->path);
+  }
+
+  if (!(history = repo_history_load(repo)) || !(jobs = calloc(dir->length + 1, sizeof(pull_job_t *)))) {
+    repo_error("pull: out of memory");
+    repo_history_free(history);
+    repo_dir_free(dir);
+    return -1;
+  }
+
+  if (!(sched = repo_sched_new(opts->jobs, opts->per_host > 0 ? opts->per_host : PULL_PER_HOST))
+      || !(checkouts = repo_pool_new(opts->checkouts > 0 ? opts->checkouts : PULL_CHECKOUTS))) {
+    repo_error("pull: failed to start worker threads");
+    if (sched) repo_sched_free(sched);
+    repo_history_free(history);
+    repo_dir_free(dir);
+    free(jobs);
+    return -1;
+  }
+
+  for (int i = 0; i < dir->length; ++i) {
+    pull_job_t *job = pull_job_new(&dir->items[i], checkouts, history);
+    if (job) jobs[length++] = job;
+  }
+
+  start = pull_now_ms();
+
+  for (int i = 0; i < length; ++i) {
+    pull_job_t *job = jobs[i];
+
+    // decided without looking at the upstream
+    if (PULL_PENDING != job->state) continue;
+
+    if (!job->fetch) {
+      if (0 != repo_pool_push(checkouts, pull_checkout, job)) pull_checkout(job);
+    } else if (0 != repo_sched_add(sched, job->fetch->host
+          , repo_history_predict(history, job->fetch->key), pull_fetch, job)) {
+      pull_fetch(job);
+    }
+  }
+
+  repo_sched_start(sched);
+
+  // every fetch has handed its repository to the checkout stage
+  // by the time the scheduler drains
+  repo_sched_wait(sched);
+  repo_sched_free(sched);
+  repo_pool_wait(checkouts);
+  repo_pool_free(checkouts);
+  elapsed = pull_now_ms() - start;
+
+  if (REPO_OUTPUT_TEXT != output) {
+    emitter = repo_emitter_new(output, STDOUT_FILENO);
+    assert(emitter);
+  }
+
+  for (int i = 0; i < length; ++i) {
+    pull_job_t *job = jobs[i];
+
+    if (job->fetch) repo_fetch_record(history, job->fetch);
+    if (PULL_PENDING == job->state) job->state = PULL_FAILED;
+    counts[job->state]++;
+
+    if (emitter) pull_emit(emitter, job);
+    else pull_print(job);
+  }
+
+  repo_emitter_free(emitter);
+
+  skipped = counts[PULL_DIRTY] + counts[PULL_BUSY] + counts[PULL_DIVERGED]
+    + counts[PULL_NO_UPSTREAM] + counts[PULL_DETACHED];
+
+  summary = emitter ? stderr : stdout;
+  fprintf(summary, "repo: pull: %d repositories in %.1fs, %d fast-forwarded, %d up to date"
+      , length, elapsed / 1000.0, counts[PULL_UPDATED], counts[PULL_CURRENT] + counts[PULL_AHEAD]);
+  if (skipped) {
+    fprintf(summary, ", %d skipped (%d dirty, %d diverged, %d other)"
+        , skipped, counts[PULL_DIRTY], counts[PULL_DIVERGED]
+        , skipped - counts[PULL_DIRTY] - counts[PULL_DIVERGED]);
+  }
+  if (counts[PULL_FAILED]) fprintf(summary, ", %d failed", counts[PULL_FAILED]);
+  fprintf(summary, "\n");
+
+  if (0 != repo_history_save(history)) {
+    fprintf(stderr, "repo: pull: failed to save job history: %s\n", strerror(errno));
+  }
+
+  for (int i = 0; i < length; ++i) {
+    repo_fetch_job_free(jobs[i]->fetch);
+    free(jobs[i]);
+  }
+
+  free(jobs);
+  repo_history_free(history);
+  repo_dir_free(dir);
+  return counts[PULL_FAILED];
+}
+
+
+static void
+on_jobs (command_t *self) {
+  pull_opts.jobs = atoi(self->arg);
+}
+
+
+static void
+on_per_host (command_t *self) {
+  pull_opts.per_host = atoi(self->arg);
+}
+
+
+static void
+on_checkouts (command_t *self) {
+  pull_opts.checkouts = atoi(self->arg);
+}
+
+
+static void
+on_ff_only (command_t *self) {
+  pull_opts.ff_only = true;
+}
+
+
+void
+repo_cmd_pull (repo_session_t *sess) {
+  int failed;
+
+  pull_opts.jobs = 0;
+  pull_opts.per_host = PULL_PER_HOST;
+  pull_opts.checkouts = PULL_CHECKOUTS;
+  pull_opts.ff_only = false;
+
+  command_option(&sess->program, "-F", "--ff-only", "Only fast-forward, skip repositories that diverged", on_ff_only);
+  command_option(&sess->program, "-j", "--jobs <n>", "Number of fetches run in parallel", on_jobs);
+  command_option(&sess->program, "-p", "--per-host <n>", "Most fetches run against one host at once", on_per_host);
+  command_option(&sess->program, "-c", "--checkouts <n>", "Number of checkouts run in parallel", on_checkouts);
+
+  if (sess->argc > 1) {
+    if (repo_cmd_needs_help(sess)) {
+      repo_help(sess, false);
+      exit(0);
+    }
+
+    repo_session_start(sess);
+  }
+
+  // merging is left to the user, say so rather than guess
+  if (!pull_opts.ff_only) {
+    repo_ferror("pull: only fast-forward pulls are supported, pass --ff-only");
+  }
+
+  failed = repo_pull_all(sess->user->repo, sess->output, &pull_opts);
+
+  repo_session_free(sess);
+  exit(0 == failed ? 0 : 1);
+}
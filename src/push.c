@@ -0,0 +1,453 @@
+
+#include <assert.h>
+#include <repo.h>
+
+/**
+ * `repo push` pushes the checked out branch of every repository
+ * that has commits its upstream lacks. Candidates are found on
+ * the calling thread by comparing the branch's tip with its
+ * remote tracking ref, which reads two refs and walks nothing.
+ * Only the repositories whose tips differ are handed to the
+ * scheduler, which counts commits ahead and behind and pushes
+ * with at most `--per-host` pushes to one host at a time.
+ * `--dry-run` stops after counting.
+ */
+
+#define PUSH_PER_HOST 4
+
+typedef enum {
+  PUSH_PENDING,
+  PUSH_PUSHED,
+  PUSH_AHEAD,
+  PUSH_CURRENT,
+  PUSH_BEHIND,
+  PUSH_DIVERGED,
+  PUSH_NO_UPSTREAM,
+  PUSH_DETACHED,
+  PUSH_REJECTED,
+  PUSH_FAILED
+} push_state_t;
+
+static const char *push_states[] = {
+  "pending", "pushed", "ahead", "current", "behind", "diverged",
+  "no-upstream", "detached", "rejected", "failed"
+};
+
+typedef struct push_job {
+  repo_dir_item_t *item;
+  char branch[256];
+  char upstream[256];
+  char remote[256];
+  char dest[256];
+  char host[256];
+  push_state_t state;
+  git_oid local;
+  git_oid tracking;
+  size_t ahead;
+  size_t behind;
+  double ms;
+  bool dry_run;
+  bool needs_auth;
+  char error[160];
+} push_job_t;
+
+static repo_push_opts_t push_opts;
+
+
+static double
+push_now_ms () {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+
+static void
+push_fail (push_job_t *job, const char *stage) {
+  const git_error *err = giterr_last();
+
+  job->state = PUSH_FAILED;
+  snprintf(job->error, sizeof(job->error), "%s: %s", stage, job->needs_auth
+      ? "authentication required"
+      : err ? err->message : "unknown error");
+}
+
+
+static int
+on_cred_acquire (git_cred **out, const char *url, const char *username_from_url,
+                 unsigned int allowed_types, void *payload) {
+  // nobody is there to answer a prompt
+  ((push_job_t *) payload)->needs_auth = true;
+  return -1;
+}
+
+
+static int
+on_status (const char *ref, const char *msg, void *data) {
+  push_job_t *job = (push_job_t *) data;
+
+  if (msg) {
+    job->state = PUSH_REJECTED;
+    snprintf(job->error, sizeof(job->error), "%s rejected: %s", ref, msg);
+  }
+
+  return 0;
+}
+
+
+static void
+push_run (void *data) {
+  push_job_t *job = (push_job_t *) data;
+  repo_handles_t *handles = repo_handles_default();
+  repo_handle_t *handle = NULL;
+  git_remote *remote = NULL;
+  git_push *push = NULL;
+  char refspec[sizeof(job->branch) + sizeof(job->dest) + 1];
+  double start = push_now_ms();
+
+  REPO_TRACE_BEGIN("push", job->item->name);
+
+  if (0 != repo_handles_get(handles, job->item->path, &handle)
+      || 0 != git_graph_ahead_behind(&job->ahead, &job->behind, handle->repo, &job->local, &job->tracking)) {
+    push_fail(job, "count");
+    goto cleanup;
+  }
+
+  if (job->ahead > 0 && job->behind > 0) {
+    job->state = PUSH_DIVERGED;
+    goto cleanup;
+  }
+
+  if (0 == job->ahead) {
+    job->state = job->behind ? PUSH_BEHIND : PUSH_CURRENT;
+    goto cleanup;
+  }
+
+  if (job->dry_run) {
+    job->state = PUSH_AHEAD;
+    goto cleanup;
+  }
+
+  snprintf(refspec, sizeof(refspec), "%s:%s", job->branch, job->dest);
+
+  if (0 != git_remote_load(&remote, handle->repo, job->remote)) {
+    push_fail(job, "push");
+    goto cleanup;
+  }
+
+  git_remote_set_cred_acquire_cb(remote, on_cred_acquire, job);
+
+  if (0 != git_push_new(&push, remote)
+      || 0 != git_push_add_refspec(push, refspec)
+      || 0 != git_push_finish(push)) {
+    push_fail(job, "push");
+    goto cleanup;
+  }
+
+  if (!git_push_unpack_ok(push)) {
+    job->state = PUSH_REJECTED;
+    snprintf(job->error, sizeof(job->error), "remote failed to unpack");
+    goto cleanup;
+  }
+
+  job->state = PUSH_PUSHED;
+  git_push_status_foreach(push, on_status, job);
+
+  // move the remote tracking ref along, as git does
+  if (PUSH_PUSHED == job->state && 0 != git_push_update_tips(push)) {
+    push_fail(job, "update tips");
+  }
+
+cleanup:
+  git_push_free(push);
+  if (remote) {
+    git_remote_disconnect(remote);
+    git_remote_free(remote);
+  }
+
+  repo_handles_put(handles, handle);
+  REPO_TRACE_END("push");
+  job->ms = push_now_ms() - start;
+}
+
+/**
+ * Reads the branch of `item`, its upstream, and the branch that
+ * upstream tracks on the remote. Returns NULL for repositories
+ * with no branch to push.
+ */
+
+static push_job_t *
+push_job_new (repo_dir_item_t *item, bool dry_run) {
+  repo_handles_t *handles = repo_handles_default();
+  repo_handle_t *handle = NULL;
+  git_reference *head = NULL;
+  git_config *config = NULL;
+  git_remote *remote = NULL;
+  const char *merge = NULL;
+  char key[300];
+  push_job_t *job;
+
+  if (!repo_dir_item_is_git_repo(item) || repo_dir_item_is_bare(item) || repo_dir_item_is_orphan(item))
+    return NULL;
+
+  if (!(job = calloc(1, sizeof(push_job_t))))
+    return NULL;
+
+  job->item = item;
+  job->dry_run = dry_run;
+
+  if (0 != repo_handles_get(handles, item->path, &handle)) {
+    push_fail(job, "open");
+    return job;
+  }
+
+  if (0 != git_repository_head(&head, handle->repo)) {
+    push_fail(job, "head");
+    goto done;
+  }
+
+  if (!git_reference_is_branch(head)) {
+    job->state = PUSH_DETACHED;
+    goto done;
+  }
+
+  snprintf(job->branch, sizeof(job->branch), "%s", git_reference_name(head));
+  git_oid_cpy(&job->local, git_reference_target(head));
+
+  if (0 > git_branch_upstream_name(job->upstream, sizeof(job->upstream), handle->repo, job->branch)
+      || 0 > git_branch_remote_name(job->remote, sizeof(job->remote), handle->repo, job->upstream)) {
+    // no upstream, or one that is a local branch
+    giterr_clear();
+    job->state = PUSH_NO_UPSTREAM;
+    goto done;
+  }
+
+  if (0 != git_reference_name_to_id(&job->tracking, handle->repo, job->upstream)) {
+    push_fail(job, "upstream");
+    goto done;
+  }
+
+  if (git_oid_equal(&job->local, &job->tracking)) {
+    job->state = PUSH_CURRENT;
+    goto done;
+  }
+
+  // `branch.<name>.merge` names the branch on the remote
+  snprintf(key, sizeof(key), "branch.%s.merge", job->branch + strlen("refs/heads/"));
+
+  if (0 != git_repository_config(&config, handle->repo)
+      || 0 != git_config_get_string(&merge, config, key)) {
+    push_fail(job, "config");
+    goto done;
+  }
+
+  snprintf(job->dest, sizeof(job->dest), "%s", merge);
+
+  if (0 != git_remote_load(&remote, handle->repo, job->remote) || !git_remote_url(remote)
+      || 0 != repo_remote_host(git_remote_url(remote), job->host, sizeof(job->host))) {
+    // let the push report why the remote can't be used
+    snprintf(job->host, sizeof(job->host), "%s", "unknown");
+  }
+
+done:
+  if (remote) git_remote_free(remote);
+  git_config_free(config);
+  git_reference_free(head);
+  repo_handles_put(handles, handle);
+  return job;
+}
+
+
+static const char *
+short_name (const char *ref) {
+  if (0 == strncmp(ref, "refs/remotes/", 13)) return ref + 13;
+  if (0 == strncmp(ref, "refs/heads/", 11)) return ref + 11;
+  return ref;
+}
+
+
+static void
+push_print (push_job_t *job) {
+  const char *name = job->item->name;
+  const char *upstream = short_name(job->upstream);
+
+  switch (job->state) {
+    case PUSH_PUSHED:
+      printf(" %s: pushed %zu commits to %s\n", name, job->ahead, upstream);
+      break;
+    case PUSH_AHEAD:
+      printf(" %s: would push %zu commits to %s\n", name, job->ahead, upstream);
+      break;
+    case PUSH_CURRENT:
+      // the common case, left to the summary
+      break;
+    case PUSH_BEHIND:
+      printf(" %s: %zu behind %s, nothing to push\n", name, job->behind, upstream);
+      break;
+    case PUSH_DIVERGED:
+      printf(" %s: skipped, diverged from %s (%zu ahead, %zu behind)\n"
+          , name, upstream, job->ahead, job->behind);
+      break;
+    case PUSH_NO_UPSTREAM:
+      printf(" %s: skipped, %s has no upstream\n", name, short_name(job->branch));
+      break;
+    case PUSH_DETACHED:
+      printf(" %s: skipped, detached HEAD\n", name);
+      break;
+    case PUSH_PENDING:
+    case PUSH_REJECTED:
+    case PUSH_FAILED:
+      printf(" %s failed: %s\n", name, job->error[0] ? job->error : "not run");
+      break;
+  }
+}
+
+
+static void
+push_emit (repo_emitter_t *emitter, push_job_t *job) {
+  repo_emitter_begin(emitter);
+  repo_emitter_str(emitter, "name", job->item->name);
+  repo_emitter_str(emitter, "path", job->item->path);
+  repo_emitter_str(emitter, "branch", job->branch[0] ? short_name(job->branch) : NULL);
+  repo_emitter_str(emitter, "upstream", job->upstream[0] ? short_name(job->upstream) : NULL);
+  repo_emitter_str(emitter, "host", job->host[0] ? job->host : NULL);
+  repo_emitter_str(emitter, "status", push_states[job->state]);
+  repo_emitter_str(emitter, "error", job->error[0] ? job->error : NULL);
+  repo_emitter_int(emitter, "ahead", job->ahead);
+  repo_emitter_int(emitter, "behind", job->behind);
+  repo_emitter_float(emitter, "ms", job->ms);
+  repo_emitter_end(emitter);
+}
+
+/**
+ * Pushes the branch of every repository under `repo` that is
+ * ahead of its upstream and prints the results. Returns the
+ * number of failed pushes, or -1 if none could be started.
+ */
+
+int
+repo_push_all (repo_t *repo, repo_output_t output, repo_push_opts_t *opts) {
+  repo_dir_t *dir = repo_dir_new(repo->path);
+  int counts[PUSH_FAILED + 1] = { 0 };
+  repo_emitter_t *emitter = NULL;
+  repo_sched_t *sched;
+  push_job_t **jobs;
+  int length = 0, failed;
+  double start, elapsed;
+  FILE *summary;
+
+  if (!dir) {
+    repo_ferror("path does not exist '%s'", repo->path);
+  }
+
+  if (!(jobs = calloc(dir->length + 1, sizeof(push_job_t *)))) {
+    repo_error("push: out of memory");
+    repo_dir_free(dir);
+    return -1;
+  }
+
+  if (!(sched = repo_sched_new(opts->jobs, opts->per_host > 0 ? opts->per_host : PUSH_PER_HOST))) {
+    repo_error("push: failed to start worker threads");
+    repo_dir_free(dir);
+    free(jobs);
+    return -1;
+  }
+
+  start = push_now_ms();
+
+  for (int i = 0; i < dir->length; ++i) {
+    push_job_t *job = push_job_new(&dir->items[i], opts->dry_run);
+
+    if (!job) continue;
+    jobs[length++] = job;
+
+    if (PUSH_PENDING != job->state) continue;
+    if (0 != repo_sched_push(sched, job->host, push_run, job)) push_run(job);
+  }
+
+  repo_sched_wait(sched);
+  repo_sched_free(sched);
+  elapsed = push_now_ms() - start;
+
+  if (REPO_OUTPUT_TEXT != output) {
+    emitter = repo_emitter_new(output, STDOUT_FILENO);
+    assert(emitter);
+  }
+
+  for (int i = 0; i < length; ++i) {
+    push_job_t *job = jobs[i];
+
+    if (PUSH_PENDING == job->state) job->state = PUSH_FAILED;
+    counts[job->state]++;
+
+    if (emitter) push_emit(emitter, job);
+    else push_print(job);
+  }
+
+  repo_emitter_free(emitter);
+
+  failed = counts[PUSH_REJECTED] + counts[PUSH_FAILED];
+
+  summary = emitter ? stderr : stdout;
+  fprintf(summary, "repo: push: %d repositories in %.1fs", length, elapsed / 1000.0);
+  if (opts->dry_run) fprintf(summary, ", %d would be pushed", counts[PUSH_AHEAD]);
+  else fprintf(summary, ", %d pushed", counts[PUSH_PUSHED]);
+  if (counts[PUSH_DIVERGED]) fprintf(summary, ", %d diverged", counts[PUSH_DIVERGED]);
+  if (counts[PUSH_NO_UPSTREAM]) fprintf(summary, ", %d without upstream", counts[PUSH_NO_UPSTREAM]);
+  if (failed) fprintf(summary, ", %d failed", failed);
+  fprintf(summary, "\n");
+
+  for (int i = 0; i < length; ++i) {
+    free(jobs[i]);
+  }
+
+  free(jobs);
+  repo_dir_free(dir);
+  return failed;
+}
+
+
+static void
+on_jobs (command_t *self) {
+  push_opts.jobs = atoi(self->arg);
+}
+
+
+static void
+on_per_host (command_t *self) {
+  push_opts.per_host = atoi(self->arg);
+}
+
+
+static void
+on_dry_run (command_t *self) {
+  push_opts.dry_run = true;
+}
+
+
+void
+repo_cmd_push (repo_session_t *sess) {
+  int failed;
+
+  push_opts.jobs = 0;
+  push_opts.per_host = PUSH_PER_HOST;
+  push_opts.dry_run = false;
+
+  command_option(&sess->program, "-j", "--jobs <n>", "Number of pushes run in parallel", on_jobs);
+  command_option(&sess->program, "-p", "--per-host <n>", "Most pushes run against one host at once", on_per_host);
+  command_option(&sess->program, "-n", "--dry-run", "List what would be pushed without pushing", on_dry_run);
+
+  if (sess->argc > 1) {
+    if (repo_cmd_needs_help(sess)) {
+      repo_help(sess, false);
+      exit(0);
+    }
+
+    repo_session_start(sess);
+  }
+
+  failed = repo_push_all(sess->user->repo, sess->output, &push_opts);
+
+  repo_session_free(sess);
+  exit(0 == failed ? 0 : 1);
+}
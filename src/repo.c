@@ -9,6 +9,18 @@ repo_help_commands () {
   out("commands:");
   out("   ls           List all git repositories");
   out("   clone <url>  Clone a repo into your repos path");
+  out("   log          Show commits across all repositories, newest first");
+  out("   which <oid>  Find the repositories containing a commit");
+  out("   status       Summarise the working tree of every repository");
+  out("   fetch        Fetch every remote of every repository");
+  out("   pull         Fast-forward every repository to its upstream");
+  out("   push         Push every branch that is ahead of its upstream");
+  out("   maintain     Pack refs and objects and write commit-graphs");
+  out("   fsck         Verify objects and connectivity of every repository");
+  out("   du           Show the disk space each repository takes");
+  out("   clean        Remove ignored files from every repository");
+  out("   stats        Count files, bytes and languages at every HEAD");
+  out("   dupes        Find files with the same content across repositories");
 }
 
 
@@ -101,7 +113,11 @@ repo_dir_new (char *path) {
   if (!(dir_ = opendir(path)))
     return NULL;
 
+  REPO_TRACE_BEGIN("readdir", NULL);
+
   dir->length = 0;
+  dir->alloc = 0;
+  dir->items = NULL;
   dir->path = path;
 
   while ((fd = readdir(dir_))) {
@@ -110,39 +126,147 @@ repo_dir_new (char *path) {
   }
   
   closedir(dir_);
+  REPO_TRACE_END("readdir");
   
   return dir;
 }
 
 
+void
+repo_dir_free (repo_dir_t *dir) {
+  for (int i = 0; i < dir->length; ++i) {
+    free(dir->items[i].name);
+    free(dir->items[i].path);
+    free((char *) dir->items[i].git_branch);
+  }
+
+  free(dir->items);
+  free(dir);
+}
+
+
 
 repo_dir_item_t *
 repo_dir_item_new (char *root, struct dirent *fd, repo_dir_t *dir) {
+  if (dir->length == dir->alloc) {
+    int alloc = dir->alloc ? dir->alloc * 2 : 64;
+    repo_dir_item_t *items = realloc(dir->items, alloc * sizeof(repo_dir_item_t));
+    if (!items) return NULL;
+    dir->items = items;
+    dir->alloc = alloc;
+  }
+
   int i = dir->length++;
   repo_dir_item_t *item = &dir->items[i];
-  if (!item) return NULL;
-  
-  char *name = malloc(REPO_NAME_MAX * sizeof(char *));
-  sprintf(name, "%s", fd->d_name);
-  
-  char *path = malloc(REPO_PATH_MAX * sizeof(char *));
+  size_t root_len = strlen(root), name_len = strlen(fd->d_name);
+
+  char *name = malloc(name_len + 1);
+  memcpy(name, fd->d_name, name_len + 1);
+
+  char *path = malloc(root_len + name_len + 2);
   sprintf(path, "%s/%s", root, fd->d_name);
 
-  item->fd_ = fd;
-  item->ino = (int)fd->d_ino;
+  // `fd` is only valid until the next readdir()
+  item->fd_ = NULL;
+  item->ino = fd->d_ino;
   item->name = name;
   item->path = path;
+  item->loaded = 0;
   item->is_git_repo = false;
+  item->is_git_orphan = false;
+  item->is_bare = false;
+  item->git_branch = NULL;
 
-  if (true == repo_is_git_repo(item)) {
-    repo_git_init(item);
-  }
+  // everything else is computed on demand
 
   assert((int) strlen(item->name) == (int) strlen(fd->d_name));
 
   return item;
 }
 
+static const struct {
+  const char *name;
+  int cost;
+} repo_fields[REPO_FIELD_COUNT] = {
+  [REPO_FIELD_NAME]   = { "name",   0 },
+  [REPO_FIELD_PATH]   = { "path",   0 },
+  [REPO_FIELD_INO]    = { "ino",    0 },
+  [REPO_FIELD_GIT]    = { "git",    1 },
+  [REPO_FIELD_BRANCH] = { "branch", 2 },
+  [REPO_FIELD_BARE]   = { "bare",   2 },
+  [REPO_FIELD_ORPHAN] = { "orphan", 2 },
+};
+
+/**
+ * Returns the `repo_field_t` named by the first `len` bytes
+ * of `name` or -1
+ */
+
+int
+repo_field_lookup (const char *name, size_t len) {
+  for (int f = 0; f < REPO_FIELD_COUNT; ++f) {
+    if (strlen(repo_fields[f].name) == len && 0 == strncmp(name, repo_fields[f].name, len))
+      return f;
+  }
+
+  return -1;
+}
+
+/**
+ * Relative cost of computing `field`: 0 is free, 1 needs a
+ * stat, 2 needs the repository opened
+ */
+
+int
+repo_field_cost (repo_field_t field) {
+  return repo_fields[field].cost;
+}
+
+
+bool
+repo_dir_item_is_git_repo (repo_dir_item_t *item) {
+  if (!(item->loaded & REPO_ITEM_GIT)) {
+    item->is_git_repo = repo_is_git_repo(item);
+    item->loaded |= REPO_ITEM_GIT;
+  }
+
+  return item->is_git_repo;
+}
+
+
+void
+repo_dir_item_load (repo_dir_item_t *item) {
+  if (item->loaded & REPO_ITEM_OPEN)
+    return;
+
+  if (repo_dir_item_is_git_repo(item)) {
+    repo_git_init(item);
+  }
+
+  item->loaded |= REPO_ITEM_OPEN;
+}
+
+
+const char *
+repo_dir_item_branch (repo_dir_item_t *item) {
+  repo_dir_item_load(item);
+  return item->git_branch;
+}
+
+
+bool
+repo_dir_item_is_bare (repo_dir_item_t *item) {
+  repo_dir_item_load(item);
+  return item->is_bare;
+}
+
+
+bool
+repo_dir_item_is_orphan (repo_dir_item_t *item) {
+  repo_dir_item_load(item);
+  return item->is_git_orphan;
+}
+
 bool
 repo_is_dir (char *path) {
   struct stat s;
@@ -153,6 +277,23 @@ repo_is_dir (char *path) {
   else return false;
 }
 
+/**
+ * Writes the path of cache file `name` kept under the
+ * root's `.repo` directory into `out`, creating the
+ * directory if needed.
+ */
+
+int
+repo_cache_path (repo_t *repo, const char *name, char *out, size_t size) {
+  snprintf(out, size, "%s/.repo", repo->path);
+
+  if (!repo_is_dir(out) && 0 != mkdir(out, 0755) && EEXIST != errno)
+    return -1;
+
+  snprintf(out, size, "%s/.repo/%s", repo->path, name);
+  return 0;
+}
+
 // commands
 void
 repo_cmd_parse (repo_session_t *sess) {
@@ -228,6 +369,26 @@ repo_cmd_has_flag (const char *flag) {
 }
 
 
+/**
+ * Returns the `n`th positional argument following the
+ * command name `cmd` once the session has been started
+ */
+
+const char *
+repo_cmd_positional (repo_session_t *sess, const char *cmd, int n) {
+  command_t *program = &sess->program;
+  int start = 0;
+
+  if (program->argc > 0 && 0 == strcmp(cmd, program->argv[0]))
+    start = 1;
+
+  if (start + n < program->argc)
+    return program->argv[start + n];
+
+  return NULL;
+}
+
+
 char *
 repo_str_replace (char str[], 
                   const char *search, 
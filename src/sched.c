@@ -0,0 +1,291 @@
+
+#include <assert.h>
+#include <repo.h>
+
+/**
+ * Runs jobs on a worker pool while keeping at most `limit` of
+ * the jobs sharing a group key in flight, so bulk network
+ * operations never open more than `limit` connections to one
+ * host. Jobs of a group that is at its limit wait in that
+ * group's queue and are handed to the pool as earlier ones
+ * finish; other groups keep the workers busy meanwhile.
+ *
+ * Jobs added with a predicted cost through `repo_sched_add()`
+ * are held back until `repo_sched_start()`, which hands them
+ * out longest first. A long job that starts last stretches the
+ * whole run; longest processing time first keeps the makespan
+ * within 4/3 of the optimum.
+ */
+
+struct repo_sched_job {
+  repo_sched_t *sched;
+  repo_sched_group_t *group;
+  repo_pool_job_cb fn;
+  void *data;
+  double cost;
+  int order;
+  repo_sched_job_t *next;
+};
+
+
+static void sched_run (void *data);
+
+
+static repo_sched_group_t *
+sched_group (repo_sched_t *sched, const char *key) {
+  repo_sched_group_t *group;
+
+  for (group = sched->groups; group; group = group->next) {
+    if (0 == strcmp(group->key, key)) return group;
+  }
+
+  if (!(group = calloc(1, sizeof(repo_sched_group_t))))
+    return NULL;
+
+  if (!(group->key = strdup(key))) {
+    free(group);
+    return NULL;
+  }
+
+  group->next = sched->groups;
+  sched->groups = group;
+  sched->length++;
+  return group;
+}
+
+// called with `sched->lock` held
+
+static int
+sched_dispatch (repo_sched_t *sched, repo_sched_job_t *job) {
+  job->group->active++;
+
+  if (0 != repo_pool_push(sched->pool, sched_run, job)) {
+    job->group->active--;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+static void
+sched_run (void *data) {
+  repo_sched_job_t *job = (repo_sched_job_t *) data;
+  repo_sched_t *sched = job->sched;
+  repo_sched_group_t *group = job->group;
+  repo_sched_job_t *next;
+
+  job->fn(job->data);
+  free(job);
+
+  // queue the group's next job before this one counts as done,
+  // so `repo_pool_wait()` can't see the pool drained in between
+  pthread_mutex_lock(&sched->lock);
+  group->active--;
+
+  while ((next = group->head)) {
+    if (!(group->head = next->next)) group->tail = NULL;
+    if (0 == sched_dispatch(sched, next)) break;
+
+    // out of memory, run it here rather than lose it
+    group->active++;
+    pthread_mutex_unlock(&sched->lock);
+    next->fn(next->data);
+    free(next);
+    pthread_mutex_lock(&sched->lock);
+    group->active--;
+  }
+
+  pthread_mutex_unlock(&sched->lock);
+}
+
+
+repo_sched_t *
+repo_sched_new (int jobs, int limit) {
+  repo_sched_t *sched;
+
+  if (!(sched = calloc(1, sizeof(repo_sched_t))))
+    return NULL;
+
+  if (!(sched->pool = repo_pool_new(jobs))) {
+    free(sched);
+    return NULL;
+  }
+
+  sched->limit = limit > 0 ? limit : sched->pool->size;
+  pthread_mutex_init(&sched->lock, NULL);
+  return sched;
+}
+
+// called with `sched->lock` held
+
+static int
+sched_enqueue (repo_sched_t *sched, repo_sched_job_t *job, const char *key) {
+  repo_sched_group_t *group;
+
+  if (!(group = sched_group(sched, key)))
+    return -1;
+
+  job->group = group;
+
+  if (group->active < sched->limit)
+    return sched_dispatch(sched, job);
+
+  if (group->tail) group->tail->next = job;
+  else group->head = job;
+  group->tail = job;
+  return 0;
+}
+
+
+static repo_sched_job_t *
+sched_job_new (repo_sched_t *sched, repo_pool_job_cb fn, void *data, double cost) {
+  repo_sched_job_t *job;
+
+  if (!(job = calloc(1, sizeof(repo_sched_job_t))))
+    return NULL;
+
+  job->sched = sched;
+  job->fn = fn;
+  job->data = data;
+  job->cost = cost;
+  return job;
+}
+
+/**
+ * Schedules `fn(data)` in group `key` right away. Jobs of one
+ * group start in the order they were pushed.
+ */
+
+int
+repo_sched_push (repo_sched_t *sched, const char *key, repo_pool_job_cb fn, void *data) {
+  repo_sched_job_t *job;
+  int rc;
+
+  if (!(job = sched_job_new(sched, fn, data, 0)))
+    return -1;
+
+  pthread_mutex_lock(&sched->lock);
+  rc = sched_enqueue(sched, job, key);
+  pthread_mutex_unlock(&sched->lock);
+
+  if (0 != rc) free(job);
+  return rc;
+}
+
+/**
+ * Holds `fn(data)` in group `key`, predicted to take `cost`,
+ * until `repo_sched_start()`
+ */
+
+int
+repo_sched_add (repo_sched_t *sched, const char *key, double cost, repo_pool_job_cb fn, void *data) {
+  repo_sched_job_t *job;
+
+  if (sched->pending_length == sched->pending_alloc) {
+    int alloc = sched->pending_alloc ? sched->pending_alloc * 2 : 64;
+    repo_sched_job_t **pending = realloc(sched->pending, alloc * sizeof(repo_sched_job_t *));
+    if (!pending) return -1;
+    sched->pending = pending;
+    sched->pending_alloc = alloc;
+  }
+
+  if (!(job = sched_job_new(sched, fn, data, cost)))
+    return -1;
+
+  pthread_mutex_lock(&sched->lock);
+  job->group = sched_group(sched, key);
+  pthread_mutex_unlock(&sched->lock);
+
+  if (!job->group) {
+    free(job);
+    return -1;
+  }
+
+  job->order = sched->pending_length;
+  sched->pending[sched->pending_length++] = job;
+  return 0;
+}
+
+
+static int
+cost_cmp (const void *a, const void *b) {
+  const repo_sched_job_t *x = *(repo_sched_job_t * const *) a;
+  const repo_sched_job_t *y = *(repo_sched_job_t * const *) b;
+
+  if (x->cost != y->cost) return x->cost > y->cost ? -1 : 1;
+  return x->order - y->order;
+}
+
+/**
+ * Dispatches every held job, longest first, and returns the
+ * makespan that predicts on the pool's workers, leaving out
+ * per group limits
+ */
+
+double
+repo_sched_start (repo_sched_t *sched) {
+  int workers = sched->pool->size;
+  double *loads, makespan = 0;
+
+  qsort(sched->pending, sched->pending_length, sizeof(repo_sched_job_t *), cost_cmp);
+
+  // each job goes to whichever worker frees up first
+  if ((loads = calloc(workers, sizeof(double)))) {
+    for (int i = 0; i < sched->pending_length; ++i) {
+      int least = 0;
+      for (int w = 1; w < workers; ++w) {
+        if (loads[w] < loads[least]) least = w;
+      }
+      loads[least] += sched->pending[i]->cost;
+      if (loads[least] > makespan) makespan = loads[least];
+    }
+    free(loads);
+  }
+
+  for (int i = 0; i < sched->pending_length; ++i) {
+    repo_sched_job_t *job = sched->pending[i];
+    int rc;
+
+    pthread_mutex_lock(&sched->lock);
+    rc = sched_enqueue(sched, job, job->group->key);
+    pthread_mutex_unlock(&sched->lock);
+
+    if (0 != rc) {
+      job->fn(job->data);
+      free(job);
+    }
+  }
+
+  sched->pending_length = 0;
+  return makespan;
+}
+
+
+/**
+ * Blocks until every pushed job, queued ones included, ran
+ */
+
+void
+repo_sched_wait (repo_sched_t *sched) {
+  repo_pool_wait(sched->pool);
+}
+
+
+void
+repo_sched_free (repo_sched_t *sched) {
+  repo_sched_group_t *group, *next;
+
+  repo_pool_free(sched->pool);
+
+  for (group = sched->groups; group; group = next) {
+    next = group->next;
+    assert(NULL == group->head);
+    free(group->key);
+    free(group);
+  }
+
+  pthread_mutex_destroy(&sched->lock);
+  free(sched->pending);
+  free(sched);
+}
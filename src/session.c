@@ -25,11 +25,33 @@ on_set_repos_dir (command_t *self) {
 			repo_ferror("'%s' is not a valid path", path);
 		}
 
-		repo_printf("Root directory set to '%s'\n"
+		// stderr keeps --json / --ndjson output on stdout clean
+		fprintf(stderr, "repo: Root directory set to '%s'\n"
 				, sess->user->repo->path);
 	}
 }
 
+void
+on_json (command_t *self) {
+	repo_session_get_current()->output = REPO_OUTPUT_JSON;
+}
+
+void
+on_ndjson (command_t *self) {
+	repo_session_get_current()->output = REPO_OUTPUT_NDJSON;
+}
+
+// installed before libgit2 is initialised, see repo_session_init()
+void
+on_stats (command_t *self) {}
+
+void
+on_trace (command_t *self) {
+	if (0 != repo_trace_start(self->arg)) {
+		repo_ferror("--trace: failed to start tracing into '%s'", self->arg);
+	}
+}
+
 
 repo_session_t *
 repo_session_init (int argc, char *argv[]) {
@@ -37,12 +59,20 @@ repo_session_init (int argc, char *argv[]) {
 	if (NULL != current_session)
 		repo_session_free(current_session);
 
-	repo_session_t *sess = malloc(sizeof(repo_session_t));
+	repo_session_t *sess = malloc(sizeof(repo_session_t) + (argc + 1) * sizeof(char *));
 	
 	if (!sess) {
 		repo_error("Failed to initialize session");
 	}
 
+	for (int i = 1; i < argc; ++i) {
+		if (0 == strcmp("--stats", argv[i]) && 0 != repo_stats_install()) {
+			repo_error("Failed to install --stats");
+		}
+	}
+
+	git_threads_init();
+
 	repo_user_t *user = repo_user_new();
   assert(user);
 
@@ -51,6 +81,7 @@ repo_session_init (int argc, char *argv[]) {
 
   sess->user = user;
   sess->argc = argc;
+  sess->output = REPO_OUTPUT_TEXT;
 
   command_t *program = &sess->program;
 	// sess->program = program;
@@ -59,11 +90,16 @@ repo_session_init (int argc, char *argv[]) {
 	
 	// defualt options
   command_option(program, "-R", "--root [path]", "Directory that holds git repositories", on_set_repos_dir);
+  command_option(program, "-J", "--json", "Write output as a single JSON array", on_json);
+  command_option(program, "-N", "--ndjson", "Write output as newline delimited JSON records", on_ndjson);
+  command_option(program, "-S", "--stats", "Report calls per operation and memory use on exit", on_stats);
+  command_option(program, "-T", "--trace <file>", "Write a Chrome trace of where time goes to file", on_trace);
 
   // copy string
   for (int i = 0; i < argc; ++i) {
   	sess->argv[i] = argv[i];
   }
+  sess->argv[argc] = NULL;
 
   current_session = sess;
 	return sess;
@@ -79,4 +115,6 @@ void
 repo_session_free (repo_session_t *sess) {
 	// command_free(sess->program);
   repo_free(sess->user);
+  repo_handles_shutdown();
+  git_threads_shutdown();
 }
\ No newline at end of file
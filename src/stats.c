@@ -0,0 +1,109 @@
+
+#include <assert.h>
+#include <sys/resource.h>
+#include <repo.h>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+/**
+ * `--stats` reports on stderr at exit how often each kind of
+ * operation ran, along with the peak RSS of the process and, on
+ * glibc 2.33 and later, the heap in use. Each operation counts
+ * itself with `repo_stats_count()`.
+ *
+ * The libgit2 this links against calls the C library allocator
+ * directly, so memory can't be charged to single operations.
+ */
+
+bool repo_stats_enabled = false;
+
+static repo_stats_counter_t stats_counters[REPO_STATS_OP_COUNT];
+
+static const char *stats_names[REPO_STATS_OP_COUNT] = {
+  [REPO_STATS_OTHER]     = "other",
+  [REPO_STATS_OPEN]      = "open",
+  [REPO_STATS_HEAD]      = "head",
+  [REPO_STATS_STATUS]    = "status",
+  [REPO_STATS_CLONE]     = "clone",
+  [REPO_STATS_WALK]      = "walk",
+  [REPO_STATS_FETCH]     = "fetch",
+  [REPO_STATS_CHECKOUT]  = "checkout",
+  [REPO_STATS_FSCK]      = "fsck",
+};
+
+
+/**
+ * Turns counting on and registers the report
+ */
+
+int
+repo_stats_install () {
+  if (repo_stats_enabled)
+    return 0;
+
+  if (0 != atexit(repo_stats_report))
+    return -1;
+
+  repo_stats_enabled = true;
+  return 0;
+}
+
+/**
+ * Counts one call of `op`
+ */
+
+void
+repo_stats_count (repo_stats_op_t op) {
+  if (repo_stats_enabled) {
+    __atomic_add_fetch(&stats_counters[op].calls, 1, __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * Copies the counters of `op` into `out`
+ */
+
+void
+repo_stats_read (repo_stats_op_t op, repo_stats_counter_t *out) {
+  repo_stats_counter_t *c = &stats_counters[op];
+
+  out->calls = __atomic_load_n(&c->calls, __ATOMIC_RELAXED);
+}
+
+
+void
+repo_stats_report () {
+  repo_stats_counter_t c;
+  struct rusage usage;
+
+  if (!repo_stats_enabled)
+    return;
+
+  fprintf(stderr, "repo: stats:\n");
+  fprintf(stderr, "  %-8s %10s\n", "op", "calls");
+
+  for (int op = 0; op < REPO_STATS_OP_COUNT; ++op) {
+    repo_stats_read(op, &c);
+
+    if (0 == c.calls) continue;
+    fprintf(stderr, "  %-8s %10zu\n", stats_names[op], c.calls);
+  }
+
+  // mallinfo2() is glibc 2.33 and later, other C libraries only get the peak
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 33)
+  fprintf(stderr, "  heap in use: %zu bytes\n", mallinfo2().uordblks);
+#endif
+#endif
+
+  // ru_maxrss is in bytes on macOS and kilobytes elsewhere
+  if (0 == getrusage(RUSAGE_SELF, &usage)) {
+#if defined(__APPLE__)
+    fprintf(stderr, "  peak rss: %ld kB\n", usage.ru_maxrss / 1024);
+#else
+    fprintf(stderr, "  peak rss: %ld kB\n", usage.ru_maxrss);
+#endif
+  }
+}
@@ -0,0 +1,260 @@
+
+#include <assert.h>
+#include <repo.h>
+
+/**
+ * `repo status` summarises the working tree of every repository.
+ * Status walks run on the worker pool; results are printed in
+ * directory order once all of them are in.
+ */
+
+static int status_jobs = 0;
+
+
+// libgit2 errors are per thread, so keep a copy for the report
+static void
+status_fail (repo_status_t *result) {
+  const git_error *err = giterr_last();
+  result->failed = true;
+  snprintf(result->error, sizeof(result->error), "%s", err ? err->message : "unknown error");
+}
+
+/**
+ * Opens the repository and reads its head. Returns the pinned
+ * handle for the working tree walk or NULL.
+ */
+
+static repo_handle_t *
+status_open (repo_status_t *result) {
+  repo_handle_t *handle = NULL;
+  git_repository *git_repo;
+  int error;
+
+  REPO_TRACE_BEGIN("open", result->item->name);
+  repo_stats_count(REPO_STATS_OPEN);
+  error = repo_handles_get(repo_handles_default(), result->item->path, &handle);
+  REPO_TRACE_END("open");
+
+  if (0 != error) {
+    status_fail(result);
+    return NULL;
+  }
+
+  git_repo = handle->repo;
+
+  REPO_TRACE_BEGIN("head", result->item->name);
+  repo_stats_count(REPO_STATS_HEAD);
+  error = git_repository_head(&result->head, git_repo);
+  REPO_TRACE_END("head");
+
+  if (0 == error) {
+    result->branch = git_reference_name(result->head);
+    if (!strncmp(result->branch, "refs/heads/", strlen("refs/heads/"))) {
+      result->branch += strlen("refs/heads/");
+    }
+  } else if (GIT_EORPHANEDHEAD == error) {
+    result->orphan = true;
+  }
+
+  result->bare = git_repository_is_bare(git_repo) ? true : false;
+  return handle;
+}
+
+
+static void
+status_scan (void *data) {
+  repo_handles_put(repo_handles_default(), status_open((repo_status_t *) data));
+}
+
+
+static void
+status_run (void *data) {
+  repo_status_t *result = (repo_status_t *) data;
+  git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+  repo_handles_t *handles = repo_handles_default();
+  repo_handle_t *handle;
+  git_status_list *list = NULL;
+  int error;
+
+  if (!(handle = status_open(result)))
+    return;
+
+  if (result->bare) {
+    repo_handles_put(handles, handle);
+    return;
+  }
+
+  opts.show  = GIT_STATUS_SHOW_INDEX_AND_WORKDIR;
+  opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED;
+
+  REPO_TRACE_BEGIN("status", result->item->name);
+  repo_stats_count(REPO_STATS_STATUS);
+  error = git_status_list_new(&list, handle->repo, &opts);
+  REPO_TRACE_END("status");
+
+  if (0 != error) {
+    status_fail(result);
+    repo_handles_put(handles, handle);
+    return;
+  }
+
+  for (size_t i = 0, n = git_status_list_entrycount(list); i < n; ++i) {
+    unsigned int status = git_status_byindex(list, i)->status;
+
+    if (status & (GIT_STATUS_INDEX_NEW | GIT_STATUS_INDEX_MODIFIED
+          | GIT_STATUS_INDEX_DELETED | GIT_STATUS_INDEX_RENAMED
+          | GIT_STATUS_INDEX_TYPECHANGE)) {
+      result->staged++;
+    }
+
+    if (status & (GIT_STATUS_WT_MODIFIED | GIT_STATUS_WT_DELETED
+          | GIT_STATUS_WT_TYPECHANGE)) {
+      result->modified++;
+    }
+
+    if (status & GIT_STATUS_WT_NEW) {
+      result->untracked++;
+    }
+  }
+
+  git_status_list_free(list);
+  repo_handles_put(handles, handle);
+}
+
+/**
+ * Opens every repository under `repo` on `jobs` workers and
+ * reads its head, and its working tree too when `workdir` is
+ * set. Never exits; returns NULL if the root can't be read.
+ */
+
+repo_status_list_t *
+repo_status_collect (repo_t *repo, int jobs, bool workdir) {
+  repo_status_list_t *list;
+  repo_pool_t *pool;
+
+  if (!(list = calloc(1, sizeof(repo_status_list_t))))
+    return NULL;
+
+  if (!(list->dir = repo_dir_new(repo->path))) {
+    free(list);
+    return NULL;
+  }
+
+  if (!(list->items = calloc(list->dir->length + 1, sizeof(repo_status_t)))
+      || !(pool = repo_pool_new(jobs))) {
+    repo_status_list_free(list);
+    return NULL;
+  }
+
+  for (int i = 0; i < list->dir->length; ++i) {
+    repo_dir_item_t *item = &list->dir->items[i];
+    if (!repo_dir_item_is_git_repo(item)) continue;
+    repo_status_t *result = &list->items[list->length++];
+    repo_pool_job_cb run = workdir ? status_run : status_scan;
+
+    result->item = item;
+    if (0 != repo_pool_push(pool, run, result)) run(result);
+  }
+
+  repo_pool_wait(pool);
+  repo_pool_free(pool);
+  return list;
+}
+
+
+void
+repo_status_list_free (repo_status_list_t *list) {
+  if (!list) return;
+
+  for (int i = 0; i < list->length; ++i) {
+    if (list->items[i].head) git_reference_free(list->items[i].head);
+  }
+
+  free(list->items);
+  repo_dir_free(list->dir);
+  free(list);
+}
+
+
+int
+repo_status_print (repo_t *repo, repo_output_t output, int jobs) {
+  repo_status_list_t *list;
+  repo_emitter_t *emitter = NULL;
+  int count;
+
+  if (!repo_is_dir(repo->path)) {
+    repo_ferror("path does not exist '%s'", repo->path);
+  }
+
+  if (!(list = repo_status_collect(repo, jobs, true))) {
+    repo_error("status: failed to start worker threads");
+    return -1;
+  }
+
+  if (REPO_OUTPUT_TEXT != output) {
+    emitter = repo_emitter_new(output, STDOUT_FILENO);
+    assert(emitter);
+  }
+
+  for (int i = 0; i < list->length; ++i) {
+    repo_status_t *r = &list->items[i];
+    bool clean = 0 == r->staged + r->modified + r->untracked;
+
+    if (emitter) {
+      repo_emitter_begin(emitter);
+      repo_emitter_str(emitter, "name", r->item->name);
+      repo_emitter_str(emitter, "path", r->item->path);
+      repo_emitter_str(emitter, "branch", r->branch);
+      repo_emitter_bool(emitter, "bare", r->bare);
+      repo_emitter_str(emitter, "error", r->failed ? r->error : NULL);
+      repo_emitter_bool(emitter, "clean", clean && !r->failed);
+      repo_emitter_int(emitter, "staged", r->staged);
+      repo_emitter_int(emitter, "modified", r->modified);
+      repo_emitter_int(emitter, "untracked", r->untracked);
+      repo_emitter_end(emitter);
+    } else if (r->failed) {
+      printf(" (%s) %s failed: %s\n", r->branch ? r->branch : "-", r->item->name, r->error);
+    } else if (clean) {
+      printf(" (%s) %s\n", r->branch ? r->branch : "-", r->item->name);
+    } else {
+      printf(" (%s) %s +%zu ~%zu ?%zu\n"
+        , r->branch ? r->branch : "-"
+        , r->item->name
+        , r->staged
+        , r->modified
+        , r->untracked
+      );
+    }
+  }
+
+  count = list->length;
+  repo_emitter_free(emitter);
+  repo_status_list_free(list);
+  return count;
+}
+
+
+static void
+on_jobs (command_t *self) {
+  status_jobs = atoi(self->arg);
+}
+
+
+void
+repo_cmd_status (repo_session_t *sess) {
+  command_option(&sess->program, "-j", "--jobs <n>", "Number of repositories inspected in parallel", on_jobs);
+
+  if (sess->argc > 1) {
+    if (repo_cmd_needs_help(sess)) {
+      repo_help(sess, false);
+      exit(0);
+    }
+
+    repo_session_start(sess);
+  }
+
+  repo_status_print(sess->user->repo, sess->output, status_jobs);
+
+  repo_session_free(sess);
+  exit(0);
+}
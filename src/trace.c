@@ -0,0 +1,251 @@
+
+#include <assert.h>
+#include <fcntl.h>
+#include <repo.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+/**
+ * `--trace <file>` records begin/end events of the phases
+ * commands go through and writes them as Chrome trace events
+ * (chrome://tracing, ui.perfetto.dev) when the process exits.
+ *
+ * Every thread records into a ring of its own, allocated on
+ * its first event, so recording takes no locks; the rings are
+ * linked into a list with a compare and swap and only read
+ * once the process exits. A full ring overwrites its oldest
+ * events. When tracing is off `REPO_TRACE_BEGIN()` and
+ * `REPO_TRACE_END()` cost one branch on `repo_trace_enabled`.
+ */
+
+bool repo_trace_enabled = false;
+
+static const char *trace_file = NULL;
+static repo_trace_ring_t *trace_rings = NULL;
+static struct timespec trace_epoch;
+static __thread repo_trace_ring_t *trace_ring = NULL;
+static __thread int trace_tid = 0;
+static int trace_main_tid = 0;
+static int trace_tids = 0;
+
+/**
+ * Id of the calling thread: the kernel's on Linux, so traces line
+ * up with `perf` and `top -H`, a process-wide counter elsewhere
+ */
+
+static int
+trace_self () {
+  if (0 == trace_tid) {
+#if defined(__linux__)
+    trace_tid = (int) syscall(SYS_gettid);
+#else
+    trace_tid = __atomic_add_fetch(&trace_tids, 1, __ATOMIC_RELAXED);
+#endif
+  }
+
+  return trace_tid;
+}
+
+
+static repo_trace_ring_t *
+trace_ring_new () {
+  repo_trace_ring_t *ring;
+
+  if (!(ring = calloc(1, sizeof(repo_trace_ring_t))))
+    return NULL;
+
+  ring->tid = trace_self();
+  ring->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+
+  while (!__atomic_compare_exchange_n(&trace_rings, &ring->next, ring,
+        true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  return ring;
+}
+
+/**
+ * Starts tracing into `file`, written at exit
+ */
+
+int
+repo_trace_start (const char *file) {
+  if (repo_trace_enabled)
+    return 0;
+
+  trace_file = file;
+  trace_main_tid = trace_self();
+  clock_gettime(CLOCK_MONOTONIC, &trace_epoch);
+
+  if (0 != atexit(repo_trace_flush))
+    return -1;
+
+  repo_trace_enabled = true;
+  return 0;
+}
+
+/**
+ * Records a `phase` ('B' or 'E') event of `name` on the
+ * calling thread. `name` must outlive the process, `arg` is
+ * copied and may be NULL.
+ */
+
+void
+repo_trace_event (char phase, const char *name, const char *arg) {
+  repo_trace_ring_t *ring = trace_ring;
+  repo_trace_event_t *event;
+  struct timespec now;
+  size_t head;
+
+  if (!ring && !(ring = trace_ring = trace_ring_new()))
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  event = &ring->events[head % REPO_TRACE_RING_SIZE];
+  event->ns = (now.tv_sec - trace_epoch.tv_sec) * 1000000000LL
+            + (now.tv_nsec - trace_epoch.tv_nsec);
+  event->phase = phase;
+  event->name = name;
+
+  if (arg) {
+    snprintf(event->arg, sizeof(event->arg), "%s", arg);
+  } else {
+    event->arg[0] = '\0';
+  }
+
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+static int
+on_print (void *userdata, const char *s, uint32_t length) {
+  return repo_buf_write((repo_buf_t *) userdata, s, length);
+}
+
+
+static void
+print_str (json_printer *printer, const char *key, const char *value) {
+  json_print_raw(printer, JSON_KEY, key, strlen(key));
+  json_print_raw(printer, JSON_STRING, value, strlen(value));
+}
+
+
+static void
+print_num (json_printer *printer, const char *key, const char *fmt, ...) {
+  char num[64];
+  va_list args;
+  int len;
+
+  va_start(args, fmt);
+  len = vsnprintf(num, sizeof(num), fmt, args);
+  va_end(args);
+
+  json_print_raw(printer, JSON_KEY, key, strlen(key));
+  json_print_raw(printer, JSON_FLOAT, num, len);
+}
+
+/**
+ * Writes every recorded event to the trace file and stops
+ * tracing. Registered with atexit() by `repo_trace_start()`,
+ * so commands that exit() still leave a trace behind.
+ */
+
+void
+repo_trace_flush () {
+  repo_trace_ring_t *ring;
+  json_printer printer;
+  repo_buf_t *out;
+  int fd, pid = (int) getpid();
+  size_t dropped = 0;
+
+  if (!repo_trace_enabled)
+    return;
+
+  repo_trace_enabled = false;
+
+  if (-1 == (fd = open(trace_file, O_WRONLY | O_CREAT | O_TRUNC, 0644))) {
+    fprintf(stderr, "repo: error: --trace: failed to open '%s': %s\n"
+        , trace_file, strerror(errno));
+    return;
+  }
+
+  out = repo_buf_new(fd);
+  assert(out);
+
+  json_print_init(&printer, on_print, out);
+  json_print_raw(&printer, JSON_OBJECT_BEGIN, NULL, 0);
+  json_print_raw(&printer, JSON_KEY, "traceEvents", strlen("traceEvents"));
+  json_print_raw(&printer, JSON_ARRAY_BEGIN, NULL, 0);
+
+  for (ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    size_t tail = head > REPO_TRACE_RING_SIZE ? head - REPO_TRACE_RING_SIZE : 0;
+    size_t depth = 0;
+
+    dropped += tail;
+
+    json_print_raw(&printer, JSON_OBJECT_BEGIN, NULL, 0);
+    print_str(&printer, "name", "thread_name");
+    print_str(&printer, "ph", "M");
+    print_num(&printer, "pid", "%d", pid);
+    print_num(&printer, "tid", "%d", ring->tid);
+    json_print_raw(&printer, JSON_KEY, "args", strlen("args"));
+    json_print_raw(&printer, JSON_OBJECT_BEGIN, NULL, 0);
+    print_str(&printer, "name", trace_main_tid == ring->tid ? "main" : "worker");
+    json_print_raw(&printer, JSON_OBJECT_END, NULL, 0);
+    json_print_raw(&printer, JSON_OBJECT_END, NULL, 0);
+
+    for (size_t i = tail; i < head; ++i) {
+      repo_trace_event_t *event = &ring->events[i % REPO_TRACE_RING_SIZE];
+      char phase[2] = { event->phase, '\0' };
+
+      // a wrapped ring can keep the end of a slice whose begin
+      // was overwritten, viewers would nest it under the wrong one
+      if ('E' == event->phase) {
+        if (0 == depth) {
+          dropped++;
+          continue;
+        }
+        depth--;
+      } else {
+        depth++;
+      }
+
+      json_print_raw(&printer, JSON_OBJECT_BEGIN, NULL, 0);
+      print_str(&printer, "name", event->name);
+      print_str(&printer, "cat", "repo");
+      print_str(&printer, "ph", phase);
+      print_num(&printer, "ts", "%.3f", event->ns / 1000.0);
+      print_num(&printer, "pid", "%d", pid);
+      print_num(&printer, "tid", "%d", ring->tid);
+
+      if ('B' == event->phase && event->arg[0]) {
+        json_print_raw(&printer, JSON_KEY, "args", strlen("args"));
+        json_print_raw(&printer, JSON_OBJECT_BEGIN, NULL, 0);
+        print_str(&printer, "repo", event->arg);
+        json_print_raw(&printer, JSON_OBJECT_END, NULL, 0);
+      }
+
+      json_print_raw(&printer, JSON_OBJECT_END, NULL, 0);
+    }
+  }
+
+  json_print_raw(&printer, JSON_ARRAY_END, NULL, 0);
+  print_str(&printer, "displayTimeUnit", "ms");
+  json_print_raw(&printer, JSON_OBJECT_END, NULL, 0);
+  json_print_free(&printer);
+
+  if (0 != repo_buf_flush(out)) {
+    fprintf(stderr, "repo: error: --trace: failed to write '%s': %s\n"
+        , trace_file, strerror(errno));
+  } else if (dropped) {
+    fprintf(stderr, "repo: --trace: dropped %zu early events, rings hold %d per thread\n"
+        , dropped, REPO_TRACE_RING_SIZE);
+  }
+
+  repo_buf_free(out);
+  close(fd);
+}
@@ -0,0 +1,543 @@
+
+#include <assert.h>
+#include <ctype.h>
+#include <regex.h>
+#include <repo.h>
+
+/**
+ * `--where` expressions are parsed once into a small tree,
+ * reordered so the cheaper side of every `&&` / `||` runs
+ * first, and flattened into a stack program. Evaluating the
+ * program pulls fields through the `repo_dir_item_*` accessors
+ * so nothing is computed for an entry until a clause needs it,
+ * and the jumps emitted for `&&` / `||` skip the remaining
+ * clauses once the result is known.
+ *
+ *   expr    := and ('||' and)*
+ *   and     := unary ('&&' unary)*
+ *   unary   := '!' unary | '(' expr ')' | cmp
+ *   cmp     := operand [('==' | '!=' | '~' | '!~' | '<' | '<=' | '>' | '>=') operand]
+ *   operand := field | "string" | 'string' | number | true | false
+ *
+ * Fields are `name`, `path`, `ino`, `git`, `branch`, `bare`
+ * and `orphan`.
+ */
+
+#define WHERE_MAX_NODES 256
+#define WHERE_MAX_REGEX 32
+
+enum where_type { V_NULL, V_INT, V_STR };
+
+typedef struct where_value {
+  enum where_type type;
+  long num;
+  const char *str;
+} where_value_t;
+
+enum where_kind {
+  N_FIELD, N_CONST, N_CMP, N_MATCH, N_TRUTH, N_NOT, N_AND, N_OR
+};
+
+enum where_cmp { C_EQ, C_NE, C_LT, C_LE, C_GT, C_GE };
+
+typedef struct where_node {
+  enum where_kind kind;
+  int op;
+  int field;
+  int regex;
+  int left;
+  int right;
+  int cost;
+  where_value_t value;
+} where_node_t;
+
+enum where_opcode {
+  OP_FIELD, OP_CONST, OP_CMP, OP_MATCH, OP_TRUTH, OP_NOT, OP_JZ, OP_JNZ
+};
+
+typedef struct where_op {
+  enum where_opcode code;
+  int arg;
+} where_op_t;
+
+struct repo_where {
+  where_op_t *ops;
+  int length;
+  where_value_t *consts;
+  where_value_t *stack;
+  regex_t regex[WHERE_MAX_REGEX];
+  int regex_count;
+  char *strings;
+};
+
+typedef struct where_parser {
+  const char *src;
+  const char *cur;
+  where_node_t nodes[WHERE_MAX_NODES];
+  int length;
+  repo_where_t *where;
+  char *strings;
+  size_t strings_len;
+  char *error;
+  size_t error_size;
+  bool failed;
+} where_parser_t;
+
+
+static void
+parse_error (where_parser_t *p, const char *message) {
+  if (p->failed) return;
+  p->failed = true;
+  snprintf(p->error, p->error_size, "%s at offset %d", message, (int) (p->cur - p->src));
+}
+
+
+static int
+node_new (where_parser_t *p, enum where_kind kind) {
+  if (p->length == WHERE_MAX_NODES) {
+    parse_error(p, "expression too long");
+    return 0;
+  }
+
+  where_node_t *node = &p->nodes[p->length];
+  memset(node, 0, sizeof(where_node_t));
+  node->kind = kind;
+  node->left = node->right = -1;
+  return p->length++;
+}
+
+
+static void
+skip_space (where_parser_t *p) {
+  while (isspace((unsigned char) *p->cur)) p->cur++;
+}
+
+
+static bool
+accept (where_parser_t *p, const char *token) {
+  size_t len = strlen(token);
+  skip_space(p);
+  if (0 != strncmp(p->cur, token, len)) return false;
+  p->cur += len;
+  return true;
+}
+
+
+static int parse_or (where_parser_t *p);
+
+
+static int
+parse_operand (where_parser_t *p) {
+  int n;
+  skip_space(p);
+
+  if ('"' == *p->cur || '\'' == *p->cur) {
+    char quote = *p->cur++;
+    char *out = p->strings + p->strings_len;
+    n = node_new(p, N_CONST);
+    p->nodes[n].value.type = V_STR;
+    p->nodes[n].value.str = out;
+
+    while (*p->cur && quote != *p->cur) {
+      if ('\\' == *p->cur && p->cur[1]) p->cur++;
+      *out++ = *p->cur++;
+    }
+
+    if (quote != *p->cur) {
+      parse_error(p, "unterminated string");
+      return n;
+    }
+
+    p->cur++;
+    *out++ = '\0';
+    p->strings_len = out - p->strings;
+    return n;
+  }
+
+  if (isdigit((unsigned char) *p->cur) || '-' == *p->cur) {
+    n = node_new(p, N_CONST);
+    p->nodes[n].value.type = V_INT;
+    p->nodes[n].value.num = strtol(p->cur, (char **) &p->cur, 10);
+    return n;
+  }
+
+  if (isalpha((unsigned char) *p->cur)) {
+    const char *start = p->cur;
+    size_t len;
+
+    while (isalnum((unsigned char) *p->cur) || '_' == *p->cur) p->cur++;
+    len = p->cur - start;
+
+    if ((4 == len && 0 == strncmp(start, "true", 4))
+        || (5 == len && 0 == strncmp(start, "false", 5))) {
+      n = node_new(p, N_CONST);
+      p->nodes[n].value.type = V_INT;
+      p->nodes[n].value.num = 4 == len;
+      return n;
+    }
+
+    int f = repo_field_lookup(start, len);
+
+    if (-1 != f) {
+      n = node_new(p, N_FIELD);
+      p->nodes[n].field = f;
+      p->nodes[n].cost = repo_field_cost(f);
+      return n;
+    }
+
+    p->cur = start;
+    parse_error(p, "unknown field");
+    return 0;
+  }
+
+  parse_error(p, "expected a field or value");
+  return 0;
+}
+
+
+static int
+truth (where_parser_t *p, int child) {
+  enum where_kind kind = p->nodes[child].kind;
+  if (N_FIELD != kind && N_CONST != kind) return child;
+  int n = node_new(p, N_TRUTH);
+  p->nodes[n].left = child;
+  p->nodes[n].cost = p->nodes[child].cost;
+  return n;
+}
+
+
+static int
+parse_cmp (where_parser_t *p) {
+  static const struct { const char *token; enum where_kind kind; int op; } ops[] = {
+    { "==", N_CMP, C_EQ }, { "!=", N_CMP, C_NE },
+    { "!~", N_MATCH, 1 },  { "~", N_MATCH, 0 },
+    { "<=", N_CMP, C_LE }, { ">=", N_CMP, C_GE },
+    { "<", N_CMP, C_LT },  { ">", N_CMP, C_GT },
+  };
+
+  int left = parse_operand(p);
+
+  for (int i = 0; i < (int) (sizeof(ops) / sizeof(ops[0])); ++i) {
+    if (!accept(p, ops[i].token)) continue;
+
+    int right = parse_operand(p);
+    int n = node_new(p, ops[i].kind);
+    where_node_t *node = &p->nodes[n];
+    node->op = ops[i].op;
+    node->left = left;
+    node->right = right;
+    node->cost = p->nodes[left].cost > p->nodes[right].cost
+      ? p->nodes[left].cost
+      : p->nodes[right].cost;
+
+    if (N_MATCH == node->kind) {
+      repo_where_t *w = p->where;
+      where_node_t *pattern = &p->nodes[right];
+
+      if (N_CONST != pattern->kind || V_STR != pattern->value.type) {
+        parse_error(p, "'~' expects a string pattern");
+      } else if (WHERE_MAX_REGEX == w->regex_count) {
+        parse_error(p, "too many patterns");
+      } else if (0 != regcomp(&w->regex[w->regex_count], pattern->value.str, REG_EXTENDED | REG_NOSUB)) {
+        parse_error(p, "invalid pattern");
+      } else {
+        node->regex = w->regex_count++;
+      }
+    }
+
+    return n;
+  }
+
+  return left;
+}
+
+
+static int
+parse_unary (where_parser_t *p) {
+  if (accept(p, "!")) {
+    int child = truth(p, parse_unary(p));
+    int n = node_new(p, N_NOT);
+    p->nodes[n].left = child;
+    p->nodes[n].cost = p->nodes[child].cost;
+    return n;
+  }
+
+  if (accept(p, "(")) {
+    int n = parse_or(p);
+    if (!accept(p, ")")) parse_error(p, "expected ')'");
+    return n;
+  }
+
+  return parse_cmp(p);
+}
+
+
+static int
+parse_binary (where_parser_t *p, enum where_kind kind, int left, int right) {
+  int n = node_new(p, kind);
+  where_node_t *node = &p->nodes[n];
+  left = truth(p, left);
+  right = truth(p, right);
+
+  // both sides are side effect free, so the cheaper one goes first
+  if (p->nodes[left].cost > p->nodes[right].cost) {
+    int tmp = left;
+    left = right;
+    right = tmp;
+  }
+
+  node->left = left;
+  node->right = right;
+  node->cost = p->nodes[right].cost;
+  return n;
+}
+
+
+static int
+parse_and (where_parser_t *p) {
+  int left = parse_unary(p);
+  while (!p->failed && accept(p, "&&")) {
+    left = parse_binary(p, N_AND, left, parse_unary(p));
+  }
+  return left;
+}
+
+
+static int
+parse_or (where_parser_t *p) {
+  int left = parse_and(p);
+  while (!p->failed && accept(p, "||")) {
+    left = parse_binary(p, N_OR, left, parse_and(p));
+  }
+  return left;
+}
+
+
+static int
+emit (repo_where_t *w, enum where_opcode code, int arg) {
+  w->ops[w->length].code = code;
+  w->ops[w->length].arg = arg;
+  return w->length++;
+}
+
+
+static void
+compile (where_parser_t *p, int index) {
+  repo_where_t *w = p->where;
+  where_node_t *node = &p->nodes[index];
+  int jump;
+
+  switch (node->kind) {
+    case N_FIELD:
+      emit(w, OP_FIELD, node->field);
+      break;
+
+    case N_CONST:
+      w->consts[index] = node->value;
+      emit(w, OP_CONST, index);
+      break;
+
+    case N_CMP:
+      compile(p, node->left);
+      compile(p, node->right);
+      emit(w, OP_CMP, node->op);
+      break;
+
+    case N_MATCH:
+      compile(p, node->left);
+      emit(w, OP_MATCH, node->regex);
+      if (node->op) emit(w, OP_NOT, 0);
+      break;
+
+    case N_TRUTH:
+      compile(p, node->left);
+      emit(w, OP_TRUTH, 0);
+      break;
+
+    case N_NOT:
+      compile(p, node->left);
+      emit(w, OP_NOT, 0);
+      break;
+
+    case N_AND:
+    case N_OR:
+      compile(p, node->left);
+      jump = emit(w, N_AND == node->kind ? OP_JZ : OP_JNZ, 0);
+      compile(p, node->right);
+      w->ops[jump].arg = w->length;
+      break;
+  }
+}
+
+
+repo_where_t *
+repo_where_compile (const char *expr, char *error, size_t size) {
+  where_parser_t *p;
+  repo_where_t *where;
+  int root;
+
+  if (!(p = calloc(1, sizeof(where_parser_t))))
+    return NULL;
+
+  if (!(where = calloc(1, sizeof(repo_where_t)))) {
+    free(p);
+    return NULL;
+  }
+
+  p->src = p->cur = expr;
+  p->where = where;
+  p->error = error;
+  p->error_size = size;
+  p->strings = where->strings = malloc(strlen(expr) + 1);
+
+  root = truth(p, parse_or(p));
+  skip_space(p);
+
+  if (!p->failed && '\0' != *p->cur) {
+    parse_error(p, "unexpected input");
+  }
+
+  if (!p->failed) {
+    // every node emits at most two ops
+    where->ops = malloc(2 * p->length * sizeof(where_op_t));
+    where->consts = calloc(p->length, sizeof(where_value_t));
+    where->stack = malloc((2 * p->length + 1) * sizeof(where_value_t));
+    assert(where->ops && where->consts && where->stack);
+    compile(p, root);
+  }
+
+  if (p->failed) {
+    repo_where_free(where);
+    where = NULL;
+  }
+
+  free(p);
+  return where;
+}
+
+
+static where_value_t
+field_value (int field, repo_dir_item_t *item) {
+  where_value_t v = { V_INT, 0, NULL };
+
+  switch (field) {
+    case REPO_FIELD_NAME: v.type = V_STR; v.str = item->name; break;
+    case REPO_FIELD_PATH: v.type = V_STR; v.str = item->path; break;
+    case REPO_FIELD_INO: v.num = (long) item->ino; break;
+    case REPO_FIELD_GIT: v.num = repo_dir_item_is_git_repo(item); break;
+    case REPO_FIELD_BARE: v.num = repo_dir_item_is_bare(item); break;
+    case REPO_FIELD_ORPHAN: v.num = repo_dir_item_is_orphan(item); break;
+    case REPO_FIELD_BRANCH:
+      v.str = repo_dir_item_branch(item);
+      v.type = v.str ? V_STR : V_NULL;
+      break;
+  }
+
+  return v;
+}
+
+
+static bool
+value_truth (where_value_t v) {
+  switch (v.type) {
+    case V_INT: return 0 != v.num;
+    case V_STR: return '\0' != v.str[0];
+    default: return false;
+  }
+}
+
+
+static bool
+value_cmp (where_value_t a, where_value_t b, int op) {
+  int cmp;
+
+  if (a.type != b.type) {
+    // mismatched or missing values are only ever unequal
+    return C_NE == op;
+  }
+
+  if (V_STR == a.type) cmp = strcmp(a.str, b.str);
+  else cmp = a.num < b.num ? -1 : a.num > b.num;
+
+  switch (op) {
+    case C_EQ: return 0 == cmp;
+    case C_NE: return 0 != cmp;
+    case C_LT: return cmp < 0;
+    case C_LE: return cmp <= 0;
+    case C_GT: return cmp > 0;
+    case C_GE: return cmp >= 0;
+  }
+
+  return false;
+}
+
+
+bool
+repo_where_match (repo_where_t *where, repo_dir_item_t *item) {
+  where_value_t *stack = where->stack;
+  int top = -1, pc = 0;
+
+  while (pc < where->length) {
+    where_op_t *op = &where->ops[pc++];
+
+    switch (op->code) {
+      case OP_FIELD:
+        stack[++top] = field_value(op->arg, item);
+        break;
+
+      case OP_CONST:
+        stack[++top] = where->consts[op->arg];
+        break;
+
+      case OP_CMP:
+        top--;
+        stack[top].num = value_cmp(stack[top], stack[top + 1], op->arg);
+        stack[top].type = V_INT;
+        break;
+
+      case OP_MATCH:
+        stack[top].num = V_STR == stack[top].type
+          && 0 == regexec(&where->regex[op->arg], stack[top].str, 0, NULL, 0);
+        stack[top].type = V_INT;
+        break;
+
+      case OP_TRUTH:
+        stack[top].num = value_truth(stack[top]);
+        stack[top].type = V_INT;
+        break;
+
+      case OP_NOT:
+        stack[top].num = !stack[top].num;
+        break;
+
+      // short circuit, leaving the deciding value on the stack
+      case OP_JZ:
+        if (!stack[top].num) pc = op->arg;
+        else top--;
+        break;
+
+      case OP_JNZ:
+        if (stack[top].num) pc = op->arg;
+        else top--;
+        break;
+    }
+  }
+
+  return top >= 0 && stack[top].num;
+}
+
+
+void
+repo_where_free (repo_where_t *where) {
+  if (!where) return;
+
+  for (int i = 0; i < where->regex_count; ++i) {
+    regfree(&where->regex[i]);
+  }
+
+  free(where->ops);
+  free(where->consts);
+  free(where->stack);
+  free(where->strings);
+  free(where);
+}
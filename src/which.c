@@ -0,0 +1,707 @@
+
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <repo.h>
+
+/**
+ * `repo which` answers "which repository contains this commit"
+ * from a sorted table of (oid, repo id) pairs kept in
+ * `<root>/.repo/oids`. The file is laid out so it can be
+ * mapped and searched in place:
+ *
+ *   header   magic, version, counts and a 256 entry fanout
+ *            table of cumulative counts by leading oid byte
+ *   entries  `entry_count` fixed width records sorted by oid
+ *   repos    per repo: name length, name, tip count and the
+ *            sorted ref tips the entries were built from
+ *
+ * Updates compare each repo's current ref tips with the stored
+ * ones. Unchanged repos keep their entries as is, changed ones
+ * are walked from the new tips with the old tips hidden so only
+ * new history is visited. When an old tip is gone or isn't in
+ * the history of the new ones, after a force-push or a deleted
+ * branch, the repo is walked again from scratch so commits no
+ * longer reachable drop out. A repo that can't be read keeps
+ * its old entries and tips until the next update.
+ */
+
+#define WHICH_MAGIC "RIDX"
+#define WHICH_VERSION 1
+#define WHICH_FILE "oids"
+
+typedef struct which_entry {
+  unsigned char oid[GIT_OID_RAWSZ];
+  uint32_t repo;
+} which_entry_t;
+
+typedef struct which_header {
+  char magic[4];
+  uint32_t version;
+  uint32_t repo_count;
+  uint32_t entry_count;
+  uint32_t fanout[256];
+} which_header_t;
+
+typedef struct which_repo {
+  const char *name;
+  uint32_t name_len;
+  uint32_t tip_count;
+  const unsigned char *tips;
+} which_repo_t;
+
+typedef struct which_index {
+  void *map;
+  size_t size;
+  const which_header_t *header;
+  const which_entry_t *entries;
+  which_repo_t *repos;
+} which_index_t;
+
+typedef struct which_vec {
+  which_entry_t *data;
+  size_t length;
+  size_t alloc;
+} which_vec_t;
+
+typedef struct which_job {
+  repo_dir_item_t *item;
+  const which_index_t *old;
+  int old_id;
+  unsigned char *tips;
+  size_t tip_count;
+  bool unchanged;
+  bool rebuild;
+  bool failed;
+  int id;
+  which_vec_t commits;
+} which_job_t;
+
+
+static int
+vec_push (which_vec_t *vec, const unsigned char *oid, uint32_t repo) {
+  if (vec->length == vec->alloc) {
+    size_t alloc = vec->alloc ? vec->alloc * 2 : 1024;
+    which_entry_t *data = realloc(vec->data, alloc * sizeof(which_entry_t));
+    if (!data) return -1;
+    vec->data = data;
+    vec->alloc = alloc;
+  }
+
+  memcpy(vec->data[vec->length].oid, oid, GIT_OID_RAWSZ);
+  vec->data[vec->length].repo = repo;
+  vec->length++;
+  return 0;
+}
+
+
+static int
+entry_cmp (const void *a, const void *b) {
+  const which_entry_t *x = a, *y = b;
+  int cmp = memcmp(x->oid, y->oid, GIT_OID_RAWSZ);
+  if (cmp) return cmp;
+  return x->repo < y->repo ? -1 : x->repo > y->repo;
+}
+
+
+static int
+oid_cmp (const void *a, const void *b) {
+  return memcmp(a, b, GIT_OID_RAWSZ);
+}
+
+
+static void
+index_close (which_index_t *index) {
+  if (index->map) munmap(index->map, index->size);
+  free(index->repos);
+  memset(index, 0, sizeof(which_index_t));
+}
+
+
+/**
+ * Lookups bound their search by the fanout, so it must never
+ * point past the entries
+ */
+
+static int
+index_check_fanout (const which_header_t *header) {
+  for (int b = 1; b < 256; ++b) {
+    if (header->fanout[b] < header->fanout[b - 1]) return -1;
+  }
+
+  return header->entry_count == header->fanout[255] ? 0 : -1;
+}
+
+
+static int
+index_open (repo_t *repo, which_index_t *index) {
+  char path[REPO_PATH_MAX];
+  struct stat st;
+  size_t offset;
+  int fd;
+
+  memset(index, 0, sizeof(which_index_t));
+
+  if (0 != repo_cache_path(repo, WHICH_FILE, path, sizeof(path)))
+    return -1;
+
+  if (-1 == (fd = open(path, O_RDONLY)))
+    return -1;
+
+  if (0 != fstat(fd, &st) || (size_t) st.st_size < sizeof(which_header_t)) {
+    close(fd);
+    return -1;
+  }
+
+  index->size = (size_t) st.st_size;
+  index->map = mmap(NULL, index->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (MAP_FAILED == index->map) {
+    index->map = NULL;
+    return -1;
+  }
+
+  index->header = (const which_header_t *) index->map;
+  index->entries = (const which_entry_t *) (index->header + 1);
+  offset = sizeof(which_header_t)
+         + (size_t) index->header->entry_count * sizeof(which_entry_t);
+
+  if (0 != memcmp(index->header->magic, WHICH_MAGIC, 4)
+      || WHICH_VERSION != index->header->version
+      || offset > index->size
+      || 0 != index_check_fanout(index->header)
+      || !(index->repos = calloc(index->header->repo_count + 1, sizeof(which_repo_t)))) {
+    index_close(index);
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < index->header->repo_count; ++i) {
+    which_repo_t *r = &index->repos[i];
+    const char *base = (const char *) index->map;
+
+    if (offset + sizeof(uint32_t) > index->size) goto corrupt;
+    memcpy(&r->name_len, base + offset, sizeof(uint32_t));
+    offset += sizeof(uint32_t);
+
+    if (offset + r->name_len + sizeof(uint32_t) > index->size) goto corrupt;
+    r->name = base + offset;
+    offset += r->name_len;
+
+    memcpy(&r->tip_count, base + offset, sizeof(uint32_t));
+    offset += sizeof(uint32_t);
+
+    if (offset + (size_t) r->tip_count * GIT_OID_RAWSZ > index->size) goto corrupt;
+    r->tips = (const unsigned char *) base + offset;
+    offset += (size_t) r->tip_count * GIT_OID_RAWSZ;
+  }
+
+  return 0;
+
+corrupt:
+  index_close(index);
+  return -1;
+}
+
+
+static int
+index_find_repo (const which_index_t *index, const char *name) {
+  size_t len = strlen(name);
+
+  if (!index->map)
+    return -1;
+
+  for (uint32_t i = 0; i < index->header->repo_count; ++i) {
+    const which_repo_t *r = &index->repos[i];
+    if (r->name_len == len && 0 == memcmp(r->name, name, len))
+      return (int) i;
+  }
+
+  return -1;
+}
+
+
+static int
+collect_tips (git_repository *git_repo, which_job_t *job) {
+  git_strarray refs = { 0 };
+  size_t count = 0;
+
+  if (0 != git_reference_list(&refs, git_repo, GIT_REF_LISTALL))
+    return -1;
+
+  if (!(job->tips = malloc((refs.count + 1) * GIT_OID_RAWSZ))) {
+    git_strarray_free(&refs);
+    return -1;
+  }
+
+  for (size_t i = 0; i < refs.count; ++i) {
+    git_oid oid;
+    git_object *obj = NULL, *commit = NULL;
+
+    if (0 != git_reference_name_to_id(&oid, git_repo, refs.strings[i])
+        || 0 != git_object_lookup(&obj, git_repo, &oid, GIT_OBJ_ANY)) {
+      continue;
+    }
+
+    // annotated tags and friends are peeled down to the commit
+    if (0 == git_object_peel(&commit, obj, GIT_OBJ_COMMIT)) {
+      memcpy(job->tips + count * GIT_OID_RAWSZ, git_object_id(commit)->id, GIT_OID_RAWSZ);
+      count++;
+      git_object_free(commit);
+    }
+
+    git_object_free(obj);
+  }
+
+  git_strarray_free(&refs);
+
+  qsort(job->tips, count, GIT_OID_RAWSZ, oid_cmp);
+
+  // dedupe
+  size_t n = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (n && 0 == oid_cmp(job->tips + (n - 1) * GIT_OID_RAWSZ, job->tips + i * GIT_OID_RAWSZ))
+      continue;
+    memmove(job->tips + n * GIT_OID_RAWSZ, job->tips + i * GIT_OID_RAWSZ, GIT_OID_RAWSZ);
+    n++;
+  }
+
+  job->tip_count = n;
+  return 0;
+}
+
+
+/**
+ * Whether every tip in `r` is one of the current tips or in
+ * their history, so the entries built from it all still hold
+ */
+
+static bool
+which_tips_kept (git_repository *git_repo, const which_repo_t *r, const which_job_t *job) {
+  for (uint32_t i = 0; i < r->tip_count; ++i) {
+    const unsigned char *tip = r->tips + i * GIT_OID_RAWSZ;
+    bool kept = false;
+    git_oid old;
+
+    if (bsearch(tip, job->tips, job->tip_count, GIT_OID_RAWSZ, oid_cmp))
+      continue;
+
+    git_oid_fromraw(&old, tip);
+
+    for (size_t j = 0; j < job->tip_count && !kept; ++j) {
+      size_t ahead, behind;
+      git_oid cur;
+
+      git_oid_fromraw(&cur, job->tips + j * GIT_OID_RAWSZ);
+      if (0 == git_graph_ahead_behind(&ahead, &behind, git_repo, &old, &cur)) {
+        kept = 0 == ahead;
+      } else {
+        giterr_clear();
+      }
+    }
+
+    if (!kept) return false;
+  }
+
+  return true;
+}
+
+
+static void
+which_job_run (void *data) {
+  which_job_t *job = (which_job_t *) data;
+  repo_handles_t *handles = repo_handles_default();
+  repo_handle_t *handle = NULL;
+  git_repository *git_repo = NULL;
+  git_revwalk *walk = NULL;
+  git_oid oid;
+
+  repo_stats_count(REPO_STATS_WALK);
+
+  if (0 != repo_handles_get(handles, job->item->path, &handle)) {
+    job->failed = true;
+    goto cleanup;
+  }
+
+  git_repo = handle->repo;
+
+  if (0 != collect_tips(git_repo, job)) {
+    job->failed = true;
+    goto cleanup;
+  }
+
+  if (job->old_id >= 0) {
+    const which_repo_t *r = &job->old->repos[job->old_id];
+    job->unchanged = r->tip_count == job->tip_count
+      && 0 == memcmp(r->tips, job->tips, job->tip_count * GIT_OID_RAWSZ);
+  }
+
+  if (job->unchanged)
+    goto cleanup;
+
+  if (job->old_id >= 0) {
+    job->rebuild = !which_tips_kept(git_repo, &job->old->repos[job->old_id], job);
+  }
+
+  if (0 != git_revwalk_new(&walk, git_repo)) {
+    job->failed = true;
+    goto cleanup;
+  }
+
+  for (size_t i = 0; i < job->tip_count; ++i) {
+    git_oid_fromraw(&oid, job->tips + i * GIT_OID_RAWSZ);
+    git_revwalk_push(walk, &oid);
+  }
+
+  // history below the previous tips is already indexed
+  if (job->old_id >= 0 && !job->rebuild) {
+    const which_repo_t *r = &job->old->repos[job->old_id];
+    for (uint32_t i = 0; i < r->tip_count; ++i) {
+      git_oid_fromraw(&oid, r->tips + i * GIT_OID_RAWSZ);
+      if (0 != git_revwalk_hide(walk, &oid)) giterr_clear();
+    }
+  }
+
+  while (0 == git_revwalk_next(&oid, walk)) {
+    if (0 != vec_push(&job->commits, oid.id, 0)) {
+      job->failed = true;
+      break;
+    }
+  }
+
+cleanup:
+  if (job->failed) {
+    free(job->commits.data);
+    memset(&job->commits, 0, sizeof(which_vec_t));
+  }
+
+  if (walk) git_revwalk_free(walk);
+  repo_handles_put(handles, handle);
+}
+
+
+static int
+index_write (repo_t *repo, which_job_t *jobs, int count, which_vec_t *entries) {
+  char path[REPO_PATH_MAX], tmp[REPO_PATH_MAX + 4];
+  which_header_t header;
+  uint32_t repo_count = 0;
+  FILE *file;
+
+  if (0 != repo_cache_path(repo, WHICH_FILE, path, sizeof(path)))
+    return -1;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+  if (!(file = fopen(tmp, "wb")))
+    return -1;
+
+  for (int i = 0; i < count; ++i) {
+    if (jobs[i].id >= 0) repo_count++;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, WHICH_MAGIC, 4);
+  header.version = WHICH_VERSION;
+  header.repo_count = repo_count;
+  header.entry_count = (uint32_t) entries->length;
+
+  for (size_t i = 0; i < entries->length; ++i) {
+    header.fanout[entries->data[i].oid[0]]++;
+  }
+
+  for (int b = 1; b < 256; ++b) {
+    header.fanout[b] += header.fanout[b - 1];
+  }
+
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(entries->data, sizeof(which_entry_t), entries->length, file);
+
+  for (int i = 0; i < count; ++i) {
+    which_job_t *job = &jobs[i];
+    uint32_t name_len = (uint32_t) strlen(job->item->name);
+    uint32_t tip_count = (uint32_t) job->tip_count;
+
+    if (job->id < 0) continue;
+
+    fwrite(&name_len, sizeof(uint32_t), 1, file);
+    fwrite(job->item->name, 1, name_len, file);
+    fwrite(&tip_count, sizeof(uint32_t), 1, file);
+    fwrite(job->tips, GIT_OID_RAWSZ, job->tip_count, file);
+  }
+
+  if (0 != fclose(file)) {
+    unlink(tmp);
+    return -1;
+  }
+
+  return rename(tmp, path);
+}
+
+
+int
+repo_which_update (repo_t *repo, int jobs) {
+  repo_dir_t *dir = repo_dir_new(repo->path);
+  which_index_t old;
+  which_job_t *list = NULL;
+  which_vec_t entries = { 0 };
+  repo_pool_t *pool;
+  int32_t *remap = NULL;
+  int count = 0, rc = -1;
+
+  if (!dir) {
+    repo_ferror("path does not exist '%s'", repo->path);
+  }
+
+  if (0 != index_open(repo, &old)) {
+    memset(&old, 0, sizeof(old));
+  }
+
+  list = calloc(dir->length + 1, sizeof(which_job_t));
+  remap = calloc(old.map ? old.header->repo_count + 1 : 1, sizeof(int32_t));
+
+  if (!list || !remap) {
+    repo_error("which: out of memory");
+    goto cleanup;
+  }
+
+  if (!(pool = repo_pool_new(jobs))) {
+    repo_error("which: failed to start worker threads");
+    goto cleanup;
+  }
+
+  for (int i = 0; i < dir->length; ++i) {
+    repo_dir_item_t *item = &dir->items[i];
+    if (!repo_dir_item_is_git_repo(item)) continue;
+    which_job_t *job = &list[count++];
+    job->item = item;
+    job->old = &old;
+    job->old_id = index_find_repo(&old, item->name);
+    if (0 != repo_pool_push(pool, which_job_run, job)) which_job_run(job);
+  }
+
+  repo_pool_wait(pool);
+  repo_pool_free(pool);
+
+  // assign new repo ids, mapping the old ids of repos whose
+  // entries are carried over onto them
+  if (old.map) {
+    for (uint32_t i = 0; i < old.header->repo_count; ++i) remap[i] = -1;
+  }
+
+  for (int i = 0, id = 0; i < count; ++i) {
+    which_job_t *job = &list[i];
+
+    job->id = -1;
+
+    // a repo that can't be read now keeps what the last update knew
+    if (job->failed) {
+      const which_repo_t *r;
+
+      if (job->old_id < 0) continue;
+
+      r = &old.repos[job->old_id];
+      free(job->tips);
+      job->tip_count = 0;
+
+      if (!(job->tips = malloc((size_t) r->tip_count * GIT_OID_RAWSZ + 1))) {
+        repo_error("which: out of memory");
+        goto cleanup;
+      }
+
+      memcpy(job->tips, r->tips, (size_t) r->tip_count * GIT_OID_RAWSZ);
+      job->tip_count = r->tip_count;
+    }
+
+    job->id = id++;
+
+    if (job->old_id >= 0 && (job->failed || !job->rebuild)) {
+      remap[job->old_id] = job->id;
+    }
+
+    for (size_t j = 0; j < job->commits.length; ++j) {
+      job->commits.data[j].repo = (uint32_t) job->id;
+    }
+  }
+
+  if (old.map) {
+    for (uint32_t i = 0; i < old.header->entry_count; ++i) {
+      const which_entry_t *e = &old.entries[i];
+
+      if (e->repo >= old.header->repo_count || remap[e->repo] < 0) continue;
+
+      if (0 != vec_push(&entries, e->oid, (uint32_t) remap[e->repo])) {
+        repo_error("which: out of memory");
+        goto cleanup;
+      }
+    }
+  }
+
+  for (int i = 0; i < count; ++i) {
+    which_vec_t *commits = &list[i].commits;
+    for (size_t j = 0; j < commits->length; ++j) {
+      if (0 != vec_push(&entries, commits->data[j].oid, commits->data[j].repo)) {
+        repo_error("which: out of memory");
+        goto cleanup;
+      }
+    }
+  }
+
+  qsort(entries.data, entries.length, sizeof(which_entry_t), entry_cmp);
+
+  size_t n = 0;
+  for (size_t i = 0; i < entries.length; ++i) {
+    if (n && 0 == entry_cmp(&entries.data[n - 1], &entries.data[i])) continue;
+    entries.data[n++] = entries.data[i];
+  }
+  entries.length = n;
+
+  // the old map must stay alive until its entries and tips are copied
+  index_close(&old);
+
+  rc = index_write(repo, list, count, &entries);
+
+cleanup:
+  for (int i = 0; i < count; ++i) {
+    free(list[i].tips);
+    free(list[i].commits.data);
+  }
+
+  index_close(&old);
+  free(entries.data);
+  free(remap);
+  free(list);
+  repo_dir_free(dir);
+  return rc;
+}
+
+
+static int
+hex_value (char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+/**
+ * Compares an entry against a prefix of `nibbles` hex digits
+ */
+
+static int
+prefix_cmp (const unsigned char *oid, const unsigned char *prefix, size_t nibbles) {
+  int cmp = memcmp(oid, prefix, nibbles / 2);
+
+  if (cmp || 0 == nibbles % 2)
+    return cmp;
+
+  return (int) (oid[nibbles / 2] & 0xf0) - (int) prefix[nibbles / 2];
+}
+
+
+int
+repo_which_lookup (repo_t *repo, const char *str) {
+  unsigned char prefix[GIT_OID_RAWSZ] = { 0 };
+  size_t nibbles = strlen(str), lo, hi;
+  which_index_t index;
+  int found = 0;
+
+  if (0 == nibbles || nibbles > GIT_OID_HEXSZ) {
+    repo_ferror("which: invalid object id prefix '%s'", str);
+  }
+
+  for (size_t i = 0; i < nibbles; ++i) {
+    int v = hex_value(str[i]);
+    if (-1 == v) {
+      repo_ferror("which: invalid object id prefix '%s'", str);
+    }
+    prefix[i / 2] |= (unsigned char) (i % 2 ? v : v << 4);
+  }
+
+  if (0 != index_open(repo, &index)) {
+    repo_error("which: no usable commit index, run `repo which --update` to rebuild it");
+    return -1;
+  }
+
+  // narrow to the fanout buckets sharing the leading byte
+  unsigned first = prefix[0], last = nibbles > 1 ? prefix[0] : prefix[0] | 0x0f;
+  lo = first ? index.header->fanout[first - 1] : 0;
+  hi = index.header->fanout[last];
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (prefix_cmp(index.entries[mid].oid, prefix, nibbles) < 0) lo = mid + 1;
+    else hi = mid;
+  }
+
+  for (size_t i = lo; i < index.header->entry_count; ++i) {
+    const which_entry_t *e = &index.entries[i];
+    char hex[GIT_OID_HEXSZ + 1];
+    git_oid oid;
+
+    if (0 != prefix_cmp(e->oid, prefix, nibbles)) break;
+    if (e->repo >= index.header->repo_count) continue;
+
+    git_oid_fromraw(&oid, e->oid);
+    git_oid_tostr(hex, sizeof(hex), &oid);
+    printf("%s %.*s\n", hex, (int) index.repos[e->repo].name_len, index.repos[e->repo].name);
+    found++;
+  }
+
+  index_close(&index);
+  return found;
+}
+
+
+static int which_jobs = 0;
+static bool which_update = false;
+
+static void
+on_jobs (command_t *self) {
+  which_jobs = atoi(self->arg);
+}
+
+
+static void
+on_update (command_t *self) {
+  which_update = true;
+}
+
+
+void
+repo_cmd_which (repo_session_t *sess) {
+  char path[REPO_PATH_MAX];
+  const char *prefix;
+  repo_t *repo = sess->user->repo;
+
+  command_option(&sess->program, "-u", "--update", "Refresh the commit index from every repo's refs", on_update);
+  command_option(&sess->program, "-j", "--jobs <n>", "Number of repositories indexed in parallel", on_jobs);
+
+  if (sess->argc > 1) {
+    if (repo_cmd_needs_help(sess)) {
+      repo_help(sess, false);
+      exit(0);
+    }
+
+    repo_session_start(sess);
+  }
+
+  prefix = repo_cmd_positional(sess, "which", 0);
+
+  if (!prefix && !which_update) {
+    repo_help(sess, false);
+    exit(1);
+  }
+
+  repo_cache_path(repo, WHICH_FILE, path, sizeof(path));
+
+  if (which_update || -1 == access(path, R_OK)) {
+    if (0 != repo_which_update(repo, which_jobs)) {
+      repo_ferror("which: failed to write index '%s'", path);
+    }
+  }
+
+  int found = prefix ? repo_which_lookup(repo, prefix) : 0;
+
+  repo_session_free(sess);
+  exit(prefix && found <= 0 ? 1 : 0);
+}
@@ -0,0 +1,113 @@
+#!/bin/sh
+
+##
+# `repo fetch` against local `file://` remotes and a `git daemon`
+# on the loopback interface, no network needed.
+#
+# The daemon takes at most two connections at a time and refuses
+# the rest, so fetching its repositories with `--per-host 1` only
+# succeeds if the per-host limit holds. The summary must count
+# every updated ref and the bytes received.
+#
+# Environment:
+#
+#   TEST_PORT  port the daemon listens on (19418)
+##
+
+port="${TEST_PORT:-19418}"
+count=6
+
+set -e
+cd "$(dirname "$0")/.."
+
+tmp=$(mktemp -d)
+out="$tmp/out"
+daemon=""
+
+cleanup () {
+  [ -n "$daemon" ] && kill "$daemon" 2>/dev/null
+  rm -rf "$tmp"
+}
+
+trap cleanup EXIT
+
+git () {
+  command git -c user.name=test -c user.email=test@example.com -c init.defaultBranch=master "$@"
+}
+
+# commits to the origin `$1` through a scratch clone
+commit () {
+  scratch="$tmp/scratch"
+  rm -rf "$scratch"
+  git clone --quiet "$1" "$scratch" 2>/dev/null
+  date +%s%N > "$scratch/file"
+  head -c 65536 /dev/urandom > "$scratch/blob"
+  git -C "$scratch" add file blob
+  git -C "$scratch" commit --quiet -m "change"
+  git -C "$scratch" push --quiet origin HEAD:master
+}
+
+fail () {
+  cat "$out" >&2
+  echo "fetch: $1" >&2
+  exit 1
+}
+
+mkdir -p "$tmp/origins" "$tmp/root"
+
+i=0
+while [ "$i" -lt "$count" ]; do
+  git init --quiet --bare "$tmp/origins/o$i.git"
+  commit "$tmp/origins/o$i.git"
+  i=$((i + 1))
+done
+
+if command git daemon --reuseaddr --listen=127.0.0.1 --port="$port" \
+    --base-path="$tmp/origins" --export-all --max-connections=2 \
+    --detach --pid-file="$tmp/daemon.pid" "$tmp/origins" 2>/dev/null; then
+  # the detached daemon writes its pid once it is listening
+  for n in 1 2 3 4 5 6 7 8 9 10; do
+    [ -s "$tmp/daemon.pid" ] && break
+    sleep 0.2
+  done
+  daemon=$(cat "$tmp/daemon.pid" 2>/dev/null || true)
+fi
+
+if [ -z "$daemon" ]; then
+  echo "fetch: git daemon did not start, skipping daemon remotes" >&2
+fi
+
+# the first half are local remotes, the rest go through the daemon
+i=0
+while [ "$i" -lt "$count" ]; do
+  if [ "$i" -lt $((count / 2)) ] || [ -z "$daemon" ]; then
+    git clone --quiet "file://$tmp/origins/o$i.git" "$tmp/root/r$i"
+  else
+    git clone --quiet "git://127.0.0.1:$port/o$i.git" "$tmp/root/r$i"
+  fi
+  i=$((i + 1))
+done
+
+./repo-fetch -R "$tmp/root" --per-host 1 -j 8 > "$out" 2>&1 \
+  || fail "fetching unchanged remotes failed"
+grep -q ", 0 refs updated, " "$out" \
+  || fail "unchanged remotes should update nothing"
+
+i=0
+while [ "$i" -lt "$count" ]; do
+  commit "$tmp/origins/o$i.git"
+  i=$((i + 1))
+done
+
+./repo-fetch -R "$tmp/root" --per-host 1 -j 8 > "$out" 2>&1 \
+  || fail "fetching with --per-host 1 failed"
+
+grep -q "failed" "$out" && fail "a fetch failed"
+grep -q "^repo: fetch: $count remotes of $count repositories" "$out" \
+  || fail "expected $count remotes in the summary"
+grep -q ", $count refs updated, " "$out" \
+  || fail "expected $count refs updated"
+grep -q ", 0 B received" "$out" && [ -n "$daemon" ] \
+  && fail "expected bytes received from the daemon"
+
+echo "pass fetch"
@@ -0,0 +1,58 @@
+#!/bin/sh
+
+##
+# `repo log` across more repositories than the process has file
+# descriptors for: every repository must be walked and none may
+# fail to open.
+#
+# Environment:
+#
+#   TEST_REPOS  repositories to generate (1500)
+##
+
+repos="${TEST_REPOS:-1500}"
+depth=2
+
+set -e
+cd "$(dirname "$0")/.."
+
+tmp=$(mktemp -d)
+root="$tmp/root"
+out="$tmp/out"
+err="$tmp/err"
+trap 'rm -rf "$tmp"' EXIT
+
+# fast-import writes master, bare repositories need HEAD there too
+GIT_CONFIG_COUNT=1 \
+GIT_CONFIG_KEY_0=init.defaultBranch \
+GIT_CONFIG_VALUE_0=master \
+  bench/generate.sh -n "$repos" -d "$depth" -f 1 "$root"
+
+# the mix bench/generate.sh makes: every 13th repository is bare,
+# every 11th unborn and every 7th detached one commit back
+expected=$(awk -v n="$repos" -v d="$depth" 'BEGIN {
+  for (i = 0; i < n; i++) {
+    if (i && 0 == i % 13) c += d
+    else if (i && 0 == i % 11) c += 0
+    else if (i && 0 == i % 7) c += d - 1
+    else c += d
+  }
+  print c
+}')
+
+(ulimit -n 1024 && ./repo-log -R "$root") > "$out" 2> "$err"
+
+if grep -q "failed" "$err"; then
+  cat "$err" >&2
+  echo "log: repositories failed to open under ulimit -n 1024" >&2
+  exit 1
+fi
+
+actual=$(wc -l < "$out" | tr -d ' ')
+
+if [ "$expected" != "$actual" ]; then
+  echo "log: expected $expected commits from $repos repositories, got $actual" >&2
+  exit 1
+fi
+
+echo "pass log"
@@ -0,0 +1,147 @@
+#!/bin/sh
+
+##
+# `repo push` against local bare remotes, served by a `git daemon`
+# on the loopback interface when one can be started.
+#
+#   ahead        pushed, and the remote moves to the local tip
+#   --dry-run    lists the ahead repository, pushes nothing
+#   diverged     skipped, the remote is left alone
+#   no upstream  skipped
+#   stale        the remote moved on since the last fetch, so the
+#                push isn't a fast-forward and is rejected
+#
+# Environment:
+#
+#   TEST_PORT  port the daemon listens on (19419)
+##
+
+port="${TEST_PORT:-19419}"
+
+set -e
+cd "$(dirname "$0")/.."
+
+tmp=$(mktemp -d)
+out="$tmp/out"
+root="$tmp/root"
+daemon=""
+
+cleanup () {
+  [ -n "$daemon" ] && kill "$daemon" 2>/dev/null
+  rm -rf "$tmp"
+}
+
+trap cleanup EXIT
+
+git () {
+  command git -c user.name=test -c user.email=test@example.com -c init.defaultBranch=master "$@"
+}
+
+fail () {
+  cat "$out" >&2
+  echo "push: $1" >&2
+  exit 1
+}
+
+# commits a change to the clone `$1`
+change () {
+  date +%s%N >> "$1/file"
+  git -C "$1" add file
+  git -C "$1" commit --quiet -m "change"
+}
+
+# the ndjson record of repository `$1` must have status `$2`
+expect_status () {
+  grep -E "\"name\": ?\"$1\"" "$out" | grep -qE "\"status\": ?\"$2\"" \
+    || fail "expected $1 to be $2"
+}
+
+tips () {
+  for name in ahead diverged topic stale; do
+    git --git-dir="$tmp/origins/$name.git" rev-parse master
+  done
+}
+
+mkdir -p "$tmp/origins" "$root"
+
+for name in ahead diverged topic stale; do
+  git init --quiet --bare "$tmp/origins/$name.git"
+  git --git-dir="$tmp/origins/$name.git" config receive.denyNonFastForwards true
+  git clone --quiet "$tmp/origins/$name.git" "$tmp/seed" 2>/dev/null
+  change "$tmp/seed"
+  git -C "$tmp/seed" push --quiet origin master
+  rm -rf "$tmp/seed"
+done
+
+if command git daemon --reuseaddr --listen=127.0.0.1 --port="$port" \
+    --base-path="$tmp/origins" --export-all --enable=receive-pack \
+    --detach --pid-file="$tmp/daemon.pid" "$tmp/origins" 2>/dev/null; then
+  # the detached daemon writes its pid once it is listening
+  for n in 1 2 3 4 5 6 7 8 9 10; do
+    [ -s "$tmp/daemon.pid" ] && break
+    sleep 0.2
+  done
+  daemon=$(cat "$tmp/daemon.pid" 2>/dev/null || true)
+fi
+
+if [ -n "$daemon" ]; then
+  base="git://127.0.0.1:$port"
+else
+  echo "push: git daemon did not start, pushing to file:// remotes" >&2
+  base="file://$tmp/origins"
+fi
+
+for name in ahead diverged topic stale; do
+  git clone --quiet "$base/$name.git" "$root/$name"
+done
+
+# ahead: one local commit
+change "$root/ahead"
+
+# diverged: a local commit and a fetched remote one
+change "$root/diverged"
+git clone --quiet "$tmp/origins/diverged.git" "$tmp/other"
+change "$tmp/other"
+git -C "$tmp/other" push --quiet origin master
+rm -rf "$tmp/other"
+git -C "$root/diverged" fetch --quiet origin
+
+# topic: a branch that was never pushed
+git -C "$root/topic" checkout --quiet -b topic
+change "$root/topic"
+
+# stale: a local commit and a remote one we haven't fetched
+change "$root/stale"
+git clone --quiet "$tmp/origins/stale.git" "$tmp/other"
+change "$tmp/other"
+git -C "$tmp/other" push --quiet origin master
+rm -rf "$tmp/other"
+
+before=$(tips)
+
+./repo-push -R "$root" --dry-run --ndjson > "$out" 2>&1 \
+  || fail "--dry-run failed"
+
+[ "$before" = "$(tips)" ] || fail "--dry-run pushed"
+expect_status ahead ahead
+expect_status stale ahead
+expect_status diverged diverged
+expect_status topic no-upstream
+
+if ./repo-push -R "$root" --ndjson > "$out" 2>&1; then
+  fail "a rejected push should fail the run"
+fi
+
+expect_status ahead pushed
+expect_status diverged diverged
+expect_status topic no-upstream
+expect_status stale rejected
+
+[ "$(git -C "$root/ahead" rev-parse HEAD)" = "$(git --git-dir="$tmp/origins/ahead.git" rev-parse master)" ] \
+  || fail "ahead was not pushed"
+[ "$(echo "$before" | sed -n 2p)" = "$(git --git-dir="$tmp/origins/diverged.git" rev-parse master)" ] \
+  || fail "diverged was pushed"
+[ "$(echo "$before" | sed -n 4p)" = "$(git --git-dir="$tmp/origins/stale.git" rev-parse master)" ] \
+  || fail "stale overwrote its remote"
+
+echo "pass push"
@@ -0,0 +1,112 @@
+#include <assert.h>
+#include <repo.h>
+
+/**
+ * `repo_remote_host()` and the per-host limit `repo fetch`
+ * schedules its jobs under
+ */
+
+#define PER_HOST 2
+#define FETCHES 8
+
+typedef struct host_job {
+  int *running;
+  int *peak;
+} host_job_t;
+
+
+static void
+expect_host (const char *url, const char *host) {
+  char out[128];
+  assert(0 == repo_remote_host(url, out, sizeof(out)));
+  if (0 != strcmp(host, out)) {
+    fprintf(stderr, "remote: '%s' is host '%s', expected '%s'\n", url, out, host);
+    exit(1);
+  }
+}
+
+
+static void
+on_fetch (void *data) {
+  host_job_t *job = (host_job_t *) data;
+  int running = __atomic_add_fetch(job->running, 1, __ATOMIC_SEQ_CST);
+  int peak = __atomic_load_n(job->peak, __ATOMIC_SEQ_CST);
+
+  while (running > peak && !__atomic_compare_exchange_n(job->peak, &peak, running,
+        true, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+  usleep(10000);
+  __atomic_sub_fetch(job->running, 1, __ATOMIC_SEQ_CST);
+}
+
+
+static void
+test_hosts () {
+  char out[8];
+
+  expect_host("https://github.com/jwerle/repo.git", "github.com");
+  expect_host("https://user@github.com:443/jwerle/repo.git", "github.com");
+  expect_host("git://example.com/repo.git", "example.com");
+  expect_host("ssh://git@example.com:2222/repo.git", "example.com");
+  expect_host("git@github.com:jwerle/repo.git", "github.com");
+  expect_host("github.com:jwerle/repo.git", "github.com");
+  expect_host("git://[::1]:9418/repo.git", "[::1]");
+  expect_host("ssh://git@[::1]:22/repo.git", "[::1]");
+  expect_host("git://127.0.0.1:9418/repo.git", "127.0.0.1");
+  expect_host("file:///srv/git/repo.git", "local");
+  expect_host("/srv/git/repo.git", "local");
+  expect_host("../repo.git", "local");
+  expect_host("repo.git", "local");
+
+  // a host that doesn't fit is an error, not a truncated host
+  assert(-1 == repo_remote_host("https://a-very-long-host.example.com/repo.git", out, sizeof(out)));
+}
+
+
+static void
+test_per_host () {
+  const char *urls[] = {
+    "https://github.com/a/b.git",
+    "git@github.com:c/d.git",
+    "git://127.0.0.1:9418/e.git",
+  };
+  host_job_t jobs[3 * FETCHES];
+  int running[2] = { 0 }, peak[2] = { 0 };
+  repo_sched_t *sched = repo_sched_new(3 * FETCHES, PER_HOST);
+
+  assert(sched);
+
+  // both github.com urls share one limit
+  for (int i = 0; i < 3 * FETCHES; ++i) {
+    char host[128];
+    int h;
+
+    assert(0 == repo_remote_host(urls[i % 3], host, sizeof(host)));
+    h = 0 == strcmp("github.com", host) ? 0 : 1;
+
+    jobs[i].running = &running[h];
+    jobs[i].peak = &peak[h];
+    assert(0 == repo_sched_add(sched, host, 1, on_fetch, &jobs[i]));
+  }
+
+  repo_sched_start(sched);
+  repo_sched_wait(sched);
+  repo_sched_free(sched);
+
+  for (int h = 0; h < 2; ++h) {
+    if (peak[h] > PER_HOST) {
+      fprintf(stderr, "remote: %d fetches ran against one host, limit is %d\n", peak[h], PER_HOST);
+      exit(1);
+    }
+    assert(peak[h] > 0);
+  }
+}
+
+
+int
+main (int argc, char *argv[]) {
+  test_hosts();
+  test_per_host();
+  puts("pass remote");
+  return 0;
+}